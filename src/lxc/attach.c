@@ -91,51 +91,66 @@ lxc_log_define(attach, lxc);
 
 /* /proc/pid-to-str/status\0 = (5 + 21 + 7 + 1) */
 #define __PROC_STATUS_LEN (5 + (LXC_NUMSTRLEN64) + 7 + 1)
-static struct lxc_proc_context_info *lxc_proc_get_context_info(pid_t pid)
+int lxc_proc_get_capability_mask(pid_t pid, unsigned long long *mask)
 {
 	int ret;
-	bool found;
 	FILE *proc_file;
 	char proc_fn[__PROC_STATUS_LEN];
 	size_t line_bufsz = 0;
 	char *line = NULL;
-	struct lxc_proc_context_info *info = NULL;
+	char *end;
 
-	/* Read capabilities. */
 	ret = snprintf(proc_fn, __PROC_STATUS_LEN, "/proc/%d/status", pid);
 	if (ret < 0 || ret >= __PROC_STATUS_LEN)
-		goto on_error;
+		return -EIO;
 
-	proc_file = fopen(proc_fn, "r");
+	proc_file = fopen(proc_fn, "re");
 	if (!proc_file) {
 		SYSERROR("Could not open %s.", proc_fn);
-		goto on_error;
-	}
-
-	info = calloc(1, sizeof(*info));
-	if (!info) {
-		SYSERROR("Could not allocate memory.");
-		fclose(proc_file);
-		return NULL;
+		return -errno;
 	}
 
-	found = false;
+	ret = -ENOENT;
 	while (getline(&line, &line_bufsz, proc_file) != -1) {
-		ret = sscanf(line, "CapBnd: %llx", &info->capability_mask);
-		if (ret != EOF && ret == 1) {
-			found = true;
-			break;
-		}
+		if (strncmp(line, "CapBnd:", 7) != 0)
+			continue;
+
+		errno = 0;
+		*mask = strtoull(line + 7, &end, 16);
+		if (errno == 0 && end != line + 7)
+			ret = 0;
+		break;
 	}
 
 	free(line);
 	fclose(proc_file);
 
-	if (!found) {
+	if (ret < 0) {
+		errno = -ret;
 		SYSERROR("Could not read capability bounding set from %s.",
 			 proc_fn);
-		errno = ENOENT;
-		goto on_error;
+	}
+
+	return ret;
+}
+
+static struct lxc_proc_context_info *lxc_proc_get_context_info(pid_t pid)
+{
+	int ret;
+	struct lxc_proc_context_info *info;
+
+	info = calloc(1, sizeof(*info));
+	if (!info) {
+		SYSERROR("Could not allocate memory.");
+		return NULL;
+	}
+
+	/* Read capabilities. */
+	ret = lxc_proc_get_capability_mask(pid, &info->capability_mask);
+	if (ret < 0) {
+		free(info);
+		errno = -ret;
+		return NULL;
 	}
 
 	info->lsm_label = lsm_process_label_get(pid);
@@ -143,10 +158,40 @@ static struct lxc_proc_context_info *lxc_proc_get_context_info(pid_t pid)
 	memset(info->ns_fd, -1, sizeof(int) * LXC_NS_MAX);
 
 	return info;
+}
 
-on_error:
-	free(info);
-	return NULL;
+/* Build the context of the container's init process from the reply to
+ * LXC_CMD_GET_ATTACH_CONTEXT. The namespace fds are moved into the context.
+ */
+static struct lxc_proc_context_info *
+lxc_proc_get_context_info_cmd(struct lxc_cmd_attach_context *ctx)
+{
+	int i;
+	struct lxc_proc_context_info *info;
+
+	info = calloc(1, sizeof(*info));
+	if (!info) {
+		SYSERROR("Could not allocate memory.");
+		return NULL;
+	}
+
+	if (ctx->lsm_label_len > 0) {
+		info->lsm_label = strdup(lxc_cmd_attach_context_lsm_label(ctx));
+		if (!info->lsm_label) {
+			free(info);
+			return NULL;
+		}
+	}
+
+	info->capability_mask = ctx->capability_mask;
+	info->personality = ctx->personality;
+	info->ns_inherited = 0;
+	for (i = 0; i < LXC_NS_MAX; i++) {
+		info->ns_fd[i] = ctx->ns_fd[i];
+		ctx->ns_fd[i] = -EBADF;
+	}
+
+	return info;
 }
 
 static inline void lxc_proc_close_ns_fd(struct lxc_proc_context_info *ctx)
@@ -643,7 +688,8 @@ static void lxc_attach_get_init_uidgid(uid_t *init_uid, gid_t *init_gid)
 /* Define default options if no options are supplied by the user. */
 static lxc_attach_options_t attach_static_default_options = LXC_ATTACH_OPTIONS_DEFAULT;
 
-static bool fetch_seccomp(struct lxc_container *c, lxc_attach_options_t *options)
+static bool fetch_seccomp(struct lxc_container *c, lxc_attach_options_t *options,
+			  struct lxc_cmd_attach_context *ctx)
 {
 	int ret;
 	bool bret;
@@ -662,8 +708,21 @@ static bool fetch_seccomp(struct lxc_container *c, lxc_attach_options_t *options
 		return false;
 	}
 
-	/* Fetch the current profile path over the cmd interface. */
-	path = c->get_running_config_item(c, "lxc.seccomp.profile");
+	/* Fetch the current profile path over the cmd interface unless we
+	 * already got it with the attach context.
+	 */
+	if (ctx) {
+		if (ctx->seccomp_len == 0) {
+			INFO("Container does not use a seccomp policy");
+			return true;
+		}
+
+		path = strdup(lxc_cmd_attach_context_seccomp(ctx));
+		if (!path)
+			return false;
+	} else {
+		path = c->get_running_config_item(c, "lxc.seccomp.profile");
+	}
 	if (!path) {
 		INFO("Failed to retrieve lxc.seccomp.profile");
 		path = c->get_running_config_item(c, "lxc.seccomp");
@@ -690,7 +749,8 @@ static bool fetch_seccomp(struct lxc_container *c, lxc_attach_options_t *options
 	return true;
 }
 
-static bool no_new_privs(struct lxc_container *c, lxc_attach_options_t *options)
+static bool no_new_privs(struct lxc_container *c, lxc_attach_options_t *options,
+			 struct lxc_cmd_attach_context *ctx)
 {
 	bool bret;
 	char *val;
@@ -701,6 +761,10 @@ static bool no_new_privs(struct lxc_container *c, lxc_attach_options_t *options)
 		return false;
 	}
 
+	if (ctx)
+		return c->set_config_item(c, "lxc.no_new_privs",
+					  ctx->no_new_privs ? "1" : "0");
+
 	/* Retrieve currently active setting. */
 	val = c->get_running_config_item(c, "lxc.no_new_privs");
 	if (!val) {
@@ -1049,6 +1113,7 @@ int lxc_attach(const char *name, const char *lxcpath,
 	signed long personality;
 	pid_t attached_pid, init_pid, pid;
 	struct lxc_proc_context_info *init_ctx;
+	struct lxc_cmd_attach_context *attach_ctx;
 	struct lxc_terminal terminal;
 	struct lxc_conf *conf;
 	struct attach_clone_payload payload = {0};
@@ -1062,28 +1127,46 @@ int lxc_attach(const char *name, const char *lxcpath,
 	if (!options)
 		options = &attach_static_default_options;
 
-	init_pid = lxc_cmd_get_init_pid(name, lxcpath);
-	if (init_pid < 0) {
-		ERROR("Failed to get init pid");
-		return -1;
-	}
+	/* Retrieve everything we need to know about the running container
+	 * with a single command. Fall back to asking for each item separately
+	 * if the container's monitor doesn't know about this command.
+	 */
+	ret = lxc_cmd_get_attach_context(name, lxcpath, &attach_ctx);
+	if (ret == 0) {
+		init_pid = attach_ctx->init_pid;
+		init_ctx = lxc_proc_get_context_info_cmd(attach_ctx);
+		if (!init_ctx) {
+			ERROR("Failed to get context of init process: %ld", (long)init_pid);
+			lxc_cmd_put_attach_context(attach_ctx);
+			return -1;
+		}
+	} else {
+		attach_ctx = NULL;
 
-	init_ctx = lxc_proc_get_context_info(init_pid);
-	if (!init_ctx) {
-		ERROR("Failed to get context of init process: %ld", (long)init_pid);
-		return -1;
-	}
+		init_pid = lxc_cmd_get_init_pid(name, lxcpath);
+		if (init_pid < 0) {
+			ERROR("Failed to get init pid");
+			return -1;
+		}
 
-	personality = get_personality(name, lxcpath);
-	if (init_ctx->personality < 0) {
-		ERROR("Failed to get personality of the container");
-		lxc_proc_put_context_info(init_ctx);
-		return -1;
+		init_ctx = lxc_proc_get_context_info(init_pid);
+		if (!init_ctx) {
+			ERROR("Failed to get context of init process: %ld", (long)init_pid);
+			return -1;
+		}
+
+		personality = get_personality(name, lxcpath);
+		if (init_ctx->personality < 0) {
+			ERROR("Failed to get personality of the container");
+			lxc_proc_put_context_info(init_ctx);
+			return -1;
+		}
+		init_ctx->personality = personality;
 	}
-	init_ctx->personality = personality;
 
 	init_ctx->container = lxc_container_new(name, lxcpath);
 	if (!init_ctx->container) {
+		lxc_cmd_put_attach_context(attach_ctx);
 		lxc_proc_put_context_info(init_ctx);
 		return -1;
 	}
@@ -1091,16 +1174,17 @@ int lxc_attach(const char *name, const char *lxcpath,
 	if (!init_ctx->container->lxc_conf) {
 		init_ctx->container->lxc_conf = lxc_conf_init();
 		if (!init_ctx->container->lxc_conf) {
+			lxc_cmd_put_attach_context(attach_ctx);
 			lxc_proc_put_context_info(init_ctx);
 			return -ENOMEM;
 		}
 	}
 	conf = init_ctx->container->lxc_conf;
 
-	if (!fetch_seccomp(init_ctx->container, options))
+	if (!fetch_seccomp(init_ctx->container, options, attach_ctx))
 		WARN("Failed to get seccomp policy");
 
-	if (!no_new_privs(init_ctx->container, options))
+	if (!no_new_privs(init_ctx->container, options, attach_ctx))
 		WARN("Could not determine whether PR_SET_NO_NEW_PRIVS is set");
 
 	cwd = getcwd(NULL, 0);
@@ -1109,7 +1193,11 @@ int lxc_attach(const char *name, const char *lxcpath,
 	 * by asking lxc-start, if necessary.
 	 */
 	if (options->namespaces == -1) {
-		options->namespaces = lxc_cmd_get_clone_flags(name, lxcpath);
+		if (attach_ctx)
+			options->namespaces = attach_ctx->clone_flags;
+		else
+			options->namespaces = lxc_cmd_get_clone_flags(name, lxcpath);
+
 		/* call failed */
 		if (options->namespaces == -1) {
 			ERROR("Failed to automatically determine the "
@@ -1131,11 +1219,23 @@ int lxc_attach(const char *name, const char *lxcpath,
 			init_ctx->ns_inherited |= ns_info[i].clone_flag;
 		}
 	}
+	lxc_cmd_put_attach_context(attach_ctx);
 
 	pid = lxc_raw_getpid();
 	for (i = 0; i < LXC_NS_MAX; i++) {
 		int j, saved_errno;
 
+		/* Namespace fds handed to us by the monitor are only kept for
+		 * the namespaces we actually attach to.
+		 */
+		if (init_ctx->ns_fd[i] >= 0) {
+			if (options->namespaces & ns_info[i].clone_flag)
+				continue;
+
+			close(init_ctx->ns_fd[i]);
+			init_ctx->ns_fd[i] = -EBADF;
+		}
+
 		if (options->namespaces & ns_info[i].clone_flag)
 			init_ctx->ns_fd[i] = lxc_preserve_ns(init_pid, ns_info[i].proc_name);
 		else if (init_ctx->ns_inherited & ns_info[i].clone_flag)
@@ -1157,8 +1257,9 @@ int lxc_attach(const char *name, const char *lxcpath,
 		/* Close all already opened file descriptors before we return an
 		 * error, so we don't leak them.
 		 */
-		for (j = 0; j < i; j++)
-			close(init_ctx->ns_fd[j]);
+		for (j = 0; j < LXC_NS_MAX; j++)
+			if (j != i && init_ctx->ns_fd[j] >= 0)
+				close(init_ctx->ns_fd[j]);
 
 		errno = saved_errno;
 		SYSERROR("Failed to attach to %s namespace of %d",
@@ -1473,6 +1574,7 @@ int lxc_attach_run_command(void* payload)
 {
 	lxc_attach_command_t* cmd = (lxc_attach_command_t*)payload;
 
+	lxc_log_flush();
 	execvp(cmd->program, cmd->argv);
 	SYSERROR("Failed to exec \"%s\".", cmd->program);
 	return -1;
@@ -1518,6 +1620,8 @@ int lxc_attach_run_shell(void* payload)
 		user_shell = lxc_attach_getpwshell(uid);
 	else
 		user_shell = pwent.pw_shell;
+
+	lxc_log_flush();
 	if (user_shell)
 		execlp(user_shell, user_shell, (char *)NULL);
 
@@ -1531,3 +1635,298 @@ int lxc_attach_run_shell(void* payload)
 	free(buf);
 	return -1;
 }
+
+/* An attach session is a helper process that attaches to the container once
+ * and then runs commands on request of the caller. Requests are sent over a
+ * SOCK_SEQPACKET socket as a single message carrying the stdio fds for the
+ * command, a struct lxc_attach_session_req and the NUL-separated program,
+ * argv and envp strings. The helper answers each request with the wait
+ * status of the command.
+ */
+#define LXC_ATTACH_SESSION_MAX_REQ 65536
+
+struct lxc_attach_session {
+	int sock;
+	pid_t pid;
+	int stdfds[3];
+};
+
+struct lxc_attach_session_req {
+	uint32_t argc;
+	/* -1 if the command inherits the helper's environment */
+	int32_t envc;
+	uint32_t len;
+	char strings[];
+};
+
+struct attach_session_payload {
+	int sock;
+	int peer;
+};
+
+static char **attach_session_unpack(char **pos, char *end, size_t count)
+{
+	size_t i;
+	char **list;
+
+	list = malloc((count + 1) * sizeof(*list));
+	if (!list)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		if (*pos >= end) {
+			free(list);
+			return NULL;
+		}
+
+		list[i] = *pos;
+		*pos += strlen(*pos) + 1;
+	}
+	list[count] = NULL;
+
+	return list;
+}
+
+static int attach_session_exec(struct lxc_attach_session_req *req,
+			       size_t size, int fds[3])
+{
+	int i;
+	pid_t pid;
+	char *pos, *end;
+	char **argv = NULL, **envp = NULL;
+
+	if (size < sizeof(*req) || req->len != size - sizeof(*req) ||
+	    req->len == 0 || req->strings[req->len - 1] != '\0' ||
+	    req->argc == 0) {
+		ERROR("Received malformed attach session request");
+		return -1;
+	}
+
+	pos = req->strings;
+	end = req->strings + req->len;
+
+	/* The program is followed by its argv and the environment. */
+	pos += strlen(pos) + 1;
+	argv = attach_session_unpack(&pos, end, req->argc);
+	if (!argv)
+		goto on_error;
+
+	if (req->envc >= 0) {
+		envp = attach_session_unpack(&pos, end, req->envc);
+		if (!envp)
+			goto on_error;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		SYSERROR("Failed to fork attach session command");
+		goto on_error;
+	}
+
+	if (pid == 0) {
+		for (i = 0; i < 3; i++) {
+			if (fds[i] < 0)
+				continue;
+
+			if (dup2(fds[i], i) < 0) {
+				SYSERROR("Failed to duplicate fd %d", fds[i]);
+				_exit(EXIT_FAILURE);
+			}
+		}
+
+		/* Don't leak the received fds into the command. */
+		for (i = 0; i < 3; i++)
+			if (fds[i] > 2)
+				close(fds[i]);
+
+		lxc_log_flush();
+		if (envp)
+			execvpe(req->strings, argv, envp);
+		else
+			execvp(req->strings, argv);
+		SYSERROR("Failed to exec \"%s\"", req->strings);
+		_exit(127);
+	}
+
+	free(argv);
+	free(envp);
+	return lxc_wait_for_pid_status(pid);
+
+on_error:
+	free(argv);
+	free(envp);
+	return -1;
+}
+
+static int attach_session_main(void *payload)
+{
+	struct attach_session_payload *p = payload;
+	struct lxc_attach_session_req *req;
+
+	/* Only keep our end of the socket so we see the caller going away. */
+	close(p->peer);
+
+	req = malloc(sizeof(*req) + LXC_ATTACH_SESSION_MAX_REQ);
+	if (!req)
+		return -1;
+
+	for (;;) {
+		int i, status;
+		ssize_t ret;
+		int fds[3];
+
+		ret = lxc_abstract_unix_recv_fds(p->sock, fds, 3, req,
+						 sizeof(*req) + LXC_ATTACH_SESSION_MAX_REQ);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		status = attach_session_exec(req, ret, fds);
+		for (i = 0; i < 3; i++)
+			if (fds[i] >= 0)
+				close(fds[i]);
+
+		ret = send(p->sock, &status, sizeof(status), MSG_NOSIGNAL);
+		if (ret != sizeof(status))
+			break;
+	}
+
+	free(req);
+	close(p->sock);
+	return 0;
+}
+
+struct lxc_attach_session *lxc_attach_session_open(const char *name,
+						   const char *lxcpath,
+						   lxc_attach_options_t *options)
+{
+	int ret;
+	int sv[2];
+	struct lxc_attach_session *session;
+	struct attach_session_payload payload;
+	lxc_attach_options_t default_options = LXC_ATTACH_OPTIONS_DEFAULT;
+
+	if (!options)
+		options = &default_options;
+
+	/* The helper is driven over a socket and can't hand out a pty. */
+	if (options->attach_flags & LXC_ATTACH_TERMINAL) {
+		ERROR("Attach sessions can't allocate a terminal");
+		errno = EINVAL;
+		return NULL;
+	}
+
+	session = malloc(sizeof(*session));
+	if (!session)
+		return NULL;
+
+	ret = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv);
+	if (ret < 0) {
+		SYSERROR("Failed to create attach session socket pair");
+		free(session);
+		return NULL;
+	}
+
+	payload.sock = sv[1];
+	payload.peer = sv[0];
+	ret = lxc_attach(name, lxcpath, attach_session_main, &payload, options,
+			 &session->pid);
+	close(sv[1]);
+	if (ret < 0) {
+		ERROR("Failed to attach session helper to container \"%s\"", name);
+		close(sv[0]);
+		free(session);
+		return NULL;
+	}
+
+	session->sock = sv[0];
+	session->stdfds[0] = options->stdin_fd;
+	session->stdfds[1] = options->stdout_fd;
+	session->stdfds[2] = options->stderr_fd;
+	TRACE("Started attach session helper %d", session->pid);
+
+	return session;
+}
+
+int lxc_attach_session_run(struct lxc_attach_session *session,
+			   const char *program, const char *const argv[],
+			   const char *const envp[], const int stdfds[3])
+{
+	int i, status;
+	ssize_t ret;
+	size_t len;
+	char *pos;
+	int argc = 0, envc = -1;
+	struct lxc_attach_session_req *req;
+
+	if (!program || !argv || !argv[0]) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	len = strlen(program) + 1;
+	for (i = 0; argv[i]; i++, argc++)
+		len += strlen(argv[i]) + 1;
+
+	if (envp) {
+		for (envc = 0; envp[envc]; envc++)
+			len += strlen(envp[envc]) + 1;
+	}
+
+	if (len > LXC_ATTACH_SESSION_MAX_REQ) {
+		ERROR("Command for attach session exceeds %d bytes",
+		      LXC_ATTACH_SESSION_MAX_REQ);
+		errno = E2BIG;
+		return -1;
+	}
+
+	req = malloc(sizeof(*req) + len);
+	if (!req)
+		return -1;
+
+	req->argc = argc;
+	req->envc = envc;
+	req->len = len;
+
+	pos = stpcpy(req->strings, program) + 1;
+	for (i = 0; i < argc; i++)
+		pos = stpcpy(pos, argv[i]) + 1;
+	for (i = 0; i < envc; i++)
+		pos = stpcpy(pos, envp[i]) + 1;
+
+	if (!stdfds)
+		stdfds = session->stdfds;
+
+	ret = lxc_abstract_unix_send_fds(session->sock, (int *)stdfds, 3, req,
+					 sizeof(*req) + len);
+	free(req);
+	if (ret < 0) {
+		SYSERROR("Failed to send command to attach session helper %d",
+			 session->pid);
+		return -1;
+	}
+
+	ret = lxc_read_nointr(session->sock, &status, sizeof(status));
+	if (ret != sizeof(status)) {
+		ERROR("Failed to receive exit status from attach session helper %d",
+		      session->pid);
+		return -1;
+	}
+
+	return status;
+}
+
+int lxc_attach_session_close(struct lxc_attach_session *session)
+{
+	int status;
+
+	if (!session)
+		return -1;
+
+	close(session->sock);
+	status = lxc_wait_for_pid_status(session->pid);
+	free(session);
+
+	return status;
+}
@@ -30,6 +30,7 @@
 
 #include "namespace.h"
 
+struct lxc_attach_session;
 struct lxc_conf;
 
 struct lxc_proc_context_info {
@@ -41,8 +42,16 @@ struct lxc_proc_context_info {
 	int ns_fd[LXC_NS_MAX];
 };
 
+extern int lxc_proc_get_capability_mask(pid_t pid, unsigned long long *mask);
 extern int lxc_attach(const char *name, const char *lxcpath,
 		      lxc_attach_exec_t exec_function, void *exec_payload,
 		      lxc_attach_options_t *options, pid_t *attached_process);
+extern struct lxc_attach_session *lxc_attach_session_open(const char *name,
+							  const char *lxcpath,
+							  lxc_attach_options_t *options);
+extern int lxc_attach_session_run(struct lxc_attach_session *session,
+				  const char *program, const char *const argv[],
+				  const char *const envp[], const int stdfds[3]);
+extern int lxc_attach_session_close(struct lxc_attach_session *session);
 
 #endif /* __LXC_ATTACH_H */
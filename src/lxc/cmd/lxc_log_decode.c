@@ -0,0 +1,487 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+/* Converts logs written with lxc.log.format = binary back into the format
+ * used by the text log appender. Lines that are not part of a binary record
+ * are passed through unchanged so mixed logs can be decoded as well.
+ */
+
+struct decode_location {
+	bool valid;
+	uint32_t line;
+	char *file;
+	char *func;
+	char *fmt;
+};
+
+struct decode_stream {
+	uint32_t pid;
+	char *prefix;
+	char *name;
+	char **categories;
+	size_t ncategories;
+	struct decode_location *locations;
+	size_t nlocations;
+	struct decode_stream *next;
+};
+
+struct decode_cursor {
+	const char *p;
+	size_t left;
+};
+
+static struct decode_stream *streams;
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-h] [file]\n", name);
+	printf("\n");
+	printf("  -h    this message\n");
+	printf("\n");
+	printf("  Decode a binary lxc log written with lxc.log.format = binary.\n");
+	printf("  Reads from standard input if no file is given.\n");
+}
+
+static bool get_bytes(struct decode_cursor *c, void *dest, size_t len)
+{
+	if (c->left < len)
+		return false;
+
+	memcpy(dest, c->p, len);
+	c->p += len;
+	c->left -= len;
+	return true;
+}
+
+static bool get_string_ref(struct decode_cursor *c, const char **str,
+			   uint32_t *len)
+{
+	if (!get_bytes(c, len, sizeof(*len)))
+		return false;
+
+	if (c->left < *len)
+		return false;
+
+	*str = c->p;
+	c->p += *len;
+	c->left -= *len;
+	return true;
+}
+
+static char *get_string(struct decode_cursor *c)
+{
+	const char *str;
+	uint32_t len;
+
+	if (!get_string_ref(c, &str, &len))
+		return NULL;
+
+	return strndup(str, len);
+}
+
+static struct decode_stream *stream_get(uint32_t pid)
+{
+	struct decode_stream *s;
+
+	for (s = streams; s; s = s->next)
+		if (s->pid == pid)
+			return s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->pid = pid;
+	s->next = streams;
+	streams = s;
+	return s;
+}
+
+static int grow(void **array, size_t *nmemb, size_t size, uint32_t id)
+{
+	size_t n = *nmemb;
+	void *tmp;
+
+	if (id < n)
+		return 0;
+
+	/* Ids are handed out sequentially so this is a corrupt record. */
+	if (id > (1U << 20))
+		return -EINVAL;
+
+	while (n <= id)
+		n = n ? n * 2 : 64;
+
+	tmp = realloc(*array, n * size);
+	if (!tmp)
+		return -ENOMEM;
+
+	memset((char *)tmp + *nmemb * size, 0, (n - *nmemb) * size);
+	*array = tmp;
+	*nmemb = n;
+	return 0;
+}
+
+/* Reformat a single event by walking its format string and feeding each
+ * conversion the argument that was stored for it.
+ */
+static void print_message(const char *fmt, struct decode_cursor *args)
+{
+	const char *p, *start;
+	char spec[64];
+	size_t n;
+	uint64_t v;
+	int64_t iv;
+	double d;
+	const char *str;
+	uint32_t slen;
+	char *tmp;
+
+	for (p = fmt; *p; p++) {
+		if (*p != '%') {
+			putchar(*p);
+			continue;
+		}
+
+		start = p++;
+		if (*p == '%') {
+			putchar('%');
+			continue;
+		}
+
+		n = 0;
+		spec[n++] = '%';
+		while (*p && strchr("#0- +'I", *p) && n < 16)
+			spec[n++] = *p++;
+
+		if (*p == '*') {
+			if (!get_bytes(args, &iv, sizeof(iv)))
+				goto out_verbatim;
+			n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)iv);
+			p++;
+		} else {
+			while (*p >= '0' && *p <= '9' && n < 32)
+				spec[n++] = *p++;
+		}
+
+		if (*p == '.') {
+			spec[n++] = *p++;
+			if (*p == '*') {
+				if (!get_bytes(args, &iv, sizeof(iv)))
+					goto out_verbatim;
+				n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)iv);
+				p++;
+			} else {
+				while (*p >= '0' && *p <= '9' && n < 48)
+					spec[n++] = *p++;
+			}
+		}
+
+		while (*p && strchr("hlqjztL", *p))
+			p++;
+
+		switch (*p) {
+		case 'd':
+		case 'i':
+			if (!get_bytes(args, &v, sizeof(v)))
+				goto out_verbatim;
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			spec[n++] = *p;
+			spec[n] = '\0';
+			printf(spec, (long long)(int64_t)v);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			if (!get_bytes(args, &v, sizeof(v)))
+				goto out_verbatim;
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+			spec[n++] = *p;
+			spec[n] = '\0';
+			printf(spec, (unsigned long long)v);
+			break;
+		case 'c':
+			if (!get_bytes(args, &v, sizeof(v)))
+				goto out_verbatim;
+			spec[n++] = *p;
+			spec[n] = '\0';
+			printf(spec, (int)(int64_t)v);
+			break;
+		case 'p':
+			if (!get_bytes(args, &v, sizeof(v)))
+				goto out_verbatim;
+			spec[n++] = *p;
+			spec[n] = '\0';
+			printf(spec, (void *)(uintptr_t)v);
+			break;
+		case 'n':
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (!get_bytes(args, &d, sizeof(d)))
+				goto out_verbatim;
+			spec[n++] = *p;
+			spec[n] = '\0';
+			printf(spec, d);
+			break;
+		case 's':
+		case 'm':
+			if (!get_string_ref(args, &str, &slen))
+				goto out_verbatim;
+			tmp = strndup(str, slen);
+			if (!tmp)
+				goto out_verbatim;
+			spec[n++] = 's';
+			spec[n] = '\0';
+			printf(spec, tmp);
+			free(tmp);
+			break;
+		default:
+			goto out_verbatim;
+		}
+	}
+
+	return;
+
+out_verbatim:
+	/* Print whatever we can't reconstruct as is. */
+	fputs(start, stdout);
+}
+
+static int decode_record(uint16_t type, struct decode_cursor *c,
+			 struct decode_stream **cur)
+{
+	struct decode_stream *s = *cur;
+	struct decode_location *loc;
+	struct lxc_log_binary_event ev;
+	struct timespec ts;
+	char date_time[LXC_NUMSTRLEN64 * 2];
+	const char *category;
+	uint32_t id, pid;
+
+	switch (type) {
+	case LXC_LOG_BINARY_STREAM:
+		if (!get_bytes(c, &pid, sizeof(pid)))
+			return -EINVAL;
+
+		s = stream_get(pid);
+		if (!s)
+			return -ENOMEM;
+
+		free(s->prefix);
+		free(s->name);
+		s->prefix = get_string(c);
+		s->name = get_string(c);
+		*cur = s;
+		break;
+	case LXC_LOG_BINARY_CATEGORY:
+		if (!s || !get_bytes(c, &id, sizeof(id)))
+			return -EINVAL;
+
+		if (grow((void **)&s->categories, &s->ncategories,
+			 sizeof(*s->categories), id) < 0)
+			return -EINVAL;
+
+		free(s->categories[id]);
+		s->categories[id] = get_string(c);
+		break;
+	case LXC_LOG_BINARY_LOCATION:
+		if (!s || !get_bytes(c, &id, sizeof(id)))
+			return -EINVAL;
+
+		if (grow((void **)&s->locations, &s->nlocations,
+			 sizeof(*s->locations), id) < 0)
+			return -EINVAL;
+
+		loc = &s->locations[id];
+		free(loc->file);
+		free(loc->func);
+		free(loc->fmt);
+		loc->valid = get_bytes(c, &loc->line, sizeof(loc->line));
+		loc->file = get_string(c);
+		loc->func = get_string(c);
+		loc->fmt = get_string(c);
+		if (!loc->file || !loc->func || !loc->fmt)
+			loc->valid = false;
+		break;
+	case LXC_LOG_BINARY_EVENT:
+		if (!s || !get_bytes(c, &ev, sizeof(ev)))
+			return -EINVAL;
+
+		if (ev.category >= s->ncategories || !s->categories[ev.category])
+			category = "?";
+		else
+			category = s->categories[ev.category];
+
+		if (ev.location >= s->nlocations || !s->locations[ev.location].valid)
+			return -EINVAL;
+		loc = &s->locations[ev.location];
+
+		ts.tv_sec = ev.sec;
+		ts.tv_nsec = ev.nsec;
+		if (lxc_unix_epoch_to_utc(date_time, sizeof(date_time), &ts) < 0)
+			date_time[0] = '\0';
+
+		printf("%s%s%s %s %-8s %s - %s:%s:%d - ",
+		       s->prefix ? s->prefix : "",
+		       s->name && *s->name ? " " : "",
+		       s->name ? s->name : "",
+		       date_time,
+		       lxc_log_priority_to_string(ev.priority),
+		       category, loc->file, loc->func, loc->line);
+		print_message(loc->fmt, c);
+		putchar('\n');
+		break;
+	default:
+		/* Unknown record types are skipped. */
+		break;
+	}
+
+	return 0;
+}
+
+static char *read_all(int fd, size_t *len)
+{
+	char *buf = NULL, *tmp;
+	size_t size = 0;
+	ssize_t ret;
+
+	*len = 0;
+	for (;;) {
+		if (*len == size) {
+			size = size ? size * 2 : 65536;
+			tmp = realloc(buf, size);
+			if (!tmp) {
+				free(buf);
+				return NULL;
+			}
+			buf = tmp;
+		}
+
+		ret = lxc_read_nointr(fd, buf + *len, size - *len);
+		if (ret < 0) {
+			free(buf);
+			return NULL;
+		}
+
+		if (ret == 0)
+			break;
+
+		*len += ret;
+	}
+
+	return buf;
+}
+
+int main(int argc, char *argv[])
+{
+	int c, fd = STDIN_FILENO;
+	char *buf;
+	size_t len, off = 0;
+	struct decode_stream *cur = NULL;
+
+	while ((c = getopt(argc, argv, "h")) != EOF) {
+		switch (c) {
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind > 1) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (optind < argc) {
+		fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to open \"%s\": %s\n",
+				argv[optind], strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	buf = read_all(fd, &len);
+	if (!buf) {
+		fprintf(stderr, "Failed to read log: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while (off < len) {
+		struct lxc_log_binary_record rec;
+		struct decode_cursor cursor;
+		const char *nl;
+		size_t left = len - off;
+
+		if (left >= sizeof(rec)) {
+			memcpy(&rec, buf + off, sizeof(rec));
+			if (rec.magic == LXC_LOG_BINARY_MAGIC &&
+			    rec.version == LXC_LOG_BINARY_VERSION) {
+				if (rec.len > left - sizeof(rec)) {
+					fprintf(stderr, "Truncated record at offset %zu\n", off);
+					break;
+				}
+
+				cursor.p = buf + off + sizeof(rec);
+				cursor.left = rec.len;
+				if (decode_record(rec.type, &cursor, &cur) < 0)
+					fprintf(stderr, "Failed to decode record at offset %zu\n", off);
+
+				off += sizeof(rec) + rec.len;
+				continue;
+			}
+		}
+
+		/* Not a binary record so pass the line through unchanged. */
+		nl = memchr(buf + off, '\n', left);
+		if (nl)
+			left = nl - (buf + off) + 1;
+		fwrite(buf + off, 1, left, stdout);
+		off += left;
+	}
+
+	free(buf);
+	exit(EXIT_SUCCESS);
+}
@@ -24,6 +24,9 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -38,6 +41,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <lxc/lxccontainer.h>
@@ -50,27 +54,67 @@
 
 #define CLIENTFDS_CHUNK 64
 
+/* Number of messages queued for a client before further messages for it
+ * are dropped.
+ */
+#define LXC_MONITORD_CLIENT_QUEUE 256
+
+/* Maximum number of messages read from the fifo in one go. */
+#define LXC_MONITORD_FIFO_BATCH 64
+
 lxc_log_define(lxc_monitord, lxc);
 
 sigjmp_buf mark;
 
 static void lxc_monitord_cleanup(void);
 
+/*
+ * Defines the structure to store a client of the monitor
+ * @fd       : the client's socket, non-blocking
+ * @subs     : the client's subscriptions, if none it receives all messages
+ * @nr_subs  : the number of subscriptions
+ * @req      : request being received from the client
+ * @req_len  : bytes of @req received so far
+ * @queue    : ring of messages not yet written to the client
+ * @head     : index of the oldest queued message
+ * @count    : number of queued messages
+ * @partial  : bytes of the oldest queued message already written
+ * @dropped  : number of messages dropped because the queue was full
+ * @dropping : whether messages are dropped since the queue last drained
+ * @pollout  : whether we wait for the socket to become writable
+ * @dead     : writing to the client failed, waiting for the hangup
+ */
+struct lxc_monitord_client {
+	int fd;
+	struct lxc_monitor_subscription *subs;
+	size_t nr_subs;
+	struct lxc_monitor_subscription req;
+	size_t req_len;
+	struct lxc_msg queue[LXC_MONITORD_CLIENT_QUEUE];
+	unsigned int head;
+	unsigned int count;
+	size_t partial;
+	uint64_t dropped;
+	bool dropping;
+	bool pollout;
+	bool dead;
+};
+
 /*
  * Defines the structure to store the monitor information
  * @lxcpath        : the path being monitored
  * @fifofd         : the file descriptor for publishers (containers) to write state
  * @listenfd       : the file descriptor for subscribers (lxc-monitors) to connect
- * @clientfds      : accepted client file descriptors
- * @clientfds_size : number of file descriptors clientfds can hold
- * @clientfds_cnt  : the count of valid fds in clientfds
+ * @clients        : accepted clients
+ * @clientfds_size : number of clients @clients can hold
+ * @clientfds_cnt  : the count of valid clients in @clients
  * @descr          : the lxc_mainloop state
  */
 struct lxc_monitor {
 	const char *lxcpath;
 	int fifofd;
 	int listenfd;
-	int *clientfds;
+	struct lxc_monitord_client **clients;
 	int clientfds_size;
 	int clientfds_cnt;
 	struct lxc_epoll_descr descr;
@@ -128,43 +172,219 @@ static int lxc_monitord_fifo_delete(struct lxc_monitor *mon)
 	return 0;
 }
 
+static struct lxc_monitord_client *lxc_monitord_client_find(struct lxc_monitor *mon,
+							    int fd, int *idx)
+{
+	int i;
+
+	for (i = 0; i < mon->clientfds_cnt; i++) {
+		if (mon->clients[i]->fd == fd) {
+			if (idx)
+				*idx = i;
+			return mon->clients[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void lxc_monitord_client_free(struct lxc_monitord_client *client)
+{
+	if (client->dropped > 0)
+		INFO("Client file descriptor %d dropped %" PRIu64 " messages in total",
+		     client->fd, client->dropped);
+
+	close(client->fd);
+	free(client->subs);
+	free(client);
+}
+
 static void lxc_monitord_sockfd_remove(struct lxc_monitor *mon, int fd) {
 	int i;
+	struct lxc_monitord_client *client;
 
 	if (lxc_mainloop_del_handler(&mon->descr, fd))
 		CRIT("File descriptor %d not found in mainloop.", fd);
-	close(fd);
 
-	for (i = 0; i < mon->clientfds_cnt; i++) {
-		if (mon->clientfds[i] == fd)
-			break;
-	}
-	if (i >= mon->clientfds_cnt) {
+	client = lxc_monitord_client_find(mon, fd, &i);
+	if (!client) {
 		CRIT("File descriptor %d not found in clients array.", fd);
+		close(fd);
 		lxc_monitord_cleanup();
 		exit(EXIT_FAILURE);
 	}
+	lxc_monitord_client_free(client);
 
-	memmove(&mon->clientfds[i], &mon->clientfds[i+1],
-		(mon->clientfds_cnt - i - 1) * sizeof(mon->clientfds[0]));
+	memmove(&mon->clients[i], &mon->clients[i+1],
+		(mon->clientfds_cnt - i - 1) * sizeof(mon->clients[0]));
 	mon->clientfds_cnt--;
 }
 
+static bool lxc_monitord_client_wants(const struct lxc_monitord_client *client,
+				      const struct lxc_msg *msg)
+{
+	size_t i;
+
+	if (client->nr_subs == 0)
+		return true;
+
+	for (i = 0; i < client->nr_subs; i++) {
+		const struct lxc_monitor_subscription *sub = &client->subs[i];
+
+		/* The type comes from whoever wrote to the fifo. */
+		if (sub->types &&
+		    ((unsigned int)msg->type >= sizeof(sub->types) * CHAR_BIT ||
+		     !(sub->types & (1U << msg->type))))
+			continue;
+
+		if (fnmatch(sub->name, msg->name, 0) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static void lxc_monitord_client_enqueue(struct lxc_monitord_client *client,
+					const struct lxc_msg *msg)
+{
+	unsigned int tail;
+
+	if (client->count == LXC_MONITORD_CLIENT_QUEUE) {
+		if (!client->dropping)
+			WARN("Queue of client file descriptor %d is full, dropping messages",
+			     client->fd);
+		client->dropping = true;
+		client->dropped++;
+		return;
+	}
+
+	tail = (client->head + client->count) % LXC_MONITORD_CLIENT_QUEUE;
+	client->queue[tail] = *msg;
+	client->count++;
+}
+
+/* Write as much of the client's queue as the socket takes without blocking.
+ * If the socket is full, wait for it to become writable again. If writing
+ * fails the connection is shut down, the hangup is then handled by the
+ * client's own handler.
+ */
+static void lxc_monitord_client_flush(struct lxc_monitor *mon,
+				      struct lxc_monitord_client *client)
+{
+	while (client->count > 0 && !client->dead) {
+		ssize_t ret;
+		unsigned int n;
+		struct iovec iov[2];
+		struct msghdr msg = {0};
+
+		/* The queued messages wrap around at most once. */
+		n = MIN(client->count, LXC_MONITORD_CLIENT_QUEUE - client->head);
+		iov[0].iov_base = (char *)&client->queue[client->head] + client->partial;
+		iov[0].iov_len = n * sizeof(struct lxc_msg) - client->partial;
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 1;
+		if (n < client->count) {
+			iov[1].iov_base = &client->queue[0];
+			iov[1].iov_len = (client->count - n) * sizeof(struct lxc_msg);
+			msg.msg_iovlen = 2;
+		}
+
+		ret = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			SYSERROR("Failed to send message to client file descriptor %d",
+				 client->fd);
+			client->dead = true;
+			client->count = 0;
+			shutdown(client->fd, SHUT_RDWR);
+			return;
+		}
+
+		ret += client->partial;
+		client->head = (client->head + ret / sizeof(struct lxc_msg)) % LXC_MONITORD_CLIENT_QUEUE;
+		client->count -= ret / sizeof(struct lxc_msg);
+		client->partial = ret % sizeof(struct lxc_msg);
+	}
+
+	if (client->count == 0 && client->dropping) {
+		INFO("Client file descriptor %d dropped %" PRIu64 " messages so far",
+		     client->fd, client->dropped);
+		client->dropping = false;
+	}
+
+	if ((client->count > 0) != client->pollout && !client->dead) {
+		client->pollout = client->count > 0;
+		if (lxc_mainloop_set_events(&mon->descr, client->fd,
+					    client->pollout ? EPOLLIN | EPOLLOUT : EPOLLIN))
+			SYSERROR("Failed to update events for client file descriptor %d",
+				 client->fd);
+	}
+}
+
+static int lxc_monitord_client_subscribe(struct lxc_monitord_client *client,
+					 const struct lxc_monitor_subscription *sub)
+{
+	struct lxc_monitor_subscription *subs;
+
+	subs = realloc(client->subs, (client->nr_subs + 1) * sizeof(*subs));
+	if (!subs)
+		return -ENOMEM;
+
+	subs[client->nr_subs] = *sub;
+	subs[client->nr_subs].name[NAME_MAX] = '\0';
+	client->subs = subs;
+	client->nr_subs++;
+
+	DEBUG("Client file descriptor %d subscribed to \"%s\" with types 0x%x",
+	      client->fd, sub->name, sub->types);
+	return 0;
+}
+
 static int lxc_monitord_sock_handler(int fd, uint32_t events, void *data,
 				     struct lxc_epoll_descr *descr)
 {
 	struct lxc_monitor *mon = data;
+	struct lxc_monitord_client *client;
 
-	if (events & EPOLLIN) {
-		int rc;
-		char buf[4];
+	client = lxc_monitord_client_find(mon, fd, NULL);
+	if (!client)
+		return LXC_MAINLOOP_CONTINUE;
 
-		rc = read(fd, buf, sizeof(buf));
-		if (rc > 0 && !strncmp(buf, "quit", 4))
+	if (events & EPOLLIN) {
+		ssize_t rc;
+		struct lxc_monitor_subscription *req = &client->req;
+
+		/* Requests may arrive in pieces on the stream socket. */
+		rc = recv(fd, (char *)req + client->req_len,
+			  sizeof(*req) - client->req_len, MSG_DONTWAIT);
+		if (rc == 0)
+			events |= EPOLLHUP;
+		else if (rc > 0)
+			client->req_len += rc;
+
+		if (client->req_len >= sizeof(req->cmd) &&
+		    !strncmp(req->cmd, "quit", sizeof(req->cmd))) {
 			quit = LXC_MAINLOOP_CLOSE;
+			client->req_len = 0;
+		} else if (client->req_len == sizeof(*req)) {
+			if (!strncmp(req->cmd, LXC_MONITOR_SUBSCRIBE, sizeof(req->cmd)))
+				lxc_monitord_client_subscribe(client, req);
+			else
+				WARN("Ignoring invalid request from client file descriptor %d",
+				     fd);
+			client->req_len = 0;
+		}
 	}
 
-	if (events & EPOLLHUP)
+	if (events & EPOLLOUT)
+		lxc_monitord_client_flush(mon, client);
+
+	if (events & (EPOLLHUP | EPOLLERR))
 		lxc_monitord_sockfd_remove(mon, fd);
 	return quit;
 }
@@ -174,11 +394,12 @@ static int lxc_monitord_sock_accept(int fd, uint32_t events, void *data,
 {
 	int ret,clientfd;
 	struct lxc_monitor *mon = data;
+	struct lxc_monitord_client *client;
 	struct ucred cred;
 	socklen_t credsz = sizeof(cred);
 
 	ret = LXC_MAINLOOP_ERROR;
-	clientfd = accept(fd, NULL, 0);
+	clientfd = accept4(fd, NULL, 0, SOCK_NONBLOCK);
 	if (clientfd < 0) {
 		SYSERROR("Failed to accept connection for client file descriptor %d.", fd);
 		goto out;
@@ -201,27 +422,35 @@ static int lxc_monitord_sock_accept(int fd, uint32_t events, void *data,
 	}
 
 	if (mon->clientfds_cnt + 1 > mon->clientfds_size) {
-		int *clientfds;
-		clientfds = realloc(mon->clientfds,
-				    (mon->clientfds_size + CLIENTFDS_CHUNK) * sizeof(mon->clientfds[0]));
-		if (clientfds == NULL) {
+		struct lxc_monitord_client **clients;
+		clients = realloc(mon->clients,
+				  (mon->clientfds_size + CLIENTFDS_CHUNK) * sizeof(mon->clients[0]));
+		if (clients == NULL) {
 			ERROR("Failed to realloc memory for %d client file "
 			      "descriptors.",
 			      mon->clientfds_size + CLIENTFDS_CHUNK);
 			goto err1;
 		}
-		mon->clientfds = clientfds;
+		mon->clients = clients;
 		mon->clientfds_size += CLIENTFDS_CHUNK;
 	}
 
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		ERROR("Failed to allocate memory for client file descriptor %d.", clientfd);
+		goto err1;
+	}
+	client->fd = clientfd;
+
 	ret = lxc_mainloop_add_handler(&mon->descr, clientfd,
 				       lxc_monitord_sock_handler, mon);
 	if (ret) {
 		ERROR("Failed to add socket handler.");
+		free(client);
 		goto err1;
 	}
 
-	mon->clientfds[mon->clientfds_cnt++] = clientfd;
+	mon->clients[mon->clientfds_cnt++] = client;
 	INFO("Accepted client file descriptor %d. Number of accepted file descriptors is now %d.", clientfd, mon->clientfds_cnt);
 	goto out;
 
@@ -285,8 +514,8 @@ static void lxc_monitord_delete(struct lxc_monitor *mon)
 	close(mon->fifofd);
 
 	for (i = 0; i < mon->clientfds_cnt; i++) {
-		lxc_mainloop_del_handler(&mon->descr, mon->clientfds[i]);
-		close(mon->clientfds[i]);
+		lxc_mainloop_del_handler(&mon->descr, mon->clients[i]->fd);
+		lxc_monitord_client_free(mon->clients[i]);
 	}
 	mon->clientfds_cnt = 0;
 }
@@ -294,21 +523,35 @@ static void lxc_monitord_delete(struct lxc_monitor *mon)
 static int lxc_monitord_fifo_handler(int fd, uint32_t events, void *data,
 				     struct lxc_epoll_descr *descr)
 {
-	int ret,i;
-	struct lxc_msg msglxc;
+	int ret, i, j, nr_msgs;
+	struct lxc_msg msgs[LXC_MONITORD_FIFO_BATCH];
 	struct lxc_monitor *mon = data;
 
-	ret = read(fd, &msglxc, sizeof(msglxc));
-	if (ret != sizeof(msglxc)) {
+	/* Messages are written to the fifo atomically, so reading as much as
+	 * is available yields whole messages only.
+	 */
+	ret = read(fd, msgs, sizeof(msgs));
+	if (ret <= 0 || ret % sizeof(msgs[0])) {
 		SYSERROR("Reading from fifo failed");
 		return LXC_MAINLOOP_CLOSE;
 	}
+	nr_msgs = ret / sizeof(msgs[0]);
 
 	for (i = 0; i < mon->clientfds_cnt; i++) {
-		ret = write(mon->clientfds[i], &msglxc, sizeof(msglxc));
-		if (ret < 0)
-			SYSERROR("Failed to send message to client file descriptor %d",
-			         mon->clientfds[i]);
+		struct lxc_monitord_client *client = mon->clients[i];
+
+		if (client->dead)
+			continue;
+
+		for (j = 0; j < nr_msgs; j++)
+			if (lxc_monitord_client_wants(client, &msgs[j]))
+				lxc_monitord_client_enqueue(client, &msgs[j]);
+
+		/* Clients already waiting for POLLOUT are flushed from their
+		 * own handler.
+		 */
+		if (!client->pollout)
+			lxc_monitord_client_flush(mon, client);
 	}
 
 	return LXC_MAINLOOP_CONTINUE;
@@ -37,12 +37,14 @@
 #include <sys/un.h>
 
 #include "af_unix.h"
+#include "attach.h"
 #include "cgroup.h"
 #include "commands.h"
 #include "commands_utils.h"
 #include "conf.h"
 #include "confile.h"
 #include "log.h"
+#include "lsm/lsm.h"
 #include "lxc.h"
 #include "lxclock.h"
 #include "mainloop.h"
@@ -94,6 +96,8 @@ static const char *lxc_cmd_str(lxc_cmd_t cmd)
 		[LXC_CMD_ADD_STATE_CLIENT]    = "add_state_client",
 		[LXC_CMD_CONSOLE_LOG]         = "console_log",
 		[LXC_CMD_SERVE_STATE_CLIENTS] = "serve_state_clients",
+		[LXC_CMD_CONSOLE_LOG_FD]      = "console_log_fd",
+		[LXC_CMD_GET_ATTACH_CONTEXT]  = "get_attach_context",
 	};
 
 	if (cmd >= LXC_CMD_MAX)
@@ -102,6 +106,45 @@ static const char *lxc_cmd_str(lxc_cmd_t cmd)
 	return cmdname[cmd];
 }
 
+/* Validate the reply to LXC_CMD_GET_ATTACH_CONTEXT and receive the namespace
+ * fds sent after it.
+ */
+static int lxc_cmd_attach_context_recv(int sock, struct lxc_cmd_rsp *rsp)
+{
+	int i, j, ret;
+	int nfds = 0;
+	int fds[LXC_NS_MAX];
+	struct lxc_cmd_attach_context *ctx = rsp->data;
+
+	if ((size_t)rsp->datalen < sizeof(*ctx) ||
+	    (size_t)rsp->datalen != sizeof(*ctx) + ctx->lsm_label_len + 1 +
+					ctx->seccomp_len + 1) {
+		ERROR("Invalid response for command \"get_attach_context\"");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < LXC_NS_MAX; i++) {
+		ctx->ns_fd[i] = -EBADF;
+		if (ctx->ns_fds & (1 << i))
+			nfds++;
+	}
+
+	if (nfds == 0)
+		return rsp->datalen;
+
+	ret = lxc_abstract_unix_recv_fds(sock, fds, nfds, NULL, 0);
+	if (ret <= 0 || fds[0] < 0) {
+		SYSERROR("Failed to receive namespace fds for command \"get_attach_context\"");
+		return -1;
+	}
+
+	for (i = 0, j = 0; i < LXC_NS_MAX; i++)
+		if (ctx->ns_fds & (1 << i))
+			ctx->ns_fd[i] = fds[j++];
+
+	return rsp->datalen;
+}
+
 /*
  * lxc_cmd_rsp_recv: Receive a response to a command
  *
@@ -117,11 +160,12 @@ static const char *lxc_cmd_str(lxc_cmd_t cmd)
  *
  * As a special case, the response for LXC_CMD_CONSOLE is created
  * here as it contains an fd for the master pty passed through the
- * unix socket.
+ * unix socket. Similarly, the fd for the console ringbuffer sent in
+ * response to LXC_CMD_CONSOLE_LOG_FD is stored in data.
  */
 static int lxc_cmd_rsp_recv(int sock, struct lxc_cmd_rr *cmd)
 {
-	int ret, rspfd;
+	int ret, rspfd = -EBADF;
 	struct lxc_cmd_rsp *rsp = &cmd->rsp;
 
 	ret = lxc_abstract_unix_recv_fds(sock, &rspfd, 1, rsp, sizeof(*rsp));
@@ -156,6 +200,15 @@ static int lxc_cmd_rsp_recv(int sock, struct lxc_cmd_rr *cmd)
 		rsp->data = rspdata;
 	}
 
+	if (cmd->req.cmd == LXC_CMD_CONSOLE_LOG_FD) {
+		if (ret > 0 && rsp->ret == 0)
+			rsp->data = INT_TO_PTR(rspfd);
+		else if (rspfd >= 0)
+			close(rspfd);
+
+		return ret;
+	}
+
 	if (rsp->datalen == 0) {
 		DEBUG("Response data length for command \"%s\" is 0",
 		      lxc_cmd_str(cmd->req.cmd));
@@ -189,8 +242,12 @@ static int lxc_cmd_rsp_recv(int sock, struct lxc_cmd_rr *cmd)
 		         lxc_cmd_str(cmd->req.cmd));
 		if (ret >= 0)
 			ret = -1;
+		return ret;
 	}
 
+	if (cmd->req.cmd == LXC_CMD_GET_ATTACH_CONTEXT && rsp->ret == 0)
+		return lxc_cmd_attach_context_recv(sock, rsp);
+
 	return ret;
 }
 
@@ -999,6 +1056,186 @@ out:
 	return lxc_cmd_rsp_send(fd, &rsp);
 }
 
+/*
+ * lxc_cmd_console_log_fd: Retrieve a read-only fd for the memfd backing the
+ * console ringbuffer. It can be mapped with lxc_ringbuf_shared_map() to follow
+ * the console output without sending further commands.
+ *
+ * @name     : name of container to connect to
+ * @lxcpath  : the lxcpath in which the container is running
+ *
+ * Returns the fd on success, < 0 on failure
+ */
+int lxc_cmd_console_log_fd(const char *name, const char *lxcpath)
+{
+	int ret, stopped;
+	struct lxc_cmd_rr cmd = {
+		.req = { .cmd = LXC_CMD_CONSOLE_LOG_FD },
+	};
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath, NULL);
+	if (ret < 0)
+		return ret;
+
+	if (cmd.rsp.ret < 0)
+		return cmd.rsp.ret;
+
+	return PTR_TO_INT(cmd.rsp.data);
+}
+
+static int lxc_cmd_console_log_fd_callback(int fd, struct lxc_cmd_req *req,
+					   struct lxc_handler *handler)
+{
+	int ret, ringfd;
+	struct lxc_cmd_rsp rsp = {0};
+	struct lxc_terminal *terminal = &handler->conf->console;
+
+	rsp.ret = -EFAULT;
+	if (terminal->buffer_size <= 0 || !terminal->ringbuf.addr)
+		return lxc_cmd_rsp_send(fd, &rsp);
+
+	ringfd = lxc_ringbuf_shared_fd(&terminal->ringbuf);
+	if (ringfd < 0) {
+		rsp.ret = ringfd;
+		return lxc_cmd_rsp_send(fd, &rsp);
+	}
+
+	rsp.ret = 0;
+	ret = lxc_abstract_unix_send_fds(fd, &ringfd, 1, &rsp, sizeof(rsp));
+	close(ringfd);
+	if (ret < 0)
+		ERROR("Failed to send console ringbuffer fd to client");
+
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * lxc_cmd_get_attach_context: Retrieve the init pid, clone flags, personality,
+ * capability bounding set, LSM label, seccomp profile and namespace fds of a
+ * running container with a single command.
+ *
+ * @name     : name of container to connect to
+ * @lxcpath  : the lxcpath in which the container is running
+ * @ctx      : the context, free with lxc_cmd_put_attach_context()
+ *
+ * Returns 0 on success, < 0 on failure
+ */
+int lxc_cmd_get_attach_context(const char *name, const char *lxcpath,
+			       struct lxc_cmd_attach_context **ctx)
+{
+	int ret, stopped;
+	struct lxc_cmd_rr cmd = {
+		.req = { .cmd = LXC_CMD_GET_ATTACH_CONTEXT },
+	};
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath, NULL);
+	if (ret < 0) {
+		free(cmd.rsp.data);
+		return ret;
+	}
+
+	if (cmd.rsp.ret < 0) {
+		free(cmd.rsp.data);
+		return cmd.rsp.ret;
+	}
+
+	if (!cmd.rsp.data)
+		return -EINVAL;
+
+	*ctx = cmd.rsp.data;
+	return 0;
+}
+
+void lxc_cmd_put_attach_context(struct lxc_cmd_attach_context *ctx)
+{
+	int i;
+
+	if (!ctx)
+		return;
+
+	for (i = 0; i < LXC_NS_MAX; i++)
+		if (ctx->ns_fd[i] >= 0)
+			close(ctx->ns_fd[i]);
+
+	free(ctx);
+}
+
+static int lxc_cmd_get_attach_context_callback(int fd, struct lxc_cmd_req *req,
+					       struct lxc_handler *handler)
+{
+	int i, ret;
+	int nfds = 0;
+	int fds[LXC_NS_MAX];
+	size_t label_len = 0, seccomp_len = 0, len;
+	char *label;
+	const char *seccomp = handler->conf->seccomp;
+	struct lxc_cmd_attach_context *ctx = NULL;
+	struct lxc_cmd_rsp rsp = {0};
+
+	label = lsm_process_label_get(handler->pid);
+	if (label)
+		label_len = strlen(label);
+
+	if (seccomp)
+		seccomp_len = strlen(seccomp);
+
+	rsp.ret = -E2BIG;
+	len = sizeof(*ctx) + label_len + 1 + seccomp_len + 1;
+	if (len > LXC_CMD_DATA_MAX)
+		goto out;
+
+	rsp.ret = -ENOMEM;
+	ctx = calloc(1, len);
+	if (!ctx)
+		goto out;
+
+	ret = lxc_proc_get_capability_mask(handler->pid, &ctx->capability_mask);
+	if (ret < 0) {
+		rsp.ret = ret;
+		goto out;
+	}
+
+	ctx->init_pid = handler->pid;
+	ctx->clone_flags = handler->ns_clone_flags;
+	ctx->personality = handler->conf->personality;
+	ctx->no_new_privs = handler->conf->no_new_privs;
+	ctx->lsm_label_len = label_len;
+	ctx->seccomp_len = seccomp_len;
+	if (label)
+		memcpy(ctx->strings, label, label_len);
+	if (seccomp)
+		memcpy(ctx->strings + label_len + 1, seccomp, seccomp_len);
+
+	for (i = 0; i < LXC_NS_MAX; i++) {
+		if (handler->nsfd[i] < 0)
+			continue;
+
+		if (!(handler->ns_clone_flags & ns_info[i].clone_flag))
+			continue;
+
+		ctx->ns_fds |= (1 << i);
+		fds[nfds++] = handler->nsfd[i];
+	}
+
+	rsp.ret = 0;
+	rsp.data = ctx;
+	rsp.datalen = len;
+
+out:
+	ret = lxc_cmd_rsp_send(fd, &rsp);
+	if (ret == 0 && rsp.ret == 0 && nfds > 0) {
+		ret = lxc_abstract_unix_send_fds(fd, fds, nfds, NULL, 0);
+		if (ret < 0)
+			SYSERROR("Failed to send namespace fds to client");
+		else
+			ret = 0;
+	}
+
+	free(ctx);
+	free(label);
+	return ret;
+}
+
 int lxc_cmd_serve_state_clients(const char *name, const char *lxcpath,
 				lxc_state_t state)
 {
@@ -1063,6 +1300,8 @@ static int lxc_cmd_process(int fd, struct lxc_cmd_req *req,
 		[LXC_CMD_ADD_STATE_CLIENT]    = lxc_cmd_add_state_client_callback,
 		[LXC_CMD_CONSOLE_LOG]         = lxc_cmd_console_log_callback,
 		[LXC_CMD_SERVE_STATE_CLIENTS] = lxc_cmd_serve_state_clients_callback,
+		[LXC_CMD_CONSOLE_LOG_FD]      = lxc_cmd_console_log_fd_callback,
+		[LXC_CMD_GET_ATTACH_CONTEXT]  = lxc_cmd_get_attach_context_callback,
 	};
 
 	if (req->cmd >= LXC_CMD_MAX) {
@@ -24,12 +24,14 @@
 #ifndef __LXC_COMMANDS_H
 #define __LXC_COMMANDS_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
 
-#include "state.h"
 #include "lxccontainer.h"
+#include "namespace.h"
+#include "state.h"
 
 #define LXC_CMD_DATA_MAX (MAXPATHLEN * 2)
 
@@ -51,6 +53,8 @@ typedef enum {
 	LXC_CMD_ADD_STATE_CLIENT,
 	LXC_CMD_CONSOLE_LOG,
 	LXC_CMD_SERVE_STATE_CLIENTS,
+	LXC_CMD_CONSOLE_LOG_FD,
+	LXC_CMD_GET_ATTACH_CONTEXT,
 	LXC_CMD_MAX,
 } lxc_cmd_t;
 
@@ -76,6 +80,36 @@ struct lxc_cmd_console_rsp_data {
 	int ttynum;
 };
 
+/* Everything lxc_attach() needs to know about a running container. The LSM
+ * label of the container's init process and the seccomp profile follow the
+ * struct as NUL-terminated strings. The fds of the namespaces whose index is
+ * set in ns_fds are sent in a separate message and stored in ns_fd.
+ */
+struct lxc_cmd_attach_context {
+	pid_t init_pid;
+	int clone_flags;
+	signed long personality;
+	unsigned long long capability_mask;
+	int no_new_privs;
+	int ns_fds;
+	int ns_fd[LXC_NS_MAX];
+	uint32_t lsm_label_len;
+	uint32_t seccomp_len;
+	char strings[];
+};
+
+static inline const char *
+lxc_cmd_attach_context_lsm_label(const struct lxc_cmd_attach_context *ctx)
+{
+	return ctx->strings;
+}
+
+static inline const char *
+lxc_cmd_attach_context_seccomp(const struct lxc_cmd_attach_context *ctx)
+{
+	return ctx->strings + ctx->lsm_label_len + 1;
+}
+
 struct lxc_cmd_console_log {
 	bool clear;
 	bool read;
@@ -129,5 +163,9 @@ extern int lxc_cmd_mainloop_add(const char *name, struct lxc_epoll_descr *descr,
 extern int lxc_try_cmd(const char *name, const char *lxcpath);
 extern int lxc_cmd_console_log(const char *name, const char *lxcpath,
 			       struct lxc_console_log *log);
+extern int lxc_cmd_console_log_fd(const char *name, const char *lxcpath);
+extern int lxc_cmd_get_attach_context(const char *name, const char *lxcpath,
+				      struct lxc_cmd_attach_context **ctx);
+extern void lxc_cmd_put_attach_context(struct lxc_cmd_attach_context *ctx);
 
 #endif /* __commands_h */
@@ -1396,6 +1396,7 @@ static int lxc_setup_rootfs(struct lxc_conf *conf)
 		      rootfs->options ? rootfs->options : "(null)");
 		return -1;
 	}
+	bdev->tmpfs_size = rootfs->tmpfs_size;
 
 	ret = bdev->ops->mount(bdev);
 	storage_put(bdev);
@@ -2662,6 +2663,11 @@ struct lxc_conf *lxc_conf_init(void)
 	new->console.buffer_size = 0;
 	new->console.log_path = NULL;
 	new->console.log_fd = -1;
+	new->console.log_timer_fd = -1;
+	new->console.splice_pipe[0] = -1;
+	new->console.splice_pipe[1] = -1;
+	new->console.tee_pipe[0] = -1;
+	new->console.tee_pipe[1] = -1;
 	new->console.log_size = 0;
 	new->console.path = NULL;
 	new->console.peer = -1;
@@ -2672,6 +2678,7 @@ struct lxc_conf *lxc_conf_init(void)
 	new->console.slave = -1;
 	new->console.name[0] = '\0';
 	memset(&new->console.ringbuf, 0, sizeof(struct lxc_ringbuf));
+	new->console.ringbuf.fd = -1;
 	new->maincmd_fd = -1;
 	new->nbd_idx = -1;
 	new->rootfs.mount = strdup(default_rootfs_mount);
@@ -3996,6 +4003,7 @@ void lxc_conf_free(struct lxc_conf *conf)
 	free(conf->rootfs.mount);
 	free(conf->rootfs.bdev_type);
 	free(conf->rootfs.options);
+	free(conf->rootfs.fstype);
 	free(conf->rootfs.path);
 	free(conf->logfile);
 	if (conf->logfd != -1)
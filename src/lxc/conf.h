@@ -158,6 +158,10 @@ struct lxc_rootfs {
 	char *mount;
 	char *options;
 	char *bdev_type;
+	char *fstype;
+	unsigned int loop_block_size;
+	/* size of the tmpfs holding the overlay upper dir, 0 to keep it on disk */
+	uint64_t tmpfs_size;
 };
 
 /*
@@ -278,6 +282,9 @@ struct lxc_conf {
 	char *seccomp;  /* filename with the seccomp rules */
 #if HAVE_SCMP_FILTER_CTX
 	scmp_filter_ctx seccomp_ctx;
+	/* compiled filter read from the seccomp cache */
+	struct sock_filter *seccomp_bpf;
+	size_t seccomp_bpf_len;
 #endif
 	int maincmd_fd;
 	unsigned int autodev;  /* if 1, mount and fill a /dev at start */
@@ -294,6 +301,7 @@ struct lxc_conf {
 	char *logfile; /* the logfile as specifed in config */
 	int loglevel; /* loglevel as specifed in config (if any) */
 	int logfd;
+	int logformat; /* log format as specified in config (if any) */
 
 	unsigned int start_auto;
 	unsigned int start_delay;
@@ -332,6 +340,9 @@ struct lxc_conf {
 	/* indicator if the container will be destroyed on shutdown */
 	unsigned int ephemeral;
 
+	/* number of snapshots of the container to keep ready for cloning */
+	unsigned int clone_pool;
+
 	/* The facility to pass to syslog. Let's users establish as what type of
 	 * program liblxc is supposed to write to the syslog. */
 	char *syslog;
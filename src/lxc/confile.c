@@ -90,6 +90,7 @@ lxc_config_define(cap_keep);
 lxc_config_define(cgroup_controller);
 lxc_config_define(cgroup2_controller);
 lxc_config_define(cgroup_dir);
+lxc_config_define(clone_pool);
 lxc_config_define(console_buffer_size);
 lxc_config_define(console_logfile);
 lxc_config_define(console_path);
@@ -108,6 +109,7 @@ lxc_config_define(init_cwd);
 lxc_config_define(init_gid);
 lxc_config_define(init_uid);
 lxc_config_define(log_file);
+lxc_config_define(log_format);
 lxc_config_define(log_level);
 lxc_config_define(log_syslog);
 lxc_config_define(monitor);
@@ -139,7 +141,10 @@ lxc_config_define(personality);
 lxc_config_define(prlimit);
 lxc_config_define(pty_max);
 lxc_config_define(rootfs_mount);
+lxc_config_define(rootfs_fstype);
+lxc_config_define(rootfs_loop_block_size);
 lxc_config_define(rootfs_options);
+lxc_config_define(rootfs_overlay_tmpfs_size);
 lxc_config_define(rootfs_path);
 lxc_config_define(seccomp_profile);
 lxc_config_define(selinux_context);
@@ -163,6 +168,7 @@ static struct lxc_config_t config[] = {
 	{ "lxc.cgroup2",                   set_config_cgroup2_controller,          get_config_cgroup2_controller,          clr_config_cgroup2_controller,        },
 	{ "lxc.cgroup.dir",                set_config_cgroup_dir,                  get_config_cgroup_dir,                  clr_config_cgroup_dir,                },
 	{ "lxc.cgroup",                    set_config_cgroup_controller,           get_config_cgroup_controller,           clr_config_cgroup_controller,         },
+	{ "lxc.clone.pool",                set_config_clone_pool,                  get_config_clone_pool,                  clr_config_clone_pool,                },
 	{ "lxc.console.buffer.size",       set_config_console_buffer_size,         get_config_console_buffer_size,         clr_config_console_buffer_size,       },
 	{ "lxc.console.logfile",           set_config_console_logfile,             get_config_console_logfile,             clr_config_console_logfile,           },
 	{ "lxc.console.path",              set_config_console_path,                get_config_console_path,                clr_config_console_path,              },
@@ -191,6 +197,7 @@ static struct lxc_config_t config[] = {
 	{ "lxc.init.uid",                  set_config_init_uid,                    get_config_init_uid,                    clr_config_init_uid,                  },
 	{ "lxc.init.cwd",                  set_config_init_cwd,                    get_config_init_cwd,                    clr_config_init_cwd,                  },
 	{ "lxc.log.file",                  set_config_log_file,                    get_config_log_file,                    clr_config_log_file,                  },
+	{ "lxc.log.format",                set_config_log_format,                  get_config_log_format,                  clr_config_log_format,                },
 	{ "lxc.log.level",                 set_config_log_level,                   get_config_log_level,                   clr_config_log_level,                 },
 	{ "lxc.log.syslog",                set_config_log_syslog,                  get_config_log_syslog,                  clr_config_log_syslog,                },
 	{ "lxc.monitor.unshare",           set_config_monitor,                     get_config_monitor,                     clr_config_monitor,                   },
@@ -220,8 +227,11 @@ static struct lxc_config_t config[] = {
 	{ "lxc.no_new_privs",	           set_config_no_new_privs,                get_config_no_new_privs,                clr_config_no_new_privs,              },
 	{ "lxc.prlimit",                   set_config_prlimit,                     get_config_prlimit,                     clr_config_prlimit,                   },
 	{ "lxc.pty.max",                   set_config_pty_max,                     get_config_pty_max,                     clr_config_pty_max,                   },
+	{ "lxc.rootfs.fstype",             set_config_rootfs_fstype,               get_config_rootfs_fstype,               clr_config_rootfs_fstype,             },
+	{ "lxc.rootfs.loop.block_size",    set_config_rootfs_loop_block_size,      get_config_rootfs_loop_block_size,      clr_config_rootfs_loop_block_size,    },
 	{ "lxc.rootfs.mount",              set_config_rootfs_mount,                get_config_rootfs_mount,                clr_config_rootfs_mount,              },
 	{ "lxc.rootfs.options",            set_config_rootfs_options,              get_config_rootfs_options,              clr_config_rootfs_options,            },
+	{ "lxc.rootfs.overlay.tmpfs_size", set_config_rootfs_overlay_tmpfs_size,   get_config_rootfs_overlay_tmpfs_size,   clr_config_rootfs_overlay_tmpfs_size, },
 	{ "lxc.rootfs.path",               set_config_rootfs_path,                 get_config_rootfs_path,                 clr_config_rootfs_path,               },
 	{ "lxc.seccomp.profile",           set_config_seccomp_profile,             get_config_seccomp_profile,             clr_config_seccomp_profile,           },
 	{ "lxc.selinux.context",           set_config_selinux_context,             get_config_selinux_context,             clr_config_selinux_context,           },
@@ -1219,6 +1229,28 @@ static int set_config_log_file(const char *key, const char *value,
 	return ret;
 }
 
+static int set_config_log_format(const char *key, const char *value,
+				 struct lxc_conf *lxc_conf, void *data)
+{
+	int format;
+
+	if (lxc_config_value_empty(value))
+		return clr_config_log_format(key, lxc_conf, data);
+
+	if (strcmp(value, "text") == 0)
+		format = LXC_LOG_FORMAT_TEXT;
+	else if (strcmp(value, "binary") == 0)
+		format = LXC_LOG_FORMAT_BINARY;
+	else
+		return -1;
+
+	if (lxc_log_set_format(format) < 0)
+		return -1;
+
+	lxc_conf->logformat = format;
+	return 0;
+}
+
 static int set_config_log_level(const char *key, const char *value,
 			       struct lxc_conf *lxc_conf, void *data)
 {
@@ -2173,6 +2205,39 @@ static int set_config_rootfs_path(const char *key, const char *value,
 	return ret;
 }
 
+static int set_config_rootfs_fstype(const char *key, const char *value,
+				    struct lxc_conf *lxc_conf, void *data)
+{
+	return set_config_string_item(&lxc_conf->rootfs.fstype, value);
+}
+
+static int set_config_rootfs_loop_block_size(const char *key, const char *value,
+					     struct lxc_conf *lxc_conf, void *data)
+{
+	int ret;
+	unsigned int block_size = 0;
+
+	if (lxc_config_value_empty(value)) {
+		lxc_conf->rootfs.loop_block_size = 0;
+		return 0;
+	}
+
+	ret = lxc_safe_uint(value, &block_size);
+	if (ret < 0)
+		return -1;
+
+	/* The kernel accepts powers of two from 512 bytes to the page size. */
+	if (block_size != 0 &&
+	    (block_size < 512 || block_size > lxc_getpagesize() ||
+	     (block_size & (block_size - 1)))) {
+		ERROR("Invalid loop device block size %u", block_size);
+		return -1;
+	}
+
+	lxc_conf->rootfs.loop_block_size = block_size;
+	return 0;
+}
+
 static int set_config_rootfs_mount(const char *key, const char *value,
 				   struct lxc_conf *lxc_conf, void *data)
 {
@@ -2185,6 +2250,30 @@ static int set_config_rootfs_options(const char *key, const char *value,
 	return set_config_string_item(&lxc_conf->rootfs.options, value);
 }
 
+static int set_config_rootfs_overlay_tmpfs_size(const char *key,
+						const char *value,
+						struct lxc_conf *lxc_conf,
+						void *data)
+{
+	int ret;
+	int64_t size;
+
+	if (lxc_config_value_empty(value)) {
+		lxc_conf->rootfs.tmpfs_size = 0;
+		return 0;
+	}
+
+	ret = parse_byte_size_string(value, &size);
+	if (ret < 0)
+		return -1;
+
+	if (size < 0)
+		return -EINVAL;
+
+	lxc_conf->rootfs.tmpfs_size = (uint64_t)size;
+	return 0;
+}
+
 static int set_config_uts_name(const char *key, const char *value,
 			      struct lxc_conf *lxc_conf, void *data)
 {
@@ -2979,6 +3068,17 @@ static int set_config_ephemeral(const char *key, const char *value,
 	return 0;
 }
 
+static int set_config_clone_pool(const char *key, const char *value,
+				 struct lxc_conf *lxc_conf, void *data)
+{
+	if (lxc_config_value_empty(value)) {
+		lxc_conf->clone_pool = 0;
+		return 0;
+	}
+
+	return lxc_safe_uint(value, &lxc_conf->clone_pool);
+}
+
 static int set_config_log_syslog(const char *key, const char *value,
 			     struct lxc_conf *lxc_conf, void *data)
 {
@@ -3241,6 +3341,15 @@ static int get_config_log_file(const char *key, char *retv, int inlen,
 	return lxc_get_conf_str(retv, inlen, c->logfile);
 }
 
+static int get_config_log_format(const char *key, char *retv, int inlen,
+				 struct lxc_conf *c, void *data)
+{
+	if (c->logformat == LXC_LOG_FORMAT_BINARY)
+		return lxc_get_conf_str(retv, inlen, "binary");
+
+	return lxc_get_conf_str(retv, inlen, "text");
+}
+
 static int get_config_mount_fstab(const char *key, char *retv, int inlen,
 				  struct lxc_conf *c, void *data)
 {
@@ -3347,6 +3456,19 @@ static int get_config_rootfs_path(const char *key, char *retv, int inlen,
 	return lxc_get_conf_str(retv, inlen, c->rootfs.path);
 }
 
+static int get_config_rootfs_fstype(const char *key, char *retv, int inlen,
+				    struct lxc_conf *c, void *data)
+{
+	return lxc_get_conf_str(retv, inlen, c->rootfs.fstype);
+}
+
+static int get_config_rootfs_loop_block_size(const char *key, char *retv,
+					     int inlen, struct lxc_conf *c,
+					     void *data)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->rootfs.loop_block_size);
+}
+
 static int get_config_rootfs_mount(const char *key, char *retv, int inlen,
 				   struct lxc_conf *c, void *data)
 {
@@ -3359,6 +3481,13 @@ static int get_config_rootfs_options(const char *key, char *retv, int inlen,
 	return lxc_get_conf_str(retv, inlen, c->rootfs.options);
 }
 
+static int get_config_rootfs_overlay_tmpfs_size(const char *key, char *retv,
+						int inlen, struct lxc_conf *c,
+						void *data)
+{
+	return lxc_get_conf_uint64(c, retv, inlen, c->rootfs.tmpfs_size);
+}
+
 static int get_config_uts_name(const char *key, char *retv, int inlen,
 			      struct lxc_conf *c, void *data)
 {
@@ -3625,6 +3754,12 @@ static int get_config_ephemeral(const char *key, char *retv, int inlen,
 	return lxc_get_conf_int(c, retv, inlen, c->ephemeral);
 }
 
+static int get_config_clone_pool(const char *key, char *retv, int inlen,
+				 struct lxc_conf *c, void *data)
+{
+	return lxc_get_conf_int(c, retv, inlen, c->clone_pool);
+}
+
 static int get_config_no_new_privs(const char *key, char *retv, int inlen,
 				   struct lxc_conf *c, void *data)
 {
@@ -3917,6 +4052,13 @@ static inline int clr_config_log_file(const char *key, struct lxc_conf *c,
 	return 0;
 }
 
+static inline int clr_config_log_format(const char *key, struct lxc_conf *c,
+				       void *data)
+{
+	c->logformat = LXC_LOG_FORMAT_TEXT;
+	return lxc_log_set_format(LXC_LOG_FORMAT_TEXT);
+}
+
 static inline int clr_config_mount(const char *key, struct lxc_conf *c,
 				   void *data)
 {
@@ -3945,6 +4087,22 @@ static inline int clr_config_rootfs_path(const char *key, struct lxc_conf *c,
 	return 0;
 }
 
+static inline int clr_config_rootfs_fstype(const char *key, struct lxc_conf *c,
+					   void *data)
+{
+	free(c->rootfs.fstype);
+	c->rootfs.fstype = NULL;
+	return 0;
+}
+
+static inline int clr_config_rootfs_loop_block_size(const char *key,
+						    struct lxc_conf *c,
+						    void *data)
+{
+	c->rootfs.loop_block_size = 0;
+	return 0;
+}
+
 static inline int clr_config_rootfs_mount(const char *key, struct lxc_conf *c,
 					  void *data)
 {
@@ -3961,6 +4119,14 @@ static inline int clr_config_rootfs_options(const char *key, struct lxc_conf *c,
 	return 0;
 }
 
+static inline int clr_config_rootfs_overlay_tmpfs_size(const char *key,
+						       struct lxc_conf *c,
+						       void *data)
+{
+	c->rootfs.tmpfs_size = 0;
+	return 0;
+}
+
 static inline int clr_config_uts_name(const char *key, struct lxc_conf *c,
 				     void *data)
 {
@@ -4161,6 +4327,13 @@ static inline int clr_config_ephemeral(const char *key, struct lxc_conf *c,
 	return 0;
 }
 
+static inline int clr_config_clone_pool(const char *key, struct lxc_conf *c,
+					void *data)
+{
+	c->clone_pool = 0;
+	return 0;
+}
+
 static inline int clr_config_no_new_privs(const char *key, struct lxc_conf *c,
 					  void *data)
 {
@@ -5060,6 +5233,8 @@ int lxc_list_subkeys(struct lxc_conf *conf, const char *key, char *retv,
 		strprint(retv, inlen, "entry\n");
 		strprint(retv, inlen, "fstab\n");
 	} else if (!strcmp(key, "lxc.rootfs")) {
+		strprint(retv, inlen, "fstype\n");
+		strprint(retv, inlen, "loop.block_size\n");
 		strprint(retv, inlen, "mount\n");
 		strprint(retv, inlen, "options\n");
 		strprint(retv, inlen, "path\n");
@@ -21,15 +21,21 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 #define _GNU_SOURCE
+#include <fcntl.h>
 #include <inttypes.h>
 #include <linux/limits.h>
+#include <pthread.h>
 #include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
@@ -63,8 +69,45 @@
 #define CRIU_IN_FLIGHT_SUPPORT	"2.4"
 #define CRIU_EXTERNAL_NOT_VETH	"2.8"
 
+/* Defaults for the iterative pre-copy dump. */
+#define CRIU_DEFAULT_ITERATIONS		5
+#define CRIU_DEFAULT_CONVERGE_PAGES	1024
+
+/* Magic numbers of criu's stats-dump image. */
+#define CRIU_IMG_COMMON_MAGIC	0x54564319
+#define CRIU_IMG_SERVICE_MAGIC	0x55105940
+#define CRIU_STATS_MAGIC	0x57093306
+
+/* Field numbers in criu's DumpStatsEntry and RestoreStatsEntry. */
+#define CRIU_STATS_DUMP_FROZEN_TIME	2
+#define CRIU_STATS_DUMP_PAGES_WRITTEN	7
+#define CRIU_STATS_RESTORE_TIME		4
+#define CRIU_STATS_RESTORE_PAGES	5
+
 lxc_log_define(criu, lxc);
 
+/* The detected criu version and the supported features. They are cached per
+ * process and in $rundir/lxc/criu.caps so that repeated dumps and restores
+ * don't have to exec criu again. The cache is keyed by the inode and mtime of
+ * the criu binary and the kernel release, and is dropped whenever either
+ * changes. Failed probes aren't cached since they might be transient.
+ */
+struct criu_caps {
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime_sec;
+	long mtime_nsec;
+	char kernel[65];
+	/* empty if the version has not been detected yet */
+	char version[1024];
+	/* features that were probed and the subset of those that is supported */
+	uint64_t features_probed;
+	uint64_t features;
+};
+
+static struct criu_caps criu_caps;
+static pthread_mutex_t criu_caps_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 struct criu_opts {
 	/* the thing to hook to stdout and stderr for logging */
 	int pipefd;
@@ -207,11 +250,15 @@ static void exec_criu(struct cgroup_ops *cgroup_ops, struct criu_opts *opts)
 		/* -t pid --freeze-cgroup /lxc/ct */
 		static_args += 4;
 
-		/* --prev-images-dir <path-to-directory-A-relative-to-B> */
+		/* --prev-images-dir <path-to-directory-A-relative-to-B> --track-mem */
 		if (opts->user->predump_dir)
-			static_args += 2;
+			static_args += 3;
+		else if (strcmp(opts->action, "pre-dump") == 0)
+			static_args++;
 
-		/* --page-server --address <address> --port <port> */
+		/* --page-server --address <address> --port <port> or
+		 * --lazy-pages --address <address> --port <port>
+		 */
 		if (opts->user->pageserver_address && opts->user->pageserver_port)
 			static_args += 5;
 
@@ -244,6 +291,10 @@ static void exec_criu(struct cgroup_ops *cgroup_ops, struct criu_opts *opts)
 		/* --inherit-fd fd[%d]:tty[%s] */
 		if (ttys[0])
 			static_args += 2;
+
+		/* --lazy-pages */
+		if (opts->user->lazy_pages)
+			static_args++;
 	} else {
 		return;
 	}
@@ -457,11 +508,22 @@ static void exec_criu(struct cgroup_ops *cgroup_ops, struct criu_opts *opts)
 		if (opts->user->predump_dir) {
 			DECLARE_ARG("--prev-images-dir");
 			DECLARE_ARG(opts->user->predump_dir);
-			DECLARE_ARG("--track-mem");
 		}
 
+		/* A pre-dump always tracks memory so that the next round only
+		 * has to copy the pages that were dirtied in the meantime.
+		 */
+		if (opts->user->predump_dir || strcmp(opts->action, "pre-dump") == 0)
+			DECLARE_ARG("--track-mem");
+
 		if (opts->user->pageserver_address && opts->user->pageserver_port) {
-			DECLARE_ARG("--page-server");
+			/* A lazy dump serves the pages itself once the
+			 * restore asks for them.
+			 */
+			if (opts->user->lazy_pages && strcmp(opts->action, "dump") == 0)
+				DECLARE_ARG("--lazy-pages");
+			else
+				DECLARE_ARG("--page-server");
 			DECLARE_ARG("--address");
 			DECLARE_ARG(opts->user->pageserver_address);
 			DECLARE_ARG("--port");
@@ -497,6 +559,9 @@ static void exec_criu(struct cgroup_ops *cgroup_ops, struct criu_opts *opts)
 		DECLARE_ARG("--restore-detached");
 		DECLARE_ARG("--restore-sibling");
 
+		if (opts->user->lazy_pages)
+			DECLARE_ARG("--lazy-pages");
+
 		if (ttys[0]) {
 			if (opts->console_fd < 0) {
 				ERROR("lxc.console.path configured on source host but not target");
@@ -657,6 +722,180 @@ err:
 	free(argv);
 }
 
+static char *criu_caps_path(void)
+{
+	int ret;
+	char *rundir, *path;
+	size_t len;
+
+	rundir = get_rundir();
+	if (!rundir)
+		return NULL;
+
+	len = strlen(rundir) + sizeof("/lxc/criu.caps");
+	path = malloc(len);
+	if (path) {
+		ret = snprintf(path, len, "%s/lxc/criu.caps", rundir);
+		if (ret < 0 || (size_t)ret >= len) {
+			free(path);
+			path = NULL;
+		}
+	}
+
+	free(rundir);
+	return path;
+}
+
+static bool criu_caps_same_key(const struct criu_caps *a,
+			       const struct criu_caps *b)
+{
+	return a->dev == b->dev && a->ino == b->ino &&
+	       a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+	       strcmp(a->kernel, b->kernel) == 0;
+}
+
+/* Must be called with criu_caps_mutex held. */
+static void criu_caps_read_file(struct criu_caps *caps)
+{
+	int ret;
+	FILE *f;
+	char *path;
+	struct criu_caps file = {0};
+
+	path = criu_caps_path();
+	if (!path)
+		return;
+
+	f = fopen(path, "re");
+	free(path);
+	if (!f)
+		return;
+
+	ret = fscanf(f, "%" SCNu64 " %" SCNu64 " %" SCNd64 " %ld %64s %" SCNx64 " %" SCNx64 " %1023[^\n]",
+		     &file.dev, &file.ino, &file.mtime_sec, &file.mtime_nsec,
+		     file.kernel, &file.features_probed, &file.features,
+		     file.version);
+	fclose(f);
+	if (ret < 7 || !criu_caps_same_key(caps, &file))
+		return;
+
+	*caps = file;
+	TRACE("Loaded cached criu capabilities");
+}
+
+/* Must be called with criu_caps_mutex held. */
+static void criu_caps_write_file(const struct criu_caps *caps)
+{
+	int ret;
+	FILE *f;
+	char *path, *dir;
+	char tmp[PATH_MAX];
+
+	path = criu_caps_path();
+	if (!path)
+		return;
+
+	ret = snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	if (ret < 0 || (size_t)ret >= sizeof(tmp))
+		goto out;
+
+	dir = strrchr(tmp, '/');
+	*dir = '\0';
+	ret = mkdir_p(tmp, 0755);
+	*dir = '/';
+	if (ret < 0)
+		goto out;
+
+	f = fopen(tmp, "we");
+	if (!f)
+		goto out;
+
+	ret = fprintf(f, "%" PRIu64 " %" PRIu64 " %" PRId64 " %ld %s %" PRIx64 " %" PRIx64 " %s\n",
+		      caps->dev, caps->ino, caps->mtime_sec, caps->mtime_nsec,
+		      caps->kernel, caps->features_probed, caps->features,
+		      caps->version);
+	if (fclose(f) != 0 || ret < 0) {
+		(void)unlink(tmp);
+		goto out;
+	}
+
+	/* Readers never see a partially written file. */
+	if (rename(tmp, path) < 0) {
+		SYSWARN("Failed to persist criu capabilities in \"%s\"", path);
+		(void)unlink(tmp);
+	}
+
+out:
+	free(path);
+}
+
+/* Fill @caps with what is known about the criu binary on $PATH. Returns false
+ * if there is no criu binary.
+ */
+static bool criu_caps_get(struct criu_caps *caps)
+{
+	int ret;
+	char *path;
+	struct stat st;
+	struct utsname uts;
+	struct criu_caps key = {0};
+
+	path = on_path("criu", NULL);
+	if (!path)
+		return false;
+
+	ret = stat(path, &st);
+	free(path);
+	if (ret < 0)
+		return false;
+
+	/* What criu supports also depends on the kernel. */
+	ret = uname(&uts);
+	if (ret < 0)
+		return false;
+
+	key.dev = st.st_dev;
+	key.ino = st.st_ino;
+	key.mtime_sec = st.st_mtim.tv_sec;
+	key.mtime_nsec = st.st_mtim.tv_nsec;
+	if (strlcpy(key.kernel, uts.release, sizeof(key.kernel)) >= sizeof(key.kernel))
+		return false;
+
+	pthread_mutex_lock(&criu_caps_mutex);
+	if (!criu_caps_same_key(&criu_caps, &key)) {
+		criu_caps = key;
+		criu_caps_read_file(&criu_caps);
+	}
+	*caps = criu_caps;
+	pthread_mutex_unlock(&criu_caps_mutex);
+
+	return true;
+}
+
+/* Record a detected @version and/or the result of probing the features in
+ * @probed for the binary described by @caps.
+ */
+static void criu_caps_update(const struct criu_caps *caps, const char *version,
+			     uint64_t probed, uint64_t supported)
+{
+	pthread_mutex_lock(&criu_caps_mutex);
+
+	/* criu was replaced in the meantime. */
+	if (!criu_caps_same_key(&criu_caps, caps))
+		goto out;
+
+	if (version)
+		(void)strlcpy(criu_caps.version, version, sizeof(criu_caps.version));
+
+	criu_caps.features_probed |= probed;
+	criu_caps.features = (criu_caps.features & ~probed) | (supported & probed);
+
+	criu_caps_write_file(&criu_caps);
+
+out:
+	pthread_mutex_unlock(&criu_caps_mutex);
+}
+
 /*
  * Function to check if the checks activated in 'features_to_check' are
  * available with the current architecture/kernel/criu combination.
@@ -677,7 +916,10 @@ bool __criu_check_feature(uint64_t *features_to_check)
 	pid_t pid;
 	uint64_t current_bit = 0;
 	int ret;
-	int features = *features_to_check;
+	uint64_t features = *features_to_check;
+	uint64_t cached = 0, to_probe;
+	bool have_caps;
+	struct criu_caps caps;
 	/* Feature checking is currently always like
 	 * criu check --feature <feature-name>
 	 */
@@ -690,6 +932,14 @@ bool __criu_check_feature(uint64_t *features_to_check)
 		return false;
 	}
 
+	/* Only probe the features we don't already know about. */
+	have_caps = criu_caps_get(&caps);
+	if (have_caps) {
+		cached = features & caps.features_probed & caps.features;
+		features &= ~caps.features_probed;
+	}
+	to_probe = features;
+
 	while (current_bit < sizeof(uint64_t) * 8) {
 		/* only test requested features */
 		if (!(features & (1ULL << current_bit))) {
@@ -748,6 +998,14 @@ bool __criu_check_feature(uint64_t *features_to_check)
 		if (!(features & ~((1ULL << current_bit)-1)))
 			break;
 	}
+
+	/* Only remember features that were found, a failed check could also
+	 * mean that criu couldn't run at all.
+	 */
+	if (have_caps && (to_probe & features))
+		criu_caps_update(&caps, NULL, to_probe & features, features);
+
+	features |= cached;
 	if (features != *features_to_check) {
 		*features_to_check = features;
 		return false;
@@ -771,6 +1029,19 @@ static bool criu_version_ok(char **version)
 {
 	int pipes[2];
 	pid_t pid;
+	bool have_caps;
+	struct criu_caps caps;
+
+	have_caps = criu_caps_get(&caps);
+	if (have_caps && caps.version[0]) {
+		if (version) {
+			*version = strdup(caps.version);
+			if (!*version)
+				return false;
+		}
+
+		return true;
+	}
 
 	if (pipe(pipes) < 0) {
 		SYSERROR("pipe() failed");
@@ -848,6 +1119,9 @@ static bool criu_version_ok(char **version)
 
 version_match:
 		fclose(f);
+		if (have_caps)
+			criu_caps_update(&caps, tmp, 0, 0);
+
 		if (!version)
 			free(tmp);
 		else
@@ -898,6 +1172,307 @@ static bool criu_ok(struct lxc_container *c, char **criu_version)
 	return true;
 }
 
+static bool pb_read_varint(const unsigned char **p, const unsigned char *end,
+			   uint64_t *val)
+{
+	unsigned int shift;
+
+	*val = 0;
+	for (shift = 0; *p < end && shift < 64; shift += 7) {
+		unsigned char b = *(*p)++;
+
+		*val |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+/* Find field @field in the protobuf message [@buf, @end). Varint fields are
+ * returned in @val, length-delimited fields in @sub and @sublen.
+ */
+static bool pb_find_field(const unsigned char *buf, const unsigned char *end,
+			  unsigned int field, uint64_t *val,
+			  const unsigned char **sub, size_t *sublen)
+{
+	while (buf < end) {
+		uint64_t key, len = 0, v = 0;
+		const unsigned char *data;
+
+		if (!pb_read_varint(&buf, end, &key))
+			return false;
+
+		data = buf;
+		switch (key & 7) {
+		case 0:
+			if (!pb_read_varint(&buf, end, &v))
+				return false;
+			break;
+		case 1:
+			buf += 8;
+			break;
+		case 2:
+			if (!pb_read_varint(&buf, end, &len) ||
+			    len > (uint64_t)(end - buf))
+				return false;
+			data = buf;
+			buf += len;
+			break;
+		case 5:
+			buf += 4;
+			break;
+		default:
+			return false;
+		}
+
+		if (buf > end)
+			return false;
+
+		if ((key >> 3) != field)
+			continue;
+
+		if (val)
+			*val = v;
+
+		if (sub) {
+			*sub = data;
+			*sublen = len;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+/* Read the fields of the DumpStatsEntry or RestoreStatsEntry criu leaves in
+ * @directory/stats-@action after a dump or restore into @stats, indexed by
+ * their field number. Fields missing from the image are left at 0.
+ */
+static int criu_read_stats(const char *directory, const char *action,
+			   uint64_t *stats, unsigned int nr_stats)
+{
+	int fd, ret;
+	ssize_t len;
+	unsigned int i;
+	uint32_t magic[3];
+	const unsigned char *p, *end, *entry;
+	size_t entry_len, off;
+	unsigned char buf[4096];
+	char path[PATH_MAX];
+
+	ret = snprintf(path, sizeof(path), "%s/stats-%s", directory, action);
+	if (ret < 0 || (size_t)ret >= sizeof(path))
+		return -1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = lxc_read_nointr(fd, buf, sizeof(buf));
+	close(fd);
+	if (len < (ssize_t)sizeof(magic))
+		return -1;
+
+	/* The image starts with the service magic (older criu versions leave
+	 * it out) and the stats magic, followed by a length-prefixed
+	 * StatsEntry.
+	 */
+	memcpy(magic, buf, sizeof(magic));
+	if (magic[0] == CRIU_STATS_MAGIC)
+		off = sizeof(uint32_t);
+	else if ((magic[0] == CRIU_IMG_SERVICE_MAGIC ||
+		  magic[0] == CRIU_IMG_COMMON_MAGIC) &&
+		 magic[1] == CRIU_STATS_MAGIC)
+		off = 2 * sizeof(uint32_t);
+	else
+		return -1;
+
+	if ((size_t)len < off + sizeof(uint32_t))
+		return -1;
+
+	memcpy(&magic[2], buf + off, sizeof(uint32_t));
+	off += sizeof(uint32_t);
+	if (magic[2] > (size_t)len - off)
+		return -1;
+
+	p = buf + off;
+	end = p + magic[2];
+
+	/* StatsEntry.dump is field 1, StatsEntry.restore field 2. */
+	if (!pb_find_field(p, end, strcmp(action, "dump") ? 2 : 1, NULL,
+			   &entry, &entry_len))
+		return -1;
+
+	for (i = 0; i < nr_stats; i++)
+		if (!pb_find_field(entry, entry + entry_len, i, &stats[i], NULL, NULL))
+			stats[i] = 0;
+
+	return 0;
+}
+
+/* Start a criu daemon running "criu @args --status-fd <fd>" and wait until it
+ * reports that it is ready to handle requests. If @detach is true the daemon
+ * is double-forked so that it isn't our child. Returns the daemon's pid.
+ */
+static pid_t criu_daemon_start(const char **args, bool detach)
+{
+	int ret;
+	pid_t pid;
+	char ready;
+	int statusfd[2];
+
+	ret = pipe2(statusfd, O_CLOEXEC);
+	if (ret < 0) {
+		SYSERROR("Failed to create status pipe for criu %s", args[0]);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		SYSERROR("Failed to fork criu %s", args[0]);
+		close(statusfd[0]);
+		close(statusfd[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		int i, nargs;
+		char **argv;
+		char fdstr[LXC_NUMSTRLEN64];
+
+		close(statusfd[0]);
+
+		if (detach) {
+			pid = fork();
+			if (pid < 0)
+				_exit(EXIT_FAILURE);
+
+			if (pid > 0)
+				_exit(EXIT_SUCCESS);
+
+			(void)setsid();
+
+			/* Tell the caller who we are before criu reports
+			 * readiness through the same pipe.
+			 */
+			pid = getpid();
+			if (lxc_write_nointr(statusfd[1], &pid, sizeof(pid)) != sizeof(pid))
+				_exit(EXIT_FAILURE);
+		}
+
+		/* The daemon outlives us so don't hand it any of our fds
+		 * apart from the status pipe.
+		 */
+		ret = lxc_check_inherited(NULL, true, &statusfd[1], 1);
+		if (ret < 0)
+			_exit(EXIT_FAILURE);
+
+		for (nargs = 0; args[nargs]; nargs++)
+			;
+
+		argv = calloc(nargs + 4, sizeof(*argv));
+		if (!argv)
+			_exit(EXIT_FAILURE);
+
+		argv[0] = on_path("criu", NULL);
+		if (!argv[0])
+			_exit(EXIT_FAILURE);
+
+		for (i = 0; i < nargs; i++)
+			argv[i + 1] = (char *)args[i];
+
+		/* criu needs to inherit the status fd. */
+		ret = fcntl(statusfd[1], F_SETFD, 0);
+		if (ret < 0)
+			_exit(EXIT_FAILURE);
+
+		ret = snprintf(fdstr, sizeof(fdstr), "%d", statusfd[1]);
+		if (ret < 0 || (size_t)ret >= sizeof(fdstr))
+			_exit(EXIT_FAILURE);
+
+		argv[nargs + 1] = "--status-fd";
+		argv[nargs + 2] = fdstr;
+
+		null_stdfds();
+
+		execv(argv[0], argv);
+		_exit(EXIT_FAILURE);
+	}
+
+	close(statusfd[1]);
+
+	if (detach) {
+		(void)wait_for_pid(pid);
+
+		ret = lxc_read_nointr(statusfd[0], &pid, sizeof(pid));
+		if (ret != sizeof(pid)) {
+			ERROR("Failed to start criu %s", args[0]);
+			close(statusfd[0]);
+			return -1;
+		}
+	}
+
+	ret = lxc_read_nointr(statusfd[0], &ready, 1);
+	close(statusfd[0]);
+	if (ret != 1) {
+		ERROR("Failed to start criu %s", args[0]);
+		if (detach)
+			(void)kill(pid, SIGKILL);
+		else
+			(void)wait_for_pid(pid);
+		return -1;
+	}
+
+	TRACE("Started criu %s", args[0]);
+	return pid;
+}
+
+/* Start a criu page-server receiving the pages of one dump round into
+ * @directory. Returns once the page-server is accepting connections.
+ */
+static pid_t criu_page_server_start(struct migrate_opts *opts,
+				    const char *directory)
+{
+	const char *args[] = {
+		"page-server", "-D", directory,
+		"--address", opts->pageserver_address,
+		"--port", opts->pageserver_port,
+		"-o", "page-server.log",
+		NULL,
+	};
+
+	return criu_daemon_start(args, false);
+}
+
+/* Start the lazy-pages daemon a lazy restore from @opts->directory faults its
+ * memory in from. It fetches the pages from the page-server at
+ * pageserver_address:pageserver_port if one was given, and from the local
+ * images otherwise. The daemon exits by itself once all pages have been
+ * transferred, so it is detached rather than becoming a child of the
+ * container's monitor.
+ */
+static pid_t criu_lazy_pages_start(struct migrate_opts *opts)
+{
+	const char *args[] = {
+		"lazy-pages", "-D", opts->directory,
+		"-o", "lazy-pages.log",
+		NULL, NULL, NULL, NULL, NULL,
+		NULL,
+	};
+
+	if (opts->pageserver_address && opts->pageserver_port) {
+		args[5] = "--page-server";
+		args[6] = "--address";
+		args[7] = opts->pageserver_address;
+		args[8] = "--port";
+		args[9] = opts->pageserver_port;
+	}
+
+	return criu_daemon_start(args, true);
+}
+
 static bool restore_net_info(struct lxc_container *c)
 {
 	int ret;
@@ -944,6 +1519,7 @@ static void do_restore(struct lxc_container *c, int status_pipe, struct migrate_
 	struct lxc_handler *handler;
 	int status = 0;
 	int pipes[2] = {-1, -1};
+	pid_t lazy_pages = -1;
 	struct cgroup_ops *cgroup_ops;
 
 	/* Try to detach from the current controlling tty if it exists.
@@ -987,6 +1563,12 @@ static void do_restore(struct lxc_container *c, int status_pipe, struct migrate_
 		goto out_fini_handler;
 	}
 
+	if (opts->lazy_pages) {
+		lazy_pages = criu_lazy_pages_start(opts);
+		if (lazy_pages < 0)
+			goto out_fini_handler;
+	}
+
 	if (pipe(pipes) < 0) {
 		SYSERROR("pipe() failed");
 		goto out_fini_handler;
@@ -1162,6 +1744,10 @@ out_fini_handler:
 	if (pipes[1] >= 0)
 		close(pipes[1]);
 
+	/* Nobody is going to ask the lazy-pages daemon for pages. */
+	if (lazy_pages > 0)
+		(void)kill(lazy_pages, SIGKILL);
+
 	lxc_fini(c->name, handler);
 
 out:
@@ -1362,6 +1948,11 @@ bool __criu_dump(struct lxc_container *c, struct migrate_opts *opts)
 	char path[PATH_MAX];
 	int ret;
 
+	if (opts->lazy_pages && !(opts->pageserver_address && opts->pageserver_port)) {
+		ERROR("A lazy dump needs a page-server address and port to serve the pages from");
+		return false;
+	}
+
 	ret = snprintf(path, sizeof(path), "%s/inventory.img", opts->directory);
 	if (ret < 0 || ret >= sizeof(path))
 		return false;
@@ -1374,18 +1965,186 @@ bool __criu_dump(struct lxc_container *c, struct migrate_opts *opts)
 	return do_dump(c, "dump", opts);
 }
 
+/* Run a single pre-dump or dump round into opts->directory, streaming the
+ * pages to the page-server if one was requested.
+ */
+static bool do_dump_round(struct lxc_container *c, char *mode,
+			  struct migrate_opts *opts)
+{
+	bool ret;
+	pid_t page_server = -1;
+
+	if (opts->local_page_server) {
+		if (mkdir_p(opts->directory, 0700) < 0)
+			return false;
+
+		page_server = criu_page_server_start(opts, opts->directory);
+		if (page_server < 0)
+			return false;
+	}
+
+	ret = do_dump(c, mode, opts);
+
+	if (page_server > 0) {
+		/* The page-server exits once the dump closed its connection.
+		 * If the dump failed before connecting it would wait forever.
+		 */
+		if (!ret)
+			kill(page_server, SIGKILL);
+
+		if (wait_for_pid(page_server) < 0 && ret) {
+			ERROR("criu page-server failed");
+			ret = false;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Iterative pre-copy dump: copy the container's memory with pre-dump rounds
+ * while it keeps running, each round only copying the pages dirtied since
+ * the previous one, until the number of dirty pages drops below
+ * opts->converge_threshold, stops shrinking or opts->max_iterations rounds
+ * were run. The final dump then only has to copy the last, small delta
+ * while the container is frozen.
+ *
+ * The rounds are stored in opts->directory/pre-dump-<n> and the final dump
+ * in opts->directory itself, which is what needs to be passed to restore.
+ */
+bool __criu_iterative_dump(struct lxc_container *c, struct migrate_opts *opts)
+{
+	int ret;
+	unsigned int i, max_iterations;
+	uint64_t converge_threshold, features;
+	uint64_t pages, last_pages = UINT64_MAX;
+	struct migrate_opts round;
+	char dir[PATH_MAX], prev[PATH_MAX];
+
+	if (!opts->directory) {
+		ERROR("No dump directory specified");
+		return false;
+	}
+
+	round = *opts;
+	round.predump_dir = NULL;
+
+	if (round.local_page_server) {
+		if (round.lazy_pages) {
+			ERROR("A local page-server can't be combined with a lazy dump");
+			return false;
+		}
+
+		if (!round.pageserver_port) {
+			ERROR("A local page-server needs a port");
+			return false;
+		}
+
+		if (!round.pageserver_address)
+			round.pageserver_address = "127.0.0.1";
+	}
+
+	ret = snprintf(dir, sizeof(dir), "%s/inventory.img", opts->directory);
+	if (ret < 0 || (size_t)ret >= sizeof(dir))
+		return false;
+
+	if (access(dir, F_OK) == 0) {
+		ERROR("please use a fresh directory for the dump directory");
+		return false;
+	}
+
+	features = FEATURE_MEM_TRACK;
+	if (!__criu_check_feature(&features)) {
+		ERROR("criu does not support memory tracking on this host");
+		return false;
+	}
+
+	max_iterations = opts->max_iterations;
+	if (max_iterations == 0)
+		max_iterations = CRIU_DEFAULT_ITERATIONS;
+
+	converge_threshold = opts->converge_threshold;
+	if (converge_threshold == 0)
+		converge_threshold = CRIU_DEFAULT_CONVERGE_PAGES;
+
+	for (i = 1; i <= max_iterations; i++) {
+		uint64_t stats[CRIU_STATS_DUMP_PAGES_WRITTEN + 1];
+
+		ret = snprintf(dir, sizeof(dir), "%s/pre-dump-%u", opts->directory, i);
+		if (ret < 0 || (size_t)ret >= sizeof(dir))
+			return false;
+		round.directory = dir;
+
+		if (!do_dump_round(c, "pre-dump", &round)) {
+			ERROR("Pre-dump round %u failed", i);
+			return false;
+		}
+
+		ret = snprintf(prev, sizeof(prev), "../pre-dump-%u", i);
+		if (ret < 0 || (size_t)ret >= sizeof(prev))
+			return false;
+		round.predump_dir = prev;
+
+		ret = criu_read_stats(dir, "dump", stats, sizeof(stats) / sizeof(stats[0]));
+		if (ret < 0) {
+			WARN("Failed to read dump statistics of pre-dump round %u", i);
+			continue;
+		}
+
+		pages = stats[CRIU_STATS_DUMP_PAGES_WRITTEN];
+		INFO("Pre-dump round %u copied %" PRIu64 " dirty pages (frozen for %" PRIu64 "us)",
+		     i, pages, stats[CRIU_STATS_DUMP_FROZEN_TIME]);
+
+		if (pages <= converge_threshold) {
+			INFO("Dirty pages converged after %u pre-dump rounds", i);
+			break;
+		}
+
+		if (pages >= last_pages) {
+			INFO("Dirty pages stopped shrinking after %u pre-dump rounds", i);
+			break;
+		}
+
+		last_pages = pages;
+	}
+
+	/* The final dump lives in opts->directory itself. */
+	round.directory = opts->directory;
+	round.predump_dir = prev + strlen("../");
+
+	if (!do_dump_round(c, "dump", &round)) {
+		ERROR("Final dump failed");
+		return false;
+	}
+
+	return true;
+}
+
 bool __criu_restore(struct lxc_container *c, struct migrate_opts *opts)
 {
 	pid_t pid;
 	int status, nread;
 	int pipefd[2];
 	char *criu_version = NULL;
+	struct timespec start, end;
+	uint64_t stats[CRIU_STATS_RESTORE_PAGES + 1];
 
 	if (geteuid()) {
 		ERROR("Must be root to restore");
 		return false;
 	}
 
+	if (opts->lazy_pages) {
+		uint64_t features = FEATURE_LAZY_PAGES;
+
+		if (!__criu_check_feature(&features)) {
+			ERROR("criu does not support lazy-pages restore on this host");
+			return false;
+		}
+	}
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+
 	if (pipe(pipefd)) {
 		ERROR("failed to create pipe");
 		return false;
@@ -1427,6 +2186,19 @@ bool __criu_restore(struct lxc_container *c, struct migrate_opts *opts)
 	 */
 	if (!WIFEXITED(status) || WEXITSTATUS(status))
 		goto err_wait;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &end);
+	opts->resume_time_us = (end.tv_sec - start.tv_sec) * 1000000 +
+			       (end.tv_nsec - start.tv_nsec) / 1000;
+
+	if (criu_read_stats(opts->directory, "restore", stats,
+			    sizeof(stats) / sizeof(stats[0])) == 0)
+		INFO("Container resumed after %" PRIu64 "us (criu restore took %" PRIu64 "us and restored %" PRIu64 " pages eagerly)",
+		     opts->resume_time_us, stats[CRIU_STATS_RESTORE_TIME],
+		     stats[CRIU_STATS_RESTORE_PAGES]);
+	else
+		INFO("Container resumed after %" PRIu64 "us", opts->resume_time_us);
+
 	return true;
 
 err_wait:
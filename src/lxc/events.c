@@ -0,0 +1,508 @@
+/* liblxcapi
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <lxc/lxccontainer.h>
+
+#include "commands.h"
+#include "config.h"
+#include "initutils.h"
+#include "list.h"
+#include "log.h"
+#include "monitor.h"
+#include "state.h"
+#include "utils.h"
+
+#ifndef HAVE_STRLCPY
+#include "include/strlcpy.h"
+#endif
+
+lxc_log_define(events, lxc);
+
+/* The cgroup2 hierarchy when the host uses the unified layout, and when it
+ * uses the hybrid layout.
+ */
+#define LXC_EVENTS_CGROUP2_ROOT "/sys/fs/cgroup"
+#define LXC_EVENTS_CGROUP2_HYBRID_ROOT "/sys/fs/cgroup/unified"
+
+enum {
+	LXC_EVENT_SOURCE_MONITOR,
+	LXC_EVENT_SOURCE_PIDFD,
+	LXC_EVENT_SOURCE_MEMORY_EVENTS,
+	LXC_EVENT_SOURCE_CGROUP_EVENTS,
+};
+
+/*
+ * A file descriptor the event stream waits on
+ * @type  : one of LXC_EVENT_SOURCE_*
+ * @fd    : the file descriptor registered with the stream's epoll instance
+ * @name  : the container the source belongs to, empty for lxc-monitord
+ * @pid   : the pid of init for pidfds
+ * @value : the last oom_kill count or populated value read from the file
+ * @msg   : message being received from lxc-monitord
+ * @msg_len : bytes of @msg received so far
+ * @node  : list entry in the stream's sources
+ */
+struct lxc_event_source {
+	int type;
+	int fd;
+	char name[NAME_MAX + 1];
+	pid_t pid;
+	uint64_t value;
+	struct lxc_msg msg;
+	size_t msg_len;
+	struct lxc_list node;
+};
+
+struct lxc_event_stream {
+	char *lxcpath;
+	int epfd;
+	struct lxc_list sources;
+};
+
+static struct lxc_event_source *lxc_event_source_add(struct lxc_event_stream *stream,
+						     int type, int fd,
+						     const char *name)
+{
+	struct epoll_event ev;
+	struct lxc_event_source *source;
+
+	source = calloc(1, sizeof(*source));
+	if (!source)
+		return NULL;
+
+	source->type = type;
+	source->fd = fd;
+	if (name)
+		(void)strlcpy(source->name, name, sizeof(source->name));
+
+	/* Changes to cgroup files are signalled with EPOLLPRI. */
+	ev.events = EPOLLIN;
+	if (type == LXC_EVENT_SOURCE_MEMORY_EVENTS ||
+	    type == LXC_EVENT_SOURCE_CGROUP_EVENTS)
+		ev.events = EPOLLPRI;
+	ev.data.ptr = source;
+	if (epoll_ctl(stream->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		SYSERROR("Failed to add file descriptor %d to event stream", fd);
+		free(source);
+		return NULL;
+	}
+
+	lxc_list_add_elem(&source->node, source);
+	lxc_list_add_tail(&stream->sources, &source->node);
+	return source;
+}
+
+static void lxc_event_source_del(struct lxc_event_stream *stream,
+				 struct lxc_event_source *source)
+{
+	epoll_ctl(stream->epfd, EPOLL_CTL_DEL, source->fd, NULL);
+	close(source->fd);
+	lxc_list_del(&source->node);
+	free(source);
+}
+
+static bool lxc_event_source_exists(struct lxc_event_stream *stream, int type,
+				    const char *name)
+{
+	struct lxc_list *it;
+
+	lxc_list_for_each(it, &stream->sources) {
+		struct lxc_event_source *source = it->elem;
+
+		if (source->type == type && !strcmp(source->name, name))
+			return true;
+	}
+
+	return false;
+}
+
+/* Read the value of @key from a flat keyed cgroup file like memory.events. */
+static int lxc_event_read_key(int fd, const char *key, uint64_t *value)
+{
+	ssize_t ret;
+	char *line, *saveptr = NULL;
+	char buf[LXC_LINELEN];
+	size_t len = strlen(key);
+
+	ret = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (ret < 0)
+		return -1;
+	buf[ret] = '\0';
+
+	for (line = strtok_r(buf, "\n", &saveptr); line;
+	     line = strtok_r(NULL, "\n", &saveptr)) {
+		if (strncmp(line, key, len) || line[len] != ' ')
+			continue;
+
+		return lxc_safe_uint64(line + len + 1, value, 10);
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+static void lxc_event_watch_init(struct lxc_event_stream *stream,
+				 const char *name)
+{
+	int fd;
+	pid_t pid;
+	struct lxc_list *it;
+	struct lxc_event_source *source;
+
+	pid = lxc_cmd_get_init_pid(name, stream->lxcpath);
+	if (pid <= 0)
+		return;
+
+	/* The pidfd of a previous init stays until its exit was read. */
+	lxc_list_for_each(it, &stream->sources) {
+		source = it->elem;
+
+		if (source->type == LXC_EVENT_SOURCE_PIDFD &&
+		    source->pid == pid && !strcmp(source->name, name))
+			return;
+	}
+
+	fd = lxc_raw_pidfd_open(pid, 0);
+	if (fd < 0) {
+		if (errno != ENOSYS)
+			SYSWARN("Failed to open pidfd for init %d of container \"%s\"",
+				pid, name);
+		return;
+	}
+
+	/* Make sure the pid wasn't recycled before we got a pidfd for it. */
+	if (lxc_cmd_get_init_pid(name, stream->lxcpath) != pid) {
+		close(fd);
+		return;
+	}
+
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+		close(fd);
+		return;
+	}
+
+	source = lxc_event_source_add(stream, LXC_EVENT_SOURCE_PIDFD, fd, name);
+	if (!source) {
+		close(fd);
+		return;
+	}
+	source->pid = pid;
+
+	TRACE("Watching init %d of container \"%s\"", pid, name);
+}
+
+static void lxc_event_watch_cgroup_file(struct lxc_event_stream *stream,
+					const char *name, int type,
+					const char *root, const char *cgroup,
+					const char *file, const char *key)
+{
+	int fd;
+	char *path;
+	uint64_t value = 0;
+	struct lxc_event_source *source;
+
+	if (lxc_event_source_exists(stream, type, name))
+		return;
+
+	path = must_make_path(root, cgroup, file, NULL);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0)
+		return;
+
+	if (lxc_event_read_key(fd, key, &value) < 0) {
+		close(fd);
+		return;
+	}
+
+	source = lxc_event_source_add(stream, type, fd, name);
+	if (!source) {
+		close(fd);
+		return;
+	}
+	source->value = value;
+}
+
+static void lxc_event_watch_cgroup(struct lxc_event_stream *stream,
+				   const char *name)
+{
+	char *cgroup;
+	const char *root;
+
+	/* On hybrid layouts the cgroup2 hierarchy has no controllers and is
+	 * looked up without one. On unified layouts it is the hierarchy of
+	 * the memory controller.
+	 */
+	root = LXC_EVENTS_CGROUP2_HYBRID_ROOT;
+	cgroup = NULL;
+	if (has_fs_type(root, CGROUP2_SUPER_MAGIC))
+		cgroup = lxc_cmd_get_cgroup_path(name, stream->lxcpath, NULL);
+
+	if (!cgroup) {
+		root = LXC_EVENTS_CGROUP2_ROOT;
+		if (!has_fs_type(root, CGROUP2_SUPER_MAGIC))
+			return;
+
+		cgroup = lxc_cmd_get_cgroup_path(name, stream->lxcpath, "memory");
+		if (!cgroup)
+			return;
+	}
+
+	lxc_event_watch_cgroup_file(stream, name, LXC_EVENT_SOURCE_CGROUP_EVENTS,
+				    root, cgroup, "cgroup.events", "populated");
+	lxc_event_watch_cgroup_file(stream, name, LXC_EVENT_SOURCE_MEMORY_EVENTS,
+				    root, cgroup, "memory.events", "oom_kill");
+	free(cgroup);
+}
+
+static void lxc_event_watch(struct lxc_event_stream *stream, const char *name)
+{
+	lxc_event_watch_init(stream, name);
+	lxc_event_watch_cgroup(stream, name);
+}
+
+static void lxc_event_unwatch(struct lxc_event_stream *stream, const char *name)
+{
+	struct lxc_list *it, *next;
+
+	lxc_list_for_each_safe(it, &stream->sources, next) {
+		struct lxc_event_source *source = it->elem;
+
+		/* The STOPPED state may be read before the pidfd signals the
+		 * exit of init. Keep it so the exit isn't lost.
+		 */
+		if (source->type == LXC_EVENT_SOURCE_MONITOR ||
+		    source->type == LXC_EVENT_SOURCE_PIDFD)
+			continue;
+
+		if (!strcmp(source->name, name))
+			lxc_event_source_del(stream, source);
+	}
+}
+
+struct lxc_event_stream *lxc_event_stream_open(const char *lxcpath)
+{
+	int fd, i, nr_names;
+	char **names = NULL;
+	struct lxc_event_stream *stream;
+
+	if (!lxcpath)
+		lxcpath = lxc_global_config_value("lxc.lxcpath");
+	if (!lxcpath)
+		return NULL;
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return NULL;
+	stream->epfd = -EBADF;
+	lxc_list_init(&stream->sources);
+
+	stream->lxcpath = strdup(lxcpath);
+	if (!stream->lxcpath)
+		goto on_error;
+
+	stream->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (stream->epfd < 0) {
+		SYSERROR("Failed to create epoll instance");
+		goto on_error;
+	}
+
+	if (lxc_monitord_spawn(lxcpath) < 0)
+		goto on_error;
+
+	fd = lxc_monitor_open(lxcpath);
+	if (fd < 0)
+		goto on_error;
+
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 ||
+	    !lxc_event_source_add(stream, LXC_EVENT_SOURCE_MONITOR, fd, NULL)) {
+		close(fd);
+		goto on_error;
+	}
+
+	/* Containers started from now on are picked up through their RUNNING
+	 * state. Containers that are already running are picked up here.
+	 */
+	nr_names = list_active_containers(lxcpath, &names, NULL);
+	for (i = 0; i < nr_names; i++) {
+		lxc_event_watch(stream, names[i]);
+		free(names[i]);
+	}
+	free(names);
+
+	return stream;
+
+on_error:
+	lxc_event_stream_close(stream);
+	return NULL;
+}
+
+int lxc_event_stream_fd(struct lxc_event_stream *stream)
+{
+	return stream->epfd;
+}
+
+static int lxc_event_monitor_read(struct lxc_event_stream *stream,
+				  struct lxc_event_source *source,
+				  struct lxc_event *event)
+{
+	ssize_t ret;
+	struct lxc_msg msg;
+
+	/* Never block the caller, the rest of a message that arrived in
+	 * pieces is picked up by a later read.
+	 */
+	ret = recv(source->fd, (char *)&source->msg + source->msg_len,
+		   sizeof(source->msg) - source->msg_len, MSG_DONTWAIT);
+	if (ret <= 0) {
+		if (ret < 0 && (errno == EINTR || errno == EAGAIN ||
+				errno == EWOULDBLOCK))
+			return 0;
+
+		ERROR("Lost connection to lxc-monitord for \"%s\"", stream->lxcpath);
+		lxc_event_source_del(stream, source);
+		errno = ECONNRESET;
+		return -1;
+	}
+
+	source->msg_len += ret;
+	if (source->msg_len < sizeof(source->msg))
+		return 0;
+
+	msg = source->msg;
+	source->msg_len = 0;
+	msg.name[NAME_MAX] = '\0';
+
+	switch (msg.type) {
+	case lxc_msg_state:
+		event->type = LXC_EVENT_STATE;
+		if (msg.value == RUNNING)
+			lxc_event_watch(stream, msg.name);
+		else if (msg.value == STOPPED)
+			lxc_event_unwatch(stream, msg.name);
+		break;
+	case lxc_msg_exit_code:
+		event->type = LXC_EVENT_EXIT_CODE;
+		break;
+	default:
+		return 0;
+	}
+
+	(void)strlcpy(event->name, msg.name, sizeof(event->name));
+	event->value = msg.value;
+	return 1;
+}
+
+static int lxc_event_cgroup_read(struct lxc_event_stream *stream,
+				 struct lxc_event_source *source,
+				 struct lxc_event *event)
+{
+	uint64_t value;
+	bool oom = source->type == LXC_EVENT_SOURCE_MEMORY_EVENTS;
+
+	/* Reading the file also rearms the notification. */
+	if (lxc_event_read_key(source->fd, oom ? "oom_kill" : "populated", &value) < 0) {
+		/* The cgroup is gone. */
+		lxc_event_source_del(stream, source);
+		return 0;
+	}
+
+	if (value == source->value)
+		return 0;
+
+	if (oom) {
+		event->type = LXC_EVENT_OOM;
+		event->value = value > source->value ? value - source->value : value;
+	} else {
+		event->type = LXC_EVENT_CGROUP;
+		event->value = value ? 1 : 0;
+	}
+	(void)strlcpy(event->name, source->name, sizeof(event->name));
+	source->value = value;
+
+	return 1;
+}
+
+int lxc_event_stream_read(struct lxc_event_stream *stream,
+			  struct lxc_event *event)
+{
+	for (;;) {
+		int nfds, ret = 0;
+		struct epoll_event ev;
+		struct lxc_event_source *source;
+
+		nfds = epoll_wait(stream->epfd, &ev, 1, 0);
+		if (nfds < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (nfds == 0)
+			return 0;
+
+		source = ev.data.ptr;
+		switch (source->type) {
+		case LXC_EVENT_SOURCE_MONITOR:
+			ret = lxc_event_monitor_read(stream, source, event);
+			break;
+		case LXC_EVENT_SOURCE_PIDFD:
+			event->type = LXC_EVENT_INIT_EXITED;
+			event->value = source->pid;
+			(void)strlcpy(event->name, source->name, sizeof(event->name));
+			lxc_event_source_del(stream, source);
+			ret = 1;
+			break;
+		case LXC_EVENT_SOURCE_MEMORY_EVENTS:
+		case LXC_EVENT_SOURCE_CGROUP_EVENTS:
+			ret = lxc_event_cgroup_read(stream, source, event);
+			break;
+		}
+
+		if (ret != 0)
+			return ret;
+	}
+}
+
+void lxc_event_stream_close(struct lxc_event_stream *stream)
+{
+	struct lxc_list *it, *next;
+
+	if (!stream)
+		return;
+
+	lxc_list_for_each_safe(it, &stream->sources, next)
+		lxc_event_source_del(stream, it->elem);
+
+	if (stream->epfd >= 0)
+		close(stream->epfd);
+	free(stream->lxcpath);
+	free(stream);
+}
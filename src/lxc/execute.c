@@ -115,6 +115,8 @@ static int execute_start(struct lxc_handler *handler, void* data)
 
 	NOTICE("Exec'ing \"%s\"", my_args->argv[0]);
 
+	lxc_log_flush();
+
 	if (my_args->init_fd >= 0)
 #ifdef __NR_execveat
 		syscall(__NR_execveat, my_args->init_fd, "", argv, environ, AT_EMPTY_PATH);
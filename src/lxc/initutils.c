@@ -65,6 +65,7 @@ const char *lxc_global_config_value(const char *option_name)
 		{ "lxc.default_config",     NULL            },
 		{ "lxc.cgroup.pattern",     NULL            },
 		{ "lxc.cgroup.use",         NULL            },
+		{ "lxc.lock.timeout",       "0"             },
 		{ NULL, NULL },
 	};
 
@@ -23,6 +23,7 @@
 
 #define _GNU_SOURCE
 #define __STDC_FORMAT_MACROS /* Required for PRIu64 to work. */
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
@@ -43,6 +44,7 @@
 
 #include "log.h"
 #include "caps.h"
+#include "namespace.h"
 #include "utils.h"
 #include "lxccontainer.h"
 
@@ -57,6 +59,7 @@
 #define LXC_LOG_TIME_SIZE ((LXC_NUMSTRLEN64)*2)
 
 int lxc_log_fd = -1;
+static enum lxc_log_format log_format = LXC_LOG_FORMAT_TEXT;
 static int syslog_enable = 0;
 int lxc_quiet_specified;
 int lxc_log_use_global_fd;
@@ -285,12 +288,8 @@ int lxc_unix_epoch_to_utc(char *buf, size_t bufsize, const struct timespec *time
  * themselves. Our logging is mostly done for debugging purposes so don't try
  * to make it pretty. Pretty might cost you thread-safety.
  */
-static int log_append_logfile(const struct lxc_log_appender *appender,
-			      struct lxc_log_event *event)
+static int log_get_fd(const char **container_name)
 {
-	char buffer[LXC_LOG_BUFFER_SIZE];
-	char date_time[LXC_LOG_TIME_SIZE];
-	int n, ret;
 	int fd_to_use = -1;
 	const char *log_container_name = log_vmname;
 
@@ -307,6 +306,22 @@ static int log_append_logfile(const struct lxc_log_appender *appender,
 	if (fd_to_use == -1)
 		fd_to_use = lxc_log_fd;
 
+	if (container_name)
+		*container_name = log_container_name;
+
+	return fd_to_use;
+}
+
+static int log_append_logfile(const struct lxc_log_appender *appender,
+			      struct lxc_log_event *event)
+{
+	char buffer[LXC_LOG_BUFFER_SIZE];
+	char date_time[LXC_LOG_TIME_SIZE];
+	int n, ret;
+	int fd_to_use;
+	const char *log_container_name;
+
+	fd_to_use = log_get_fd(&log_container_name);
 	if (fd_to_use == -1)
 		return 0;
 
@@ -343,6 +358,658 @@ static int log_append_logfile(const struct lxc_log_appender *appender,
 	return write(fd_to_use, buffer, n + 1);
 }
 
+#ifndef NO_LXC_CONF
+/* The binary appender avoids formatting log messages and converting
+ * timestamps on the hot path. Events are serialized into compact records
+ * referring to category and location ids. The record for an id is emitted
+ * into the stream the first time it is used. Records are collected in one
+ * half of a double buffer while a background thread writes out the other
+ * half. Only the process that selected the binary format does so, processes
+ * forked from it write their records right away. Use lxc-log-decode to turn a
+ * binary log into text.
+ */
+struct log_binary_entry {
+	const void *key1;
+	const void *key2;
+	int line;
+	uint32_t id;
+	uint64_t generation;
+};
+
+struct log_binary_table {
+	struct log_binary_entry *entries;
+	size_t size;
+	size_t used;
+};
+
+static struct log_binary_state {
+	pid_t pid;
+	/* the process that selected the binary format */
+	pid_t owner;
+	/* protects everything but writing to the log fd */
+	pthread_mutex_t lock;
+	/* serializes writes to the log fd so chunks stay ordered */
+	pthread_mutex_t write_lock;
+	pthread_cond_t cond;
+	bool flusher;
+	int fd;
+	/* bumped whenever definitions need to be emitted again */
+	uint64_t generation;
+	int active;
+	char *buf[2];
+	size_t len[2];
+	uint32_t next_id;
+	struct log_binary_table categories;
+	struct log_binary_table locations;
+} log_binary = {
+	.pid		= -1,
+	.owner		= -1,
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.write_lock	= PTHREAD_MUTEX_INITIALIZER,
+	.cond		= PTHREAD_COND_INITIALIZER,
+	.fd		= -1,
+	.generation	= 1,
+};
+
+static pthread_once_t log_binary_atexit_once = PTHREAD_ONCE_INIT;
+
+static inline void log_binary_put(char *buf, size_t *off, const void *data,
+				  size_t len)
+{
+	memcpy(buf + *off, data, len);
+	*off += len;
+}
+
+static inline void log_binary_put_u32(char *buf, size_t *off, uint32_t v)
+{
+	log_binary_put(buf, off, &v, sizeof(v));
+}
+
+static inline void log_binary_put_string(char *buf, size_t *off,
+					 const char *str, size_t len)
+{
+	log_binary_put_u32(buf, off, len);
+	log_binary_put(buf, off, str, len);
+}
+
+static inline size_t log_binary_string_size(const char *str)
+{
+	return sizeof(uint32_t) + (str ? strlen(str) : 0);
+}
+
+static void log_binary_put_record(char *buf, size_t *off, uint16_t type,
+				  uint32_t len)
+{
+	struct lxc_log_binary_record rec = {
+		.magic		= LXC_LOG_BINARY_MAGIC,
+		.version	= LXC_LOG_BINARY_VERSION,
+		.type		= type,
+		.len		= len,
+	};
+
+	log_binary_put(buf, off, &rec, sizeof(rec));
+}
+
+enum {
+	LOG_BINARY_LEN_NONE,
+	LOG_BINARY_LEN_HH,
+	LOG_BINARY_LEN_H,
+	LOG_BINARY_LEN_L,
+	LOG_BINARY_LEN_LL,
+	LOG_BINARY_LEN_J,
+	LOG_BINARY_LEN_Z,
+	LOG_BINARY_LEN_T,
+	LOG_BINARY_LEN_LD,
+};
+
+/* Serialize the arguments consumed by @fmt. Returns the number of bytes
+ * written to @buf. Stops early if @buf is full or @fmt contains a conversion
+ * we don't know about. The decoder will print the remainder of the format
+ * string verbatim in that case.
+ */
+static size_t log_binary_encode_args(char *buf, size_t size, const char *fmt,
+				     va_list *vap)
+{
+	const char *p;
+	size_t off = 0;
+
+	for (p = fmt; *p; p++) {
+		int len = LOG_BINARY_LEN_NONE;
+		uint64_t v;
+		double d;
+		const char *str;
+		size_t slen;
+
+		if (*p != '%')
+			continue;
+
+		p++;
+		if (*p == '%')
+			continue;
+
+		while (*p && strchr("#0- +'I", *p))
+			p++;
+
+		if (*p == '*') {
+			if (off + sizeof(v) > size)
+				return off;
+
+			v = (uint64_t)(int64_t)va_arg(*vap, int);
+			log_binary_put(buf, &off, &v, sizeof(v));
+			p++;
+		} else {
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				if (off + sizeof(v) > size)
+					return off;
+
+				v = (uint64_t)(int64_t)va_arg(*vap, int);
+				log_binary_put(buf, &off, &v, sizeof(v));
+				p++;
+			} else {
+				while (*p >= '0' && *p <= '9')
+					p++;
+			}
+		}
+
+		switch (*p) {
+		case 'h':
+			len = LOG_BINARY_LEN_H;
+			if (*(p + 1) == 'h') {
+				len = LOG_BINARY_LEN_HH;
+				p++;
+			}
+			p++;
+			break;
+		case 'l':
+			len = LOG_BINARY_LEN_L;
+			if (*(p + 1) == 'l') {
+				len = LOG_BINARY_LEN_LL;
+				p++;
+			}
+			p++;
+			break;
+		case 'q':
+			len = LOG_BINARY_LEN_LL;
+			p++;
+			break;
+		case 'j':
+			len = LOG_BINARY_LEN_J;
+			p++;
+			break;
+		case 'z':
+			len = LOG_BINARY_LEN_Z;
+			p++;
+			break;
+		case 't':
+			len = LOG_BINARY_LEN_T;
+			p++;
+			break;
+		case 'L':
+			len = LOG_BINARY_LEN_LD;
+			p++;
+			break;
+		}
+
+		switch (*p) {
+		case 'd':
+		case 'i':
+			if (len == LOG_BINARY_LEN_L)
+				v = (int64_t)va_arg(*vap, long);
+			else if (len == LOG_BINARY_LEN_LL)
+				v = (int64_t)va_arg(*vap, long long);
+			else if (len == LOG_BINARY_LEN_J)
+				v = (int64_t)va_arg(*vap, intmax_t);
+			else if (len == LOG_BINARY_LEN_Z)
+				v = (int64_t)va_arg(*vap, ssize_t);
+			else if (len == LOG_BINARY_LEN_T)
+				v = (int64_t)va_arg(*vap, ptrdiff_t);
+			else if (len == LOG_BINARY_LEN_HH)
+				v = (int64_t)(signed char)va_arg(*vap, int);
+			else if (len == LOG_BINARY_LEN_H)
+				v = (int64_t)(short)va_arg(*vap, int);
+			else
+				v = (int64_t)va_arg(*vap, int);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			if (len == LOG_BINARY_LEN_L)
+				v = va_arg(*vap, unsigned long);
+			else if (len == LOG_BINARY_LEN_LL)
+				v = va_arg(*vap, unsigned long long);
+			else if (len == LOG_BINARY_LEN_J)
+				v = va_arg(*vap, uintmax_t);
+			else if (len == LOG_BINARY_LEN_Z)
+				v = va_arg(*vap, size_t);
+			else if (len == LOG_BINARY_LEN_T)
+				v = (uint64_t)va_arg(*vap, ptrdiff_t);
+			else if (len == LOG_BINARY_LEN_HH)
+				v = (unsigned char)va_arg(*vap, unsigned int);
+			else if (len == LOG_BINARY_LEN_H)
+				v = (unsigned short)va_arg(*vap, unsigned int);
+			else
+				v = va_arg(*vap, unsigned int);
+			break;
+		case 'c':
+			v = (uint64_t)(int64_t)va_arg(*vap, int);
+			break;
+		case 'p':
+			v = (uintptr_t)va_arg(*vap, void *);
+			break;
+		case 'n':
+			/* Never let a log message write to memory. */
+			(void)va_arg(*vap, void *);
+			continue;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (len == LOG_BINARY_LEN_LD)
+				d = (double)va_arg(*vap, long double);
+			else
+				d = va_arg(*vap, double);
+			memcpy(&v, &d, sizeof(v));
+			break;
+		case 's':
+		case 'm':
+			if (off + sizeof(uint32_t) > size)
+				return off;
+
+			if (*p == 'm') {
+				lxc_log_strerror_r;
+
+				slen = strlen(ptr);
+				if (slen > size - off - sizeof(uint32_t))
+					slen = size - off - sizeof(uint32_t);
+				log_binary_put_string(buf, &off, ptr, slen);
+				continue;
+			}
+
+			str = va_arg(*vap, const char *);
+			if (!str)
+				str = "(null)";
+
+			slen = strlen(str);
+			if (slen > size - off - sizeof(uint32_t))
+				slen = size - off - sizeof(uint32_t);
+			log_binary_put_string(buf, &off, str, slen);
+			continue;
+		default:
+			return off;
+		}
+
+		if (off + sizeof(v) > size)
+			return off;
+
+		log_binary_put(buf, &off, &v, sizeof(v));
+	}
+
+	return off;
+}
+
+static uint64_t log_binary_hash(const void *key1, const void *key2, int line)
+{
+	uint64_t h = (uintptr_t)key1 * 0x9e3779b97f4a7c15ULL;
+
+	h ^= (uintptr_t)key2 + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= (uint64_t)line + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	return h;
+}
+
+/* Open addressing hash table mapping string literal addresses to ids. The
+ * keys are never freed so no deletion is needed.
+ */
+static struct log_binary_entry *log_binary_lookup(struct log_binary_table *t,
+						  const void *key1,
+						  const void *key2, int line)
+{
+	size_t i, mask;
+	struct log_binary_entry *e;
+
+	if (t->used * 2 >= t->size) {
+		struct log_binary_table n;
+		size_t j;
+
+		n.size = t->size ? t->size * 2 : 256;
+		n.used = 0;
+		n.entries = calloc(n.size, sizeof(*n.entries));
+		if (!n.entries)
+			return NULL;
+
+		for (j = 0; j < t->size; j++) {
+			e = &t->entries[j];
+			if (!e->id)
+				continue;
+
+			mask = n.size - 1;
+			i = log_binary_hash(e->key1, e->key2, e->line) & mask;
+			while (n.entries[i].id)
+				i = (i + 1) & mask;
+			n.entries[i] = *e;
+			n.used++;
+		}
+
+		free(t->entries);
+		*t = n;
+	}
+
+	mask = t->size - 1;
+	i = log_binary_hash(key1, key2, line) & mask;
+	for (;;) {
+		e = &t->entries[i];
+		if (!e->id)
+			break;
+
+		if (e->key1 == key1 && e->key2 == key2 && e->line == line)
+			return e;
+
+		i = (i + 1) & mask;
+	}
+
+	e->key1 = key1;
+	e->key2 = key2;
+	e->line = line;
+	e->id = ++log_binary.next_id;
+	e->generation = 0;
+	t->used++;
+	return e;
+}
+
+/* Must be called with log_binary.lock held. */
+static void log_binary_flush_locked(void)
+{
+	int idx = log_binary.active;
+
+	if (!log_binary.len[idx])
+		return;
+
+	pthread_mutex_lock(&log_binary.write_lock);
+	if (log_binary.fd >= 0)
+		(void)lxc_write_nointr(log_binary.fd, log_binary.buf[idx],
+				       log_binary.len[idx]);
+	pthread_mutex_unlock(&log_binary.write_lock);
+	log_binary.len[idx] = 0;
+}
+
+static void *log_binary_flusher(void *data)
+{
+	pid_t pid = (pid_t)(intptr_t)data;
+
+	pthread_mutex_lock(&log_binary.lock);
+	while (log_binary.pid == pid) {
+		struct timespec deadline;
+		int idx, fd;
+		size_t len;
+
+		(void)clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += LXC_LOG_BINARY_FLUSH_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		(void)pthread_cond_timedwait(&log_binary.cond, &log_binary.lock,
+					     &deadline);
+
+		idx = log_binary.active;
+		len = log_binary.len[idx];
+		fd = log_binary.fd;
+		if (!len)
+			continue;
+
+		/* Switch halves so writers can continue while we write. */
+		log_binary.active = !idx;
+		log_binary.len[!idx] = 0;
+		pthread_mutex_lock(&log_binary.write_lock);
+		pthread_mutex_unlock(&log_binary.lock);
+
+		if (fd >= 0)
+			(void)lxc_write_nointr(fd, log_binary.buf[idx], len);
+
+		pthread_mutex_unlock(&log_binary.write_lock);
+		pthread_mutex_lock(&log_binary.lock);
+	}
+	pthread_mutex_unlock(&log_binary.lock);
+
+	return NULL;
+}
+
+static void log_binary_atexit(void)
+{
+	lxc_log_flush();
+}
+
+static void log_binary_register_atexit(void)
+{
+	(void)atexit(log_binary_atexit);
+}
+
+/* Must be called with log_binary.lock held. */
+static void log_binary_start_flusher(void)
+{
+	int ret;
+	pthread_t thread;
+	pthread_attr_t attr;
+	sigset_t mask, oldmask;
+
+	/* Don't try again if we failed before. */
+	log_binary.flusher = true;
+
+	ret = pthread_attr_init(&attr);
+	if (ret)
+		return;
+
+	(void)pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	/* The flusher must never handle signals meant for the caller. */
+	sigfillset(&mask);
+	(void)pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+	ret = pthread_create(&thread, &attr, log_binary_flusher,
+			     (void *)(intptr_t)log_binary.pid);
+	(void)pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+	pthread_attr_destroy(&attr);
+	if (ret)
+		return;
+
+	(void)pthread_once(&log_binary_atexit_once, log_binary_register_atexit);
+}
+
+/* Records buffered by our parent will be written by our parent. A child
+ * created via fork() or clone() only inherits the memory of the thread that
+ * created it so reset all state.
+ */
+static void log_binary_check_pid(void)
+{
+	pid_t pid = lxc_raw_getpid();
+
+	if (log_binary.pid == pid)
+		return;
+
+	if (log_binary.pid != -1) {
+		pthread_mutex_init(&log_binary.lock, NULL);
+		pthread_mutex_init(&log_binary.write_lock, NULL);
+		pthread_cond_init(&log_binary.cond, NULL);
+		log_binary.len[0] = 0;
+		log_binary.len[1] = 0;
+		log_binary.flusher = false;
+		log_binary.generation++;
+	}
+
+	log_binary.pid = pid;
+}
+
+static int log_append_binary(const struct lxc_log_appender *appender,
+			     struct lxc_log_event *event)
+{
+	int idx, fd_to_use;
+	size_t args_len, needed, off;
+	struct log_binary_entry *cat, *loc;
+	struct lxc_log_binary_event ev;
+	const char *log_container_name;
+	char args[LXC_LOG_BUFFER_SIZE];
+
+	fd_to_use = log_get_fd(&log_container_name);
+	if (fd_to_use == -1)
+		return 0;
+
+	args_len = log_binary_encode_args(args, sizeof(args), event->fmt,
+					  event->vap);
+
+	log_binary_check_pid();
+
+	pthread_mutex_lock(&log_binary.lock);
+	if (!log_binary.buf[0]) {
+		log_binary.buf[0] = malloc(LXC_LOG_BINARY_BUFFER_SIZE);
+		log_binary.buf[1] = malloc(LXC_LOG_BINARY_BUFFER_SIZE);
+		if (!log_binary.buf[0] || !log_binary.buf[1]) {
+			free(log_binary.buf[0]);
+			free(log_binary.buf[1]);
+			log_binary.buf[0] = NULL;
+			log_binary.buf[1] = NULL;
+			goto on_error;
+		}
+	}
+
+	if (log_binary.fd != fd_to_use) {
+		log_binary_flush_locked();
+		log_binary.fd = fd_to_use;
+		log_binary.generation++;
+	}
+
+	cat = log_binary_lookup(&log_binary.categories, event->category, NULL, 0);
+	if (!cat)
+		goto on_error;
+
+	loc = log_binary_lookup(&log_binary.locations, event->locinfo->file,
+				event->fmt, event->locinfo->line);
+	if (!loc)
+		goto on_error;
+
+	for (;;) {
+		idx = log_binary.active;
+
+		needed = sizeof(struct lxc_log_binary_record) + sizeof(ev) + args_len;
+		if (!log_binary.len[idx])
+			needed += sizeof(struct lxc_log_binary_record) +
+				  sizeof(uint32_t) +
+				  log_binary_string_size(log_prefix) +
+				  log_binary_string_size(log_container_name);
+
+		if (cat->generation != log_binary.generation)
+			needed += sizeof(struct lxc_log_binary_record) +
+				  sizeof(uint32_t) +
+				  log_binary_string_size(event->category);
+
+		if (loc->generation != log_binary.generation)
+			needed += sizeof(struct lxc_log_binary_record) +
+				  2 * sizeof(uint32_t) +
+				  log_binary_string_size(event->locinfo->file) +
+				  log_binary_string_size(event->locinfo->func) +
+				  log_binary_string_size(event->fmt);
+
+		if (needed > LXC_LOG_BINARY_BUFFER_SIZE)
+			goto on_error;
+
+		if (log_binary.len[idx] + needed <= LXC_LOG_BINARY_BUFFER_SIZE)
+			break;
+
+		log_binary_flush_locked();
+	}
+
+	off = log_binary.len[idx];
+	if (!off) {
+		size_t plen = strlen(log_prefix);
+		size_t nlen = log_container_name ? strlen(log_container_name) : 0;
+
+		log_binary_put_record(log_binary.buf[idx], &off,
+				      LXC_LOG_BINARY_STREAM,
+				      3 * sizeof(uint32_t) + plen + nlen);
+		log_binary_put_u32(log_binary.buf[idx], &off, log_binary.pid);
+		log_binary_put_string(log_binary.buf[idx], &off, log_prefix, plen);
+		log_binary_put_string(log_binary.buf[idx], &off,
+				      log_container_name, nlen);
+	}
+
+	if (cat->generation != log_binary.generation) {
+		size_t clen = strlen(event->category);
+
+		log_binary_put_record(log_binary.buf[idx], &off,
+				      LXC_LOG_BINARY_CATEGORY,
+				      2 * sizeof(uint32_t) + clen);
+		log_binary_put_u32(log_binary.buf[idx], &off, cat->id);
+		log_binary_put_string(log_binary.buf[idx], &off,
+				      event->category, clen);
+		cat->generation = log_binary.generation;
+	}
+
+	if (loc->generation != log_binary.generation) {
+		size_t flen = strlen(event->locinfo->file);
+		size_t fnlen = strlen(event->locinfo->func);
+		size_t fmtlen = strlen(event->fmt);
+
+		log_binary_put_record(log_binary.buf[idx], &off,
+				      LXC_LOG_BINARY_LOCATION,
+				      5 * sizeof(uint32_t) + flen + fnlen + fmtlen);
+		log_binary_put_u32(log_binary.buf[idx], &off, loc->id);
+		log_binary_put_u32(log_binary.buf[idx], &off, event->locinfo->line);
+		log_binary_put_string(log_binary.buf[idx], &off,
+				      event->locinfo->file, flen);
+		log_binary_put_string(log_binary.buf[idx], &off,
+				      event->locinfo->func, fnlen);
+		log_binary_put_string(log_binary.buf[idx], &off, event->fmt, fmtlen);
+		loc->generation = log_binary.generation;
+	}
+
+	ev.sec = event->timestamp.tv_sec;
+	ev.nsec = event->timestamp.tv_nsec;
+	ev.priority = event->priority;
+	ev.category = cat->id;
+	ev.location = loc->id;
+	log_binary_put_record(log_binary.buf[idx], &off, LXC_LOG_BINARY_EVENT,
+			      sizeof(ev) + args_len);
+	log_binary_put(log_binary.buf[idx], &off, &ev, sizeof(ev));
+	log_binary_put(log_binary.buf[idx], &off, args, args_len);
+	log_binary.len[idx] = off;
+
+	/* Forked children must stay single-threaded since they might still
+	 * setns() or unshare() and they usually leave via _exit() without
+	 * flushing. Errors are rare and likely followed by the process going
+	 * away. Don't keep either buffered.
+	 */
+	if (log_binary.pid != log_binary.owner ||
+	    event->priority >= LXC_LOG_LEVEL_ERROR) {
+		log_binary_flush_locked();
+		goto on_error;
+	}
+
+	if (!log_binary.flusher)
+		log_binary_start_flusher();
+
+	if (off >= LXC_LOG_BINARY_BUFFER_SIZE / 2)
+		pthread_cond_signal(&log_binary.cond);
+
+on_error:
+	pthread_mutex_unlock(&log_binary.lock);
+	return 0;
+}
+
+static struct lxc_log_appender log_appender_binary = {
+	.name		= "binary",
+	.append		= log_append_binary,
+	.next		= NULL,
+};
+#endif
+
 static struct lxc_log_appender log_appender_syslog = {
 	.name		= "syslog",
 	.append		= log_append_syslog,
@@ -490,6 +1157,7 @@ static char *build_log_path(const char *name, const char *lxcpath)
 
 extern void lxc_log_close(void)
 {
+	lxc_log_flush();
 	closelog();
 
 	free(log_vmname);
@@ -707,6 +1375,7 @@ extern bool lxc_log_has_valid_level(void)
 extern int lxc_log_set_file(int *fd, const char *fname)
 {
 	if (*fd != -1) {
+		lxc_log_flush();
 		close(*fd);
 		*fd = -1;
 	}
@@ -744,3 +1413,70 @@ extern void lxc_log_options_no_override()
 	lxc_quiet_specified = 1;
 	lxc_loglevel_specified = 1;
 }
+
+/*
+ * This is called when we read a lxc.log.format entry in a lxc.conf file. Like
+ * lxc.log.syslog it changes the appenders used by the whole process.
+ */
+extern int lxc_log_set_format(enum lxc_log_format format)
+{
+#ifndef NO_LXC_CONF
+	struct lxc_log_appender **it, *from, *to;
+
+	if (format == LXC_LOG_FORMAT_TEXT) {
+		from = &log_appender_binary;
+		to = &log_appender_logfile;
+	} else if (format == LXC_LOG_FORMAT_BINARY) {
+		from = &log_appender_logfile;
+		to = &log_appender_binary;
+	} else {
+		return -EINVAL;
+	}
+
+	if (log_format == format)
+		return 0;
+
+	lxc_log_flush();
+
+	if (format == LXC_LOG_FORMAT_BINARY)
+		log_binary.owner = lxc_raw_getpid();
+
+	for (it = &lxc_log_category_lxc.appender; *it; it = &(*it)->next) {
+		if (*it != from)
+			continue;
+
+		to->next = from->next;
+		from->next = NULL;
+		*it = to;
+		break;
+	}
+
+	log_format = format;
+	return 0;
+#else
+	if (format != LXC_LOG_FORMAT_TEXT)
+		return -EOPNOTSUPP;
+
+	return 0;
+#endif
+}
+
+extern enum lxc_log_format lxc_log_get_format(void)
+{
+	return log_format;
+}
+
+/* Write out all buffered binary log records of the calling process. Must be
+ * called before exec()ing since buffered records would be lost otherwise.
+ */
+extern void lxc_log_flush(void)
+{
+#ifndef NO_LXC_CONF
+	if (log_binary.pid != lxc_raw_getpid())
+		return;
+
+	pthread_mutex_lock(&log_binary.lock);
+	log_binary_flush_locked();
+	pthread_mutex_unlock(&log_binary.lock);
+#endif
+}
@@ -28,6 +28,7 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/time.h>
 #include <string.h>
@@ -49,6 +50,12 @@
 #define LXC_LOG_PREFIX_SIZE	32
 #define LXC_LOG_BUFFER_SIZE	4096
 
+/* Size of each of the two halves of the per-process binary log buffer and the
+ * interval after which the background thread flushes pending records.
+ */
+#define LXC_LOG_BINARY_BUFFER_SIZE	65536
+#define LXC_LOG_BINARY_FLUSH_MS		100
+
 /* This attribute is required to silence clang warnings */
 #if defined(__GNUC__)
 #define ATTR_UNUSED __attribute__ ((unused))
@@ -90,6 +97,58 @@ struct lxc_log_event {
 	va_list *vap;
 };
 
+/* on-disk log formats */
+enum lxc_log_format {
+	LXC_LOG_FORMAT_TEXT,
+	LXC_LOG_FORMAT_BINARY,
+};
+
+/*
+ * Binary log format
+ *
+ * A binary log is a stream of records. Every record starts with a struct
+ * lxc_log_binary_record followed by @len bytes of payload. Strings in
+ * payloads are encoded as a uint32_t length followed by the (unterminated)
+ * string.
+ *
+ * Each chunk flushed by a process starts with a LXC_LOG_BINARY_STREAM record
+ * identifying the writer. Category and location definitions are only valid
+ * for the stream of the process that emitted them:
+ *
+ * LXC_LOG_BINARY_STREAM:   uint32_t pid, string prefix, string name
+ * LXC_LOG_BINARY_CATEGORY: uint32_t id, string name
+ * LXC_LOG_BINARY_LOCATION: uint32_t id, uint32_t line, string file,
+ *                          string func, string fmt
+ * LXC_LOG_BINARY_EVENT:    struct lxc_log_binary_event followed by the
+ *                          arguments of fmt. Integer, pointer and floating
+ *                          point arguments are stored as 8 bytes, strings as
+ *                          described above.
+ */
+#define LXC_LOG_BINARY_MAGIC	0x4c58424cU /* "LBXL" */
+#define LXC_LOG_BINARY_VERSION	1
+
+enum lxc_log_binary_record_type {
+	LXC_LOG_BINARY_STREAM   = 1,
+	LXC_LOG_BINARY_CATEGORY = 2,
+	LXC_LOG_BINARY_LOCATION = 3,
+	LXC_LOG_BINARY_EVENT    = 4,
+};
+
+struct lxc_log_binary_record {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;
+	uint32_t len;
+} __attribute__((packed));
+
+struct lxc_log_binary_event {
+	int64_t sec;
+	uint32_t nsec;
+	uint32_t priority;
+	uint32_t category;
+	uint32_t location;
+} __attribute__((packed));
+
 /* log appender object */
 struct lxc_log_appender {
 	const char *name;
@@ -441,4 +500,9 @@ extern int lxc_log_get_level(void);
 extern bool lxc_log_has_valid_level(void);
 extern const char *lxc_log_get_prefix(void);
 extern void lxc_log_options_no_override();
+extern int lxc_log_set_format(enum lxc_log_format format);
+extern enum lxc_log_format lxc_log_get_format(void);
+extern void lxc_log_flush(void);
+extern int lxc_unix_epoch_to_utc(char *buf, size_t bufsize,
+				 const struct timespec *time);
 #endif
@@ -24,7 +24,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <inttypes.h>
 #include <libgen.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stdarg.h>
@@ -115,6 +117,8 @@ static bool container_destroy(struct lxc_container *c,
 static bool get_snappath_dir(struct lxc_container *c, char *snappath);
 static bool lxcapi_snapshot_destroy_all(struct lxc_container *c);
 static bool do_lxcapi_save_config(struct lxc_container *c, const char *alt_file);
+static bool get_pool_dir(struct lxc_container *c, char *poolpath);
+static bool clone_pool_drain(struct lxc_container *c, bool remove);
 
 static bool config_file_exists(const char *lxcpath, const char *cname)
 {
@@ -238,7 +242,12 @@ static void remove_partial(struct lxc_container *c, int fd)
  * 2. container_disk_lock(c) protects the on-disk container data - in particular the
  *    container configuration file.
  *    The container_disk_lock also takes the container_mem_lock.
- * 3. thread_mutex protects process data (ex: fd table) from multiple threads.
+ *    Paths that only read the on-disk data take container_disk_rdlock(c)
+ *    instead, which other readers can hold at the same time.
+ * 3. There is no process-wide API lock. Process data shared between threads
+ *    gets its own narrow lock (ex: the lxc_ttys list in terminal.c) or is kept
+ *    thread-local (ex: the current config and global config values), so
+ *    threads working on unrelated containers never serialize on each other.
  * NOTHING mutexes two independent programs with their own struct
  * lxc_container for the same c->name, between API calls.  For instance,
  * c->config_read(); c->start();  Between those calls, data on disk
@@ -623,7 +632,7 @@ static bool do_lxcapi_load_config(struct lxc_container *c, const char *alt_file)
 		need_disklock = true;
 
 	if (need_disklock)
-		lret = container_disk_lock(c);
+		lret = container_disk_rdlock(c);
 	else
 		lret = container_mem_lock(c);
 	if (lret)
@@ -876,6 +885,12 @@ static bool do_lxcapi_start(struct lxc_container *c, int useinit, char * const a
 		return false;
 	}
 
+	/* Pooled snapshots would miss what the container changes on its
+	 * rootfs.
+	 */
+	if (!clone_pool_drain(c, false))
+		WARN("Failed to empty the clone pool of \"%s\"", c->name);
+
 	if (container_mem_lock(c))
 		return false;
 
@@ -1227,6 +1242,28 @@ static bool create_container_dir(struct lxc_container *c)
 	return ret == 0;
 }
 
+/* Record the filesystem type of block based root filesystems in
+ * lxc.rootfs.fstype so that starting the container can mount it right away.
+ */
+static void set_rootfs_fstype(struct lxc_conf *conf, struct lxc_storage *bdev)
+{
+	int ret;
+	char fstype[100];
+
+	clear_unexp_config_line(conf, "lxc.rootfs.fstype", false);
+	free(conf->rootfs.fstype);
+	conf->rootfs.fstype = NULL;
+
+	ret = probe_fstype(lxc_storage_get_path(bdev->src, bdev->type), fstype,
+			   sizeof(fstype));
+	if (ret < 0)
+		return;
+
+	ret = lxc_set_config_item_locked(conf, "lxc.rootfs.fstype", fstype);
+	if (ret < 0)
+		WARN("Failed to set \"lxc.rootfs.fstype = %s\"", fstype);
+}
+
 /* do_storage_create: thin wrapper around storage_create(). Like
  * storage_create(), it returns a mounted bdev on success, NULL on error.
  */
@@ -1266,6 +1303,8 @@ static struct lxc_storage *do_storage_create(struct lxc_container *c,
 		return NULL;
 	}
 
+	set_rootfs_fstype(c->lxc_conf, bdev);
+
 	/* If we are not root, chown the rootfs dir to root in the target user
 	 * namespace.
 	 */
@@ -2765,13 +2804,19 @@ out:
 	fclose(f);
 }
 
+/* Check whether containers other than the ones in the clone pool, which go
+ * away together with the container, are based on the rootfs of @c.
+ */
 static bool has_fs_snapshots(struct lxc_container *c)
 {
 	FILE *f;
-	char path[MAXPATHLEN];
+	char path[MAXPATHLEN], poolpath[MAXPATHLEN];
 	int ret, v;
 	struct stat fbuf;
 	bool bret = false;
+	char *line = NULL;
+	size_t sz = 0;
+	unsigned int n = 0;
 
 	ret = snprintf(path, MAXPATHLEN, "%s/%s/lxc_snapshots", c->config_path,
 			c->name);
@@ -2786,10 +2831,28 @@ static bool has_fs_snapshots(struct lxc_container *c)
 		if (!f)
 			goto out;
 		ret = fscanf(f, "%d", &v);
-		fclose(f);
 		/* TODO: Figure out what to do with the return value of fscanf. */
-		if (ret != 1)
+		if (ret != 1) {
 			INFO("Container uses new lxc-snapshots format %s", path);
+
+			/* Entries are made up of an lxcpath and a name line. */
+			v = 0;
+			rewind(f);
+			if (!get_pool_dir(c, poolpath))
+				poolpath[0] = '\0';
+			while (getline(&line, &sz, f) != -1) {
+				if (n++ % 2)
+					continue;
+
+				line[strcspn(line, "\n")] = '\0';
+				if (strcmp(line, poolpath)) {
+					v = 1;
+					break;
+				}
+			}
+			free(line);
+		}
+		fclose(f);
 	}
 	bret = v != 0;
 
@@ -3002,6 +3065,16 @@ static bool do_lxcapi_destroy(struct lxc_container *c)
 		return false;
 	}
 
+	if (!is_stopped(c)) {
+		ERROR("container %s is not stopped", c->name);
+		return false;
+	}
+
+	if (!clone_pool_drain(c, true)) {
+		ERROR("Failed to remove the clone pool of \"%s\"", c->name);
+		return false;
+	}
+
 	return container_destroy(c, NULL);
 }
 
@@ -3212,7 +3285,7 @@ static int do_lxcapi_get_cgroup_item(struct lxc_container *c, const char *subsys
 	if (!cgroup_ops)
 		return -1;
 
-	if (container_disk_lock(c))
+	if (container_disk_rdlock(c))
 		return -1;
 
 	ret = cgroup_ops->get(cgroup_ops, subsys, retv, inlen, c->name,
@@ -3489,6 +3562,7 @@ static int copy_storage(struct lxc_container *c0, struct lxc_container *c,
 	/* Set new rootfs. */
 	free(c->lxc_conf->rootfs.path);
 	c->lxc_conf->rootfs.path = strdup(bdev->src);
+	set_rootfs_fstype(c->lxc_conf, bdev);
 	storage_put(bdev);
 
 	if (!c->lxc_conf->rootfs.path) {
@@ -3656,6 +3730,668 @@ static int create_file_dirname(char *path, struct lxc_conf *conf)
 	return ret;
 }
 
+/* Clone pool
+ *
+ * With lxc.clone.pool = N a container keeps up to N snapshots of itself ready
+ * in "<lxcpath>/<name>/pool/". A snapshot clone of the container then only
+ * needs to rename one of them into place and rewrite its paths instead of
+ * provisioning storage. The pool is refilled in the background.
+ *
+ * Entries are built as "pool/.new" and renamed to a number once complete.
+ * "pool/.lock" serializes taking, publishing and draining entries and
+ * "pool/.fill" ensures there's only a single process refilling the pool.
+ * "pool/.generation" is a counter bumped whenever the pool is emptied and
+ * "pool/.stamp" records the generation and the state of the container the
+ * entries were built from.
+ */
+
+#define CLONE_POOL_FLAGS \
+	(LXC_CLONE_SNAPSHOT | LXC_CLONE_MAYBE_SNAPSHOT | LXC_CLONE_KEEPNAME)
+
+static bool get_pool_dir(struct lxc_container *c, char *poolpath)
+{
+	int ret;
+
+	ret = snprintf(poolpath, MAXPATHLEN, "%s/%s/pool", c->config_path,
+		       c->name);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return false;
+
+	return true;
+}
+
+static int clone_pool_lock(const char *poolpath, const char *name, int op)
+{
+	int fd, ret;
+	char path[MAXPATHLEN];
+
+	ret = snprintf(path, MAXPATHLEN, "%s/%s", poolpath, name);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return -1;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+
+	ret = flock(fd, op);
+	if (ret < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static uint64_t clone_pool_generation(const char *poolpath)
+{
+	int ret;
+	uint64_t gen;
+	char path[MAXPATHLEN];
+	char buf[32] = {0};
+
+	ret = snprintf(path, MAXPATHLEN, "%s/.generation", poolpath);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return 0;
+
+	ret = lxc_read_from_file(path, buf, sizeof(buf) - 1);
+	if (ret < 0 || lxc_safe_uint64(buf, &gen, 10) < 0)
+		return 0;
+
+	return gen;
+}
+
+static bool clone_pool_bump_generation(const char *poolpath)
+{
+	int ret;
+	char path[MAXPATHLEN];
+	char buf[32];
+
+	ret = snprintf(path, MAXPATHLEN, "%s/.generation", poolpath);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return false;
+
+	ret = snprintf(buf, sizeof(buf), "%" PRIu64,
+		       clone_pool_generation(poolpath) + 1);
+	if (ret < 0 || (size_t)ret >= sizeof(buf))
+		return false;
+
+	ret = lxc_write_to_file(path, buf, strlen(buf), false, 0600);
+	return ret == 0;
+}
+
+/* The generation of the pool and the modification time of the container's
+ * config. Emptying the pool or changing the config invalidates the entries.
+ * Must be called with "pool/.lock" held.
+ */
+static bool clone_pool_stamp(struct lxc_container *c, const char *poolpath,
+			     char *stamp, size_t len)
+{
+	int ret;
+	struct stat st;
+
+	ret = stat(c->configfile, &st);
+	if (ret < 0)
+		return false;
+
+	ret = snprintf(stamp, len, "%" PRIu64 ":%lld.%09ld",
+		       clone_pool_generation(poolpath),
+		       (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+	if (ret < 0 || (size_t)ret >= len)
+		return false;
+
+	return true;
+}
+
+static bool clone_pool_stamp_matches(const char *poolpath, const char *stamp)
+{
+	int ret;
+	char path[MAXPATHLEN];
+	char buf[64] = {0};
+
+	ret = snprintf(path, MAXPATHLEN, "%s/.stamp", poolpath);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return false;
+
+	ret = lxc_read_from_file(path, buf, sizeof(buf) - 1);
+	if (ret < 0)
+		return false;
+
+	return strcmp(buf, stamp) == 0;
+}
+
+static bool clone_pool_set_stamp(const char *poolpath, const char *stamp)
+{
+	int ret;
+	char path[MAXPATHLEN];
+
+	ret = snprintf(path, MAXPATHLEN, "%s/.stamp", poolpath);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return false;
+
+	ret = lxc_write_to_file(path, stamp, strlen(stamp), false, 0600);
+	return ret == 0;
+}
+
+/* Destroy the pooled container @e. Entries without a config, e.g. left over
+ * from a move that didn't complete, are removed as a plain directory.
+ */
+static void clone_pool_remove_entry(struct lxc_container *e)
+{
+	char path[MAXPATHLEN];
+	int ret;
+
+	if (do_lxcapi_is_defined(e)) {
+		if (!do_lxcapi_destroy(e))
+			ERROR("Failed to destroy pooled container \"%s/%s\"",
+			      e->config_path, e->name);
+		else
+			TRACE("Destroyed pooled container \"%s/%s\"",
+			      e->config_path, e->name);
+		return;
+	}
+
+	ret = snprintf(path, MAXPATHLEN, "%s/%s", e->config_path, e->name);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return;
+
+	if (lxc_rmdir_onedev(path, NULL) < 0)
+		WARN("Failed to remove broken pooled container \"%s\"", path);
+	else
+		TRACE("Removed broken pooled container \"%s\"", path);
+}
+
+/* Destroy all entries of the pool. Must be called with "pool/.lock" held. */
+static void clone_pool_drain_locked(const char *poolpath, bool all)
+{
+	DIR *dir;
+	struct dirent *direntp;
+
+	dir = opendir(poolpath);
+	if (!dir)
+		return;
+
+	while ((direntp = readdir(dir))) {
+		struct lxc_container *e;
+
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+
+		if (direntp->d_name[0] == '.' &&
+		    (!all || strcmp(direntp->d_name, ".new")))
+			continue;
+
+		e = lxc_container_new(direntp->d_name, poolpath);
+		if (!e)
+			continue;
+
+		clone_pool_remove_entry(e);
+		lxc_container_put(e);
+	}
+	closedir(dir);
+}
+
+/* Empty the pool of @c after waiting for a running refill to finish. With
+ * @remove the pool is removed altogether.
+ */
+static bool clone_pool_drain(struct lxc_container *c, bool remove)
+{
+	int fillfd, lockfd;
+	char poolpath[MAXPATHLEN];
+
+	if (!get_pool_dir(c, poolpath))
+		return false;
+
+	if (!dir_exists(poolpath))
+		return true;
+
+	fillfd = clone_pool_lock(poolpath, ".fill", LOCK_EX);
+	if (fillfd < 0)
+		return false;
+
+	lockfd = clone_pool_lock(poolpath, ".lock", LOCK_EX);
+	if (lockfd < 0) {
+		close(fillfd);
+		return false;
+	}
+
+	/* A later refill can't restore the stamp of the entries built so far
+	 * since it includes the generation.
+	 */
+	if (!clone_pool_bump_generation(poolpath))
+		WARN("Failed to invalidate the clone pool \"%s\"", poolpath);
+	(void)clone_pool_set_stamp(poolpath, "0");
+	clone_pool_drain_locked(poolpath, remove);
+
+	if (remove && lxc_rmdir_onedev(poolpath, NULL) < 0)
+		WARN("Failed to remove \"%s\"", poolpath);
+
+	close(lockfd);
+	close(fillfd);
+
+	return true;
+}
+
+/* Replace the path @old with @new in the config file @path. */
+static bool clone_pool_rewrite_config(const char *path, const char *old,
+				      const char *new)
+{
+	FILE *f;
+	char *buf, *p, *q;
+	size_t oldlen = strlen(old), newlen = strlen(new);
+	size_t len, n = 0;
+	struct stat st;
+	char *out = NULL;
+	bool bret = false;
+
+	f = fopen(path, "re");
+	if (!f)
+		return false;
+
+	if (fstat(fileno(f), &st) < 0) {
+		fclose(f);
+		return false;
+	}
+
+	buf = must_realloc(NULL, st.st_size + 1);
+	len = fread(buf, 1, st.st_size, f);
+	fclose(f);
+	buf[len] = '\0';
+
+	for (p = buf; (q = strstr(p, old)); p = q + oldlen)
+		n++;
+
+	out = must_realloc(NULL, len + n * (newlen > oldlen ? newlen - oldlen : 0) + 1);
+	out[0] = '\0';
+	len = 0;
+	for (p = buf; (q = strstr(p, old)); p = q + oldlen) {
+		char next = q[oldlen];
+
+		memcpy(out + len, p, q - p);
+		len += q - p;
+
+		/* Only replace whole path components. */
+		if (next == '/' || next == ':' || next == '\n' ||
+		    next == ' ' || next == '\t' || next == ',' || next == '\0') {
+			memcpy(out + len, new, newlen);
+			len += newlen;
+		} else {
+			memcpy(out + len, old, oldlen);
+			len += oldlen;
+		}
+	}
+	strcpy(out + len, p);
+	len += strlen(p);
+
+	if (lxc_write_to_file(path, out, len, false, 0640) == 0)
+		bret = true;
+
+	free(buf);
+	free(out);
+	return bret;
+}
+
+/* Move the stopped container @c to @newname in @lxcpath by renaming its
+ * directory. Only valid for containers whose storage lives in that
+ * directory.
+ */
+static struct lxc_container *clone_pool_move(struct lxc_container *c,
+					     const char *lxcpath,
+					     const char *newname)
+{
+	int ret;
+	struct lxc_container *c2;
+	char oldpath[MAXPATHLEN], newpath[MAXPATHLEN], config[MAXPATHLEN];
+
+	ret = snprintf(oldpath, MAXPATHLEN, "%s/%s", c->config_path, c->name);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return NULL;
+
+	ret = snprintf(newpath, MAXPATHLEN, "%s/%s", lxcpath, newname);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return NULL;
+
+	ret = snprintf(config, MAXPATHLEN, "%s/config", newpath);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return NULL;
+
+	mod_all_rdeps(c, false);
+
+	ret = rename(oldpath, newpath);
+	if (ret < 0) {
+		SYSERROR("Failed to rename \"%s\" to \"%s\"", oldpath, newpath);
+		mod_all_rdeps(c, true);
+		return NULL;
+	}
+
+	if (!clone_pool_rewrite_config(config, oldpath, newpath)) {
+		ERROR("Failed to update paths in \"%s\"", config);
+
+		ret = rename(newpath, oldpath);
+		if (ret < 0)
+			SYSERROR("Failed to rename \"%s\" back to \"%s\"",
+				 newpath, oldpath);
+		else
+			mod_all_rdeps(c, true);
+		return NULL;
+	}
+
+	c2 = lxc_container_new(newname, lxcpath);
+	if (!c2) {
+		ERROR("Failed to load moved container \"%s\"", newpath);
+		return NULL;
+	}
+
+	mod_all_rdeps(c2, true);
+	TRACE("Moved container \"%s\" to \"%s\"", oldpath, newpath);
+	return c2;
+}
+
+/* Only snapshots of these backing stores live in the container's directory
+ * and move along with it. Snapshots of lvm, zfs and rbd containers are named
+ * volumes and datasets outside of it and aren't pooled.
+ */
+static bool clone_pool_storage_supported(struct lxc_conf *conf)
+{
+	size_t i;
+	struct lxc_storage *bdev;
+	bool bret = false;
+	static const char *types[] = {
+		"btrfs", "dir", "image", "loop", "overlay", "overlayfs",
+	};
+
+	bdev = storage_init(conf);
+	if (!bdev)
+		return false;
+
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (strcmp(bdev->type, types[i]) == 0) {
+			bret = true;
+			break;
+		}
+	}
+	storage_put(bdev);
+
+	return bret;
+}
+
+static bool clone_pool_usable(struct lxc_container *c, const char *lxcpath,
+			      int flags, const char *bdevtype,
+			      const char *bdevdata, uint64_t newsize,
+			      char **hookargs)
+{
+	if (!c->lxc_conf->clone_pool)
+		return false;
+
+	if (!(flags & LXC_CLONE_SNAPSHOT) || (flags & ~CLONE_POOL_FLAGS))
+		return false;
+
+	if (bdevtype || bdevdata || newsize || hookargs)
+		return false;
+
+	if (!lxc_list_empty(&c->lxc_conf->hooks[LXCHOOK_CLONE]))
+		return false;
+
+	if (strcmp(lxcpath, c->config_path))
+		return false;
+
+	if (!clone_pool_storage_supported(c->lxc_conf)) {
+		INFO("The storage of \"%s\" can't be pooled", c->name);
+		return false;
+	}
+
+	return true;
+}
+
+/* Take an entry from the pool of @c and move it to @newname in the lxcpath of
+ * @c.
+ */
+static struct lxc_container *clone_pool_take(struct lxc_container *c,
+					     const char *newname)
+{
+	DIR *dir;
+	int lockfd;
+	struct dirent *direntp;
+	char poolpath[MAXPATHLEN];
+	char stamp[64];
+	struct lxc_container *c2 = NULL;
+
+	if (!get_pool_dir(c, poolpath) || !dir_exists(poolpath))
+		return NULL;
+
+	lockfd = clone_pool_lock(poolpath, ".lock", LOCK_EX);
+	if (lockfd < 0)
+		return NULL;
+
+	if (!clone_pool_stamp(c, poolpath, stamp, sizeof(stamp)) ||
+	    !clone_pool_stamp_matches(poolpath, stamp)) {
+		INFO("Discarding outdated clone pool of \"%s\"", c->name);
+		(void)clone_pool_set_stamp(poolpath, "0");
+		clone_pool_drain_locked(poolpath, false);
+		goto out;
+	}
+
+	dir = opendir(poolpath);
+	if (!dir)
+		goto out;
+
+	while ((direntp = readdir(dir))) {
+		struct lxc_container *e;
+
+		if (direntp->d_name[0] == '.')
+			continue;
+
+		e = lxc_container_new(direntp->d_name, poolpath);
+		if (!e)
+			continue;
+
+		if (!do_lxcapi_is_defined(e)) {
+			clone_pool_remove_entry(e);
+			lxc_container_put(e);
+			continue;
+		}
+
+		c2 = clone_pool_move(e, c->config_path, newname);
+		lxc_container_put(e);
+		break;
+	}
+	closedir(dir);
+
+	if (c2)
+		INFO("Took \"%s\" from the clone pool of \"%s\"", newname, c->name);
+
+out:
+	close(lockfd);
+	return c2;
+}
+
+/* Count the entries of the pool and return a free name for a new one in
+ * @name.
+ */
+static unsigned int clone_pool_count(const char *poolpath, char *name,
+				     size_t len)
+{
+	DIR *dir;
+	struct dirent *direntp;
+	unsigned int i, nr = 0;
+	char path[MAXPATHLEN];
+
+	dir = opendir(poolpath);
+	if (dir) {
+		while ((direntp = readdir(dir)))
+			if (direntp->d_name[0] != '.')
+				nr++;
+		closedir(dir);
+	}
+
+	for (i = 0; i < UINT_MAX; i++) {
+		int ret;
+
+		ret = snprintf(path, MAXPATHLEN, "%s/%u", poolpath, i);
+		if (ret < 0 || ret >= MAXPATHLEN || !dir_exists(path))
+			break;
+	}
+	(void)snprintf(name, len, "%u", i);
+
+	return nr;
+}
+
+/* Fill the pool of the container @name in @lxcpath up to lxc.clone.pool
+ * entries.
+ */
+static bool clone_pool_fill(const char *name, const char *lxcpath)
+{
+	int fillfd, lockfd, ret;
+	struct lxc_container *c;
+	char poolpath[MAXPATHLEN], tmppath[MAXPATHLEN];
+	bool bret = false;
+
+	c = lxc_container_new(name, lxcpath);
+	if (!c)
+		return false;
+
+	if (!do_lxcapi_is_defined(c) || !get_pool_dir(c, poolpath))
+		goto out_put;
+
+	ret = mkdir(poolpath, 0755);
+	if (ret < 0 && errno != EEXIST) {
+		SYSERROR("Failed to create directory \"%s\"", poolpath);
+		goto out_put;
+	}
+
+	ret = snprintf(tmppath, MAXPATHLEN, "%s/.new", poolpath);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		goto out_put;
+
+	/* Someone else is refilling the pool already. */
+	fillfd = clone_pool_lock(poolpath, ".fill", LOCK_EX | LOCK_NB);
+	if (fillfd < 0) {
+		bret = (errno == EWOULDBLOCK);
+		goto out_put;
+	}
+
+	for (;;) {
+		struct lxc_container *e, *moved;
+		char now[64], stamp[64], entry[16];
+		unsigned int nr;
+
+		if (!is_stopped(c))
+			break;
+
+		lockfd = clone_pool_lock(poolpath, ".lock", LOCK_EX);
+		if (lockfd < 0)
+			break;
+
+		if (!clone_pool_stamp(c, poolpath, stamp, sizeof(stamp))) {
+			close(lockfd);
+			break;
+		}
+
+		if (!clone_pool_stamp_matches(poolpath, stamp)) {
+			clone_pool_drain_locked(poolpath, false);
+			(void)clone_pool_set_stamp(poolpath, stamp);
+		}
+
+		nr = clone_pool_count(poolpath, entry, sizeof(entry));
+		close(lockfd);
+
+		if (nr >= c->lxc_conf->clone_pool) {
+			bret = true;
+			break;
+		}
+
+		/* Left behind by an interrupted refill. */
+		if (dir_exists(tmppath)) {
+			e = lxc_container_new(".new", poolpath);
+			if (e && do_lxcapi_is_defined(e))
+				do_lxcapi_destroy(e);
+			lxc_container_put(e);
+			(void)lxc_rmdir_onedev(tmppath, NULL);
+		}
+
+		e = c->clone(c, ".new", poolpath,
+			     LXC_CLONE_SNAPSHOT | LXC_CLONE_KEEPNAME, NULL,
+			     NULL, 0, NULL);
+		if (!e) {
+			ERROR("Failed to create pooled snapshot of \"%s\"", name);
+			break;
+		}
+
+		if (!e->lxc_conf->rootfs.path ||
+		    !strstr(e->lxc_conf->rootfs.path, tmppath)) {
+			INFO("Storage of \"%s\" can't be pooled", name);
+			do_lxcapi_destroy(e);
+			lxc_container_put(e);
+			break;
+		}
+
+		/* Clones of the entry don't get their own pool. */
+		clear_unexp_config_line(e->lxc_conf, "lxc.clone.pool", false);
+		if (!do_lxcapi_save_config(e, NULL)) {
+			do_lxcapi_destroy(e);
+			lxc_container_put(e);
+			break;
+		}
+
+		lockfd = clone_pool_lock(poolpath, ".lock", LOCK_EX);
+		if (lockfd < 0) {
+			lxc_container_put(e);
+			break;
+		}
+
+		if (!clone_pool_stamp(c, poolpath, now, sizeof(now)) ||
+		    strcmp(now, stamp) || !clone_pool_stamp_matches(poolpath, stamp)) {
+			INFO("Discarding outdated pooled snapshot of \"%s\"", name);
+			do_lxcapi_destroy(e);
+			moved = NULL;
+		} else {
+			moved = clone_pool_move(e, poolpath, entry);
+		}
+		close(lockfd);
+		lxc_container_put(e);
+		if (!moved)
+			break;
+		lxc_container_put(moved);
+	}
+
+	close(fillfd);
+
+out_put:
+	lxc_container_put(c);
+	return bret;
+}
+
+/* Refill the pool of @c in a detached process. */
+static void clone_pool_refill(struct lxc_container *c)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		SYSWARN("Failed to fork to refill the clone pool");
+		return;
+	}
+
+	if (pid > 0) {
+		(void)wait_for_pid(pid);
+		return;
+	}
+
+	pid = fork();
+	if (pid != 0)
+		_exit(pid < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
+	(void)setsid();
+
+	if (lxc_check_inherited(NULL, true, NULL, 0) < 0 || null_stdfds() < 0)
+		_exit(EXIT_FAILURE);
+
+	if (!clone_pool_fill(c->name, c->config_path))
+		_exit(EXIT_FAILURE);
+
+	_exit(EXIT_SUCCESS);
+}
+
 static struct lxc_container *do_lxcapi_clone(struct lxc_container *c, const char *newname,
 		const char *lxcpath, int flags,
 		const char *bdevtype, const char *bdevdata, uint64_t newsize,
@@ -3697,6 +4433,31 @@ static struct lxc_container *do_lxcapi_clone(struct lxc_container *c, const char
 		goto out;
 	}
 
+	if (clone_pool_usable(c, lxcpath, flags, bdevtype, bdevdata, newsize,
+			      hookargs)) {
+		c2 = clone_pool_take(c, newname);
+		clone_pool_refill(c);
+		if (c2) {
+			storage_copied = 1;
+			if (flags & LXC_CLONE_KEEPNAME) {
+				container_mem_unlock(c);
+				return c2;
+			}
+
+			clear_unexp_config_line(c2->lxc_conf, "lxc.utsname", false);
+			clear_unexp_config_line(c2->lxc_conf, "lxc.uts.name", false);
+			if (!do_set_config_item_locked(c2, "lxc.uts.name", newname)) {
+				ERROR("Error setting new hostname");
+				goto out;
+			}
+
+			if (!c2->save_config(c2, NULL))
+				goto out;
+
+			goto update_rootfs;
+		}
+	}
+
 	ret = create_file_dirname(newpath, c->lxc_conf);
 	if (ret < 0 && errno != EEXIST) {
 		ERROR("Error creating container dir for %s", newpath);
@@ -3815,6 +4576,7 @@ static struct lxc_container *do_lxcapi_clone(struct lxc_container *c, const char
 	if (!c2->save_config(c2, NULL))
 		goto out;
 
+update_rootfs:
 	if ((pid = fork()) < 0) {
 		SYSERROR("fork");
 		goto out;
@@ -3944,6 +4706,50 @@ static int lxcapi_attach_run_wait(struct lxc_container *c, lxc_attach_options_t
 	return ret;
 }
 
+static struct lxc_attach_session *lxcapi_attach_session_open(struct lxc_container *c,
+							     lxc_attach_options_t *options)
+{
+	struct lxc_attach_session *session;
+
+	if (!c)
+		return NULL;
+
+	current_config = c->lxc_conf;
+	session = lxc_attach_session_open(c->name, c->config_path, options);
+	current_config = NULL;
+	return session;
+}
+
+static int lxcapi_attach_session_run(struct lxc_container *c,
+				     struct lxc_attach_session *session,
+				     const char *program, const char * const argv[],
+				     const char * const envp[], const int stdfds[3])
+{
+	int ret;
+
+	if (!c || !session)
+		return -1;
+
+	current_config = c->lxc_conf;
+	ret = lxc_attach_session_run(session, program, argv, envp, stdfds);
+	current_config = NULL;
+	return ret;
+}
+
+static int lxcapi_attach_session_close(struct lxc_container *c,
+				       struct lxc_attach_session *session)
+{
+	int ret;
+
+	if (!c)
+		return -1;
+
+	current_config = c->lxc_conf;
+	ret = lxc_attach_session_close(session);
+	current_config = NULL;
+	return ret;
+}
+
 static int get_next_index(const char *lxcpath, char *cname)
 {
 	char *fname;
@@ -4689,6 +5495,13 @@ static int do_lxcapi_migrate(struct lxc_container *c, unsigned int cmd,
 		}
 		ret = !__criu_dump(c, valid_opts);
 		break;
+	case MIGRATE_ITERATIVE_DUMP:
+		if (!do_lxcapi_is_running(c)) {
+			ERROR("container is not running");
+			goto on_error;
+		}
+		ret = !__criu_iterative_dump(c, valid_opts);
+		break;
 	case MIGRATE_RESTORE:
 		if (do_lxcapi_is_running(c)) {
 			ERROR("container is already running");
@@ -4885,6 +5698,9 @@ struct lxc_container *lxc_container_new(const char *name, const char *configpath
 	c->attach = lxcapi_attach;
 	c->attach_run_wait = lxcapi_attach_run_wait;
 	c->attach_run_waitl = lxcapi_attach_run_waitl;
+	c->attach_session_open = lxcapi_attach_session_open;
+	c->attach_session_run = lxcapi_attach_session_run;
+	c->attach_session_close = lxcapi_attach_session_close;
 	c->snapshot = lxcapi_snapshot;
 	c->snapshot_list = lxcapi_snapshot_list;
 	c->snapshot_restore = lxcapi_snapshot_restore;
@@ -52,6 +52,7 @@ struct lxc_lock;
 struct migrate_opts;
 
 struct lxc_console_log;
+struct lxc_attach_session;
 
 /*!
  * An LXC container.
@@ -846,6 +847,50 @@ struct lxc_container {
 	 * \return \c true if the container was rebooted successfully, else \c false.
 	 */
 	bool (*reboot2)(struct lxc_container *c, int timeout);
+
+	/*!
+	 * \brief Attach a helper process to the container that runs
+	 *  commands on request, so that several commands can be run
+	 *  without setting up namespaces, cgroups, LSM and seccomp for each
+	 *  of them.
+	 *
+	 * \param c Container.
+	 * \param options \ref lxc_attach_options_t applied to the helper and
+	 *  inherited by all commands run in the session. \c LXC_ATTACH_TERMINAL
+	 *  isn't supported.
+	 *
+	 * \return The attach session, or \c NULL on error. The session must
+	 *  be released with \ref attach_session_close.
+	 */
+	struct lxc_attach_session *(*attach_session_open)(struct lxc_container *c, lxc_attach_options_t *options);
+
+	/*!
+	 * \brief Run a command in an attach session and wait for it.
+	 *
+	 * \param c Container.
+	 * \param session Attach session returned by \ref attach_session_open.
+	 * \param program Full path inside container of program to run.
+	 * \param argv Array of arguments to pass to \p program.
+	 * \param envp Environment of \p program, or \c NULL to inherit
+	 *  the environment of the session.
+	 * \param stdfds stdin, stdout and stderr of \p program, or \c NULL
+	 *  to use the fds given in the options of the session.
+	 *
+	 * \return \c waitpid(2) status of the command, or \c -1 on error.
+	 */
+	int (*attach_session_run)(struct lxc_container *c, struct lxc_attach_session *session,
+				  const char *program, const char * const argv[],
+				  const char * const envp[], const int stdfds[3]);
+
+	/*!
+	 * \brief Close an attach session and wait for its helper to exit.
+	 *
+	 * \param c Container.
+	 * \param session Attach session returned by \ref attach_session_open.
+	 *
+	 * \return \c waitpid(2) status of the helper, or \c -1 on error.
+	 */
+	int (*attach_session_close)(struct lxc_container *c, struct lxc_attach_session *session);
 };
 
 /*!
@@ -894,6 +939,7 @@ enum {
 	MIGRATE_DUMP,
 	MIGRATE_RESTORE,
 	MIGRATE_FEATURE_CHECK,
+	MIGRATE_ITERATIVE_DUMP,
 };
 
 /*!
@@ -945,6 +991,37 @@ struct migrate_opts {
 	 * in which the desired feature checks can be encoded.
 	 */
 	uint64_t features_to_check;
+
+	/* MIGRATE_ITERATIVE_DUMP: maximum number of pre-dump rounds to run
+	 * before the final dump. 0 selects the default of 5 rounds.
+	 */
+	unsigned int max_iterations;
+
+	/* MIGRATE_ITERATIVE_DUMP: stop iterating once a pre-dump round had to
+	 * copy at most this many dirty pages. 0 selects the default of 1024
+	 * pages.
+	 */
+	uint64_t converge_threshold;
+
+	/* MIGRATE_ITERATIVE_DUMP: run a criu page-server on this host which
+	 * receives the pages sent to pageserver_address:pageserver_port. This
+	 * is mostly useful for testing the page-server path locally.
+	 */
+	bool local_page_server;
+
+	/* Use criu's lazy-pages mode. On MIGRATE_DUMP the dump keeps serving
+	 * the container's memory from pageserver_address:pageserver_port until
+	 * the restore has fetched all of it. On MIGRATE_RESTORE the container
+	 * resumes before its memory is restored and a lazy-pages daemon faults
+	 * the pages in on demand, from the page-server if one is given or
+	 * from the local images otherwise.
+	 */
+	bool lazy_pages;
+
+	/* MIGRATE_RESTORE output: microseconds between the start of the
+	 * restore and the container running again.
+	 */
+	uint64_t resume_time_us;
 };
 
 struct lxc_console_log {
@@ -1104,6 +1181,99 @@ void lxc_log_close(void);
  */
 bool lxc_config_item_is_supported(const char *key);
 
+/*!
+ * Contention counters of the container locks taken by the calling process.
+ */
+struct lxc_lock_stats {
+	uint64_t shared; /*!< Shared lock file acquisitions */
+	uint64_t exclusive; /*!< Exclusive lock file acquisitions */
+	uint64_t contended; /*!< Acquisitions that had to wait */
+	uint64_t timeouts; /*!< Acquisitions that timed out */
+	uint64_t wait_ns; /*!< Total time spent waiting in nanoseconds */
+};
+
+/*!
+ * \brief Get the contention counters of the container locks.
+ *
+ * Intended for debugging lock contention between processes operating on
+ * the same containers.
+ *
+ * \param[out] stats Counters.
+ */
+void lxc_get_lock_stats(struct lxc_lock_stats *stats);
+
+/*!
+ * Types of events read from an event stream.
+ */
+enum {
+	LXC_EVENT_STATE = 0, /*!< State change, \c value indexes the list returned by \ref lxc_get_wait_states */
+	LXC_EVENT_EXIT_CODE = 1, /*!< Exit status of init as reported by the container's monitor */
+	LXC_EVENT_INIT_EXITED = 2, /*!< Init exited, \c value is its pid */
+	LXC_EVENT_OOM = 3, /*!< Processes were OOM killed, \c value is the number of new kills */
+	LXC_EVENT_CGROUP = 4, /*!< The container's cgroup became (un)populated, \c value is \c 1 or \c 0 */
+};
+
+/*!
+ * An event of a container.
+ */
+struct lxc_event {
+	int type; /*!< One of the \c LXC_EVENT_* types */
+	char name[256]; /*!< Name of the container */
+	int value; /*!< Type specific value */
+};
+
+struct lxc_event_stream;
+
+/*!
+ * \brief Watch all containers of an lxcpath.
+ *
+ * Containers running when the stream is opened and containers started
+ * afterwards are watched. State changes and exit codes are delivered by
+ * lxc-monitord which is started if needed. Init exits are tracked with
+ * pidfds, and OOM kills and cgroup population changes with the cgroup2
+ * \c memory.events and \c cgroup.events files, when the kernel supports
+ * them.
+ *
+ * The exit of a watched init is always delivered, also when the
+ * \c STOPPED state is read first. States and exit codes are only queued
+ * by lxc-monitord up to a limit. Those arriving while a reader is that far
+ * behind are lost. OOM kills and cgroup changes are reported relative to
+ * the last event read for the container, so changes in between are
+ * coalesced.
+ *
+ * \param lxcpath Full \c LXCPATH path to watch.
+ *
+ * \return The event stream, or \c NULL on error.
+ */
+struct lxc_event_stream *lxc_event_stream_open(const char *lxcpath);
+
+/*!
+ * \brief Get a pollable file descriptor of an event stream.
+ *
+ * \param stream Event stream.
+ *
+ * \return A file descriptor that is readable while events are pending.
+ */
+int lxc_event_stream_fd(struct lxc_event_stream *stream);
+
+/*!
+ * \brief Read the next pending event without blocking.
+ *
+ * \param stream Event stream.
+ * \param[out] event Event.
+ *
+ * \return \c 1 if \p event was filled in, \c 0 if no event is pending,
+ *  or \c -1 on error.
+ */
+int lxc_event_stream_read(struct lxc_event_stream *stream, struct lxc_event *event);
+
+/*!
+ * \brief Close an event stream.
+ *
+ * \param stream Event stream.
+ */
+void lxc_event_stream_close(struct lxc_event_stream *stream);
+
 #ifdef  __cplusplus
 }
 #endif
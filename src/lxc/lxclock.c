@@ -22,7 +22,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
-#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/file.h>
@@ -30,69 +31,13 @@
 
 #include <lxc/lxccontainer.h>
 
+#include "initutils.h"
 #include "lxclock.h"
 #include "utils.h"
 #include "log.h"
 
-#ifdef MUTEX_DEBUGGING
-#include <execinfo.h>
-#endif
-
-#define MAX_STACKDEPTH 25
-
 lxc_log_define(lxclock, lxc);
 
-#ifdef MUTEX_DEBUGGING
-static pthread_mutex_t thread_mutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
-
-static inline void dump_stacktrace(void)
-{
-	void *array[MAX_STACKDEPTH];
-	size_t size;
-	char **strings;
-	size_t i;
-
-	size = backtrace(array, MAX_STACKDEPTH);
-	strings = backtrace_symbols(array, size);
-
-	/* Using fprintf here as our logging module is not thread safe. */
-	fprintf(stderr, "\tObtained %zu stack frames\n", size);
-
-	for (i = 0; i < size; i++)
-		fprintf(stderr, "\t\t%s\n", strings[i]);
-
-	free(strings);
-}
-#else
-static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static inline void dump_stacktrace(void) {;}
-#endif
-
-static void lock_mutex(pthread_mutex_t *l)
-{
-	int ret;
-
-	ret = pthread_mutex_lock(l);
-	if (ret != 0) {
-		fprintf(stderr, "%s - Failed acquire mutex", strerror(ret));
-		dump_stacktrace();
-		_exit(EXIT_FAILURE);
-	}
-}
-
-static void unlock_mutex(pthread_mutex_t *l)
-{
-	int ret;
-
-	ret = pthread_mutex_unlock(l);
-	if (ret != 0) {
-		fprintf(stderr, "%s - Failed to release mutex", strerror(ret));
-		dump_stacktrace();
-		_exit(EXIT_FAILURE);
-	}
-}
-
 static char *lxclock_name(const char *p, const char *n)
 {
 	int ret;
@@ -187,10 +132,101 @@ out:
 	return l;
 }
 
-int lxclock(struct lxc_lock *l, int timeout)
+static struct lxc_lock_stats lock_stats;
+
+static inline uint64_t lxclock_now_ns(void)
 {
-	int ret = -1, saved_errno = errno;
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Take a shared (F_RDLCK) or exclusive (F_WRLCK) lock on the lock file. Open
+ * file description locks can't be taken with a timeout. So if @timeout is
+ * set, poll for the lock with increasing intervals until the deadline.
+ */
+static int lxclock_file(struct lxc_lock *l, short type, int timeout)
+{
+	int ret;
 	struct flock lk;
+	bool use_flock = false;
+	uint64_t start = 0, deadline = 0;
+	useconds_t backoff = 1000;
+
+	memset(&lk, 0, sizeof(struct flock));
+	lk.l_type = type;
+	lk.l_whence = SEEK_SET;
+
+	/* Fast path: try to take the lock without waiting. */
+	ret = fcntl(l->u.f.fd, F_OFD_SETLK, &lk);
+	if (ret < 0 && errno == EINVAL) {
+		use_flock = true;
+		ret = flock(l->u.f.fd, (type == F_RDLCK ? LOCK_SH : LOCK_EX) | LOCK_NB);
+	}
+	if (ret == 0)
+		goto out;
+
+	if (errno != EAGAIN && errno != EACCES && errno != EWOULDBLOCK)
+		return -1;
+
+	__atomic_add_fetch(&lock_stats.contended, 1, __ATOMIC_RELAXED);
+	start = lxclock_now_ns();
+	if (timeout)
+		deadline = start + (uint64_t)timeout * 1000000000;
+
+	for (;;) {
+		if (!timeout) {
+			if (use_flock)
+				ret = flock(l->u.f.fd, type == F_RDLCK ? LOCK_SH : LOCK_EX);
+			else
+				ret = fcntl(l->u.f.fd, F_OFD_SETLKW, &lk);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (lxclock_now_ns() >= deadline) {
+			__atomic_add_fetch(&lock_stats.timeouts, 1, __ATOMIC_RELAXED);
+			ERROR("Timed out after %d seconds waiting for lock %s",
+			      timeout, l->u.f.fname);
+			errno = ETIMEDOUT;
+			ret = -1;
+			break;
+		}
+
+		usleep(backoff);
+		if (backoff < 100000)
+			backoff *= 2;
+
+		if (use_flock)
+			ret = flock(l->u.f.fd, (type == F_RDLCK ? LOCK_SH : LOCK_EX) | LOCK_NB);
+		else
+			ret = fcntl(l->u.f.fd, F_OFD_SETLK, &lk);
+		if (ret == 0)
+			break;
+
+		if (errno != EAGAIN && errno != EACCES && errno != EWOULDBLOCK)
+			break;
+	}
+
+	__atomic_add_fetch(&lock_stats.wait_ns, lxclock_now_ns() - start, __ATOMIC_RELAXED);
+	if (ret < 0)
+		return -1;
+
+out:
+	if (type == F_RDLCK)
+		__atomic_add_fetch(&lock_stats.shared, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&lock_stats.exclusive, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int lxclock_type(struct lxc_lock *l, short type, int timeout)
+{
+	int ret = -1, saved_errno = errno;
 
 	switch(l->type) {
 	case LXC_LOCK_ANON_SEM:
@@ -212,10 +248,6 @@ int lxclock(struct lxc_lock *l, int timeout)
 		break;
 	case LXC_LOCK_FLOCK:
 		ret = -2;
-		if (timeout) {
-			ERROR("Error: timeout not supported with flock");
-			goto out;
-		}
 		if (!l->u.f.fname) {
 			ERROR("Error: filename not set for flock");
 			goto out;
@@ -228,15 +260,9 @@ int lxclock(struct lxc_lock *l, int timeout)
 				goto out;
 			}
 		}
-		memset(&lk, 0, sizeof(struct flock));
-		lk.l_type = F_WRLCK;
-		lk.l_whence = SEEK_SET;
-		ret = fcntl(l->u.f.fd, F_OFD_SETLKW, &lk);
-		if (ret < 0) {
-			if (errno == EINVAL)
-				ret = flock(l->u.f.fd, LOCK_EX);
+		ret = lxclock_file(l, type, timeout);
+		if (ret < 0)
 			saved_errno = errno;
-		}
 		break;
 	}
 
@@ -245,6 +271,16 @@ out:
 	return ret;
 }
 
+int lxclock(struct lxc_lock *l, int timeout)
+{
+	return lxclock_type(l, F_WRLCK, timeout);
+}
+
+int lxcrdlock(struct lxc_lock *l, int timeout)
+{
+	return lxclock_type(l, F_RDLCK, timeout);
+}
+
 int lxcunlock(struct lxc_lock *l)
 {
 	int ret = 0, saved_errno = errno;
@@ -312,14 +348,13 @@ void lxc_putlock(struct lxc_lock *l)
 	free(l);
 }
 
-void process_lock(void)
-{
-	lock_mutex(&thread_mutex);
-}
-
-void process_unlock(void)
+void lxc_get_lock_stats(struct lxc_lock_stats *stats)
 {
-	unlock_mutex(&thread_mutex);
+	stats->shared = __atomic_load_n(&lock_stats.shared, __ATOMIC_RELAXED);
+	stats->exclusive = __atomic_load_n(&lock_stats.exclusive, __ATOMIC_RELAXED);
+	stats->contended = __atomic_load_n(&lock_stats.contended, __ATOMIC_RELAXED);
+	stats->timeouts = __atomic_load_n(&lock_stats.timeouts, __ATOMIC_RELAXED);
+	stats->wait_ns = __atomic_load_n(&lock_stats.wait_ns, __ATOMIC_RELAXED);
 }
 
 int container_mem_lock(struct lxc_container *c)
@@ -332,19 +367,42 @@ void container_mem_unlock(struct lxc_container *c)
 	lxcunlock(c->privlock);
 }
 
-int container_disk_lock(struct lxc_container *c)
+/* Seconds to wait for the lock file of a container, 0 waits forever. */
+static int container_disk_lock_timeout(void)
+{
+	int timeout;
+	const char *value;
+
+	value = lxc_global_config_value("lxc.lock.timeout");
+	if (!value || lxc_safe_int(value, &timeout) < 0 || timeout < 0)
+		return 0;
+
+	return timeout;
+}
+
+static int container_disk_lock_type(struct lxc_container *c, short type)
 {
 	int ret;
 
 	if ((ret = lxclock(c->privlock, 0)))
 		return ret;
-	if ((ret = lxclock(c->slock, 0))) {
+	if ((ret = lxclock_type(c->slock, type, container_disk_lock_timeout()))) {
 		lxcunlock(c->privlock);
 		return ret;
 	}
 	return 0;
 }
 
+int container_disk_lock(struct lxc_container *c)
+{
+	return container_disk_lock_type(c, F_WRLCK);
+}
+
+int container_disk_rdlock(struct lxc_container *c)
+{
+	return container_disk_lock_type(c, F_RDLCK);
+}
+
 void container_disk_unlock(struct lxc_container *c)
 {
 	lxcunlock(c->slock);
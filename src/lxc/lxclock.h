@@ -104,13 +104,22 @@ extern struct lxc_lock *lxc_newlock(const char *lxcpath, const char *name);
  *  or \c -1 on any other error (\c errno will be set by \c sem_wait(3)
  * or \c fcntl(2)).
  *
- * \note \p timeout is (currently?) only supported for privlock, not
- * for slock.  Since currently there is not a single use of the timeout
- * (except in the test case) I may remove the support for it in sem as
- * well.
+ * \note For lock files the timeout is implemented by polling for the lock
+ * with increasing intervals, \c errno is set to \c ETIMEDOUT if it expires.
  */
 extern int lxclock(struct lxc_lock *lock, int timeout);
 
+/*!
+ * \brief Take a shared lock.
+ * \param lock Lock to operate on.
+ * \param timeout Seconds to wait to take lock (\c 0 signifies an
+ * indefinite wait).
+ * \return As for \ref lxclock().
+ * \note Only lock files can be shared. Anonymous semaphores are always
+ * taken exclusively.
+ */
+extern int lxcrdlock(struct lxc_lock *lock, int timeout);
+
 /*!
  * \brief Unlock specified lock previously locked using \ref lxclock().
  *
@@ -128,16 +137,6 @@ extern int lxcunlock(struct lxc_lock *lock);
  */
 extern void lxc_putlock(struct lxc_lock *lock);
 
-/*!
- * \brief Lock the current process.
- */
-extern void process_lock(void);
-
-/*!
- * \brief Unlock the current process.
- */
-extern void process_unlock(void);
-
 struct lxc_container;
 
 /*!
@@ -166,6 +165,15 @@ extern void container_mem_unlock(struct lxc_container *c);
  */
 extern int container_disk_lock(struct lxc_container *c);
 
+/*!
+ * \brief Lock the containers disk data for reading.
+ * \param c Container.
+ * \return As for \ref container_disk_lock().
+ * \note Other readers can hold the lock at the same time. The container's
+ * memory lock is still taken exclusively.
+ */
+extern int container_disk_rdlock(struct lxc_container *c);
+
 /*!
  * \brief Unlock the containers disk data.
  *
@@ -131,6 +131,27 @@ int lxc_mainloop_del_handler(struct lxc_epoll_descr *descr, int fd)
 	return -1;
 }
 
+int lxc_mainloop_set_events(struct lxc_epoll_descr *descr, int fd,
+			    uint32_t events)
+{
+	struct epoll_event ev;
+	struct mainloop_handler *handler;
+	struct lxc_list *iterator;
+
+	lxc_list_for_each(iterator, &descr->handlers) {
+		handler = iterator->elem;
+
+		if (handler->fd != fd)
+			continue;
+
+		ev.events = events;
+		ev.data.ptr = handler;
+		return epoll_ctl(descr->epfd, EPOLL_CTL_MOD, fd, &ev);
+	}
+
+	return -1;
+}
+
 int lxc_mainloop_open(struct lxc_epoll_descr *descr)
 {
 	/* hint value passed to epoll create */
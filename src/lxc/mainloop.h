@@ -47,6 +47,10 @@ extern int lxc_mainloop_add_handler(struct lxc_epoll_descr *descr, int fd,
 
 extern int lxc_mainloop_del_handler(struct lxc_epoll_descr *descr, int fd);
 
+/* Change the epoll events a registered handler is woken up for. */
+extern int lxc_mainloop_set_events(struct lxc_epoll_descr *descr, int fd,
+				   uint32_t events);
+
 extern int lxc_mainloop_open(struct lxc_epoll_descr *descr);
 
 extern int lxc_mainloop_close(struct lxc_epoll_descr *descr);
@@ -27,11 +27,15 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <net/if.h>
 #include <netinet/in.h>
@@ -91,63 +95,169 @@ int lxc_monitor_fifo_name(const char *lxcpath, char *fifo_path, size_t fifo_path
 	return 0;
 }
 
-static void lxc_monitor_fifo_send(struct lxc_msg *msg, const char *lxcpath)
+static int lxc_monitor_fifo_open(const char *lxcpath)
 {
-	int fd,ret;
+	int fd, ret;
 	char fifo_path[PATH_MAX];
 
-	BUILD_BUG_ON(sizeof(*msg) > PIPE_BUF); /* write not guaranteed atomic */
-
 	ret = lxc_monitor_fifo_name(lxcpath, fifo_path, sizeof(fifo_path), 0);
 	if (ret < 0)
-		return;
+		return -1;
 
 	/* Open the fifo nonblock in case the monitor is dead, we don't want the
 	 * open to wait for a reader since it may never come.
 	 */
-	fd = open(fifo_path, O_WRONLY | O_NONBLOCK);
+	fd = open(fifo_path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
 	if (fd < 0) {
 		/* It is normal for this open() to fail with ENXIO when there is
 		 * no monitor running, so we don't log it.
 		 */
 		if (errno == ENXIO || errno == ENOENT)
-			return;
+			return -1;
 
 		SYSWARN("Failed to open fifo to send message");
-		return;
+		return -1;
 	}
 
 	if (fcntl(fd, F_SETFL, O_WRONLY) < 0) {
 		close(fd);
-		return;
+		return -1;
 	}
 
-	ret = write(fd, msg, sizeof(*msg));
-	if (ret != sizeof(*msg)) {
-		close(fd);
-		SYSERROR("Failed to write to monitor fifo \"%s\".", fifo_path);
+	return fd;
+}
+
+/* Write to the fifo without raising SIGPIPE if lxc-monitord went away. The
+ * container's monitor process blocks all signals and forwards the ones it
+ * reads from its signalfd to init, so a SIGPIPE that becomes pending here is
+ * consumed before the signal mask is restored.
+ */
+static ssize_t lxc_monitor_fifo_write(int fd, const void *buf, size_t count)
+{
+	int saved_errno;
+	ssize_t ret;
+	bool pending;
+	sigset_t mask, oldmask, set;
+	struct timespec nowait = {0, 0};
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pending = sigpending(&set) == 0 && sigismember(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+
+	ret = lxc_write_nointr(fd, buf, count);
+	saved_errno = errno;
+	if (ret < 0 && errno == EPIPE && !pending)
+		(void)sigtimedwait(&mask, NULL, &nowait);
+
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+	errno = saved_errno;
+	return ret;
+}
+
+void lxc_monitor_sender_init(struct lxc_monitor_sender *sender)
+{
+	sender->fifofd = -EBADF;
+	sender->nr_msgs = 0;
+}
+
+void lxc_monitor_sender_flush(struct lxc_monitor_sender *sender,
+			      const char *lxcpath)
+{
+	int retry;
+	ssize_t ret;
+	size_t len = sender->nr_msgs * sizeof(sender->msgs[0]);
+
+	BUILD_BUG_ON(sizeof(sender->msgs) > PIPE_BUF); /* write not guaranteed atomic */
+
+	if (sender->nr_msgs == 0)
+		return;
+	sender->nr_msgs = 0;
+
+	/* Reopen the fifo once if lxc-monitord went away since the last write
+	 * or if it wasn't running when we last tried to open it.
+	 */
+	for (retry = 0; retry < 2; retry++) {
+		if (sender->fifofd < 0) {
+			sender->fifofd = lxc_monitor_fifo_open(lxcpath);
+			if (sender->fifofd < 0)
+				return;
+		}
+
+		ret = lxc_monitor_fifo_write(sender->fifofd, sender->msgs, len);
+		if (ret == len)
+			return;
+
+		if (ret < 0 && (errno == EPIPE || errno == ENXIO)) {
+			close(sender->fifofd);
+			sender->fifofd = -EBADF;
+			continue;
+		}
+
+		SYSERROR("Failed to write to monitor fifo for \"%s\"", lxcpath);
+		close(sender->fifofd);
+		sender->fifofd = -EBADF;
 		return;
 	}
+}
 
-	close(fd);
+static void lxc_monitor_queue(struct lxc_monitor_sender *sender,
+			      struct lxc_msg *msg, const char *lxcpath)
+{
+	if (sender->nr_msgs == LXC_MONITOR_MAX_BATCH)
+		lxc_monitor_sender_flush(sender, lxcpath);
+
+	sender->msgs[sender->nr_msgs++] = *msg;
 }
 
-void lxc_monitor_send_state(const char *name, lxc_state_t state,
-			    const char *lxcpath)
+void lxc_monitor_queue_state(struct lxc_monitor_sender *sender,
+			     const char *name, lxc_state_t state,
+			     const char *lxcpath)
 {
 	struct lxc_msg msg = {.type = lxc_msg_state, .value = state};
 
 	(void)strlcpy(msg.name, name, sizeof(msg.name));
-	lxc_monitor_fifo_send(&msg, lxcpath);
+	lxc_monitor_queue(sender, &msg, lxcpath);
 }
 
-void lxc_monitor_send_exit_code(const char *name, int exit_code,
-				const char *lxcpath)
+void lxc_monitor_queue_exit_code(struct lxc_monitor_sender *sender,
+				 const char *name, int exit_code,
+				 const char *lxcpath)
 {
 	struct lxc_msg msg = {.type = lxc_msg_exit_code, .value = exit_code};
 
 	(void)strlcpy(msg.name, name, sizeof(msg.name));
-	lxc_monitor_fifo_send(&msg, lxcpath);
+	lxc_monitor_queue(sender, &msg, lxcpath);
+}
+
+void lxc_monitor_sender_close(struct lxc_monitor_sender *sender,
+			      const char *lxcpath)
+{
+	lxc_monitor_sender_flush(sender, lxcpath);
+
+	if (sender->fifofd >= 0)
+		close(sender->fifofd);
+	sender->fifofd = -EBADF;
+}
+
+void lxc_monitor_send_state(const char *name, lxc_state_t state,
+			    const char *lxcpath)
+{
+	struct lxc_monitor_sender sender;
+
+	lxc_monitor_sender_init(&sender);
+	lxc_monitor_queue_state(&sender, name, state, lxcpath);
+	lxc_monitor_sender_close(&sender, lxcpath);
+}
+
+void lxc_monitor_send_exit_code(const char *name, int exit_code,
+				const char *lxcpath)
+{
+	struct lxc_monitor_sender sender;
+
+	lxc_monitor_sender_init(&sender);
+	lxc_monitor_queue_exit_code(&sender, name, exit_code, lxcpath);
+	lxc_monitor_sender_close(&sender, lxcpath);
 }
 
 /* routines used by monitor subscribers (lxc-monitor) */
@@ -242,6 +352,28 @@ int lxc_monitor_open(const char *lxcpath)
 	return fd;
 }
 
+int lxc_monitor_subscribe(int fd, const char *name, unsigned int types)
+{
+	ssize_t ret;
+	struct lxc_monitor_subscription sub;
+
+	memset(&sub, 0, sizeof(sub));
+	memcpy(sub.cmd, LXC_MONITOR_SUBSCRIBE, sizeof(sub.cmd));
+	sub.types = types;
+	if (strlcpy(sub.name, name, sizeof(sub.name)) >= sizeof(sub.name)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	ret = lxc_write_nointr(fd, &sub, sizeof(sub));
+	if (ret != sizeof(sub)) {
+		SYSERROR("Failed to send subscription to monitor socket");
+		return -1;
+	}
+
+	return 0;
+}
+
 int lxc_monitor_read_fdset(struct pollfd *fds, nfds_t nfds, struct lxc_msg *msg,
 			   int timeout)
 {
@@ -258,15 +390,31 @@ int lxc_monitor_read_fdset(struct pollfd *fds, nfds_t nfds, struct lxc_msg *msg,
 	 * when this routine is called again.
 	 */
 	for (i = 0; i < nfds; i++) {
-		if (fds[i].revents != 0) {
-			fds[i].revents = 0;
-			ret = recv(fds[i].fd, msg, sizeof(*msg), 0);
-			if (ret <= 0) {
+		size_t len = 0;
+
+		if (fds[i].revents == 0)
+			continue;
+
+		/* lxc-monitord may have written only part of the message so
+		 * far.
+		 */
+		fds[i].revents = 0;
+		while (len < sizeof(*msg)) {
+			ssize_t rc;
+
+			rc = recv(fds[i].fd, (char *)msg + len, sizeof(*msg) - len, 0);
+			if (rc < 0 && errno == EINTR)
+				continue;
+
+			if (rc <= 0) {
 				SYSERROR("Failed to receive message. Did monitord die?");
 				return -1;
 			}
-			return ret;
+
+			len += rc;
 		}
+
+		return len;
 	}
 
 	SYSERROR("No ready fd found.");
@@ -28,6 +28,8 @@
 #include <sys/un.h>
 #include <poll.h>
 
+#include "state.h"
+
 typedef enum {
 	lxc_msg_state,
 	lxc_msg_priority,
@@ -40,6 +42,46 @@ struct lxc_msg {
 	int value;
 };
 
+/* Sent by a client to lxc-monitord to only receive messages for containers
+ * whose name matches the fnmatch(3) pattern @name and whose type is set in
+ * @types (a bitmask of 1 << lxc_msg_type_t, 0 for all types). A client can
+ * register multiple subscriptions; clients without any receive all messages.
+ */
+#define LXC_MONITOR_SUBSCRIBE "subs"
+
+struct lxc_monitor_subscription {
+	char cmd[4];
+	unsigned int types;
+	char name[NAME_MAX+1];
+};
+
+/* Maximum number of messages that fit into a single atomic fifo write. */
+#define LXC_MONITOR_MAX_BATCH (PIPE_BUF / sizeof(struct lxc_msg))
+
+/*
+ * Cached connection of a container to the lxc-monitord fifo
+ * @fifofd  : the fifo, -EBADF if not opened yet or if opening failed
+ * @nr_msgs : number of messages in @msgs
+ * @msgs    : messages not yet written to the fifo
+ */
+struct lxc_monitor_sender {
+	int fifofd;
+	size_t nr_msgs;
+	struct lxc_msg msgs[LXC_MONITOR_MAX_BATCH];
+};
+
+extern void lxc_monitor_sender_init(struct lxc_monitor_sender *sender);
+extern void lxc_monitor_queue_state(struct lxc_monitor_sender *sender,
+				    const char *name, lxc_state_t state,
+				    const char *lxcpath);
+extern void lxc_monitor_queue_exit_code(struct lxc_monitor_sender *sender,
+					const char *name, int exit_code,
+					const char *lxcpath);
+extern void lxc_monitor_sender_flush(struct lxc_monitor_sender *sender,
+				     const char *lxcpath);
+extern void lxc_monitor_sender_close(struct lxc_monitor_sender *sender,
+				     const char *lxcpath);
+
 extern int lxc_monitor_sock_name(const char *lxcpath, struct sockaddr_un *addr);
 extern int lxc_monitor_fifo_name(const char *lxcpath, char *fifo_path,
 				 size_t fifo_path_sz, int do_mkdirp);
@@ -56,6 +98,15 @@ extern int lxc_monitord_spawn(const char *lxcpath);
  */
 extern int lxc_monitor_open(const char *lxcpath);
 
+/*
+ * Only receive messages for matching containers on a monitor fd
+ * @fd    : the file descriptor provided by lxc_monitor_open
+ * @name  : fnmatch(3) pattern for the container names
+ * @types : bitmask of 1 << lxc_msg_type_t to receive, 0 for all
+ * Returns 0 on success, < 0 otherwise
+ */
+extern int lxc_monitor_subscribe(int fd, const char *name, unsigned int types);
+
 /*
  * Blocking read for the next container state change
  * @fd  : the file descriptor provided by lxc_monitor_open
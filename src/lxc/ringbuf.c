@@ -20,6 +20,7 @@
 #define _GNU_SOURCE
 #define __STDC_FORMAT_MACROS
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -27,6 +28,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "ringbuf.h"
 #include "utils.h"
@@ -36,10 +38,13 @@ int lxc_ringbuf_create(struct lxc_ringbuf *buf, size_t size)
 	char *tmp;
 	int ret;
 	int memfd = -1;
+	size_t data_off = lxc_getpagesize();
 
 	buf->size = size;
 	buf->r_off = 0;
 	buf->w_off = 0;
+	buf->hdr = NULL;
+	buf->fd = -1;
 
 	/* verify that we are at least given the multiple of a page size */
 	if (buf->size % lxc_getpagesize())
@@ -58,25 +63,37 @@ int lxc_ringbuf_create(struct lxc_ringbuf *buf, size_t size)
 			goto on_error;
 
 		memfd = lxc_make_tmpfile(template, true);
+		if (memfd >= 0 && fd_cloexec(memfd, true) < 0)
+			goto on_error;
 	}
 	if (memfd < 0)
 		goto on_error;
 
-	ret = ftruncate(memfd, buf->size);
+	/* The first page holds the header shared with readers. */
+	ret = ftruncate(memfd, data_off + buf->size);
 	if (ret < 0)
 		goto on_error;
 
 	tmp = mmap(buf->addr, buf->size, PROT_READ | PROT_WRITE,
-		   MAP_FIXED | MAP_SHARED, memfd, 0);
+		   MAP_FIXED | MAP_SHARED, memfd, data_off);
 	if (tmp == MAP_FAILED || tmp != buf->addr)
 		goto on_error;
 
 	tmp = mmap(buf->addr + buf->size, buf->size, PROT_READ | PROT_WRITE,
-		   MAP_FIXED | MAP_SHARED, memfd, 0);
+		   MAP_FIXED | MAP_SHARED, memfd, data_off);
 	if (tmp == MAP_FAILED || tmp != (buf->addr + buf->size))
 		goto on_error;
 
-	close(memfd);
+	buf->hdr = mmap(NULL, data_off, PROT_READ | PROT_WRITE, MAP_SHARED,
+			memfd, 0);
+	if (buf->hdr == MAP_FAILED) {
+		buf->hdr = NULL;
+		goto on_error;
+	}
+
+	buf->hdr->data_off = data_off;
+	buf->hdr->size = buf->size;
+	buf->fd = memfd;
 
 	return 0;
 
@@ -91,12 +108,13 @@ void lxc_ringbuf_move_read_addr(struct lxc_ringbuf *buf, size_t len)
 {
 	buf->r_off += len;
 
-	if (buf->r_off < buf->size)
-		return;
+	if (buf->r_off >= buf->size) {
+		/* wrap around */
+		buf->r_off -= buf->size;
+		buf->w_off -= buf->size;
+	}
 
-	/* wrap around */
-	buf->r_off -= buf->size;
-	buf->w_off -= buf->size;
+	lxc_ringbuf_publish(buf, 0);
 }
 
 /**
@@ -145,3 +163,127 @@ int lxc_ringbuf_read(struct lxc_ringbuf *buf, char *out, size_t *len)
 	out[*len - 1] = '\0';
 	return 0;
 }
+
+int lxc_ringbuf_shared_fd(struct lxc_ringbuf *buf)
+{
+	int ret;
+	char path[LXC_PROC_PID_FD_LEN];
+
+	if (buf->fd < 0)
+		return -EBADF;
+
+	/* Reopen the memfd so the new file description is read-only. */
+	ret = snprintf(path, sizeof(path), "/proc/self/fd/%d", buf->fd);
+	if (ret < 0 || (size_t)ret >= sizeof(path))
+		return -EIO;
+
+	ret = open(path, O_RDONLY | O_CLOEXEC);
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
+
+int lxc_ringbuf_shared_map(struct lxc_ringbuf_shared *shared, int fd)
+{
+	int ret;
+	struct stat st;
+	const struct lxc_ringbuf_header *hdr;
+
+	ret = fstat(fd, &st);
+	if (ret < 0)
+		return -errno;
+
+	if ((size_t)st.st_size < sizeof(*hdr))
+		return -EINVAL;
+
+	shared->len = st.st_size;
+	shared->addr = mmap(NULL, shared->len, PROT_READ, MAP_SHARED, fd, 0);
+	if (shared->addr == MAP_FAILED)
+		return -errno;
+
+	hdr = shared->addr;
+	if (hdr->data_off < sizeof(*hdr) || hdr->data_off > shared->len ||
+	    hdr->size > shared->len - hdr->data_off) {
+		munmap(shared->addr, shared->len);
+		return -EINVAL;
+	}
+
+	shared->hdr = hdr;
+	shared->data = (const char *)shared->addr + hdr->data_off;
+	shared->pos = 0;
+
+	return 0;
+}
+
+void lxc_ringbuf_shared_unmap(struct lxc_ringbuf_shared *shared)
+{
+	munmap(shared->addr, shared->len);
+	shared->addr = NULL;
+	shared->hdr = NULL;
+	shared->data = NULL;
+}
+
+static void lxc_ringbuf_shared_snapshot(const struct lxc_ringbuf_shared *shared,
+					struct lxc_ringbuf_header *out)
+{
+	uint64_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&shared->hdr->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		out->size = shared->hdr->size;
+		out->r_off = shared->hdr->r_off;
+		out->w_off = shared->hdr->w_off;
+		out->written = shared->hdr->written;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shared->hdr->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+}
+
+ssize_t lxc_ringbuf_shared_read(struct lxc_ringbuf_shared *shared, char *out,
+				size_t len)
+{
+	struct lxc_ringbuf_header hdr;
+	uint64_t start, avail, idx, first;
+
+	for (;;) {
+		lxc_ringbuf_shared_snapshot(shared, &hdr);
+		if (hdr.size == 0 || hdr.w_off - hdr.r_off > hdr.size)
+			return -EINVAL;
+
+		start = hdr.written - (hdr.w_off - hdr.r_off);
+		if (shared->pos < start)
+			shared->pos = start;
+
+		avail = hdr.written - shared->pos;
+		if (avail == 0)
+			return 0;
+
+		if (avail < len)
+			len = avail;
+
+		/* position of the byte at shared->pos in the ringbuffer */
+		idx = (hdr.w_off + hdr.size - avail) % hdr.size;
+		first = hdr.size - idx;
+		if (first > len)
+			first = len;
+
+		memcpy(out, shared->data + idx, first);
+		memcpy(out + first, shared->data, len - first);
+
+		/* Make sure the writer didn't overwrite what we just copied. */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		lxc_ringbuf_shared_snapshot(shared, &hdr);
+		start = hdr.written - (hdr.w_off - hdr.r_off);
+		if (start <= shared->pos)
+			break;
+	}
+
+	shared->pos += len;
+	return len;
+}
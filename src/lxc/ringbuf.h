@@ -24,6 +24,27 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * lxc_ringbuf_header - Describes the ringbuffer to other processes.
+ * - The memfd backing the ringbuffer starts with a page holding this header
+ *   followed by the @size bytes of the ringbuffer at offset @data_off.
+ * - @seq is odd while the writer updates the header. Readers should only use
+ *   the values if @seq was even and unchanged before and after reading them.
+ * - @written counts all bytes ever written to the ringbuffer. The byte at
+ *   absolute position @written - 1 sits right before @w_off and the oldest
+ *   byte still available is at absolute position @written - (@w_off - @r_off).
+ */
+struct lxc_ringbuf_header {
+	uint64_t seq;
+	uint64_t data_off;
+	uint64_t size;
+	uint64_t r_off;
+	uint64_t w_off;
+	uint64_t written;
+};
 
 /**
  * lxc_ringbuf - Implements a simple and efficient memory mapped ringbuffer.
@@ -39,6 +60,20 @@ struct lxc_ringbuf {
 	uint64_t size; /* total size of the ringbuffer in bytes */
 	uint64_t r_off; /* read offset */
 	uint64_t w_off; /* write offset */
+	struct lxc_ringbuf_header *hdr; /* header shared with readers */
+	int fd; /* memfd backing the header and the ringbuffer */
+};
+
+/**
+ * lxc_ringbuf_shared - Read-only view of a ringbuffer owned by another
+ * process.
+ */
+struct lxc_ringbuf_shared {
+	void *addr; /* start of the mapping */
+	size_t len; /* length of the mapping */
+	const struct lxc_ringbuf_header *hdr;
+	const char *data;
+	uint64_t pos; /* absolute position of the next byte to read */
 };
 
 /**
@@ -51,15 +86,65 @@ extern void lxc_ringbuf_move_read_addr(struct lxc_ringbuf *buf, size_t len);
 extern int lxc_ringbuf_write(struct lxc_ringbuf *buf, const char *msg, size_t len);
 extern int lxc_ringbuf_read(struct lxc_ringbuf *buf, char *out, size_t *len);
 
+/**
+ * lxc_ringbuf_shared_fd - Get a read-only fd for the ringbuffer's memfd which
+ * can be handed to other processes.
+ */
+extern int lxc_ringbuf_shared_fd(struct lxc_ringbuf *buf);
+
+/**
+ * lxc_ringbuf_shared_map - Map a ringbuffer from an fd retrieved via
+ * lxc_ringbuf_shared_fd(). Reading starts at the oldest available byte.
+ */
+extern int lxc_ringbuf_shared_map(struct lxc_ringbuf_shared *shared, int fd);
+extern void lxc_ringbuf_shared_unmap(struct lxc_ringbuf_shared *shared);
+
+/**
+ * lxc_ringbuf_shared_read - Copy up to @len new bytes from a shared
+ * ringbuffer to @out. If the writer has overwritten data that wasn't read
+ * yet, reading continues with the oldest byte still available.
+ * Returns the number of bytes copied, 0 if there's no new data.
+ */
+extern ssize_t lxc_ringbuf_shared_read(struct lxc_ringbuf_shared *shared,
+				       char *out, size_t len);
+
 static inline void lxc_ringbuf_release(struct lxc_ringbuf *buf)
 {
 	munmap(buf->addr, buf->size * 2);
+
+	if (buf->hdr)
+		munmap(buf->hdr, buf->hdr->data_off);
+	buf->hdr = NULL;
+
+	if (buf->fd >= 0)
+		close(buf->fd);
+	buf->fd = -1;
+}
+
+/* Make the current offsets visible to readers of the shared header. */
+static inline void lxc_ringbuf_publish(struct lxc_ringbuf *buf, size_t written)
+{
+	struct lxc_ringbuf_header *hdr = buf->hdr;
+
+	if (!hdr)
+		return;
+
+	__atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	hdr->r_off = buf->r_off;
+	hdr->w_off = buf->w_off;
+	hdr->written += written;
+	__atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELEASE);
+
+	/* Readers must see the new offsets before the data gets overwritten. */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
 }
 
 static inline void lxc_ringbuf_clear(struct lxc_ringbuf *buf)
 {
 	buf->r_off = 0;
 	buf->w_off = 0;
+	lxc_ringbuf_publish(buf, 0);
 }
 
 static inline uint64_t lxc_ringbuf_used(struct lxc_ringbuf *buf)
@@ -85,6 +170,7 @@ static inline char *lxc_ringbuf_get_write_addr(struct lxc_ringbuf *buf)
 static inline void lxc_ringbuf_move_write_addr(struct lxc_ringbuf *buf, size_t len)
 {
 	buf->w_off += len;
+	lxc_ringbuf_publish(buf, len);
 }
 
 #endif /* __LXC_RINGBUF_H */
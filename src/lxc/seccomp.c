@@ -23,11 +23,19 @@
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
 #include <seccomp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/utsname.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "log.h"
@@ -42,6 +50,10 @@
 #define MIPS_ARCH_N64 lxc_seccomp_arch_mips64
 #endif
 
+#ifndef SECCOMP_SET_MODE_FILTER
+#define SECCOMP_SET_MODE_FILTER 1
+#endif
+
 lxc_log_define(seccomp, lxc);
 
 static int parse_config_v1(FILE *f, char *line, size_t *line_bufsz, struct lxc_conf *conf)
@@ -1132,10 +1144,197 @@ static bool use_seccomp(void)
 	return true;
 }
 
+#if HAVE_SCMP_FILTER_CTX
+/*
+ * The compiled BPF program only depends on the policy text, the set of
+ * architectures the host supports and the libseccomp version that generated
+ * it. Hash all three so that a cached program is never reused across hosts
+ * or library upgrades.
+ */
+static int seccomp_cache_path(FILE *f, char *path, size_t len)
+{
+	int ret;
+	size_t bytes;
+	char *rundir;
+	struct utsname uts;
+	uint64_t hash = FNV1A_64_INIT;
+	char buf[4096];
+#if HAVE_DECL_SECCOMP_VERSION
+	const struct scmp_version *v;
+#endif
+
+	while ((bytes = fread(buf, 1, sizeof(buf), f)) > 0)
+		hash = fnv_64a_buf(buf, bytes, hash);
+	ret = ferror(f);
+	rewind(f);
+	if (ret)
+		return -1;
+
+	ret = uname(&uts);
+	if (ret < 0)
+		return -1;
+	hash = fnv_64a_buf(uts.machine, strlen(uts.machine), hash);
+
+#if HAVE_DECL_SECCOMP_VERSION
+	v = seccomp_version();
+	if (!v)
+		return -1;
+
+	ret = snprintf(buf, sizeof(buf), "%u.%u.%u", v->major, v->minor, v->micro);
+#elif defined(SCMP_VER_MAJOR)
+	ret = snprintf(buf, sizeof(buf), "%d.%d.%d", SCMP_VER_MAJOR,
+		       SCMP_VER_MINOR, SCMP_VER_MICRO);
+#else
+	ret = snprintf(buf, sizeof(buf), "unknown");
+#endif
+	if (ret < 0 || (size_t)ret >= sizeof(buf))
+		return -1;
+	hash = fnv_64a_buf(buf, ret, hash);
+
+	rundir = get_rundir();
+	if (!rundir)
+		return -1;
+
+	ret = snprintf(path, len, "%s/lxc/seccomp/%016" PRIx64 ".bpf", rundir, hash);
+	free(rundir);
+	if (ret < 0 || (size_t)ret >= len)
+		return -1;
+
+	return 0;
+}
+
+/* Returns 0 on cache hit, < 0 otherwise. */
+static int seccomp_cache_read(struct lxc_conf *conf, const char *path)
+{
+	int fd;
+	ssize_t ret;
+	struct stat st;
+	struct sock_filter *bpf;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return -1;
+
+	ret = fstat(fd, &st);
+	if (ret < 0)
+		goto on_error;
+
+	/* Don't trust programs someone else could have placed there. */
+	if (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+		goto on_error;
+
+	if (st.st_size <= 0 || (st.st_size % sizeof(struct sock_filter)) ||
+	    (st.st_size / sizeof(struct sock_filter)) > BPF_MAXINSNS)
+		goto on_error;
+
+	bpf = malloc(st.st_size);
+	if (!bpf)
+		goto on_error;
+
+	ret = lxc_read_nointr(fd, bpf, st.st_size);
+	if (ret != st.st_size) {
+		free(bpf);
+		goto on_error;
+	}
+	close(fd);
+
+	conf->seccomp_bpf = bpf;
+	conf->seccomp_bpf_len = st.st_size / sizeof(struct sock_filter);
+	return 0;
+
+on_error:
+	close(fd);
+	return -1;
+}
+
+static void seccomp_cache_write(struct lxc_conf *conf, const char *path)
+{
+	int fd, ret;
+	char *dir, *slash;
+	char tmp[PATH_MAX];
+
+	dir = strdup(path);
+	if (!dir)
+		return;
+
+	/* <rundir>/lxc is shared with other users of the run directory so only
+	 * restrict access to the cache directory itself.
+	 */
+	slash = strrchr(dir, '/');
+	*slash = '\0';
+	slash = strrchr(dir, '/');
+	*slash = '\0';
+	ret = mkdir_p(dir, 0755);
+	*slash = '/';
+	if (ret == 0) {
+		ret = mkdir(dir, 0700);
+		if (ret < 0 && errno == EEXIST)
+			ret = 0;
+	}
+	free(dir);
+	if (ret < 0) {
+		SYSWARN("Failed to create seccomp cache directory");
+		return;
+	}
+
+	ret = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if (ret < 0 || (size_t)ret >= sizeof(tmp))
+		return;
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		SYSWARN("Failed to create temporary seccomp cache file");
+		return;
+	}
+
+	ret = seccomp_export_bpf(conf->seccomp_ctx, fd);
+	close(fd);
+	if (ret < 0) {
+		errno = -ret;
+		SYSWARN("Failed to export seccomp filter to \"%s\"", tmp);
+		goto on_error;
+	}
+
+	/* Publish atomically so concurrent starts never see partial filters. */
+	ret = rename(tmp, path);
+	if (ret < 0) {
+		SYSWARN("Failed to rename \"%s\" to \"%s\"", tmp, path);
+		goto on_error;
+	}
+
+	TRACE("Cached compiled seccomp filter in \"%s\"", path);
+	return;
+
+on_error:
+	(void)unlink(tmp);
+}
+
+static int seccomp_load_cached(struct lxc_conf *conf)
+{
+	int ret;
+	struct sock_fprog prog = {
+		.len	= conf->seccomp_bpf_len,
+		.filter	= conf->seccomp_bpf,
+	};
+
+#ifdef __NR_seccomp
+	ret = syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER, 0, &prog);
+	if (ret == 0 || errno != ENOSYS)
+		return ret;
+#endif
+
+	return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0);
+}
+#endif
+
 int lxc_read_seccomp_config(struct lxc_conf *conf)
 {
 	int ret;
 	FILE *f;
+#if HAVE_SCMP_FILTER_CTX
+	bool cacheable;
+	char cache_path[PATH_MAX];
+#endif
 
 	if (!conf->seccomp)
 		return 0;
@@ -1143,6 +1342,22 @@ int lxc_read_seccomp_config(struct lxc_conf *conf)
 	if (!use_seccomp())
 		return 0;
 
+	f = fopen(conf->seccomp, "r");
+	if (!f) {
+		SYSERROR("Failed to open seccomp policy file %s", conf->seccomp);
+		return -1;
+	}
+
+#if HAVE_SCMP_FILTER_CTX
+	cacheable = seccomp_cache_path(f, cache_path, sizeof(cache_path)) == 0;
+	if (cacheable && seccomp_cache_read(conf, cache_path) == 0) {
+		INFO("Using cached seccomp filter \"%s\" for policy %s",
+		     cache_path, conf->seccomp);
+		fclose(f);
+		return 0;
+	}
+#endif
+
 #if HAVE_SCMP_FILTER_CTX
 	/* XXX for debug, pass in SCMP_ACT_TRAP */
 	conf->seccomp_ctx = seccomp_init(SCMP_ACT_KILL);
@@ -1152,6 +1367,7 @@ int lxc_read_seccomp_config(struct lxc_conf *conf)
 #endif
 	if (ret) {
 		ERROR("Failed initializing seccomp");
+		fclose(f);
 		return -1;
 	}
 
@@ -1165,6 +1381,7 @@ int lxc_read_seccomp_config(struct lxc_conf *conf)
 	if (ret < 0) {
 		errno = -ret;
 		SYSERROR("Failed to turn off no-new-privs");
+		fclose(f);
 		return -1;
 	}
 
@@ -1176,15 +1393,14 @@ int lxc_read_seccomp_config(struct lxc_conf *conf)
 	}
 #endif
 
-	f = fopen(conf->seccomp, "r");
-	if (!f) {
-		SYSERROR("Failed to open seccomp policy file %s", conf->seccomp);
-		return -1;
-	}
-
 	ret = parse_config(f, conf);
 	fclose(f);
 
+#if HAVE_SCMP_FILTER_CTX
+	if (ret == 0 && cacheable)
+		seccomp_cache_write(conf, cache_path);
+#endif
+
 	return ret;
 }
 
@@ -1199,6 +1415,18 @@ int lxc_seccomp_load(struct lxc_conf *conf)
 		return 0;
 
 #if HAVE_SCMP_FILTER_CTX
+	if (conf->seccomp_bpf) {
+		ret = seccomp_load_cached(conf);
+		if (ret < 0) {
+			SYSERROR("Error loading the cached seccomp policy");
+			return -1;
+		}
+
+		TRACE("Loaded cached seccomp filter with %zu instructions",
+		      conf->seccomp_bpf_len);
+		return 0;
+	}
+
 	ret = seccomp_load(conf->seccomp_ctx);
 #else
 	ret = seccomp_load();
@@ -1237,5 +1465,9 @@ void lxc_seccomp_free(struct lxc_conf *conf)
 		seccomp_release(conf->seccomp_ctx);
 		conf->seccomp_ctx = NULL;
 	}
+
+	free(conf->seccomp_bpf);
+	conf->seccomp_bpf = NULL;
+	conf->seccomp_bpf_len = 0;
 #endif
 }
@@ -524,9 +524,11 @@ int lxc_set_state(const char *name, struct lxc_handler *handler,
 		return -1;
 
 	/* This function will try to connect to the legacy lxc-monitord state
-	 * server and only exists for backwards compatibility.
+	 * server and only exists for backwards compatibility. Any queued
+	 * messages are sent along with the new state.
 	 */
-	lxc_monitor_send_state(name, state, handler->lxcpath);
+	lxc_monitor_queue_state(&handler->monitor, name, state, handler->lxcpath);
+	lxc_monitor_sender_flush(&handler->monitor, handler->lxcpath);
 
 	return 0;
 }
@@ -657,6 +659,8 @@ void lxc_free_handler(struct lxc_handler *handler)
 	if (handler->state_socket_pair[1] >= 0)
 		close(handler->state_socket_pair[1]);
 
+	lxc_monitor_sender_close(&handler->monitor, handler->lxcpath);
+
 	handler->conf = NULL;
 	free(handler);
 	handler = NULL;
@@ -685,6 +689,8 @@ struct lxc_handler *lxc_init_handler(const char *name, struct lxc_conf *conf,
 	handler->sigfd = -EBADF;
 	handler->init_died = false;
 	handler->state_socket_pair[0] = handler->state_socket_pair[1] = -1;
+	lxc_monitor_sender_init(&handler->monitor);
+	handler->init_status = -1;
 	if (handler->conf->reboot == REBOOT_NONE)
 		lxc_list_init(&handler->conf->state_clients);
 
@@ -946,6 +952,14 @@ void lxc_fini(const char *name, struct lxc_handler *handler)
 	cgroup_ops->destroy(cgroup_ops, handler);
 	cgroup_exit(cgroup_ops);
 
+	/* The exit code of init goes out to lxc-monitord in the same write as
+	 * the STOPPED state.
+	 */
+	if (handler->init_status >= 0)
+		lxc_monitor_queue_exit_code(&handler->monitor, name,
+					    handler->init_status,
+					    handler->lxcpath);
+
 	if (handler->conf->reboot == REBOOT_NONE) {
 		/* For all new state clients simply close the command socket.
 		 * This will inform all state clients that the container is
@@ -960,7 +974,9 @@ void lxc_fini(const char *name, struct lxc_handler *handler)
 		/* This function will try to connect to the legacy lxc-monitord
 		 * state server and only exists for backwards compatibility.
 		 */
-		lxc_monitor_send_state(name, STOPPED, handler->lxcpath);
+		lxc_monitor_queue_state(&handler->monitor, name, STOPPED,
+					handler->lxcpath);
+		lxc_monitor_sender_flush(&handler->monitor, handler->lxcpath);
 
 		/* The command socket is closed so no one can acces the command
 		 * socket anymore so there's no need to lock it.
@@ -1942,7 +1958,8 @@ int __lxc_start(const char *name, struct lxc_handler *handler,
 		handler->pinfd = -1;
 	}
 
-	lxc_monitor_send_exit_code(name, status, handler->lxcpath);
+	/* Sent along with the STOPPED state in lxc_fini(). */
+	handler->init_status = status;
 	lxc_error_set_and_log(handler->pid, status);
 	if (error_num)
 		*error_num = handler->exit_status;
@@ -1972,6 +1989,7 @@ static int start(struct lxc_handler *handler, void* data)
 
 	NOTICE("Exec'ing \"%s\"", arg->argv[0]);
 
+	lxc_log_flush();
 	execvp(arg->argv[0], arg->argv);
 	SYSERROR("Failed to exec \"%s\"", arg->argv[0]);
 	return 0;
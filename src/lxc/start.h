@@ -33,6 +33,7 @@
 
 #include "conf.h"
 #include "config.h"
+#include "monitor.h"
 #include "namespace.h"
 #include "state.h"
 
@@ -85,6 +86,14 @@ struct lxc_handler {
 	/* The socketpair() fds used to wait on successful daemonized startup. */
 	int state_socket_pair[2];
 
+	/* Cached connection to the legacy lxc-monitord fifo. */
+	struct lxc_monitor_sender monitor;
+
+	/* The wait status of the container's init which is sent to
+	 * lxc-monitord along with the STOPPED state; -1 if it wasn't reaped.
+	 */
+	int init_status;
+
 	/* Socketpair to synchronize processes during container creation. */
 	int sync_sock[2];
 
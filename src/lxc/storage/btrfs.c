@@ -567,96 +567,160 @@ static int btrfs_do_destroy_subvol(const char *path)
 	return ret;
 }
 
+static inline unsigned int btrfs_tree_hash(u64 id, int index_size)
+{
+	return (unsigned int)((id * 0x9E3779B97F4A7C15ULL) >> 32) &
+	       (index_size - 1);
+}
+
 static int get_btrfs_tree_idx(struct my_btrfs_tree *tree, u64 id)
 {
-	int i;
+	unsigned int h;
+
 	if (!tree)
 		return -1;
-	for (i = 0; i < tree->num; i++) {
-		if (tree->nodes[i].objid == id)
-			return i;
+
+	for (h = btrfs_tree_hash(id, tree->index_size);
+	     tree->index[h] >= 0; h = (h + 1) & (tree->index_size - 1)) {
+		if (tree->nodes[tree->index[h]].objid == id)
+			return tree->index[h];
 	}
+
 	return -1;
 }
 
+static void btrfs_tree_index_insert(struct my_btrfs_tree *tree, int idx)
+{
+	unsigned int h;
+
+	for (h = btrfs_tree_hash(tree->nodes[idx].objid, tree->index_size);
+	     tree->index[h] >= 0; h = (h + 1) & (tree->index_size - 1))
+		;
+
+	tree->index[h] = idx;
+}
+
+/* Keep the index at most half full. */
+static bool btrfs_tree_index_grow(struct my_btrfs_tree *tree)
+{
+	int i, *index;
+	int index_size = tree->index_size ? tree->index_size * 2 : 64;
+
+	index = malloc(index_size * sizeof(*index));
+	if (!index)
+		return false;
+
+	for (i = 0; i < index_size; i++)
+		index[i] = -1;
+
+	free(tree->index);
+	tree->index = index;
+	tree->index_size = index_size;
+
+	for (i = 0; i < tree->num; i++)
+		btrfs_tree_index_insert(tree, i);
+
+	return true;
+}
+
 static struct my_btrfs_tree *create_my_btrfs_tree(u64 id, const char *path,
 						  int name_len)
 {
 	struct my_btrfs_tree *tree;
 
-	tree = malloc(sizeof(struct my_btrfs_tree));
+	tree = calloc(1, sizeof(struct my_btrfs_tree));
 	if (!tree)
 		return NULL;
-	tree->nodes = malloc(sizeof(struct mytree_node));
-	if (!tree->nodes) {
-		free(tree);
-		return NULL;
-	}
-	tree->num = 1;
-	tree->nodes[0].dirname = NULL;
+
+	tree->nodes = calloc(1, sizeof(struct mytree_node));
+	if (!tree->nodes)
+		goto on_error;
+	tree->size = 1;
+
 	tree->nodes[0].name = strdup(path);
-	if (!tree->nodes[0].name) {
-		free(tree->nodes);
-		free(tree);
-		return NULL;
-	}
-	tree->nodes[0].parentid = 0;
+	if (!tree->nodes[0].name)
+		goto on_error;
 	tree->nodes[0].objid = id;
+	tree->nodes[0].first_child = -1;
+	tree->nodes[0].next_sibling = -1;
+	tree->num = 1;
+
+	if (!btrfs_tree_index_grow(tree))
+		goto on_error;
+
 	return tree;
+
+on_error:
+	if (tree->nodes)
+		free(tree->nodes[0].name);
+	free(tree->nodes);
+	free(tree);
+	return NULL;
 }
 
-static bool update_tree_node(struct mytree_node *n, u64 id, u64 parent,
-			     char *name, int name_len, char *dirname)
+static bool add_btrfs_tree_node(struct my_btrfs_tree *tree, u64 id, u64 parent,
+				u64 dir_id, char *name, int name_len)
 {
-	if (id)
-		n->objid = id;
+	struct mytree_node *n;
+	int i;
 
-	if (parent)
-		n->parentid = parent;
+	i = get_btrfs_tree_idx(tree, id);
+	if (i < 0) {
+		if (tree->num == tree->size) {
+			struct mytree_node *tmp;
+			int size = tree->size * 2;
+
+			tmp = realloc(tree->nodes, size * sizeof(struct mytree_node));
+			if (!tmp)
+				return false;
+			tree->nodes = tmp;
+			tree->size = size;
+		}
 
-	if (name) {
-		n->name = malloc(name_len + 1);
-		if (!n->name)
+		if (2 * (tree->num + 1) > tree->index_size &&
+		    !btrfs_tree_index_grow(tree))
 			return false;
 
-		(void)strlcpy(n->name, name, name_len + 1);
+		i = tree->num;
+		memset(&tree->nodes[i], 0, sizeof(struct mytree_node));
+		tree->nodes[i].objid = id;
+		tree->nodes[i].first_child = -1;
+		tree->nodes[i].next_sibling = -1;
+		tree->num++;
+		btrfs_tree_index_insert(tree, i);
 	}
+	n = &tree->nodes[i];
 
-	if (dirname) {
-		size_t len;
+	n->parentid = parent;
+	n->dir_id = dir_id;
 
-		len = strlen(dirname);
-		n->dirname = malloc(len + 1);
-		if (!n->dirname) {
-			free(n->name);
-			return false;
-		}
+	free(n->name);
+	n->name = malloc(name_len + 1);
+	if (!n->name)
+		return false;
+	memcpy(n->name, name, name_len);
+	n->name[name_len] = '\0';
 
-		(void)strlcpy(n->dirname, dirname, len + 1);
-	}
 	return true;
 }
 
-static bool add_btrfs_tree_node(struct my_btrfs_tree *tree, u64 id, u64 parent,
-				char *name, int name_len, char *dirname)
+/* Link every node to its parent so that the subvolumes below the root can be
+ * walked without searching the whole tree for each parent.
+ */
+static void link_btrfs_tree(struct my_btrfs_tree *tree)
 {
-	struct mytree_node *tmp;
+	int i;
 
-	int i = get_btrfs_tree_idx(tree, id);
-	if (i != -1)
-		return update_tree_node(&tree->nodes[i], id, parent, name,
-				name_len, dirname);
+	for (i = 1; i < tree->num; i++) {
+		int p;
 
-	tmp = realloc(tree->nodes, (tree->num+1) * sizeof(struct mytree_node));
-	if (!tmp)
-		return false;
-	tree->nodes = tmp;
-	memset(&tree->nodes[tree->num], 0, sizeof(struct mytree_node));
-	if (!update_tree_node(&tree->nodes[tree->num], id, parent, name,
-				name_len, dirname))
-		return false;
-	tree->num++;
-	return true;
+		p = get_btrfs_tree_idx(tree, tree->nodes[i].parentid);
+		if (p < 0)
+			continue;
+
+		tree->nodes[i].next_sibling = tree->nodes[p].first_child;
+		tree->nodes[p].first_child = i;
+	}
 }
 
 static void free_btrfs_tree(struct my_btrfs_tree *tree)
@@ -669,49 +733,119 @@ static void free_btrfs_tree(struct my_btrfs_tree *tree)
 		free(tree->nodes[i].dirname);
 	}
 	free(tree->nodes);
+	free(tree->index);
 	free(tree);
 }
 
+/* Destroy the subvolume @subvolid without resolving its path. This needs
+ * Linux 5.7 and CAP_SYS_ADMIN.
+ */
+static int btrfs_do_destroy_subvol_id(int fd, u64 subvolid)
+{
+	int ret;
+	struct btrfs_ioctl_vol_args_v2 args;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = BTRFS_SUBVOL_SPEC_BY_ID;
+	args.subvolid = subvolid;
+
+	ret = ioctl(fd, BTRFS_IOC_SNAP_DESTROY_V2, &args);
+	INFO("btrfs: snapshot destroy ioctl returned %d for subvolume %llu",
+	     ret, (unsigned long long)subvolid);
+	return ret;
+}
+
+/* Build the path of node @idx from the path of the tree's root, resolving the
+ * names of the subvolumes on the way.
+ */
+static char *btrfs_tree_node_path(struct my_btrfs_tree *tree, int fd, int idx)
+{
+	int ret, p;
+	size_t len;
+	char *parent_path, *path;
+	struct mytree_node *n = &tree->nodes[idx];
+
+	if (idx == 0)
+		return strdup(n->name);
+
+	p = get_btrfs_tree_idx(tree, n->parentid);
+	if (p < 0)
+		return NULL;
+
+	if (!n->dirname) {
+		n->dirname = get_btrfs_subvol_path(fd, n->parentid, n->dir_id,
+						   n->name, strlen(n->name));
+		if (!n->dirname)
+			return NULL;
+	}
+
+	parent_path = btrfs_tree_node_path(tree, fd, p);
+	if (!parent_path)
+		return NULL;
+
+	len = strlen(parent_path) + strlen(n->dirname) + 2;
+	path = malloc(len);
+	if (!path) {
+		free(parent_path);
+		return NULL;
+	}
+
+	ret = snprintf(path, len, "%s/%s", parent_path, n->dirname);
+	free(parent_path);
+	if (ret < 0 || (size_t)ret >= len) {
+		free(path);
+		return NULL;
+	}
+
+	return path;
+}
+
 /*
- * Given a @tree of subvolumes under @path, ask btrfs to remove each
- * subvolume
+ * Given a @tree of subvolumes, ask btrfs to remove each subvolume below node
+ * @idx. Subvolumes are removed by id so that no paths need to be resolved.
+ * If the kernel doesn't support that, or we lack CAP_SYS_ADMIN, we fall back
+ * to removing them by path.
  */
-static bool do_remove_btrfs_children(struct my_btrfs_tree *tree, u64 root_id,
-				     const char *path)
+static bool do_remove_btrfs_children(struct my_btrfs_tree *tree, int idx,
+				     int fd, bool *by_id)
 {
 	int i, ret;
-	char *newpath;
-	size_t len;
+	char *path;
+
+	for (i = tree->nodes[idx].first_child; i >= 0;
+	     i = tree->nodes[i].next_sibling) {
+		if (!do_remove_btrfs_children(tree, i, fd, by_id))
+			return false;
 
-	for (i = 0; i < tree->num; i++) {
-		if (tree->nodes[i].parentid == root_id) {
-			if (!tree->nodes[i].dirname) {
-				WARN("Odd condition: child objid with no name under %s\n", path);
+		if (*by_id) {
+			ret = btrfs_do_destroy_subvol_id(fd, tree->nodes[i].objid);
+			if (ret == 0)
 				continue;
-			}
-			len = strlen(path) + strlen(tree->nodes[i].dirname) + 2;
-			newpath = malloc(len);
-			if (!newpath) {
-				ERROR("Out of memory");
-				return false;
-			}
-			ret = snprintf(newpath, len, "%s/%s", path, tree->nodes[i].dirname);
-			if (ret < 0 || ret >= len) {
-				free(newpath);
-				return false;
-			}
-			if (!do_remove_btrfs_children(tree, tree->nodes[i].objid, newpath)) {
-				ERROR("Failed to prune %s\n", tree->nodes[i].name);
-				free(newpath);
-				return false;
-			}
-			if (btrfs_do_destroy_subvol(newpath) != 0) {
-				ERROR("Failed to remove %s\n", newpath);
-				free(newpath);
+
+			if (errno != ENOTTY && errno != EINVAL &&
+			    errno != EOPNOTSUPP && errno != EPERM) {
+				SYSERROR("Failed to remove subvolume %llu",
+					 (unsigned long long)tree->nodes[i].objid);
 				return false;
 			}
-			free(newpath);
+
+			SYSINFO("Falling back to removing subvolumes by path");
+			*by_id = false;
 		}
+
+		path = btrfs_tree_node_path(tree, fd, i);
+		if (!path) {
+			WARN("Odd condition: child objid with no name under %s\n",
+			     tree->nodes[idx].name);
+			continue;
+		}
+
+		if (btrfs_do_destroy_subvol(path) != 0) {
+			ERROR("Failed to remove %s\n", path);
+			free(path);
+			return false;
+		}
+		free(path);
 	}
 	return true;
 }
@@ -729,8 +863,8 @@ static int btrfs_recursive_destroy(const char *path)
 	unsigned long off = 0;
 	int name_len;
 	char *name;
-	char *tmppath;
 	u64 dir_id;
+	bool by_id = true;
 
 	fd = open(path, O_RDONLY);
 	if (fd < 0) {
@@ -801,18 +935,14 @@ static int btrfs_recursive_destroy(const char *path)
 				name_len = btrfs_stack_root_ref_name_len(ref);
 				name = (char *)(ref + 1);
 				dir_id = btrfs_stack_root_ref_dirid(ref);
-				tmppath = get_btrfs_subvol_path(fd, sh.offset,
-						dir_id, name, name_len);
 				if (!add_btrfs_tree_node(tree, sh.objectid,
-							sh.offset, name,
-							name_len, tmppath)) {
+							 sh.offset, dir_id,
+							 name, name_len)) {
 					ERROR("Out of memory");
 					free_btrfs_tree(tree);
-					free(tmppath);
 					close(fd);
 					return -1;
 				}
-				free(tmppath);
 			}
 			off += sh.len;
 
@@ -840,16 +970,17 @@ static int btrfs_recursive_destroy(const char *path)
 		if (sk->min_objectid >= sk->max_objectid)
 			break;
 	}
-	close(fd);
 
 	/* now actually remove them */
-
-	if (!do_remove_btrfs_children(tree, root_id, path)) {
+	link_btrfs_tree(tree);
+	if (!do_remove_btrfs_children(tree, 0, fd, &by_id)) {
+		close(fd);
 		free_btrfs_tree(tree);
 		ERROR("failed pruning\n");
 		return -1;
 	}
 
+	close(fd);
 	free_btrfs_tree(tree);
 	/* All child subvols have been removed, now remove this one */
 ignore_search:
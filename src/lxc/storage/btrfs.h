@@ -85,6 +85,11 @@ struct btrfs_ioctl_vol_args {
                                    struct btrfs_ioctl_vol_args)
 #define BTRFS_IOC_SNAP_DESTROY _IOW(BTRFS_IOCTL_MAGIC, 15, \
                                    struct btrfs_ioctl_vol_args)
+#define BTRFS_IOC_SNAP_DESTROY_V2 _IOW(BTRFS_IOCTL_MAGIC, 63, \
+                                   struct btrfs_ioctl_vol_args_v2)
+
+/* The subvolume to destroy is given by its id instead of its name. */
+#define BTRFS_SUBVOL_SPEC_BY_ID (1ULL << 4)
 
 #define BTRFS_QGROUP_INHERIT_SET_LIMITS (1ULL << 0)
 
@@ -100,7 +105,11 @@ struct btrfs_ioctl_vol_args_v2 {
 		};
 		unsigned long long unused[4];
 	};
-	char name[BTRFS_SUBVOL_NAME_MAX + 1];
+	union {
+		char name[BTRFS_SUBVOL_NAME_MAX + 1];
+		unsigned long long devid;
+		unsigned long long subvolid;
+	};
 };
 
 /*
@@ -375,13 +384,23 @@ struct lxc_conf;
 struct mytree_node {
 	u64 objid;
 	u64 parentid;
+	/* inode of the directory in the parent holding the subvolume */
+	u64 dir_id;
 	char *name;
+	/* path relative to the parent, only resolved when needed */
 	char *dirname;
+	/* indices into the tree's nodes, -1 if there is none */
+	int first_child;
+	int next_sibling;
 };
 
 struct my_btrfs_tree {
 	struct mytree_node *nodes;
 	int num;
+	int size;
+	/* open addressing hash of node indices by objid */
+	int *index;
+	int index_size;
 };
 
 extern int btrfs_clonepaths(struct lxc_storage *orig, struct lxc_storage *new,
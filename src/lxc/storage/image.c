@@ -0,0 +1,481 @@
+/*
+ * lxc: linux Container library
+ *
+ * (C) Copyright IBM Corp. 2007, 2008
+ *
+ * Authors:
+ * Daniel Lezcano <daniel.lezcano at free.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/loop.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#include "conf.h"
+#include "image.h"
+#include "log.h"
+#include "overlay.h"
+#include "storage.h"
+#include "storage_utils.h"
+#include "utils.h"
+
+#ifndef HAVE_STRLCPY
+#include "include/strlcpy.h"
+#endif
+
+lxc_log_define(image, lxc);
+
+/* An "image:<image>:<upper>" rootfs is a read-only EROFS or squashfs image
+ * with an overlay upper dir on top. The image is attached to a single
+ * read-only loop device which is shared by all containers using it. Since all
+ * of them mount the same block device they share one superblock and thereby
+ * the page cache for the image's contents.
+ */
+
+#define EROFS_SUPER_MAGIC_V1 0xE0F5E1E2
+#define EROFS_SUPER_OFFSET 1024
+#define SQUASHFS_MAGIC 0x73717368
+
+/* Split "image:<image>:<upper>" into its parts. The returned string needs to
+ * be freed and holds both.
+ */
+static char *image_split_src(const char *src, char **image, char **upper)
+{
+	char *dup, *p;
+
+	if (strncmp(src, "image:", 6) == 0)
+		src += 6;
+
+	dup = must_copy_string(src);
+	p = strrchr(dup, ':');
+	if (!p || p == dup || *(p + 1) != '/') {
+		ERROR("Failed to find upper dir in \"%s\"", src);
+		free(dup);
+		return NULL;
+	}
+	*p = '\0';
+
+	*image = dup;
+	*upper = p + 1;
+	return dup;
+}
+
+/* Return the sibling @name of @path. */
+static char *image_sibling(const char *path, const char *name)
+{
+	char *dir, *p, *ret;
+
+	dir = must_copy_string(path);
+	p = strrchr(dir, '/');
+	if (p)
+		*p = '\0';
+
+	ret = must_make_path(dir, name, NULL);
+	free(dir);
+	return ret;
+}
+
+static const char *image_fstype(int fd)
+{
+	ssize_t ret;
+	uint32_t magic;
+
+	ret = pread(fd, &magic, sizeof(magic), EROFS_SUPER_OFFSET);
+	if (ret == sizeof(magic) && le32toh(magic) == EROFS_SUPER_MAGIC_V1)
+		return "erofs";
+
+	ret = pread(fd, &magic, sizeof(magic), 0);
+	if (ret == sizeof(magic) && le32toh(magic) == SQUASHFS_MAGIC)
+		return "squashfs";
+
+	return NULL;
+}
+
+/* Find a read-only loop device backed by the image described by @st. The
+ * returned fd pins the device so it can't be cleared before it is mounted.
+ */
+static int image_find_loop_dev(const struct stat *st, char *loop_dev,
+			       size_t len)
+{
+	DIR *dir;
+	struct dirent *direntp;
+	int fd = -1;
+
+	dir = opendir("/sys/block");
+	if (!dir)
+		return -1;
+
+	while ((direntp = readdir(dir))) {
+		int ret;
+		struct loop_info64 lo64;
+
+		if (strncmp(direntp->d_name, "loop", 4))
+			continue;
+
+		ret = snprintf(loop_dev, len, "/dev/%s", direntp->d_name);
+		if (ret < 0 || (size_t)ret >= len)
+			continue;
+
+		fd = open(loop_dev, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		ret = ioctl(fd, LOOP_GET_STATUS64, &lo64);
+		if (ret == 0 &&
+		    major(lo64.lo_device) == major(st->st_dev) &&
+		    minor(lo64.lo_device) == minor(st->st_dev) &&
+		    lo64.lo_inode == st->st_ino && lo64.lo_offset == 0 &&
+		    lo64.lo_sizelimit == 0 &&
+		    (lo64.lo_flags & LO_FLAGS_READ_ONLY))
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+	closedir(dir);
+
+	return fd;
+}
+
+/* Mount @image read-only on @target, attaching it to a loop device unless an
+ * existing one can be shared. Block devices are mounted directly.
+ */
+static int image_mount_ro(const char *image, const char *target)
+{
+	int fd, ret;
+	struct stat st;
+	const char *fstype;
+	char loop_dev[MAXPATHLEN];
+	int loopfd = -1;
+
+	fd = open(image, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		SYSERROR("Failed to open image \"%s\"", image);
+		return -1;
+	}
+
+	ret = fstat(fd, &st);
+	if (ret < 0) {
+		SYSERROR("Failed to stat image \"%s\"", image);
+		goto on_error;
+	}
+
+	fstype = image_fstype(fd);
+	if (!fstype) {
+		ERROR("Image \"%s\" is neither an erofs nor a squashfs image", image);
+		ret = -1;
+		goto on_error;
+	}
+
+	if (S_ISBLK(st.st_mode)) {
+		(void)strlcpy(loop_dev, image, sizeof(loop_dev));
+		goto do_mount;
+	}
+
+	/* Serialize lookup and setup of the loop device so concurrently
+	 * starting containers attach the image only once.
+	 */
+	ret = flock(fd, LOCK_EX);
+	if (ret < 0) {
+		SYSERROR("Failed to lock image \"%s\"", image);
+		goto on_error;
+	}
+
+	loopfd = image_find_loop_dev(&st, loop_dev, sizeof(loop_dev));
+	if (loopfd >= 0) {
+		DEBUG("Sharing loop device \"%s\" for image \"%s\"", loop_dev, image);
+	} else {
+		/* Direct I/O keeps the image out of the page cache of the
+		 * backing filesystem so only the mounted filesystem caches it.
+		 */
+		loopfd = lxc_prepare_loop_dev(image, loop_dev,
+					      LO_FLAGS_READ_ONLY |
+					      LO_FLAGS_AUTOCLEAR |
+					      LO_FLAGS_DIRECT_IO, 0);
+		if (loopfd < 0) {
+			ERROR("Failed to prepare loop device for image \"%s\"", image);
+			ret = -1;
+			goto on_error;
+		}
+		DEBUG("Prepared loop device \"%s\" for image \"%s\"", loop_dev, image);
+	}
+
+do_mount:
+	ret = mount(loop_dev, target, fstype, MS_RDONLY, NULL);
+	if (ret < 0)
+		SYSERROR("Failed to mount \"%s\" with filesystem \"%s\" on \"%s\"",
+			 loop_dev, fstype, target);
+	else
+		DEBUG("Mounted \"%s\" with filesystem \"%s\" on \"%s\"",
+		      loop_dev, fstype, target);
+
+on_error:
+	/* With LO_FLAGS_AUTOCLEAR the loop device now lives as long as the
+	 * mount does.
+	 */
+	if (loopfd >= 0)
+		close(loopfd);
+	close(fd);
+	return ret;
+}
+
+int image_clonepaths(struct lxc_storage *orig, struct lxc_storage *new,
+		     const char *oldname, const char *cname, const char *oldpath,
+		     const char *lxcpath, int snap, uint64_t newsize,
+		     struct lxc_conf *conf)
+{
+	int ret;
+	char *dup, *image, *ndelta, *odelta;
+	size_t len;
+
+	if (strcmp(orig->type, "image")) {
+		ERROR("image clone of %s container is not supported", orig->type);
+		return -1;
+	}
+
+	if (!orig->src)
+		return -1;
+
+	new->dest = must_make_path(lxcpath, cname, "rootfs", NULL);
+	ret = mkdir_p(new->dest, 0755);
+	if (ret < 0 && errno != EEXIST) {
+		SYSERROR("Failed to create directory \"%s\"", new->dest);
+		return -1;
+	}
+
+	dup = image_split_src(orig->src, &image, &odelta);
+	if (!dup)
+		return -22;
+
+	ndelta = must_make_path(lxcpath, cname, "delta0", NULL);
+	ret = mkdir(ndelta, 0755);
+	if (ret < 0 && errno != EEXIST) {
+		SYSERROR("Failed to create directory \"%s\"", ndelta);
+		free(dup);
+		free(ndelta);
+		return -1;
+	}
+
+	if (am_guest_unpriv()) {
+		if (chown_mapped_root(new->dest, conf) < 0 ||
+		    chown_mapped_root(ndelta, conf) < 0)
+			WARN("Failed to update ownership of %s", ndelta);
+	}
+
+	len = strlen("image:") + strlen(image) + 1 + strlen(ndelta) + 1;
+	new->src = must_realloc(NULL, len);
+	ret = snprintf(new->src, len, "image:%s:%s", image, ndelta);
+	free(dup);
+	free(ndelta);
+	if (ret < 0 || (size_t)ret >= len) {
+		ERROR("Failed to create string");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The image itself is shared, copies and snapshots only copy the upper dir. */
+bool image_copy(struct lxc_conf *conf, struct lxc_storage *orig,
+		struct lxc_storage *new, uint64_t newsize)
+{
+	int ret;
+	char *odup, *ndup, *image, *odelta, *ndelta;
+
+	odup = image_split_src(orig->src, &image, &odelta);
+	if (!odup)
+		return false;
+
+	ndup = image_split_src(new->src, &image, &ndelta);
+	if (!ndup) {
+		free(odup);
+		return false;
+	}
+
+	ret = ovl_do_rsync(odelta, ndelta, conf);
+	free(odup);
+	free(ndup);
+
+	return ret == 0;
+}
+
+int image_create(struct lxc_storage *bdev, const char *dest, const char *n,
+		 struct bdev_specs *specs)
+{
+	int fd, ret;
+	char *delta;
+	size_t len;
+	const char *image;
+
+	if (!specs || !specs->dir) {
+		ERROR("No image specified");
+		return -1;
+	}
+	image = specs->dir;
+
+	if (image[0] != '/' || strstr(image, ":/")) {
+		ERROR("Image path \"%s\" must be absolute and must not contain \":/\"",
+		      image);
+		return -1;
+	}
+
+	fd = open(image, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		SYSERROR("Failed to open image \"%s\"", image);
+		return -1;
+	}
+
+	if (!image_fstype(fd)) {
+		ERROR("Image \"%s\" is neither an erofs nor a squashfs image", image);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	bdev->dest = must_copy_string(dest);
+	ret = mkdir_p(bdev->dest, 0755);
+	if (ret < 0) {
+		SYSERROR("Failed to create directory \"%s\"", bdev->dest);
+		return -1;
+	}
+
+	delta = image_sibling(dest, "delta0");
+	ret = mkdir_p(delta, 0755);
+	if (ret < 0) {
+		SYSERROR("Failed to create directory \"%s\"", delta);
+		free(delta);
+		return -1;
+	}
+
+	len = strlen("image:") + strlen(image) + 1 + strlen(delta) + 1;
+	bdev->src = must_realloc(NULL, len);
+	ret = snprintf(bdev->src, len, "image:%s:%s", image, delta);
+	free(delta);
+	if (ret < 0 || (size_t)ret >= len) {
+		ERROR("Failed to create string");
+		return -1;
+	}
+
+	return 0;
+}
+
+int image_destroy(struct lxc_storage *orig)
+{
+	int ret;
+	char *dup, *image, *upper;
+
+	dup = image_split_src(orig->src, &image, &upper);
+	if (!dup)
+		return -22;
+
+	ret = lxc_rmdir_onedev(upper, NULL);
+	free(dup);
+	return ret;
+}
+
+bool image_detect(const char *path)
+{
+	if (!strncmp(path, "image:", 6))
+		return true;
+
+	return false;
+}
+
+int image_mount(struct lxc_storage *bdev)
+{
+	int ret;
+	size_t len;
+	char *dup, *image, *lower, *upper;
+	struct lxc_storage ovl;
+
+	if (strcmp(bdev->type, "image"))
+		return -22;
+
+	if (!bdev->src || !bdev->dest)
+		return -22;
+
+	dup = image_split_src(bdev->src, &image, &upper);
+	if (!dup)
+		return -22;
+
+	/* The image is mounted on "<container>/image" only long enough to
+	 * set up the overlay which keeps a reference to it.
+	 */
+	lower = image_sibling(upper, "image");
+	ret = mkdir_p(lower, 0755);
+	if (ret < 0) {
+		SYSERROR("Failed to create directory \"%s\"", lower);
+		goto out;
+	}
+
+	ret = image_mount_ro(image, lower);
+	if (ret < 0)
+		goto out;
+
+	ovl = *bdev;
+	ovl.type = "overlay";
+	len = strlen("overlay:") + strlen(lower) + 1 + strlen(upper) + 1;
+	ovl.src = must_realloc(NULL, len);
+	ret = snprintf(ovl.src, len, "overlay:%s:%s", lower, upper);
+	if (ret < 0 || (size_t)ret >= len) {
+		ERROR("Failed to create string");
+		ret = -1;
+	} else {
+		ret = ovl_mount(&ovl);
+	}
+	free(ovl.src);
+
+	if (umount2(lower, MNT_DETACH) < 0)
+		SYSWARN("Failed to detach \"%s\"", lower);
+
+out:
+	free(lower);
+	free(dup);
+	return ret;
+}
+
+int image_umount(struct lxc_storage *bdev)
+{
+	int ret;
+
+	if (strcmp(bdev->type, "image"))
+		return -22;
+
+	if (!bdev->src || !bdev->dest)
+		return -22;
+
+	ret = umount(bdev->dest);
+	if (ret < 0)
+		SYSERROR("Failed to unmount \"%s\"", bdev->dest);
+	else
+		TRACE("Unmounted \"%s\"", bdev->dest);
+
+	return ret;
+}
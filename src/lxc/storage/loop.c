@@ -25,13 +25,16 @@
 #define __STDC_FORMAT_MACROS
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <linux/loop.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 
 #include "log.h"
@@ -40,10 +43,21 @@
 #include "storage_utils.h"
 #include "utils.h"
 
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
 lxc_log_define(loop, lxc);
 
 static int do_loop_create(const char *path, uint64_t size, const char *fstype);
 
+/* Whether the image of @orig can be copied as is for a clone of @newsize. */
+static inline bool loop_can_copy_image(struct lxc_storage *orig,
+				       uint64_t newsize)
+{
+	return strcmp(orig->type, "loop") == 0 && newsize == 0;
+}
+
 /*
  * No idea what the original blockdev will be called, but the copy will be
  * called $lxcpath/$lxcname/rootdev
@@ -58,8 +72,9 @@ int loop_clonepaths(struct lxc_storage *orig, struct lxc_storage *new,
 	char *srcdev;
 	char fstype[100] = "ext4";
 
-	if (snap) {
-		ERROR("The loop storage driver does not support snapshots");
+	if (snap && !loop_can_copy_image(orig, newsize)) {
+		ERROR("The loop storage driver only supports snapshots of loop "
+		      "containers without resizing them");
 		return -1;
 	}
 
@@ -98,10 +113,12 @@ int loop_clonepaths(struct lxc_storage *orig, struct lxc_storage *new,
 		return -1;
 	}
 
-	/* It's tempting to say: if orig->src == loopback and !newsize, then
-	 * copy the loopback file. However, we'd have to make sure to correctly
-	 * keep holes! So punt for now.
+	/* The image of a loop container is copied by loop_copy() or
+	 * loop_snapshot() keeping its holes, see loop_copy_image().
 	 */
+	if (loop_can_copy_image(orig, newsize))
+		return 0;
+
 	if (is_blktype(orig)) {
 		/* detect size */
 		if (!newsize && blk_getsize(orig, &size) < 0) {
@@ -130,6 +147,204 @@ int loop_clonepaths(struct lxc_storage *orig, struct lxc_storage *new,
 	return 0;
 }
 
+static ssize_t lxc_copy_file_range(int fd_in, loff_t *off_in, int fd_out,
+				   loff_t *off_out, size_t len)
+{
+#ifdef __NR_copy_file_range
+	return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out,
+		       len, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Copy [@off, @off + @len) of @srcfd to the same offset in @dstfd. */
+static int loop_copy_range(int srcfd, int dstfd, loff_t off, loff_t len,
+			   bool *use_copy_file_range)
+{
+	char buf[65536];
+
+	while (len > 0) {
+		ssize_t ret;
+		size_t chunk;
+
+		if (*use_copy_file_range) {
+			loff_t in = off, out = off;
+
+			ret = lxc_copy_file_range(srcfd, &in, dstfd, &out,
+						  len > SSIZE_MAX ? SSIZE_MAX : len);
+			if (ret > 0) {
+				off += ret;
+				len -= ret;
+				continue;
+			}
+
+			if (ret == 0)
+				return -1;
+
+			if (errno != ENOSYS && errno != EXDEV &&
+			    errno != EINVAL && errno != EOPNOTSUPP)
+				return -1;
+
+			/* Not supported for these files, copy by hand. */
+			*use_copy_file_range = false;
+		}
+
+		chunk = len > (loff_t)sizeof(buf) ? sizeof(buf) : (size_t)len;
+		ret = pread(srcfd, buf, chunk, off);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (pwrite(dstfd, buf, ret, off) != ret)
+			return -1;
+
+		off += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Copy the loop image @src to the new file @dst. The copy shares all blocks
+ * with the original via FICLONE if the filesystem supports reflinks.
+ * Otherwise only the data regions of @src are copied (with copy_file_range()
+ * where possible) so that the holes of a sparse image stay holes.
+ */
+static int loop_copy_image(const char *src, const char *dst)
+{
+	int ret;
+	int srcfd, dstfd = -1;
+	loff_t off = 0;
+	struct stat st;
+	bool use_copy_file_range = true;
+
+	srcfd = open(src, O_RDONLY | O_CLOEXEC);
+	if (srcfd < 0) {
+		SYSERROR("Failed to open loop file \"%s\"", src);
+		return -1;
+	}
+
+	ret = fstat(srcfd, &st);
+	if (ret < 0) {
+		SYSERROR("Failed to stat loop file \"%s\"", src);
+		goto on_error;
+	}
+
+	dstfd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+		     S_IRUSR | S_IWUSR);
+	if (dstfd < 0) {
+		SYSERROR("Failed to create new loop file \"%s\"", dst);
+		goto on_error;
+	}
+
+	ret = ioctl(dstfd, FICLONE, srcfd);
+	if (ret == 0) {
+		TRACE("Reflinked loop file \"%s\" to \"%s\"", src, dst);
+		goto on_success;
+	}
+	TRACE("Failed to reflink loop file \"%s\", copying it", src);
+
+	ret = ftruncate(dstfd, st.st_size);
+	if (ret < 0) {
+		SYSERROR("Failed to set size of loop file \"%s\"", dst);
+		goto on_error;
+	}
+
+	while (off < st.st_size) {
+		loff_t data, hole;
+
+		data = lseek(srcfd, off, SEEK_DATA);
+		if (data < 0) {
+			/* No more data. */
+			if (errno == ENXIO)
+				break;
+
+			/* SEEK_DATA is not supported, treat it all as data. */
+			if (errno != EINVAL)
+				goto on_error;
+
+			data = off;
+			hole = st.st_size;
+		} else {
+			hole = lseek(srcfd, data, SEEK_HOLE);
+			if (hole < 0)
+				goto on_error;
+		}
+
+		ret = loop_copy_range(srcfd, dstfd, data, hole - data,
+				      &use_copy_file_range);
+		if (ret < 0) {
+			SYSERROR("Failed to copy loop file \"%s\" to \"%s\"",
+				 src, dst);
+			goto on_error;
+		}
+
+		off = hole;
+	}
+
+	ret = fsync(dstfd);
+	if (ret < 0) {
+		SYSERROR("Failed to sync loop file \"%s\"", dst);
+		goto on_error;
+	}
+
+	TRACE("Copied sparse loop file \"%s\" to \"%s\"", src, dst);
+
+on_success:
+	close(srcfd);
+	close(dstfd);
+	return 0;
+
+on_error:
+	close(srcfd);
+	if (dstfd >= 0) {
+		close(dstfd);
+		(void)unlink(dst);
+	}
+
+	return -1;
+}
+
+bool loop_copy(struct lxc_conf *conf, struct lxc_storage *orig,
+	       struct lxc_storage *new, uint64_t newsize)
+{
+	const char *src, *dst;
+
+	src = lxc_storage_get_path(orig->src, orig->type);
+	dst = lxc_storage_get_path(new->src, new->type);
+
+	if (loop_copy_image(src, dst) < 0) {
+		ERROR("Failed to copy loop file \"%s\" to \"%s\"", src, dst);
+		return false;
+	}
+
+	return true;
+}
+
+bool loop_snapshot(struct lxc_conf *conf, struct lxc_storage *orig,
+		   struct lxc_storage *new, uint64_t newsize)
+{
+	const char *src, *dst;
+
+	src = lxc_storage_get_path(orig->src, orig->type);
+	dst = lxc_storage_get_path(new->src, new->type);
+
+	/* On filesystems supporting reflinks this is a copy-on-write
+	 * snapshot, elsewhere a sparse copy.
+	 */
+	if (loop_copy_image(src, dst) < 0) {
+		ERROR("Failed to snapshot loop file \"%s\" to \"%s\"", src, dst);
+		return false;
+	}
+
+	return true;
+}
+
 int loop_create(struct lxc_storage *bdev, const char *dest, const char *n,
 		struct bdev_specs *specs)
 {
@@ -246,14 +461,21 @@ int loop_mount(struct lxc_storage *bdev)
 	/* skip prefix */
 	src = lxc_storage_get_path(bdev->src, bdev->type);
 
-	loopfd = lxc_prepare_loop_dev(src, loname, LO_FLAGS_AUTOCLEAR);
+	/* Let the loop device bypass the page cache so the image contents
+	 * aren't cached twice, once for the loop device and once for the
+	 * backing file. The kernel silently falls back to buffered I/O where
+	 * the backing filesystem doesn't support direct I/O.
+	 */
+	loopfd = lxc_prepare_loop_dev(src, loname,
+				      LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO,
+				      bdev->lo_block_size);
 	if (loopfd < 0) {
 		ERROR("Failed to prepare loop device for loop file \"%s\"", src);
 		return -1;
 	}
 	DEBUG("Prepared loop device \"%s\"", loname);
 
-	ret = mount_unknown_fs(loname, bdev->dest, bdev->mntopts);
+	ret = storage_mount_fs(bdev, loname);
 	if (ret < 0) {
 		ERROR("Failed to mount rootfs \"%s\" on \"%s\" via loop device \"%s\"",
 		      bdev->src, bdev->dest, loname);
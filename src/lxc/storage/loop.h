@@ -40,6 +40,10 @@ extern int loop_clonepaths(struct lxc_storage *orig, struct lxc_storage *new,
 			   uint64_t newsize, struct lxc_conf *conf);
 extern int loop_create(struct lxc_storage *bdev, const char *dest,
 		       const char *n, struct bdev_specs *specs);
+extern bool loop_copy(struct lxc_conf *conf, struct lxc_storage *orig,
+		      struct lxc_storage *new, uint64_t newsize);
+extern bool loop_snapshot(struct lxc_conf *conf, struct lxc_storage *orig,
+			  struct lxc_storage *new, uint64_t newsize);
 extern int loop_destroy(struct lxc_storage *orig);
 extern bool loop_detect(const char *path);
 extern int loop_mount(struct lxc_storage *bdev);
@@ -23,11 +23,14 @@
 
 #define _GNU_SOURCE
 #define __STDC_FORMAT_MACROS
+#include <dirent.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/sysmacros.h>
 #include <sys/wait.h>
@@ -44,6 +47,14 @@
 #include <sys/mkdev.h>
 #endif
 
+#ifndef HAVE_STRLCPY
+#include "include/strlcpy.h"
+#endif
+
+#ifndef HAVE_STRLCAT
+#include "include/strlcat.h"
+#endif
+
 lxc_log_define(lvm, lxc);
 
 struct lvcreate_args {
@@ -246,9 +257,9 @@ int lvm_mount(struct lxc_storage *bdev)
 	src = lxc_storage_get_path(bdev->src, bdev->type);
 
 	/* If we might pass in data sometime, then we'll have to enrich
-	 * mount_unknown_fs().
+	 * storage_mount_fs().
 	 */
-	return mount_unknown_fs(src, bdev->dest, bdev->mntopts);
+	return storage_mount_fs(bdev, src);
 }
 
 int lvm_umount(struct lxc_storage *bdev)
@@ -262,16 +273,122 @@ int lvm_umount(struct lxc_storage *bdev)
 	return umount(bdev->dest);
 }
 
+/* Every lvs invocation rescans all physical volumes so the attributes of the
+ * logical volumes we looked at are remembered for LV_ATTR_CACHE_TIMEOUT
+ * seconds, long enough to cover a burst of clones from the same origin. lvs is
+ * only asked about inactive volumes which have no device to key the entries
+ * on, and another process may remove and recreate a volume in the meantime.
+ * Lookups of volumes that don't exist or that lvs failed to report on are
+ * never cached.
+ */
+#define LV_ATTR_CACHE_TIMEOUT 30
+
+struct lv_attr_entry {
+	char *path;
+	char attr[12];
+	time_t expires;
+	struct lv_attr_entry *next;
+};
+
+static struct lv_attr_entry *lv_attr_cache;
+static pthread_mutex_t lv_attr_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static time_t lv_attr_cache_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return -1;
+
+	return ts.tv_sec;
+}
+
+static bool lv_attr_cache_get(const char *path, char *attr)
+{
+	struct lv_attr_entry **p, *e;
+	time_t now = lv_attr_cache_now();
+	bool found = false;
+
+	pthread_mutex_lock(&lv_attr_cache_mutex);
+	for (p = &lv_attr_cache; (e = *p);) {
+		if (now < 0 || now >= e->expires) {
+			*p = e->next;
+			free(e->path);
+			free(e);
+			continue;
+		}
+
+		if (!found && strcmp(e->path, path) == 0) {
+			memcpy(attr, e->attr, sizeof(e->attr));
+			found = true;
+		}
+
+		p = &e->next;
+	}
+	pthread_mutex_unlock(&lv_attr_cache_mutex);
+
+	return found;
+}
+
+static void lv_attr_cache_set(const char *path, const char *attr)
+{
+	struct lv_attr_entry *e;
+	time_t now;
+
+	now = lv_attr_cache_now();
+	if (now < 0)
+		return;
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		return;
+
+	e->path = strdup(path);
+	if (!e->path) {
+		free(e);
+		return;
+	}
+	(void)strlcpy(e->attr, attr, sizeof(e->attr));
+	e->expires = now + LV_ATTR_CACHE_TIMEOUT;
+
+	pthread_mutex_lock(&lv_attr_cache_mutex);
+	e->next = lv_attr_cache;
+	lv_attr_cache = e;
+	pthread_mutex_unlock(&lv_attr_cache_mutex);
+}
+
+/* A removed logical volume may be recreated with different attributes. */
+static void lv_attr_cache_drop(const char *path)
+{
+	struct lv_attr_entry **p, *e;
+
+	pthread_mutex_lock(&lv_attr_cache_mutex);
+	for (p = &lv_attr_cache; (e = *p);) {
+		if (strcmp(e->path, path) == 0) {
+			*p = e->next;
+			free(e->path);
+			free(e);
+			continue;
+		}
+
+		p = &e->next;
+	}
+	pthread_mutex_unlock(&lv_attr_cache_mutex);
+}
+
 int lvm_compare_lv_attr(const char *path, int pos, const char expected)
 {
 	struct lxc_popen_FILE *f;
 	int ret, status;
 	size_t len;
 	char *cmd;
-	char output[12];
+	char output[12] = {0};
 	int start = 0;
 	const char *lvscmd = "lvs --unbuffered --noheadings -o lv_attr %s 2>/dev/null";
 
+	if (lv_attr_cache_get(path, output))
+		goto compare;
+
 	len = strlen(lvscmd) + strlen(path) + 1;
 	cmd = alloca(len);
 
@@ -290,10 +407,15 @@ int lvm_compare_lv_attr(const char *path, int pos, const char expected)
 		ret = 1;
 
 	status = lxc_pclose(f);
-	/* Assume either vg or lvs do not exist, default comparison to false. */
+	/* Assume either vg or lvs do not exist, default comparison to false.
+	 * The volume may still be created later so this isn't cached.
+	 */
 	if (ret || WEXITSTATUS(status))
-		return 0;
+		output[0] = '\0';
+	else
+		lv_attr_cache_set(path, output);
 
+compare:
 	len = strlen(output);
 	while (start < len && output[start] == ' ')
 		start++;
@@ -304,13 +426,152 @@ int lvm_compare_lv_attr(const char *path, int pos, const char expected)
 	return 0;
 }
 
+/* Build the device-mapper name of the logical volume "/dev/<vg>/<lv>" in
+ * @path followed by @suffix. Dashes in <vg> and <lv> are doubled.
+ */
+static int lvm_dm_name(const char *path, const char *suffix, char *buf,
+		       size_t len)
+{
+	const char *p, *vg, *lv;
+	size_t i = 0;
+
+	lv = strrchr(path, '/');
+	if (!lv || lv == path)
+		return -EINVAL;
+
+	for (vg = lv - 1; vg > path && *(vg - 1) != '/'; vg--)
+		;
+
+	for (p = vg; *p; p++) {
+		if (p == lv) {
+			if (i + 1 >= len)
+				return -E2BIG;
+			buf[i++] = '-';
+			continue;
+		}
+
+		if (*p == '-') {
+			if (i + 1 >= len)
+				return -E2BIG;
+			buf[i++] = '-';
+		}
+
+		if (i + 1 >= len)
+			return -E2BIG;
+		buf[i++] = *p;
+	}
+	buf[i] = '\0';
+
+	if (strlcat(buf, suffix, len) >= len)
+		return -E2BIG;
+
+	return 0;
+}
+
+/* Thin volumes are mapped onto the "<vg>-<pool>-tpool" device of their thin
+ * pool. Returns -ENOENT if @path isn't an active logical volume.
+ */
+static int lvm_sysfs_is_thin_volume(const char *path)
+{
+	int ret;
+	DIR *dir;
+	struct dirent *direntp;
+	struct stat st;
+	char slaves[MAXPATHLEN];
+	int fret = 0;
+
+	ret = stat(path, &st);
+	if (ret < 0 || !S_ISBLK(st.st_mode))
+		return -ENOENT;
+
+	ret = snprintf(slaves, sizeof(slaves), "/sys/dev/block/%u:%u/slaves",
+		       major(st.st_rdev), minor(st.st_rdev));
+	if (ret < 0 || (size_t)ret >= sizeof(slaves))
+		return -ENOENT;
+
+	dir = opendir(slaves);
+	if (!dir)
+		return -ENOENT;
+
+	while ((direntp = readdir(dir))) {
+		int fd;
+		ssize_t bytes;
+		char name[MAXPATHLEN], file[MAXPATHLEN];
+
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+
+		ret = snprintf(file, sizeof(file), "%s/%s/dm/name", slaves,
+			       direntp->d_name);
+		if (ret < 0 || (size_t)ret >= sizeof(file))
+			continue;
+
+		fd = open(file, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		bytes = lxc_read_nointr(fd, name, sizeof(name) - 1);
+		close(fd);
+		if (bytes <= 0)
+			continue;
+		name[bytes] = '\0';
+		name[strcspn(name, "\n")] = '\0';
+
+		bytes = strlen(name);
+		if (bytes > 6 && !strcmp(name + bytes - 6, "-tpool")) {
+			fret = 1;
+			break;
+		}
+	}
+	closedir(dir);
+
+	return fret;
+}
+
+/* An active thin pool has a "<vg>-<pool>-tpool" device. Returns -ENOENT if it
+ * doesn't exist since the pool might merely be inactive.
+ */
+static int lvm_sysfs_is_thin_pool(const char *path)
+{
+	int ret;
+	char name[MAXPATHLEN];
+
+	ret = snprintf(name, sizeof(name), "/dev/mapper/");
+	if (ret < 0 || (size_t)ret >= sizeof(name))
+		return -ENOENT;
+
+	ret = lvm_dm_name(path, "-tpool", name + ret, sizeof(name) - ret);
+	if (ret < 0)
+		return -ENOENT;
+
+	if (access(name, F_OK) == 0)
+		return 1;
+
+	return -ENOENT;
+}
+
 int lvm_is_thin_volume(const char *path)
 {
+	int ret;
+
+	path = lxc_storage_get_path((char *)path, "lvm");
+
+	ret = lvm_sysfs_is_thin_volume(path);
+	if (ret >= 0)
+		return ret;
+
 	return lvm_compare_lv_attr(path, 6, 't');
 }
 
 int lvm_is_thin_pool(const char *path)
 {
+	int ret;
+
+	ret = lvm_sysfs_is_thin_pool(path);
+	if (ret >= 0)
+		return ret;
+
 	return lvm_compare_lv_attr(path, 0, 't');
 }
 
@@ -393,6 +654,14 @@ static int lvm_snapshot(struct lxc_storage *orig, const char *path, uint64_t siz
 		return -1;
 	}
 
+	/* Only xfs and btrfs refuse to mount two filesystems with the same
+	 * uuid so don't fork for anything else.
+	 */
+	if (strcmp(fstype, "xfs") && strcmp(fstype, "btrfs")) {
+		free(pathdup);
+		return 0;
+	}
+
 	/* repair path */
 	lv--;
 	*lv = repairchar;
@@ -595,6 +864,7 @@ int lvm_destroy(struct lxc_storage *orig)
 	struct lvcreate_args cmd_args = {0};
 
 	cmd_args.lv = lxc_storage_get_path(orig->src, "lvm");
+	lv_attr_cache_drop(cmd_args.lv);
 	ret = run_command(cmd_output, sizeof(cmd_output),
 			  lvm_destroy_exec_wrapper, (void *)&cmd_args);
 	if (ret < 0) {
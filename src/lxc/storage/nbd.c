@@ -156,7 +156,7 @@ int nbd_mount(struct lxc_storage *bdev)
 		if (!wait_for_partition(path))
 			return -2;
 	}
-	ret = mount_unknown_fs(path, bdev->dest, bdev->mntopts);
+	ret = storage_mount_fs(bdev, path);
 	if (ret < 0)
 		ERROR("Error mounting %s", bdev->src);
 
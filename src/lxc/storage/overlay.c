@@ -22,10 +22,20 @@
  */
 
 #define _GNU_SOURCE
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
 
 #include "conf.h"
 #include "confile.h"
@@ -39,15 +49,28 @@
 
 lxc_log_define(overlay, lxc);
 
+/* Directory below the lxcpath holding the shared read-only layers. */
+#define OVL_LAYERS_DIR ".layers"
+
+/* Number of layers after which the shared layers are squashed into one. */
+#define OVL_MAX_LAYERS 16
+
 static char *ovl_name;
 static char *ovl_version[] = {"overlay", "overlayfs"};
 
 static char *ovl_detect_name(void);
-static int ovl_do_rsync(const char *src, const char *dest,
-			struct lxc_conf *conf);
 static int ovl_remount_on_enodev(const char *lower, const char *target,
 				 const char *name, unsigned long mountflags,
 				 const void *options);
+static char *ovl_snapshot_lowers(const char *lxcpath, const char *lowers,
+				 const char *upper, const char *ndelta,
+				 struct lxc_conf *conf);
+static int ovl_ref_name(const char *upper, char *name, size_t len);
+static int ovl_layers_ref(const char *lowers, const char *upper,
+			  const char *name, bool get);
+static char *ovl_concat(const char *a, const char *b, const char *c);
+static int ovl_tmpfs_mount(const char *upper, const char *target,
+			   uint64_t size);
 
 int ovl_clonepaths(struct lxc_storage *orig, struct lxc_storage *new, const char *oldname,
 		   const char *cname, const char *oldpath, const char *lxcpath,
@@ -188,8 +211,8 @@ int ovl_clonepaths(struct lxc_storage *orig, struct lxc_storage *new, const char
 	} else if (!strcmp(orig->type, "overlayfs") ||
 		   !strcmp(orig->type, "overlay")) {
 		char *clean_old_path, *clean_new_path;
-		char *lastslash, *ndelta, *nsrc, *odelta, *osrc, *s1, *s2, *s3,
-		    *work;
+		char *lastslash, *lowers, *ndelta, *nsrc, *odelta, *osrc, *s1,
+		    *s2, *s3, *work;
 		int ret, lastslashidx;
 		size_t len, name_len;
 
@@ -205,7 +228,7 @@ int ovl_clonepaths(struct lxc_storage *orig, struct lxc_storage *new, const char
 		else if (strncmp(osrc, "overlayfs:", 10) == 0)
 			nsrc += 10;
 
-		odelta = strchr(nsrc, ':');
+		odelta = strrchr(nsrc, ':');
 		if (!odelta) {
 			ERROR("Failed to find \":\" in \"%s\"", nsrc);
 			free(osrc);
@@ -272,6 +295,18 @@ int ovl_clonepaths(struct lxc_storage *orig, struct lxc_storage *new, const char
 		}
 		free(work);
 
+		/* Instead of copying the original's upper dir into our own
+		 * upper dir it becomes a shared read-only layer below it.
+		 */
+		lowers = ovl_snapshot_lowers(lxcpath, nsrc, odelta, ndelta,
+					     conf);
+		free(osrc);
+		if (!lowers) {
+			ERROR("Failed to create layers for \"%s\"", orig->src);
+			free(ndelta);
+			return -1;
+		}
+
 		/* strlen("overlay:") = 8
 		 * +
 		 * strlen(delta)
@@ -282,24 +317,24 @@ int ovl_clonepaths(struct lxc_storage *orig, struct lxc_storage *new, const char
 		 * +
 		 * \0
 		 */
-		len = 8 + strlen(ndelta) + 1 + strlen(nsrc) + 1;
+		len = 8 + strlen(ndelta) + 1 + strlen(lowers) + 1;
 		new->src = malloc(len);
 		if (!new->src) {
-			free(osrc);
+			free(lowers);
 			free(ndelta);
 			ERROR("Failed to allocate memory");
 			return -ENOMEM;
 		}
-		ret = snprintf(new->src, len, "overlay:%s:%s", nsrc, ndelta);
+		ret = snprintf(new->src, len, "overlay:%s:%s", lowers, ndelta);
 		if (ret < 0 || (size_t)ret >= len) {
 			ERROR("Failed to create string");
-			free(osrc);
+			free(lowers);
 			free(ndelta);
 			return -1;
 		}
 
-		ret = ovl_do_rsync(odelta, ndelta, conf);
-		free(osrc);
+		ret = ovl_layers_ref(lowers, ndelta, NULL, true);
+		free(lowers);
 		free(ndelta);
 		if (ret < 0)
 			return -1;
@@ -453,7 +488,10 @@ int ovl_create(struct lxc_storage *bdev, const char *dest, const char *n,
 
 int ovl_destroy(struct lxc_storage *orig)
 {
+	int ret;
+	char *lowers;
 	char *upper = orig->src;
+	char name[17] = {0};
 
 	/* For an overlay container the rootfs is considered immutable
 	 * and cannot be removed when restoring from a snapshot.
@@ -466,12 +504,28 @@ int ovl_destroy(struct lxc_storage *orig)
 	else if (strncmp(upper, "overlayfs:", 10) == 0)
 		upper += 10;
 
-	upper = strchr(upper, ':');
-	if (!upper)
+	lowers = must_copy_string(upper);
+	upper = strrchr(lowers, ':');
+	if (!upper) {
+		free(lowers);
 		return -22;
+	}
+	*upper = '\0';
 	upper++;
 
-	return lxc_rmdir_onedev(upper, NULL);
+	/* The references are named after the upper dir which is about to go
+	 * away. They are only dropped once it is gone so the layers stay around
+	 * for a container that could only partially be removed.
+	 */
+	if (ovl_ref_name(upper, name, sizeof(name)) < 0)
+		name[0] = '\0';
+
+	ret = lxc_rmdir_onedev(upper, NULL);
+	if (ret == 0 && name[0] != '\0')
+		(void)ovl_layers_ref(lowers, upper, name, false);
+	free(lowers);
+
+	return ret;
 }
 
 bool ovl_detect(const char *path)
@@ -489,6 +543,7 @@ int ovl_mount(struct lxc_storage *bdev)
 {
 	char *tmp, *options, *dup, *lower, *upper;
 	char *options_work, *work, *lastslash;
+	char *tmpfs = NULL, *tmpfs_lower = NULL, *tmpfs_upper = NULL;
 	int lastslashidx;
 	size_t len, len2;
 	unsigned long mntflags;
@@ -589,6 +644,27 @@ int ovl_mount(struct lxc_storage *bdev)
 		return -22;
 	}
 
+	/* With a tmpfs upper dir the on-disk upper dir becomes the topmost
+	 * lower layer. Changes only ever reach the tmpfs which is mounted in
+	 * the container's mount namespace and goes away with it.
+	 */
+	if (bdev->tmpfs_size > 0) {
+		ret = ovl_tmpfs_mount(upper, work, bdev->tmpfs_size);
+		if (ret < 0) {
+			free(mntdata);
+			free(dup);
+			free(work);
+			return -22;
+		}
+
+		tmpfs = work;
+		tmpfs_lower = ovl_concat(upper, ":", lower);
+		tmpfs_upper = ovl_concat(tmpfs, "/upper", "");
+		work = ovl_concat(tmpfs, "/work", "");
+		lower = tmpfs_lower;
+		upper = tmpfs_upper;
+	}
+
 	/*
 	 * TODO:
 	 * We should check whether bdev->src is a blockdev but for now only
@@ -606,7 +682,7 @@ int ovl_mount(struct lxc_storage *bdev)
 		       strlen("upperdir=,lowerdir=,workdir=") +
 		       strlen(mntdata) + 1;
 		options_work = alloca(len2);
-		ret2 = snprintf(options, len2,
+		ret2 = snprintf(options_work, len2,
 				"upperdir=%s,lowerdir=%s,workdir=%s,%s", upper,
 				lower, work, mntdata);
 	} else {
@@ -626,10 +702,8 @@ int ovl_mount(struct lxc_storage *bdev)
 
 	if (ret < 0 || ret >= len || ret2 < 0 || ret2 >= len2) {
 		ERROR("Failed to create string");
-		free(mntdata);
-		free(dup);
-		free(work);
-		return -1;
+		ret = -1;
+		goto out;
 	}
 
 	/* Assume we need a workdir as we are on a overlay version >= v22. */
@@ -655,8 +729,16 @@ int ovl_mount(struct lxc_storage *bdev)
 		     bdev->dest, options_work);
 	}
 
+out:
+	if (ret < 0 && tmpfs && umount2(tmpfs, MNT_DETACH) < 0)
+		SYSWARN("Failed to detach tmpfs \"%s\"", tmpfs);
+
+	free(mntdata);
 	free(dup);
 	free(work);
+	free(tmpfs);
+	free(tmpfs_lower);
+	free(tmpfs_upper);
 	return ret;
 }
 
@@ -688,8 +770,9 @@ const char *ovl_get_lower(const char *rootfs_path)
 	else if (strncmp(rootfs_path, "overlayfs:", 10) == 0)
 		s1 += 10;
 
-	s1 = strstr(s1, ":/");
-	if (!s1)
+	/* With stacked layers the upper dir follows the last lower dir. */
+	s1 = strrchr(s1, ':');
+	if (!s1 || s1[1] != '/')
 		return NULL;
 	s1++;
 
@@ -947,8 +1030,7 @@ static char *ovl_detect_name(void)
 	return v;
 }
 
-static int ovl_do_rsync(const char *src, const char *dest,
-			struct lxc_conf *conf)
+int ovl_do_rsync(const char *src, const char *dest, struct lxc_conf *conf)
 {
 	int ret = -1;
 	struct rsync_data_char rdata = {0};
@@ -969,3 +1051,799 @@ static int ovl_do_rsync(const char *src, const char *dest,
 
 	return ret;
 }
+
+/* Layer store
+ *
+ * Snapshots of overlay containers don't get a private copy of the original's
+ * upper dir. Instead the upper dir is committed once as a read-only layer to
+ * "<lxcpath>/.layers/<id>/root" which all snapshots taken while it is
+ * unchanged share. The <id> is a digest of the contents and the metadata of
+ * the committed upper dir, so equal upper dirs of different containers share
+ * a layer too. A container using a layer holds a reference in
+ * "<lxcpath>/.layers/<id>/refs/" and the layer is removed together with its
+ * last user. References are named after the inode of the container's upper
+ * dir so they stay valid when the container's directory is renamed.
+ */
+
+static char *ovl_concat(const char *a, const char *b, const char *c)
+{
+	size_t len = strlen(a) + strlen(b) + strlen(c) + 1;
+	char *s;
+
+	s = must_realloc(NULL, len);
+	(void)snprintf(s, len, "%s%s%s", a, b, c);
+
+	return s;
+}
+
+static int ovl_layers_lock(const char *layers)
+{
+	int fd, ret;
+	char *path;
+
+	path = must_make_path(layers, ".lock", NULL);
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		SYSERROR("Failed to open \"%s\"", path);
+		free(path);
+		return -1;
+	}
+	free(path);
+
+	ret = flock(fd, LOCK_EX);
+	if (ret < 0) {
+		SYSERROR("Failed to lock layer store \"%s\"", layers);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Returns 1 if @path is an empty directory, 0 if it has entries and -1 if it
+ * couldn't be read.
+ */
+static int ovl_dir_is_empty(const char *path)
+{
+	DIR *dir;
+	struct dirent *direntp;
+	int empty = 1;
+
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((direntp = readdir(dir))) {
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+
+		empty = 0;
+		break;
+	}
+	closedir(dir);
+
+	return empty;
+}
+
+/* Hash what a copy of the file with @st preserves. The inode and the ctime
+ * depend on where the file lives and are left out, as are the size and the
+ * mtime of directories which change with every entry added to them.
+ */
+static uint64_t ovl_stat_digest(const struct stat *st, uint64_t h)
+{
+	bool dir = S_ISDIR(st->st_mode);
+	uint64_t v[] = {
+		st->st_mode,
+		st->st_uid,
+		st->st_gid,
+		dir ? 0 : st->st_size,
+		st->st_rdev,
+		dir ? 0 : st->st_mtim.tv_sec,
+		dir ? 0 : st->st_mtim.tv_nsec,
+	};
+
+	return fnv_64a_buf(v, sizeof(v), h);
+}
+
+/* Hash the extended attributes of @name in @dfd in the order the filesystem
+ * lists them.
+ */
+static int ovl_xattr_digest(int dfd, const char *name, uint64_t *h)
+{
+	ssize_t len, vlen;
+	char *list, *key;
+	char path[PATH_MAX];
+	int ret;
+	int fret = -1;
+
+	ret = snprintf(path, sizeof(path), "/proc/self/fd/%d/%s", dfd, name);
+	if (ret < 0 || (size_t)ret >= sizeof(path))
+		return -1;
+
+	len = llistxattr(path, NULL, 0);
+	if (len < 0)
+		return (errno == ENOTSUP) ? 0 : -1;
+	if (len == 0)
+		return 0;
+
+	list = malloc(len);
+	if (!list)
+		return -1;
+
+	len = llistxattr(path, list, len);
+	if (len < 0)
+		goto on_error;
+
+	for (key = list; key < list + len; key += strlen(key) + 1) {
+		char *value;
+
+		vlen = lgetxattr(path, key, NULL, 0);
+		if (vlen < 0)
+			goto on_error;
+
+		value = malloc(vlen + 1);
+		if (!value)
+			goto on_error;
+
+		vlen = lgetxattr(path, key, value, vlen);
+		if (vlen >= 0) {
+			*h = fnv_64a_buf(key, strlen(key) + 1, *h);
+			*h = fnv_64a_buf(value, vlen, *h);
+		}
+		free(value);
+		if (vlen < 0)
+			goto on_error;
+	}
+
+	fret = 0;
+
+on_error:
+	free(list);
+	return fret;
+}
+
+/* Hash the contents of the regular file or the target of the symlink @name
+ * in @dfd. Files we aren't allowed to read are identified by their device,
+ * inode and ctime instead. That only prevents sharing the layer, never shares
+ * a layer with different contents.
+ */
+static int ovl_data_digest(int dfd, const char *name, const struct stat *st,
+			   uint64_t *h)
+{
+	int fd;
+	ssize_t len;
+	char buf[8192];
+
+	if (S_ISLNK(st->st_mode)) {
+		len = readlinkat(dfd, name, buf, sizeof(buf));
+		if (len < 0)
+			return -1;
+
+		*h = fnv_64a_buf(buf, len, *h);
+		return 0;
+	}
+
+	if (!S_ISREG(st->st_mode))
+		return 0;
+
+	fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		uint64_t v[] = {
+			st->st_dev,
+			st->st_ino,
+			st->st_ctim.tv_sec,
+			st->st_ctim.tv_nsec,
+		};
+
+		if (errno != EACCES && errno != EPERM)
+			return -1;
+
+		*h = fnv_64a_buf(v, sizeof(v), *h);
+		return 0;
+	}
+
+	while ((len = lxc_read_nointr(fd, buf, sizeof(buf))) > 0)
+		*h = fnv_64a_buf(buf, len, *h);
+	close(fd);
+
+	return len < 0 ? -1 : 0;
+}
+
+static int ovl_cmp_names(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Hash the names, metadata, extended attributes and contents of everything
+ * below @dfd. Entries are visited in name order so that equal trees hash the
+ * same whichever filesystem they live on.
+ */
+static int ovl_tree_digest(int dfd, uint64_t *h)
+{
+	DIR *dir;
+	struct dirent *direntp;
+	char **it, **names = NULL;
+	int ret = 0;
+
+	dir = fdopendir(dfd);
+	if (!dir) {
+		close(dfd);
+		return -1;
+	}
+
+	while ((direntp = readdir(dir))) {
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+
+		ret = lxc_append_string(&names, direntp->d_name);
+		if (ret < 0)
+			goto out;
+	}
+
+	if (!names)
+		goto out;
+
+	qsort(names, lxc_array_len((void **)names), sizeof(*names),
+	      ovl_cmp_names);
+
+	for (it = names; *it; it++) {
+		struct stat st;
+
+		ret = fstatat(dirfd(dir), *it, &st, AT_SYMLINK_NOFOLLOW);
+		if (ret < 0)
+			break;
+
+		*h = fnv_64a_buf(*it, strlen(*it) + 1, *h);
+		*h = ovl_stat_digest(&st, *h);
+
+		ret = ovl_xattr_digest(dirfd(dir), *it, h);
+		if (ret < 0)
+			break;
+
+		if (S_ISDIR(st.st_mode)) {
+			int fd;
+
+			fd = openat(dirfd(dir), *it,
+				    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+			if (fd < 0) {
+				ret = -1;
+				break;
+			}
+
+			ret = ovl_tree_digest(fd, h);
+		} else {
+			ret = ovl_data_digest(dirfd(dir), *it, &st, h);
+		}
+		if (ret < 0)
+			break;
+	}
+
+out:
+	lxc_free_array((void **)names, free);
+	closedir(dir);
+
+	return ret;
+}
+
+/* Return the layer directory if @lower is the root of a layer in a layer
+ * store.
+ */
+static char *ovl_layer_of(const char *lower)
+{
+	size_t len = strlen(lower);
+	const char *p;
+
+	if (len < sizeof("/" OVL_LAYERS_DIR "/x/root") - 1 ||
+	    strcmp(lower + len - 5, "/root"))
+		return NULL;
+
+	len -= 5;
+	for (p = lower + len - 1; p > lower && *p != '/'; p--)
+		;
+
+	if (p - lower < (ptrdiff_t)(sizeof("/" OVL_LAYERS_DIR) - 1) ||
+	    strncmp(p - (sizeof("/" OVL_LAYERS_DIR) - 1), "/" OVL_LAYERS_DIR "/",
+		    sizeof("/" OVL_LAYERS_DIR "/") - 1))
+		return NULL;
+
+	return strndup(lower, len);
+}
+
+/* Take (@get == true) or drop the reference @name of the container with the
+ * upper dir @upper to @layer. Dropping the last reference removes the layer.
+ * Must be called with the layer store locked.
+ */
+static int ovl_layer_ref_locked(const char *layer, const char *name,
+				const char *upper, bool get)
+{
+	int fd, ret;
+	char *refs, *ref;
+	int fret = -1;
+
+	refs = must_make_path(layer, "refs", NULL);
+	ref = must_make_path(refs, name, NULL);
+
+	if (get) {
+		ret = mkdir(refs, 0700);
+		if (ret < 0 && errno != EEXIST) {
+			SYSERROR("Failed to create directory \"%s\"", refs);
+			goto on_error_free;
+		}
+
+		fd = open(ref, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (fd < 0) {
+			SYSERROR("Failed to create reference \"%s\"", ref);
+			goto on_error_free;
+		}
+
+		ret = lxc_write_nointr(fd, upper, strlen(upper));
+		close(fd);
+		if (ret < 0)
+			goto on_error_free;
+
+		TRACE("Took reference \"%s\" to layer \"%s\"", ref, layer);
+	} else {
+		ret = unlink(ref);
+		if (ret < 0 && errno != ENOENT)
+			SYSWARN("Failed to remove reference \"%s\"", ref);
+
+		/* Only a refs/ dir we could read and found empty means that
+		 * nobody uses the layer anymore.
+		 */
+		ret = ovl_dir_is_empty(refs);
+		if (ret < 0) {
+			SYSWARN("Keeping layer \"%s\" as its references can't be read",
+				layer);
+		} else if (ret > 0) {
+			ret = lxc_rmdir_onedev(layer, NULL);
+			if (ret < 0)
+				WARN("Failed to remove unused layer \"%s\"", layer);
+			else
+				INFO("Removed unused layer \"%s\"", layer);
+		}
+	}
+
+	fret = 0;
+
+on_error_free:
+	free(refs);
+	free(ref);
+	return fret;
+}
+
+static int ovl_layer_ref(const char *layer, const char *name,
+			 const char *upper, bool get)
+{
+	int lockfd, ret;
+	char *layers;
+
+	layers = must_copy_string(layer);
+	*strrchr(layers, '/') = '\0';
+
+	lockfd = ovl_layers_lock(layers);
+	free(layers);
+	if (lockfd < 0)
+		return -1;
+
+	ret = ovl_layer_ref_locked(layer, name, upper, get);
+	close(lockfd);
+	return ret;
+}
+
+/* References are named after the device and inode of the upper dir so they
+ * stay valid when the container is renamed.
+ */
+static int ovl_ref_name(const char *upper, char *name, size_t len)
+{
+	int ret;
+	struct stat st;
+	uint64_t key[2];
+
+	ret = stat(upper, &st);
+	if (ret < 0) {
+		SYSERROR("Failed to stat \"%s\"", upper);
+		return -1;
+	}
+
+	key[0] = st.st_dev;
+	key[1] = st.st_ino;
+	ret = snprintf(name, len, "%016" PRIx64,
+		       fnv_64a_buf(key, sizeof(key), FNV1A_64_INIT));
+	if (ret < 0 || (size_t)ret >= len)
+		return -1;
+
+	return 0;
+}
+
+/* Take or drop references of @upper to all layers from a layer store in the
+ * colon separated @lowers. Without @name the reference name is computed from
+ * @upper.
+ */
+static int ovl_layers_ref(const char *lowers, const char *upper,
+			  const char *name, bool get)
+{
+	char **layers, **it;
+	char buf[17] = {0};
+	int fret = 0;
+
+	layers = lxc_string_split(lowers, ':');
+	if (!layers)
+		return -1;
+
+	for (it = layers; *it; it++) {
+		char *layer;
+
+		layer = ovl_layer_of(*it);
+		if (!layer)
+			continue;
+
+		if (!name) {
+			if (ovl_ref_name(upper, buf, sizeof(buf)) < 0) {
+				free(layer);
+				fret = -1;
+				break;
+			}
+			name = buf;
+		}
+
+		if (ovl_layer_ref(layer, name, upper, get) < 0)
+			fret = -1;
+		free(layer);
+	}
+	lxc_free_array((void **)layers, free);
+
+	return fret;
+}
+
+struct ovl_squash_args {
+	const char *lowers;
+	const char *mnt;
+	const char *dest;
+};
+
+/* Mount the read-only union of the layers in a private mount namespace and
+ * copy it. The kernel resolves whiteouts and opaque directories for us.
+ */
+static int ovl_squash_exec_wrapper(void *data)
+{
+	int ret;
+	char *options;
+	struct ovl_squash_args *args = data;
+
+	ret = unshare(CLONE_NEWNS);
+	if (ret < 0) {
+		SYSERROR("Failed to unshare CLONE_NEWNS");
+		return -1;
+	}
+
+	ret = mount(NULL, "/", NULL, MS_SLAVE | MS_REC, NULL);
+	if (ret < 0) {
+		SYSERROR("Failed to make \"/\" a slave mount");
+		return -1;
+	}
+
+	if (!ovl_name)
+		ovl_name = ovl_detect_name();
+
+	options = ovl_concat("lowerdir=", args->lowers, "");
+	ret = ovl_remount_on_enodev(args->lowers, args->mnt, ovl_name,
+				    MS_RDONLY, options);
+	free(options);
+	if (ret < 0) {
+		SYSERROR("Failed to mount layers \"%s\"", args->lowers);
+		return -1;
+	}
+
+	return lxc_rsync_exec(args->mnt, args->dest);
+}
+
+/* Create the layer "<layers>/<id>" from @upper, or if @upper is NULL by
+ * squashing the colon separated @lowers. Reuses an existing layer with the
+ * same id. The reference @name of the container with the upper dir @ref_upper
+ * is taken before the layer store is unlocked so that the layer can't be
+ * removed in between. Returns the path to the layer's root.
+ */
+static char *ovl_layer_create(const char *layers, uint64_t id,
+			      const char *upper, const char *lowers,
+			      const char *name, const char *ref_upper,
+			      struct lxc_conf *conf)
+{
+	int lockfd, ret;
+	char *layer, *root, *tmp, *tmproot;
+	char id_name[17];
+
+	ret = snprintf(id_name, sizeof(id_name), "%016" PRIx64, id);
+	if (ret < 0 || (size_t)ret >= sizeof(id_name))
+		return NULL;
+
+	layer = must_make_path(layers, id_name, NULL);
+	root = must_make_path(layer, "root", NULL);
+	tmp = ovl_concat(layer, ".tmp", "");
+	tmproot = must_make_path(tmp, "root", NULL);
+
+	lockfd = ovl_layers_lock(layers);
+	if (lockfd < 0)
+		goto on_error;
+
+	if (dir_exists(root)) {
+		INFO("Reusing layer \"%s\"", layer);
+		goto on_success;
+	}
+
+	if (dir_exists(tmp))
+		(void)lxc_rmdir_onedev(tmp, NULL);
+
+	ret = mkdir_p(tmproot, 0755);
+	if (ret < 0) {
+		SYSERROR("Failed to create directory \"%s\"", tmproot);
+		goto on_error;
+	}
+
+	if (am_guest_unpriv()) {
+		if (chown_mapped_root(tmp, conf) < 0 ||
+		    chown_mapped_root(tmproot, conf) < 0)
+			WARN("Failed to update ownership of %s", tmp);
+	}
+
+	if (upper) {
+		ret = ovl_do_rsync(upper, tmproot, conf);
+	} else {
+		char cmd_output[MAXPATHLEN] = {0};
+		struct ovl_squash_args args = {
+			.lowers = lowers,
+			.dest = tmproot,
+		};
+
+		args.mnt = must_make_path(tmp, "mnt", NULL);
+		ret = mkdir(args.mnt, 0755);
+		if (ret == 0)
+			ret = run_command(cmd_output, sizeof(cmd_output),
+					  ovl_squash_exec_wrapper, &args);
+		if (ret < 0)
+			ERROR("Failed to squash layers \"%s\"%s%s", lowers,
+			      cmd_output[0] != '\0' ? ": " : "",
+			      cmd_output[0] != '\0' ? cmd_output : "");
+		else
+			(void)rmdir(args.mnt);
+		free((char *)args.mnt);
+	}
+	if (ret < 0) {
+		(void)lxc_rmdir_onedev(tmp, NULL);
+		goto on_error;
+	}
+
+	ret = rename(tmp, layer);
+	if (ret < 0) {
+		SYSERROR("Failed to rename \"%s\" to \"%s\"", tmp, layer);
+		(void)lxc_rmdir_onedev(tmp, NULL);
+		goto on_error;
+	}
+
+	INFO("Created layer \"%s\"", layer);
+
+on_success:
+	ret = ovl_layer_ref_locked(layer, name, ref_upper, true);
+	if (ret < 0)
+		goto on_error;
+
+	close(lockfd);
+	free(layer);
+	free(tmp);
+	free(tmproot);
+	return root;
+
+on_error:
+	if (lockfd >= 0)
+		close(lockfd);
+	free(layer);
+	free(root);
+	free(tmp);
+	free(tmproot);
+	return NULL;
+}
+
+/* Compute the lower layers for a snapshot of an overlay container with the
+ * colon separated lower layers @lowers and the upper dir @upper. The upper dir
+ * is committed as a new layer on top unless it is empty. Once there are more
+ * than OVL_MAX_LAYERS layers the layers from the layer store are squashed
+ * into one so that the mount options don't grow without bounds. New layers
+ * are referenced by the snapshot with the upper dir @ndelta.
+ */
+static char *ovl_snapshot_lowers(const char *lxcpath, const char *lowers,
+				 const char *upper, const char *ndelta,
+				 struct lxc_conf *conf)
+{
+	int ret;
+	char *layers, *result, *top = NULL;
+	char **stack = NULL;
+	size_t nr, nr_store = 0;
+	char name[17];
+
+	ret = ovl_ref_name(ndelta, name, sizeof(name));
+	if (ret < 0)
+		return NULL;
+
+	layers = must_make_path(lxcpath, OVL_LAYERS_DIR, NULL);
+	ret = mkdir_p(layers, 0755);
+	if (ret < 0) {
+		SYSERROR("Failed to create directory \"%s\"", layers);
+		free(layers);
+		return NULL;
+	}
+
+	ret = ovl_dir_is_empty(upper);
+	if (ret < 0) {
+		SYSERROR("Failed to read \"%s\"", upper);
+		free(layers);
+		return NULL;
+	}
+
+	if (ret == 0) {
+		int fd;
+		struct stat st;
+		uint64_t id;
+
+		fd = open(upper, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			SYSERROR("Failed to open \"%s\"", upper);
+			if (fd >= 0)
+				close(fd);
+			free(layers);
+			return NULL;
+		}
+
+		id = ovl_stat_digest(&st, FNV1A_64_INIT);
+		ret = ovl_tree_digest(fd, &id);
+		if (ret < 0) {
+			SYSERROR("Failed to scan \"%s\"", upper);
+			free(layers);
+			return NULL;
+		}
+
+		top = ovl_layer_create(layers, id, upper, NULL, name, ndelta,
+				       conf);
+		if (!top) {
+			free(layers);
+			return NULL;
+		}
+	}
+
+	if (top)
+		result = ovl_concat(top, ":", lowers);
+	else
+		result = must_copy_string(lowers);
+
+	stack = lxc_string_split(result, ':');
+	if (!stack)
+		goto on_success;
+
+	nr = lxc_array_len((void **)stack);
+	if (nr <= OVL_MAX_LAYERS)
+		goto on_success;
+
+	/* Squashing needs a mount. */
+	if (am_guest_unpriv()) {
+		WARN("Not squashing %zu layers as an unprivileged user", nr);
+		goto on_success;
+	}
+
+	/* Layers from the store are always stacked on top of the original
+	 * lower dirs which may change. Only squash the immutable ones.
+	 */
+	while (nr_store < nr) {
+		char *layer = ovl_layer_of(stack[nr_store]);
+		if (!layer)
+			break;
+		free(layer);
+		nr_store++;
+	}
+
+	if (nr_store >= 2) {
+		char *squash, *squashed, *rest;
+		char *tmp = stack[nr_store];
+
+		stack[nr_store] = NULL;
+		squash = lxc_string_join(":", (const char **)stack, false);
+		stack[nr_store] = tmp;
+
+		rest = lxc_string_join(":", (const char **)stack + nr_store, false);
+		if (!squash || !rest) {
+			free(squash);
+			free(rest);
+			goto on_success;
+		}
+
+		squashed = ovl_layer_create(layers,
+					    fnv_64a_buf(squash, strlen(squash),
+							FNV1A_64_INIT),
+					    NULL, squash, name, ndelta, conf);
+		free(squash);
+		if (squashed) {
+			free(result);
+			if (*rest)
+				result = ovl_concat(squashed, ":", rest);
+			else
+				result = must_copy_string(squashed);
+			INFO("Squashed %zu layers into \"%s\"", nr_store, squashed);
+
+			/* The new top layer is part of the squashed one. */
+			if (top) {
+				char *layer = ovl_layer_of(top);
+
+				if (layer)
+					(void)ovl_layer_ref(layer, name, ndelta, false);
+				free(layer);
+			}
+		}
+		free(squashed);
+		free(rest);
+	}
+
+on_success:
+	lxc_free_array((void **)stack, free);
+	free(layers);
+	free(top);
+	return result;
+}
+
+/* Mount a tmpfs of @size bytes on @target and create the "upper" and "work"
+ * dirs for the overlay in it. The root of the overlay takes its owner and mode
+ * from its upper dir so they are copied over from @upper.
+ */
+static int ovl_tmpfs_mount(const char *upper, const char *target,
+			   uint64_t size)
+{
+	int ret;
+	char *dir;
+	struct stat st;
+	char opts[64];
+
+	ret = stat(upper, &st);
+	if (ret < 0) {
+		SYSERROR("Failed to stat \"%s\"", upper);
+		return -1;
+	}
+
+	ret = snprintf(opts, sizeof(opts), "size=%" PRIu64 ",mode=0755", size);
+	if (ret < 0 || (size_t)ret >= sizeof(opts))
+		return -1;
+
+	ret = mount("none", target, "tmpfs", 0, opts);
+	if (ret < 0) {
+		SYSERROR("Failed to mount tmpfs on \"%s\"", target);
+		return -1;
+	}
+
+	dir = ovl_concat(target, "/upper", "");
+	ret = mkdir(dir, 0755);
+	if (ret == 0)
+		ret = chown(dir, st.st_uid, st.st_gid);
+	if (ret == 0)
+		ret = chmod(dir, st.st_mode & 07777);
+	if (ret < 0) {
+		SYSERROR("Failed to create directory \"%s\"", dir);
+		free(dir);
+		goto on_error;
+	}
+	free(dir);
+
+	dir = ovl_concat(target, "/work", "");
+	ret = mkdir(dir, 0755);
+	if (ret < 0) {
+		SYSERROR("Failed to create directory \"%s\"", dir);
+		free(dir);
+		goto on_error;
+	}
+	free(dir);
+
+	TRACE("Mounted tmpfs of %" PRIu64 " bytes on \"%s\"", size, target);
+	return 0;
+
+on_error:
+	if (umount2(target, MNT_DETACH) < 0)
+		SYSWARN("Failed to detach tmpfs \"%s\"", target);
+
+	return -1;
+}
@@ -52,6 +52,12 @@ extern bool ovl_detect(const char *path);
 extern int ovl_mount(struct lxc_storage *bdev);
 extern int ovl_umount(struct lxc_storage *bdev);
 
+/* Copy the directory @src to @dest, inside the container's user namespace for
+ * unprivileged containers.
+ */
+extern int ovl_do_rsync(const char *src, const char *dest,
+			struct lxc_conf *conf);
+
 /* To be called from lxcapi_clone() in lxccontainer.c: When we clone a container
  * with overlay lxc.mount.entry entries we need to update absolute paths for
  * upper- and workdir. This update is done in two locations:
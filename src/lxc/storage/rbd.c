@@ -257,7 +257,7 @@ int rbd_mount(struct lxc_storage *bdev)
 		return -1;
 	}
 
-	return mount_unknown_fs(src, bdev->dest, bdev->mntopts);
+	return storage_mount_fs(bdev, src);
 }
 
 int rbd_umount(struct lxc_storage *bdev)
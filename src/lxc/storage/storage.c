@@ -44,6 +44,7 @@
 #include "config.h"
 #include "dir.h"
 #include "error.h"
+#include "image.h"
 #include "log.h"
 #include "loop.h"
 #include "lvm.h"
@@ -98,6 +99,20 @@ static const struct lxc_storage_ops dir_ops = {
     .can_backup = true,
 };
 
+/* image */
+static const struct lxc_storage_ops image_ops = {
+    .detect = &image_detect,
+    .mount = &image_mount,
+    .umount = &image_umount,
+    .clone_paths = &image_clonepaths,
+    .destroy = &image_destroy,
+    .create = &image_create,
+    .copy = &image_copy,
+    .snapshot = &image_copy,
+    .can_snapshot = true,
+    .can_backup = false,
+};
+
 /* loop */
 static const struct lxc_storage_ops loop_ops = {
     .detect = &loop_detect,
@@ -106,9 +121,9 @@ static const struct lxc_storage_ops loop_ops = {
     .clone_paths = &loop_clonepaths,
     .destroy = &loop_destroy,
     .create = &loop_create,
-    .copy = NULL,
-    .snapshot = NULL,
-    .can_snapshot = false,
+    .copy = &loop_copy,
+    .snapshot = &loop_snapshot,
+    .can_snapshot = true,
     .can_backup = true,
 };
 
@@ -195,6 +210,7 @@ static const struct lxc_storage_type bdevs[] = {
 	{ .name = "btrfs",     .ops = &btrfs_ops, },
 	{ .name = "overlay",   .ops = &ovl_ops,   },
 	{ .name = "overlayfs", .ops = &ovl_ops,   },
+	{ .name = "image",     .ops = &image_ops, },
 	{ .name = "loop",      .ops = &loop_ops,  },
 	{ .name = "nbd",       .ops = &nbd_ops,   },
 };
@@ -468,6 +484,35 @@ struct lxc_storage *storage_copy(struct lxc_container *c, const char *cname,
 		goto on_success;
 	}
 
+	/* loop: copy the image itself unless it needs to be resized */
+	if (!strcmp(orig->type, "loop") && !strcmp(new->type, "loop") &&
+	    !newsize) {
+		bool bret;
+
+		if (snap)
+			bret = new->ops->snapshot(c->lxc_conf, orig, new, newsize);
+		else
+			bret = new->ops->copy(c->lxc_conf, orig, new, newsize);
+		if (!bret)
+			goto on_error_put_new;
+
+		goto on_success;
+	}
+
+	/* image: the image is shared, only the upper dir is copied */
+	if (!strcmp(orig->type, "image") && !strcmp(new->type, "image")) {
+		bool bret;
+
+		if (snap)
+			bret = new->ops->snapshot(c->lxc_conf, orig, new, newsize);
+		else
+			bret = new->ops->copy(c->lxc_conf, orig, new, newsize);
+		if (!bret)
+			goto on_error_put_new;
+
+		goto on_success;
+	}
+
 	/* zfs */
 	if (!strcmp(orig->type, "zfs") && !strcmp(new->type, "zfs")) {
 		bool bret;
@@ -632,6 +677,11 @@ struct lxc_storage *storage_init(struct lxc_conf *conf)
 	if (mntopts)
 		bdev->mntopts = strdup(mntopts);
 
+	if (conf->rootfs.fstype)
+		bdev->fstype = strdup(conf->rootfs.fstype);
+
+	bdev->lo_block_size = conf->rootfs.loop_block_size;
+
 	if (src)
 		bdev->src = strdup(src);
 
@@ -667,6 +717,7 @@ bool storage_is_dir(struct lxc_conf *conf)
 void storage_put(struct lxc_storage *bdev)
 {
 	free(bdev->mntopts);
+	free(bdev->fstype);
 	free(bdev->src);
 	free(bdev->dest);
 	free(bdev);
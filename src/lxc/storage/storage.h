@@ -101,9 +101,17 @@ struct lxc_storage {
 	char *src;
 	char *dest;
 	char *mntopts;
+	/* Filesystem type from lxc.rootfs.fstype, NULL if unknown. */
+	char *fstype;
 	/* Turn the following into a union if need be. */
 	/* lofd is the open fd for the mounted loopback file. */
 	int lofd;
+	/* Logical block size of the loop device, 0 for the kernel's default. */
+	unsigned int lo_block_size;
+	/* Size of the tmpfs the overlay upper dir is placed on when the rootfs
+	 * is mounted to start the container, 0 to keep it on disk.
+	 */
+	uint64_t tmpfs_size;
 	/* index for the connected nbd device. */
 	int nbd_idx;
 	int flags;
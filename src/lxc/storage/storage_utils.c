@@ -23,6 +23,7 @@
 
 #define _GNU_SOURCE
 #include <dirent.h>
+#include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
@@ -164,6 +165,145 @@ void detach_block_device(struct lxc_conf *conf)
 		detach_nbd_idx(conf->nbd_idx);
 }
 
+/* Superblock locations and magic numbers of the filesystems we can detect
+ * without trying to mount them.
+ */
+#define EXT_SB_OFFSET			1024
+#define EXT_MAGIC_OFFSET		0x38
+#define EXT_MAGIC			0xEF53
+#define EXT_FEATURE_COMPAT_OFFSET	0x5C
+#define EXT_FEATURE_INCOMPAT_OFFSET	0x60
+#define EXT_FEATURE_RO_COMPAT_OFFSET	0x64
+#define EXT3_FEATURE_COMPAT_HAS_JOURNAL	0x0004
+/* Features ext3 knows about, anything else means ext4. */
+#define EXT3_FEATURE_INCOMPAT_SUPP	0x0016
+#define EXT3_FEATURE_RO_COMPAT_SUPP	0x0007
+#define XFS_MAGIC			"XFSB"
+#define BTRFS_SB_OFFSET			(65536 + 0x40)
+#define BTRFS_MAGIC			"_BHRfS_M"
+#define SQUASHFS_MAGIC			0x73717368
+#define EROFS_SB_OFFSET			1024
+#define EROFS_MAGIC			0xE0F5E1E2
+
+static uint16_t sb_le16(const unsigned char *buf, size_t off)
+{
+	uint16_t v;
+
+	memcpy(&v, buf + off, sizeof(v));
+	return le16toh(v);
+}
+
+static uint32_t sb_le32(const unsigned char *buf, size_t off)
+{
+	uint32_t v;
+
+	memcpy(&v, buf + off, sizeof(v));
+	return le32toh(v);
+}
+
+/*
+ * Detect the filesystem on @path by looking for the superblock magic of the
+ * filesystems containers are usually created on. This is a lot cheaper than
+ * trying to mount @path with every filesystem the kernel knows about.
+ * Returns the length of the filesystem type written to @type or -1 if the
+ * filesystem wasn't recognized.
+ */
+int probe_fstype(const char *path, char *type, size_t len)
+{
+	int fd;
+	ssize_t ret;
+	const char *fstype = NULL;
+	unsigned char buf[4096];
+	char btrfs[sizeof(BTRFS_MAGIC) - 1];
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	/* Small images (e.g. squashfs) may end before the buffer does. */
+	memset(buf, 0, sizeof(buf));
+	ret = pread(fd, buf, sizeof(buf), 0);
+	if (ret < 2 * EXT_SB_OFFSET)
+		goto out;
+
+	if (sb_le32(buf, 0) == SQUASHFS_MAGIC) {
+		fstype = "squashfs";
+	} else if (memcmp(buf, XFS_MAGIC, sizeof(XFS_MAGIC) - 1) == 0) {
+		fstype = "xfs";
+	} else if (sb_le32(buf, EROFS_SB_OFFSET) == EROFS_MAGIC) {
+		fstype = "erofs";
+	} else if (sb_le16(buf, EXT_SB_OFFSET + EXT_MAGIC_OFFSET) == EXT_MAGIC) {
+		uint32_t compat, incompat, ro_compat;
+
+		compat = sb_le32(buf, EXT_SB_OFFSET + EXT_FEATURE_COMPAT_OFFSET);
+		incompat = sb_le32(buf, EXT_SB_OFFSET + EXT_FEATURE_INCOMPAT_OFFSET);
+		ro_compat = sb_le32(buf, EXT_SB_OFFSET + EXT_FEATURE_RO_COMPAT_OFFSET);
+
+		if ((incompat & ~EXT3_FEATURE_INCOMPAT_SUPP) ||
+		    (ro_compat & ~EXT3_FEATURE_RO_COMPAT_SUPP))
+			fstype = "ext4";
+		else if (compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL)
+			fstype = "ext3";
+		else
+			fstype = "ext2";
+	} else {
+		ret = pread(fd, btrfs, sizeof(btrfs), BTRFS_SB_OFFSET);
+		if (ret == sizeof(btrfs) && memcmp(btrfs, BTRFS_MAGIC, sizeof(btrfs)) == 0)
+			fstype = "btrfs";
+	}
+
+out:
+	close(fd);
+
+	if (!fstype)
+		return -1;
+
+	if (strlcpy(type, fstype, len) >= len)
+		return -1;
+
+	TRACE("Detected fstype %s for %s from its superblock", type, path);
+	return strlen(type);
+}
+
+/*
+ * Mount the filesystem of @bdev on @src. If the type of the filesystem is known
+ * from lxc.rootfs.fstype or the superblock it is mounted directly, otherwise
+ * every filesystem type the kernel supports is tried.
+ */
+int storage_mount_fs(struct lxc_storage *bdev, const char *src)
+{
+	int ret;
+	char *mntdata;
+	unsigned long mntflags;
+	char fstype[100];
+
+	if (bdev->fstype) {
+		if (strlcpy(fstype, bdev->fstype, sizeof(fstype)) >= sizeof(fstype))
+			return -1;
+	} else if (probe_fstype(src, fstype, sizeof(fstype)) < 0) {
+		return mount_unknown_fs(src, bdev->dest, bdev->mntopts);
+	}
+
+	if (parse_mntopts(bdev->mntopts, &mntflags, &mntdata) < 0) {
+		free(mntdata);
+		return -1;
+	}
+
+	ret = mount(src, bdev->dest, fstype, mntflags, mntdata);
+	free(mntdata);
+	if (ret < 0) {
+		/* The filesystem might have been recreated with another type
+		 * since lxc.rootfs.fstype was recorded.
+		 */
+		SYSWARN("Failed to mount \"%s\" on \"%s\" with fstype \"%s\"",
+			src, bdev->dest, fstype);
+		return mount_unknown_fs(src, bdev->dest, bdev->mntopts);
+	}
+
+	INFO("Mounted \"%s\" on \"%s\" with fstype \"%s\"", src, bdev->dest, fstype);
+	return 0;
+}
+
 /*
  * Given a lxc_storage (presumably blockdev-based), detect the fstype
  * by trying mounting (in a private mntns) it.
@@ -189,6 +329,18 @@ int detect_fs(struct lxc_storage *bdev, char *type, int len)
 
 	srcdev = lxc_storage_get_path(bdev->src, bdev->type);
 
+	if (bdev->fstype) {
+		ret = strlcpy(type, bdev->fstype, len);
+		if (ret < len)
+			return ret;
+	}
+
+	ret = probe_fstype(srcdev, type, len);
+	if (ret > 0) {
+		INFO("detected fstype %s for %s", type, srcdev);
+		return ret;
+	}
+
 	ret = pipe(p);
 	if (ret < 0)
 		return -1;
@@ -461,6 +613,7 @@ bool is_valid_storage_type(const char *type)
 {
 	if (strcmp(type, "dir") == 0 ||
 	    strcmp(type, "btrfs") == 0 ||
+	    strcmp(type, "image") == 0 ||
 	    strcmp(type, "loop") == 0 ||
 	    strcmp(type, "lvm") == 0 ||
 	    strcmp(type, "nbd") == 0 ||
@@ -40,6 +40,8 @@ extern bool attach_block_device(struct lxc_conf *conf);
 extern void detach_block_device(struct lxc_conf *conf);
 extern int blk_getsize(struct lxc_storage *bdev, uint64_t *size);
 extern int detect_fs(struct lxc_storage *bdev, char *type, int len);
+extern int probe_fstype(const char *path, char *type, size_t len);
+extern int storage_mount_fs(struct lxc_storage *bdev, const char *src);
 extern int do_mkfs_exec_wrapper(void *args);
 extern int is_blktype(struct lxc_storage *b);
 extern int mount_unknown_fs(const char *rootfs, const char *target,
@@ -23,6 +23,7 @@
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +39,10 @@
 #include "utils.h"
 #include "zfs.h"
 
+#ifdef HAVE_LIBZFS_CORE
+#include <libzfs_core.h>
+#endif
+
 lxc_log_define(zfs, lxc);
 
 struct zfs_args {
@@ -105,6 +110,292 @@ int zfs_get_parent_snapshot_exec_wrapper(void *args)
 	return -1;
 }
 
+#ifdef HAVE_LIBZFS_CORE
+/* ZFS_CANMOUNT_NOAUTO */
+#define LXC_ZFS_CANMOUNT_NOAUTO 2
+
+static bool zfs_core_ok;
+static pthread_once_t zfs_core_once = PTHREAD_ONCE_INIT;
+
+static void zfs_core_init_once(void)
+{
+	int ret;
+
+	ret = libzfs_core_init();
+	if (ret) {
+		errno = ret;
+		SYSINFO("Failed to initialize libzfs_core, using the zfs tool");
+		return;
+	}
+
+	zfs_core_ok = true;
+}
+
+static inline bool zfs_core_available(void)
+{
+	pthread_once(&zfs_core_once, zfs_core_init_once);
+	return zfs_core_ok;
+}
+
+/* Returns 1 if @dataset exists, 0 if not and -ENOSYS if libzfs_core can't be
+ * used.
+ */
+static int zfs_core_exists(const char *dataset)
+{
+	if (!zfs_core_available())
+		return -ENOSYS;
+
+	return lzc_exists(dataset) ? 1 : 0;
+}
+
+static nvlist_t *zfs_core_props(const char *mountpoint)
+{
+	nvlist_t *props;
+
+	if (nvlist_alloc(&props, NV_UNIQUE_NAME, 0))
+		return NULL;
+
+	if (nvlist_add_string(props, "mountpoint", mountpoint) ||
+	    nvlist_add_uint64(props, "canmount", LXC_ZFS_CANMOUNT_NOAUTO)) {
+		nvlist_free(props);
+		return NULL;
+	}
+
+	return props;
+}
+
+static int zfs_core_create(const char *dataset, const char *mountpoint)
+{
+	int ret;
+	nvlist_t *props;
+
+	if (!zfs_core_available())
+		return -ENOSYS;
+
+	props = zfs_core_props(mountpoint);
+	if (!props)
+		return -ENOMEM;
+
+	ret = lzc_create(dataset, LZC_DATSET_TYPE_ZFS, props, NULL, 0);
+	nvlist_free(props);
+	return -ret;
+}
+
+static int zfs_core_snapshot(const char *snapshot)
+{
+	int ret;
+	nvlist_t *snaps, *errlist = NULL;
+
+	if (!zfs_core_available())
+		return -ENOSYS;
+
+	if (nvlist_alloc(&snaps, NV_UNIQUE_NAME, 0))
+		return -ENOMEM;
+
+	if (nvlist_add_boolean(snaps, snapshot)) {
+		nvlist_free(snaps);
+		return -ENOMEM;
+	}
+
+	ret = lzc_snapshot(snaps, NULL, &errlist);
+	nvlist_free(errlist);
+	nvlist_free(snaps);
+	return -ret;
+}
+
+static int zfs_core_clone(const char *dataset, const char *snapshot,
+			  const char *mountpoint)
+{
+	int ret;
+	nvlist_t *props;
+
+	if (!zfs_core_available())
+		return -ENOSYS;
+
+	props = zfs_core_props(mountpoint);
+	if (!props)
+		return -ENOMEM;
+
+	ret = lzc_clone(dataset, snapshot, props);
+	nvlist_free(props);
+	return -ret;
+}
+
+static int zfs_core_destroy(const char *dataset)
+{
+	int ret;
+	nvlist_t *snaps, *errlist = NULL;
+
+	if (!zfs_core_available())
+		return -ENOSYS;
+
+	if (!strchr(dataset, '@'))
+		return -lzc_destroy(dataset);
+
+	if (nvlist_alloc(&snaps, NV_UNIQUE_NAME, 0))
+		return -ENOMEM;
+
+	if (nvlist_add_boolean(snaps, dataset)) {
+		nvlist_free(snaps);
+		return -ENOMEM;
+	}
+
+	ret = lzc_destroy_snaps(snaps, B_FALSE, &errlist);
+	nvlist_free(errlist);
+	nvlist_free(snaps);
+	return -ret;
+}
+#else
+static inline int zfs_core_exists(const char *dataset)
+{
+	return -ENOSYS;
+}
+
+static inline int zfs_core_create(const char *dataset, const char *mountpoint)
+{
+	return -ENOSYS;
+}
+
+static inline int zfs_core_snapshot(const char *snapshot)
+{
+	return -ENOSYS;
+}
+
+static inline int zfs_core_clone(const char *dataset, const char *snapshot,
+				 const char *mountpoint)
+{
+	return -ENOSYS;
+}
+
+static inline int zfs_core_destroy(const char *dataset)
+{
+	return -ENOSYS;
+}
+#endif
+
+/* Check whether @dataset exists, asking libzfs_core if possible and running
+ * "zfs get" otherwise.
+ */
+static bool zfs_dataset_exists(const char *dataset)
+{
+	int ret;
+	char *output;
+	struct zfs_args cmd_args = {0};
+	char cmd_output[MAXPATHLEN] = {0};
+
+	ret = zfs_core_exists(dataset);
+	if (ret == 0)
+		return false;
+
+	if (ret < 0) {
+		cmd_args.dataset = dataset;
+		ret = run_command(cmd_output, sizeof(cmd_output),
+				  zfs_detect_exec_wrapper, (void *)&cmd_args);
+		if (ret < 0) {
+			ERROR("Failed to detect zfs dataset \"%s\": %s",
+			      dataset, cmd_output);
+			return false;
+		}
+
+		if (cmd_output[0] == '\0')
+			return false;
+
+		/* remove any possible leading and trailing whitespace */
+		output = cmd_output;
+		output += lxc_char_left_gc(output, strlen(output));
+		output[lxc_char_right_gc(output, strlen(output))] = '\0';
+
+		if (strcmp(output, dataset))
+			return false;
+	}
+
+	return true;
+}
+
+/* Create @dataset with its parents mounted at @mountpoint. */
+static int zfs_create_dataset(const char *dataset, const char *mountpoint)
+{
+	int ret;
+	struct zfs_args cmd_args = {0};
+	char cmd_output[MAXPATHLEN], option[MAXPATHLEN];
+	const char *argv[] = {"zfs",			   /* 0    */
+			      "create",			   /* 1    */
+			      "-o",     "",		   /* 2, 3 */
+			      "-o",     "canmount=noauto", /* 4, 5 */
+			      "-p",			   /* 6    */
+			      "",			   /* 7    */
+			      NULL};
+
+	/* Missing parents (ENOENT) are left to "zfs create -p". */
+	ret = zfs_core_create(dataset, mountpoint);
+	if (ret == 0) {
+		TRACE("Created zfs dataset \"%s\"", dataset);
+		return 0;
+	} else if (ret != -ENOSYS) {
+		errno = -ret;
+		SYSTRACE("Failed to create zfs dataset \"%s\" via libzfs_core",
+			 dataset);
+	}
+
+	ret = snprintf(option, MAXPATHLEN, "mountpoint=%s", mountpoint);
+	if (ret < 0 || ret >= MAXPATHLEN) {
+		ERROR("Failed to create string");
+		return -1;
+	}
+	argv[3] = option;
+	argv[7] = dataset;
+
+	cmd_args.argv = argv;
+	ret = run_command(cmd_output, sizeof(cmd_output),
+			  zfs_create_exec_wrapper, (void *)&cmd_args);
+	if (ret < 0) {
+		ERROR("Failed to create zfs dataset \"%s\": %s", dataset, cmd_output);
+		return -1;
+	} else if (cmd_output[0] != '\0') {
+		INFO("Created zfs dataset \"%s\": %s", dataset, cmd_output);
+	} else {
+		TRACE("Created zfs dataset \"%s\"", dataset);
+	}
+
+	return 0;
+}
+
+/* Destroy @dataset which may also be a snapshot. libzfs_core refuses to
+ * destroy datasets that still have snapshots or children in which case
+ * "zfs destroy -r" is used.
+ */
+static int zfs_destroy_dataset(const char *dataset)
+{
+	int ret;
+	struct zfs_args cmd_args = {0};
+	char cmd_output[MAXPATHLEN] = {0};
+
+	ret = zfs_core_destroy(dataset);
+	if (ret == 0) {
+		INFO("Deleted zfs dataset \"%s\"", dataset);
+		return 0;
+	} else if (ret != -ENOSYS) {
+		errno = -ret;
+		SYSTRACE("Failed to delete zfs dataset \"%s\" via libzfs_core",
+			 dataset);
+	}
+
+	cmd_args.dataset = dataset;
+	ret = run_command(cmd_output, sizeof(cmd_output),
+			  zfs_delete_exec_wrapper, (void *)&cmd_args);
+	if (ret < 0) {
+		ERROR("Failed to delete zfs dataset \"%s\": %s", dataset,
+		      cmd_output);
+		return -1;
+	} else if (cmd_output[0] != '\0') {
+		INFO("Deleted zfs dataset \"%s\": %s", dataset, cmd_output);
+	} else {
+		INFO("Deleted zfs dataset \"%s\"", dataset);
+	}
+
+	return 0;
+}
+
 static bool zfs_list_entry(const char *path, char *output, size_t inlen)
 {
 	struct lxc_popen_FILE *f;
@@ -129,11 +420,6 @@ static bool zfs_list_entry(const char *path, char *output, size_t inlen)
 
 bool zfs_detect(const char *path)
 {
-	int ret;
-	char *dataset;
-	struct zfs_args cmd_args = {0};
-	char cmd_output[MAXPATHLEN] = {0};
-
 	if (!strncmp(path, "zfs:", 4))
 		return true;
 
@@ -154,26 +440,7 @@ bool zfs_detect(const char *path)
 		return found;
 	}
 
-	cmd_args.dataset = path;
-	ret = run_command(cmd_output, sizeof(cmd_output),
-			  zfs_detect_exec_wrapper, (void *)&cmd_args);
-	if (ret < 0) {
-		ERROR("Failed to detect zfs dataset \"%s\": %s", path, cmd_output);
-		return false;
-	}
-
-	if (cmd_output[0] == '\0')
-		return false;
-
-	/* remove any possible leading and trailing whitespace */
-	dataset = cmd_output;
-	dataset += lxc_char_left_gc(dataset, strlen(dataset));
-	dataset[lxc_char_right_gc(dataset, strlen(dataset))] = '\0';
-
-	if (strcmp(dataset, path))
-		return false;
-
-	return true;
+	return zfs_dataset_exists(path);
 }
 
 int zfs_mount(struct lxc_storage *bdev)
@@ -285,37 +552,13 @@ bool zfs_copy(struct lxc_conf *conf, struct lxc_storage *orig,
 	      struct lxc_storage *new, uint64_t newsize)
 {
 	int ret;
-	char cmd_output[MAXPATHLEN], option[MAXPATHLEN];
+	char cmd_output[MAXPATHLEN];
 	struct rsync_data data = {0, 0};
-	struct zfs_args cmd_args = {0};
-	const char *argv[] = {"zfs",			   /* 0    */
-			      "create",			   /* 1    */
-			      "-o",     "",		   /* 2, 3 */
-			      "-o",     "canmount=noauto", /* 4, 5 */
-			      "-p",			   /* 6    */
-			      "",			   /* 7    */
-			      NULL};
 
-	/* mountpoint */
-	ret = snprintf(option, MAXPATHLEN, "mountpoint=%s", new->dest);
-	if (ret < 0 || ret >= MAXPATHLEN) {
-		ERROR("Failed to create string");
+	ret = zfs_create_dataset(lxc_storage_get_path(new->src, new->type),
+				 new->dest);
+	if (ret < 0)
 		return false;
-	}
-	argv[3] = option;
-	argv[7] = lxc_storage_get_path(new->src, new->type);
-
-	cmd_args.argv = argv;
-	ret = run_command(cmd_output, sizeof(cmd_output),
-			  zfs_create_exec_wrapper, (void *)&cmd_args);
-	if (ret < 0) {
-		ERROR("Failed to create zfs dataset \"%s\": %s", new->src, cmd_output);
-		return false;
-	} else if (cmd_output[0] != '\0') {
-		INFO("Created zfs dataset \"%s\": %s", new->src, cmd_output);
-	} else {
-		TRACE("Created zfs dataset \"%s\"", new->src);
-	}
 
 	ret = mkdir_p(new->dest, 0755);
 	if (ret < 0 && errno != EEXIST) {
@@ -344,7 +587,7 @@ bool zfs_snapshot(struct lxc_conf *conf, struct lxc_storage *orig,
 	int ret;
 	size_t snapshot_len, len;
 	char *tmp, *snap_name, *snapshot;
-	const char *orig_src;
+	const char *dataset, *orig_src;
 	struct zfs_args cmd_args = {0};
 	char cmd_output[MAXPATHLEN] = {0}, option[MAXPATHLEN];
 
@@ -408,37 +651,67 @@ bool zfs_snapshot(struct lxc_conf *conf, struct lxc_storage *orig,
 		return false;
 	}
 
-	cmd_args.snapshot = snapshot;
-	ret = run_command(cmd_output, sizeof(cmd_output),
-			  zfs_snapshot_exec_wrapper, (void *)&cmd_args);
-	if (ret < 0) {
-		ERROR("Failed to create zfs snapshot \"%s\": %s", snapshot, cmd_output);
-		free(snapshot);
-		return false;
-	} else if (cmd_output[0] != '\0') {
-		INFO("Created zfs snapshot \"%s\": %s", snapshot, cmd_output);
-	} else {
+	/* The container's dataset has no children so unlike "zfs snapshot -r"
+	 * libzfs_core's non-recursive snapshot is all that is needed.
+	 */
+	ret = zfs_core_snapshot(snapshot);
+	if (ret == 0) {
 		TRACE("Created zfs snapshot \"%s\"", snapshot);
+	} else {
+		if (ret != -ENOSYS) {
+			errno = -ret;
+			SYSTRACE("Failed to create zfs snapshot \"%s\" via "
+				 "libzfs_core", snapshot);
+		}
+
+		cmd_args.snapshot = snapshot;
+		ret = run_command(cmd_output, sizeof(cmd_output),
+				  zfs_snapshot_exec_wrapper, (void *)&cmd_args);
+		if (ret < 0) {
+			ERROR("Failed to create zfs snapshot \"%s\": %s",
+			      snapshot, cmd_output);
+			free(snapshot);
+			return false;
+		} else if (cmd_output[0] != '\0') {
+			INFO("Created zfs snapshot \"%s\": %s", snapshot, cmd_output);
+		} else {
+			TRACE("Created zfs snapshot \"%s\"", snapshot);
+		}
+	}
+
+	dataset = lxc_storage_get_path(new->src, new->type);
+	ret = zfs_core_clone(dataset, snapshot, new->dest);
+	if (ret == 0) {
+		TRACE("Created zfs dataset \"%s\"", new->src);
+		free(snapshot);
+		return true;
+	} else if (ret != -ENOSYS) {
+		errno = -ret;
+		SYSTRACE("Failed to create zfs dataset \"%s\" via libzfs_core",
+			 new->src);
 	}
 
 	ret = snprintf(option, MAXPATHLEN, "mountpoint=%s", new->dest);
 	if (ret < 0 || ret >= MAXPATHLEN) {
 		ERROR("Failed to create string");
 		free(snapshot);
-		return -1;
+		return false;
 	}
 
-	cmd_args.dataset = lxc_storage_get_path(new->src, new->type);
+	cmd_args.dataset = dataset;
 	cmd_args.snapshot = snapshot;
 	cmd_args.options = option;
 	ret = run_command(cmd_output, sizeof(cmd_output),
 			  zfs_clone_exec_wrapper, (void *)&cmd_args);
-	if (ret < 0)
+	if (ret < 0) {
 		ERROR("Failed to create zfs dataset \"%s\": %s", new->src, cmd_output);
-	else if (cmd_output[0] != '\0')
+		free(snapshot);
+		return false;
+	} else if (cmd_output[0] != '\0') {
 		INFO("Created zfs dataset \"%s\": %s", new->src, cmd_output);
-	else
+	} else {
 		TRACE("Created zfs dataset \"%s\"", new->src);
+	}
 
 	free(snapshot);
 	return true;
@@ -579,8 +852,8 @@ int zfs_clonepaths(struct lxc_storage *orig, struct lxc_storage *new,
 int zfs_destroy(struct lxc_storage *orig)
 {
 	int ret;
-	char *dataset, *tmp;
-	const char *src;
+	char *tmp;
+	const char *dataset, *src;
 	bool found;
 	char *parent_snapshot = NULL;
 	struct zfs_args cmd_args = {0};
@@ -609,30 +882,12 @@ int zfs_destroy(struct lxc_storage *orig)
 		*tmp = '\0';
 		dataset = cmd_output;
 	} else {
-		cmd_args.dataset = src;
-		ret = run_command(cmd_output, sizeof(cmd_output),
-				  zfs_detect_exec_wrapper, (void *)&cmd_args);
-		if (ret < 0) {
-			ERROR("Failed to detect zfs dataset \"%s\": %s", src,
-			      cmd_output);
-			return -1;
-		}
-
-		if (cmd_output[0] == '\0') {
+		if (!zfs_dataset_exists(src)) {
 			ERROR("Failed to detect zfs dataset \"%s\"", src);
 			return -1;
 		}
 
-		/* remove any possible leading and trailing whitespace */
-		dataset = cmd_output;
-		dataset += lxc_char_left_gc(dataset, strlen(dataset));
-		dataset[lxc_char_right_gc(dataset, strlen(dataset))] = '\0';
-
-		if (strcmp(dataset, src)) {
-			ERROR("Detected dataset \"%s\" does not match expected "
-			      "dataset \"%s\"", dataset, src);
-			return -1;
-		}
+		dataset = src;
 	}
 
 	cmd_args.dataset = strdup(dataset);
@@ -670,38 +925,20 @@ int zfs_destroy(struct lxc_storage *orig)
 	}
 
 	/* delete dataset */
-	ret = run_command(cmd_output, sizeof(cmd_output),
-			  zfs_delete_exec_wrapper, (void *)&cmd_args);
+	ret = zfs_destroy_dataset(cmd_args.dataset);
+	free((void *)cmd_args.dataset);
 	if (ret < 0) {
-		ERROR("Failed to delete zfs dataset \"%s\": %s", dataset,
-		      cmd_output);
-		free((void *)cmd_args.dataset);
 		free(parent_snapshot);
 		return -1;
-	} else if (cmd_output[0] != '\0') {
-		INFO("Deleted zfs dataset \"%s\": %s", src, cmd_output);
-	} else {
-		INFO("Deleted zfs dataset \"%s\"", src);
 	}
 
-	free((void *)cmd_args.dataset);
-
 	/* Not a clone so nothing more to do. */
 	if (!parent_snapshot)
 		return 0;
 
 	/* delete parent snapshot */
-	cmd_args.dataset = parent_snapshot;
-	ret = run_command(cmd_output, sizeof(cmd_output),
-			  zfs_delete_exec_wrapper, (void *)&cmd_args);
-	if (ret < 0)
-		ERROR("Failed to delete zfs snapshot \"%s\": %s", dataset, cmd_output);
-	else if (cmd_output[0] != '\0')
-		INFO("Deleted zfs snapshot \"%s\": %s", src, cmd_output);
-	else
-		INFO("Deleted zfs snapshot \"%s\"", src);
-
-	free((void *)cmd_args.dataset);
+	ret = zfs_destroy_dataset(parent_snapshot);
+	free(parent_snapshot);
 	return ret;
 }
 
@@ -711,15 +948,6 @@ int zfs_create(struct lxc_storage *bdev, const char *dest, const char *n,
 	const char *zfsroot;
 	int ret;
 	size_t len;
-	struct zfs_args cmd_args = {0};
-	char cmd_output[MAXPATHLEN], option[MAXPATHLEN];
-	const char *argv[] = {"zfs",			   /* 0    */
-			      "create",			   /* 1    */
-			      "-o",     "",		   /* 2, 3 */
-			      "-o",     "canmount=noauto", /* 4, 5 */
-			      "-p",			   /* 6    */
-			      "",			   /* 7    */
-			      NULL};
 
 	if (!specs || !specs->zfs.zfsroot)
 		zfsroot = lxc_global_config_value("lxc.bdev.zfs.root");
@@ -746,26 +974,11 @@ int zfs_create(struct lxc_storage *bdev, const char *dest, const char *n,
 		ERROR("Failed to create string");
 		return -1;
 	}
-	argv[7] = lxc_storage_get_path(bdev->src, bdev->type);
-
-	ret = snprintf(option, MAXPATHLEN, "mountpoint=%s", bdev->dest);
-	if (ret < 0 || ret >= MAXPATHLEN) {
-		ERROR("Failed to create string");
-		return -1;
-	}
-	argv[3] = option;
 
-	cmd_args.argv = argv;
-	ret = run_command(cmd_output, sizeof(cmd_output),
-			  zfs_create_exec_wrapper, (void *)&cmd_args);
-	if (ret < 0) {
-		ERROR("Failed to create zfs dataset \"%s\": %s", bdev->src, cmd_output);
+	ret = zfs_create_dataset(lxc_storage_get_path(bdev->src, bdev->type),
+				 bdev->dest);
+	if (ret < 0)
 		return -1;
-	} else if (cmd_output[0] != '\0') {
-		INFO("Created zfs dataset \"%s\": %s", bdev->src, cmd_output);
-	} else {
-		TRACE("Created zfs dataset \"%s\"", bdev->src);
-	}
 
 	ret = mkdir_p(bdev->dest, 0755);
 	if (ret < 0 && errno != EEXIST) {
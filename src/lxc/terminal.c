@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <unistd.h>
@@ -54,9 +55,21 @@
 
 #define LXC_TERMINAL_BUFFER_SIZE 1024
 
+/* Output for the terminal log file is collected until this many bytes are
+ * pending or LXC_TERMINAL_LOG_FLUSH_MS milliseconds have passed since the
+ * first pending byte.
+ */
+#define LXC_TERMINAL_LOG_BUFFER_SIZE 16384
+#define LXC_TERMINAL_LOG_FLUSH_MS 100
+
+/* Maximum number of bytes moved from the terminal master with one splice. */
+#define LXC_TERMINAL_SPLICE_SIZE 65536
+
 lxc_log_define(terminal, lxc);
 
+/* lxc_ttys_mutex protects lxc_ttys, which is shared by all threads. */
 static struct lxc_list lxc_ttys;
+static pthread_mutex_t lxc_ttys_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 typedef void (*sighandler_t)(int);
 
@@ -102,10 +115,12 @@ void lxc_terminal_sigwinch(int sig)
 	struct lxc_list *it;
 	struct lxc_terminal_state *ts;
 
+	pthread_mutex_lock(&lxc_ttys_mutex);
 	lxc_list_for_each(it, &lxc_ttys) {
 		ts = it->elem;
 		lxc_terminal_winch(ts);
 	}
+	pthread_mutex_unlock(&lxc_ttys_mutex);
 }
 
 int lxc_terminal_signalfd_cb(int fd, uint32_t events, void *cbdata,
@@ -160,7 +175,9 @@ struct lxc_terminal_state *lxc_terminal_signal_init(int srcfd, int dstfd)
 	} else {
 		/* Add tty to list to be scanned at SIGWINCH time. */
 		lxc_list_add_elem(&ts->node, ts);
+		pthread_mutex_lock(&lxc_ttys_mutex);
 		lxc_list_add_tail(&lxc_ttys, &ts->node);
+		pthread_mutex_unlock(&lxc_ttys_mutex);
 		ret = sigaddset(&mask, SIGWINCH);
 		if (ret < 0)
 			SYSNOTICE("Failed to add SIGWINCH to signal set");
@@ -196,8 +213,11 @@ on_error:
 		ts->sigfd = -1;
 	}
 
-	if (istty)
+	if (istty) {
+		pthread_mutex_lock(&lxc_ttys_mutex);
 		lxc_list_del(&ts->node);
+		pthread_mutex_unlock(&lxc_ttys_mutex);
+	}
 
 	return ts;
 }
@@ -211,19 +231,94 @@ void lxc_terminal_signal_fini(struct lxc_terminal_state *ts)
 			SYSWARN("Failed to restore signal mask");
 	}
 
-	if (isatty(ts->stdinfd))
+	if (isatty(ts->stdinfd)) {
+		pthread_mutex_lock(&lxc_ttys_mutex);
 		lxc_list_del(&ts->node);
+		pthread_mutex_unlock(&lxc_ttys_mutex);
+	}
 
 	free(ts);
 }
 
+static int lxc_terminal_flush_log_file(struct lxc_terminal *terminal)
+{
+	ssize_t ret;
+
+	if (terminal->log_fd < 0 || terminal->log_buf_len == 0)
+		return 0;
+
+	ret = lxc_write_nointr(terminal->log_fd, terminal->log_buf,
+			       terminal->log_buf_len);
+	terminal->log_buf_len = 0;
+	if (ret < 0)
+		return -1;
+
+	return 0;
+}
+
+static void lxc_terminal_arm_log_timer(struct lxc_terminal *terminal)
+{
+	int ret;
+	struct itimerspec its = {
+		.it_value.tv_nsec = LXC_TERMINAL_LOG_FLUSH_MS * 1000000,
+	};
+
+	ret = timerfd_settime(terminal->log_timer_fd, 0, &its, NULL);
+	if (ret < 0)
+		SYSWARN("Failed to arm terminal log timer");
+}
+
+/* Queue @len bytes for the log file. Data is written out when the buffer is
+ * full or when the log timer expires. If there's no buffer or no timer to
+ * flush it we write through.
+ */
+static int lxc_terminal_append_log_file(struct lxc_terminal *terminal,
+					const char *buf, size_t len)
+{
+	int ret;
+
+	terminal->log_written += len;
+
+	if (!terminal->log_buf || terminal->log_timer_fd < 0)
+		return lxc_write_nointr(terminal->log_fd, buf, len);
+
+	if (terminal->log_buf_len + len > LXC_TERMINAL_LOG_BUFFER_SIZE) {
+		ret = lxc_terminal_flush_log_file(terminal);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (len >= LXC_TERMINAL_LOG_BUFFER_SIZE)
+		return lxc_write_nointr(terminal->log_fd, buf, len);
+
+	if (terminal->log_buf_len == 0)
+		lxc_terminal_arm_log_timer(terminal);
+
+	memcpy(terminal->log_buf + terminal->log_buf_len, buf, len);
+	terminal->log_buf_len += len;
+	return len;
+}
+
 static int lxc_terminal_truncate_log_file(struct lxc_terminal *terminal)
 {
+	int ret;
+
 	/* be very certain things are kosher */
 	if (!terminal->log_path || terminal->log_fd < 0)
 		return -EBADF;
 
-	return lxc_unpriv(ftruncate(terminal->log_fd, 0));
+	/* Pending data would have been truncated away as well. */
+	terminal->log_buf_len = 0;
+
+	ret = lxc_unpriv(ftruncate(terminal->log_fd, 0));
+	if (ret < 0)
+		return ret;
+
+	/* Without O_APPEND the next write would leave a hole otherwise. */
+	if (!terminal->log_append)
+		(void)lseek(terminal->log_fd, 0, SEEK_SET);
+	terminal->log_written = 0;
+	return 0;
 }
 
 static int lxc_terminal_rotate_log_file(struct lxc_terminal *terminal)
@@ -246,6 +341,10 @@ static int lxc_terminal_rotate_log_file(struct lxc_terminal *terminal)
 	if (ret < 0 || (size_t)ret >= len)
 		return -EFBIG;
 
+	ret = lxc_terminal_flush_log_file(terminal);
+	if (ret < 0)
+		WARN("Failed to flush terminal log file before rotating it");
+
 	close(terminal->log_fd);
 	terminal->log_fd = -1;
 	ret = lxc_unpriv(rename(terminal->log_path, tmp));
@@ -259,7 +358,6 @@ static int lxc_terminal_write_log_file(struct lxc_terminal *terminal, char *buf,
 				       int bytes_read)
 {
 	int ret;
-	struct stat st;
 	int64_t space_left = -1;
 
 	if (terminal->log_fd < 0)
@@ -270,30 +368,22 @@ static int lxc_terminal_write_log_file(struct lxc_terminal *terminal, char *buf,
 	 * be rotated or not.
 	 */
 	if (terminal->log_size <= 0)
-		return lxc_write_nointr(terminal->log_fd, buf, bytes_read);
-
-	/* Get current size of the log file. */
-	ret = fstat(terminal->log_fd, &st);
-	if (ret < 0) {
-		SYSERROR("Failed to stat the terminal log file descriptor");
-		return -1;
-	}
+		return lxc_terminal_append_log_file(terminal, buf, bytes_read);
 
 	/* handle non-regular files */
-	if ((st.st_mode & S_IFMT) != S_IFREG) {
+	if (!terminal->log_regular) {
 		/* This isn't a regular file. so rotating the file seems a
 		 * dangerous thing to do, size limits are also very
 		 * questionable. Let's not risk anything and tell the user that
 		 * he's requesting us to do weird stuff.
 		 */
-		if (terminal->log_rotate > 0 || terminal->log_size > 0)
-			return -EINVAL;
-
-		/* I mean, sure log wherever you want to. */
-		return lxc_write_nointr(terminal->log_fd, buf, bytes_read);
+		return -EINVAL;
 	}
 
-	space_left = terminal->log_size - st.st_size;
+	/* The size of the log file is tracked in memory and includes data that
+	 * hasn't been flushed yet.
+	 */
+	space_left = terminal->log_size - terminal->log_written;
 
 	/* User doesn't want to rotate the log file and there's no more space
 	 * left so simply truncate it.
@@ -304,20 +394,20 @@ static int lxc_terminal_write_log_file(struct lxc_terminal *terminal, char *buf,
 			return ret;
 
 		if (bytes_read <= terminal->log_size)
-			return lxc_write_nointr(terminal->log_fd, buf, bytes_read);
+			return lxc_terminal_append_log_file(terminal, buf, bytes_read);
 
 		/* Write as much as we can into the buffer and loose the rest. */
-		return lxc_write_nointr(terminal->log_fd, buf, terminal->log_size);
+		return lxc_terminal_append_log_file(terminal, buf, terminal->log_size);
 	}
 
 	/* There's enough space left. */
 	if (bytes_read <= space_left)
-		return lxc_write_nointr(terminal->log_fd, buf, bytes_read);
+		return lxc_terminal_append_log_file(terminal, buf, bytes_read);
 
 	/* There's not enough space left but at least write as much as we can
 	 * into the old log file.
 	 */
-	ret = lxc_write_nointr(terminal->log_fd, buf, space_left);
+	ret = lxc_terminal_append_log_file(terminal, buf, space_left);
 	if (ret < 0)
 		return -1;
 
@@ -346,7 +436,7 @@ static int lxc_terminal_write_log_file(struct lxc_terminal *terminal, char *buf,
 		 * should be read and written.
 		 */
 		WARN("Size of terminal log file is smaller than the bytes to write");
-		ret = lxc_write_nointr(terminal->log_fd, buf, terminal->log_size);
+		ret = lxc_terminal_append_log_file(terminal, buf, terminal->log_size);
 		if (ret < 0)
 			return -1;
 		bytes_read -= ret;
@@ -354,13 +444,213 @@ static int lxc_terminal_write_log_file(struct lxc_terminal *terminal, char *buf,
 	}
 
 	/* Yay, we made it. */
-	ret = lxc_write_nointr(terminal->log_fd, buf, bytes_read);
+	ret = lxc_terminal_append_log_file(terminal, buf, bytes_read);
 	if (ret < 0)
 		return -1;
 	bytes_read -= ret;
 	return bytes_read;
 }
 
+static int lxc_terminal_log_timer_cb(int fd, uint32_t events, void *data,
+				     struct lxc_epoll_descr *descr)
+{
+	int ret;
+	uint64_t expirations;
+	struct lxc_terminal *terminal = data;
+
+	ret = lxc_read_nointr(fd, &expirations, sizeof(expirations));
+	if (ret < 0 && errno != EAGAIN)
+		SYSTRACE("Failed to read terminal log timer");
+
+	ret = lxc_terminal_flush_log_file(terminal);
+	if (ret < 0)
+		TRACE("Failed to flush terminal log");
+
+	return LXC_MAINLOOP_CONTINUE;
+}
+
+/* Throw away @len bytes left in @pipefd after a failed splice so they don't
+ * end up in front of the next chunk.
+ */
+static void lxc_terminal_splice_discard(int pipefd, size_t len)
+{
+	char buf[LXC_TERMINAL_BUFFER_SIZE];
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = lxc_read_nointr(pipefd, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (ret <= 0)
+			return;
+
+		len -= ret;
+	}
+}
+
+/* Move @len bytes from @pipefd to @fd. If @fd doesn't support splice the data
+ * is bounced through userspace and the fast path is turned off.
+ */
+static ssize_t lxc_terminal_splice_out(struct lxc_terminal *terminal,
+				       int pipefd, int fd, size_t len)
+{
+	char buf[LXC_TERMINAL_BUFFER_SIZE];
+	size_t left = len;
+	ssize_t ret;
+
+	while (left > 0) {
+		ret = splice(pipefd, NULL, fd, NULL, left, SPLICE_F_MOVE);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0 && errno == EINVAL) {
+			terminal->splice_disabled = true;
+
+			ret = lxc_read_nointr(pipefd, buf, left < sizeof(buf) ? left : sizeof(buf));
+			if (ret <= 0)
+				break;
+
+			if (lxc_write_nointr(fd, buf, ret) != ret) {
+				left -= ret;
+				break;
+			}
+		} else if (ret <= 0) {
+			break;
+		}
+
+		left -= ret;
+	}
+
+	if (left > 0) {
+		lxc_terminal_splice_discard(pipefd, left);
+		return -1;
+	}
+
+	return len;
+}
+
+static int lxc_terminal_splice_pipes(struct lxc_terminal *terminal)
+{
+	int ret;
+
+	if (terminal->splice_pipe[0] < 0) {
+		ret = pipe2(terminal->splice_pipe, O_CLOEXEC);
+		if (ret < 0)
+			return -1;
+	}
+
+	if (terminal->tee_pipe[0] < 0) {
+		ret = pipe2(terminal->tee_pipe, O_CLOEXEC);
+		if (ret < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Move output from the terminal master to the peer and the log file through a
+ * pipe so that the data never has to be copied into userspace. When both
+ * receive the data the pipe is duplicated with tee(). Returns the number of
+ * bytes moved, 0 if the master was hung up or -EOPNOTSUPP if the data needs
+ * to go through lxc_terminal_io_cb()'s buffer instead.
+ */
+static int lxc_terminal_splice_master(struct lxc_terminal *terminal)
+{
+	ssize_t in, ret;
+	size_t len = LXC_TERMINAL_SPLICE_SIZE;
+	bool to_peer = terminal->peer >= 0;
+	bool to_log = terminal->log_fd >= 0;
+
+	/* The ringbuffer needs its own copy anyway. */
+	if (terminal->splice_disabled || terminal->buffer_size > 0)
+		return -EOPNOTSUPP;
+
+	if (!to_peer && !to_log)
+		return -EOPNOTSUPP;
+
+	/* splice() refuses files opened with O_APPEND. */
+	if (to_log && terminal->log_append)
+		return -EOPNOTSUPP;
+
+	if (to_log && terminal->log_size > 0) {
+		int64_t space_left;
+
+		/* Rotation and truncation are left to
+		 * lxc_terminal_write_log_file().
+		 */
+		if (!terminal->log_regular)
+			return -EOPNOTSUPP;
+
+		space_left = terminal->log_size - terminal->log_written;
+		if (space_left <= 0)
+			return -EOPNOTSUPP;
+
+		if ((uint64_t)space_left < len)
+			len = space_left;
+	}
+
+	ret = lxc_terminal_splice_pipes(terminal);
+	if (ret < 0) {
+		SYSWARN("Failed to create pipes for terminal splicing");
+		terminal->splice_disabled = true;
+		return -EOPNOTSUPP;
+	}
+
+	in = splice(terminal->master, NULL, terminal->splice_pipe[1], NULL,
+		    len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (in < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return -EAGAIN;
+
+		if (errno == EINVAL) {
+			TRACE("Terminal does not support splice");
+			terminal->splice_disabled = true;
+			return -EOPNOTSUPP;
+		}
+
+		return 0;
+	}
+
+	if (in == 0)
+		return 0;
+
+	if (to_peer && to_log) {
+		ret = tee(terminal->splice_pipe[0], terminal->tee_pipe[1], in,
+			  SPLICE_F_NONBLOCK);
+		if (ret != in) {
+			/* Let the log fall behind rather than the peer. */
+			if (ret > 0)
+				lxc_terminal_splice_discard(terminal->tee_pipe[0], ret);
+			TRACE("Failed to duplicate %zd bytes for the terminal log", in);
+			to_log = false;
+		}
+	}
+
+	if (to_peer) {
+		ret = lxc_terminal_splice_out(terminal, terminal->splice_pipe[0],
+					      terminal->peer, in);
+		if (ret < 0)
+			WARN("Short write on terminal r:%zd", in);
+	}
+
+	if (to_log) {
+		int pipefd = to_peer ? terminal->tee_pipe[0] : terminal->splice_pipe[0];
+
+		/* Keep the log in order with previously buffered output. */
+		ret = lxc_terminal_flush_log_file(terminal);
+		if (ret < 0)
+			TRACE("Failed to flush terminal log");
+
+		ret = lxc_terminal_splice_out(terminal, pipefd, terminal->log_fd, in);
+		if (ret < 0)
+			TRACE("Failed to write %zd bytes to terminal log", in);
+		else
+			terminal->log_written += in;
+	} else if (!to_peer) {
+		lxc_terminal_splice_discard(terminal->splice_pipe[0], in);
+	}
+
+	return in;
+}
+
 int lxc_terminal_io_cb(int fd, uint32_t events, void *data,
 		       struct lxc_epoll_descr *descr)
 {
@@ -368,27 +658,19 @@ int lxc_terminal_io_cb(int fd, uint32_t events, void *data,
 	char buf[LXC_TERMINAL_BUFFER_SIZE];
 	int r, w, w_log, w_rbuf;
 
-	w = r = lxc_read_nointr(fd, buf, sizeof(buf));
-	if (r <= 0) {
-		INFO("Terminal client on fd %d has exited", fd);
-		lxc_mainloop_del_handler(descr, fd);
-
-		if (fd == terminal->master) {
-			terminal->master = -EBADF;
-		} else if (fd == terminal->peer) {
-			if (terminal->tty_state) {
-				lxc_terminal_signal_fini(terminal->tty_state);
-				terminal->tty_state = NULL;
-			}
-			terminal->peer = -EBADF;
-		} else {
-			ERROR("Handler received unexpected file descriptor");
-		}
-		close(fd);
+	if (fd == terminal->master) {
+		r = lxc_terminal_splice_master(terminal);
+		if (r == -EAGAIN || r > 0)
+			return LXC_MAINLOOP_CONTINUE;
 
-		return LXC_MAINLOOP_CLOSE;
+		if (r == 0)
+			goto on_close;
 	}
 
+	w = r = lxc_read_nointr(fd, buf, sizeof(buf));
+	if (r <= 0)
+		goto on_close;
+
 	if (fd == terminal->peer)
 		w = lxc_write_nointr(terminal->master, buf, r);
 
@@ -419,6 +701,25 @@ int lxc_terminal_io_cb(int fd, uint32_t events, void *data,
 		TRACE("Failed to write %d bytes to terminal log", r);
 
 	return LXC_MAINLOOP_CONTINUE;
+
+on_close:
+	INFO("Terminal client on fd %d has exited", fd);
+	lxc_mainloop_del_handler(descr, fd);
+
+	if (fd == terminal->master) {
+		terminal->master = -EBADF;
+	} else if (fd == terminal->peer) {
+		if (terminal->tty_state) {
+			lxc_terminal_signal_fini(terminal->tty_state);
+			terminal->tty_state = NULL;
+		}
+		terminal->peer = -EBADF;
+	} else {
+		ERROR("Handler received unexpected file descriptor");
+	}
+	close(fd);
+
+	return LXC_MAINLOOP_CLOSE;
 }
 
 static int lxc_terminal_mainloop_add_peer(struct lxc_terminal *terminal)
@@ -447,6 +748,31 @@ static int lxc_terminal_mainloop_add_peer(struct lxc_terminal *terminal)
 	return 0;
 }
 
+/* Without the timer the terminal log file is written through. */
+static void lxc_terminal_mainloop_add_log_timer(struct lxc_epoll_descr *descr,
+						struct lxc_terminal *terminal)
+{
+	int ret;
+
+	if (!terminal->log_buf || terminal->log_timer_fd >= 0)
+		return;
+
+	terminal->log_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+						TFD_NONBLOCK | TFD_CLOEXEC);
+	if (terminal->log_timer_fd < 0) {
+		SYSWARN("Failed to create terminal log timer");
+		return;
+	}
+
+	ret = lxc_mainloop_add_handler(descr, terminal->log_timer_fd,
+				       lxc_terminal_log_timer_cb, terminal);
+	if (ret < 0) {
+		WARN("Failed to add terminal log timer to mainloop");
+		close(terminal->log_timer_fd);
+		terminal->log_timer_fd = -EBADF;
+	}
+}
+
 int lxc_terminal_mainloop_add(struct lxc_epoll_descr *descr,
 			      struct lxc_terminal *terminal)
 {
@@ -470,6 +796,8 @@ int lxc_terminal_mainloop_add(struct lxc_epoll_descr *descr,
 	 */
 	terminal->descr = descr;
 
+	lxc_terminal_mainloop_add_log_timer(descr, terminal);
+
 	return lxc_terminal_mainloop_add_peer(terminal);
 }
 
@@ -774,14 +1102,35 @@ int lxc_terminal_write_ringbuffer(struct lxc_terminal *terminal)
 	ret = lxc_write_nointr(terminal->log_fd, r_addr, used);
 	if (ret < 0)
 		return -EIO;
+	terminal->log_written = ret;
 
 	return 0;
 }
 
+static void lxc_terminal_close_splice_pipes(struct lxc_terminal *terminal)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (terminal->splice_pipe[i] >= 0)
+			close(terminal->splice_pipe[i]);
+		terminal->splice_pipe[i] = -EBADF;
+
+		if (terminal->tee_pipe[i] >= 0)
+			close(terminal->tee_pipe[i]);
+		terminal->tee_pipe[i] = -EBADF;
+	}
+	terminal->splice_disabled = false;
+}
+
 void lxc_terminal_delete(struct lxc_terminal *terminal)
 {
 	int ret;
 
+	ret = lxc_terminal_flush_log_file(terminal);
+	if (ret < 0)
+		WARN("Failed to flush terminal log file");
+
 	ret = lxc_terminal_write_ringbuffer(terminal);
 	if (ret < 0)
 		WARN("Failed to write terminal log to disk");
@@ -809,6 +1158,16 @@ void lxc_terminal_delete(struct lxc_terminal *terminal)
 	if (terminal->log_fd >= 0)
 		close(terminal->log_fd);
 	terminal->log_fd = -1;
+
+	if (terminal->log_timer_fd >= 0)
+		close(terminal->log_timer_fd);
+	terminal->log_timer_fd = -1;
+
+	free(terminal->log_buf);
+	terminal->log_buf = NULL;
+	terminal->log_buf_len = 0;
+
+	lxc_terminal_close_splice_pipes(terminal);
 }
 
 /**
@@ -864,14 +1223,46 @@ static int lxc_terminal_create_ringbuf(struct lxc_terminal *terminal)
  */
 int lxc_terminal_create_log_file(struct lxc_terminal *terminal)
 {
+	int flags, ret;
+	struct stat st;
+
 	if (!terminal->log_path)
 		return 0;
 
-	terminal->log_fd = lxc_unpriv(open(terminal->log_path, O_CLOEXEC | O_RDWR | O_CREAT | O_APPEND, 0600));
+	/* Output can't be spliced into files opened with O_APPEND. It is only
+	 * spliced if there's neither a ringbuffer nor log rotation. We're the
+	 * only writer then so position the file offset at the end ourselves.
+	 */
+	terminal->log_append = terminal->buffer_size > 0 || terminal->log_rotate > 0;
+	flags = O_CLOEXEC | O_RDWR | O_CREAT;
+	if (terminal->log_append)
+		flags |= O_APPEND;
+
+	terminal->log_fd = lxc_unpriv(open(terminal->log_path, flags, 0600));
 	if (terminal->log_fd < 0) {
 		SYSERROR("Failed to open terminal log file \"%s\"", terminal->log_path);
 		return -1;
 	}
+	if (!terminal->log_append)
+		(void)lseek(terminal->log_fd, 0, SEEK_END);
+
+	/* The size of the log file is tracked in memory from here on. */
+	ret = fstat(terminal->log_fd, &st);
+	if (ret < 0) {
+		SYSERROR("Failed to stat terminal log file \"%s\"", terminal->log_path);
+		close(terminal->log_fd);
+		terminal->log_fd = -1;
+		return -1;
+	}
+	terminal->log_written = st.st_size;
+	terminal->log_regular = S_ISREG(st.st_mode);
+
+	if (!terminal->log_buf) {
+		terminal->log_buf = malloc(LXC_TERMINAL_LOG_BUFFER_SIZE);
+		if (!terminal->log_buf)
+			WARN("Failed to allocate terminal log buffer, writing through");
+	}
+	terminal->log_buf_len = 0;
 
 	DEBUG("Using \"%s\" as terminal log file", terminal->log_path);
 	return 0;
@@ -1192,12 +1583,19 @@ void lxc_terminal_init(struct lxc_terminal *terminal)
 	terminal->master = -EBADF;
 	terminal->peer = -EBADF;
 	terminal->log_fd = -EBADF;
+	terminal->log_timer_fd = -EBADF;
+	terminal->splice_pipe[0] = -EBADF;
+	terminal->splice_pipe[1] = -EBADF;
+	terminal->tee_pipe[0] = -EBADF;
+	terminal->tee_pipe[1] = -EBADF;
+	terminal->ringbuf.fd = -EBADF;
 	lxc_terminal_info_init(&terminal->proxy);
 }
 
 void lxc_terminal_conf_free(struct lxc_terminal *terminal)
 {
 	free(terminal->log_path);
+	free(terminal->log_buf);
 	free(terminal->path);
 	if (terminal->buffer_size > 0 && terminal->ringbuf.addr)
 		lxc_ringbuf_release(&terminal->ringbuf);
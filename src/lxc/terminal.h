@@ -27,6 +27,7 @@
 #include "config.h"
 
 #include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "list.h"
@@ -107,6 +108,22 @@ struct lxc_terminal {
 
 		/* whether the log file will be rotated */
 		unsigned int log_rotate;
+
+		/* size of the log file including pending data */
+		uint64_t log_written;
+
+		/* whether the log file is a regular file */
+		bool log_regular;
+
+		/* whether the log file is opened with O_APPEND */
+		bool log_append;
+
+		/* data not yet written to the log file */
+		char *log_buf;
+		size_t log_buf_len;
+
+		/* timer to flush pending data to the log file */
+		int log_timer_fd;
 	};
 
 	struct /* lxc_terminal_ringbuf */ {
@@ -116,6 +133,17 @@ struct lxc_terminal {
 		/* the in-memory ringbuffer */
 		struct lxc_ringbuf ringbuf;
 	};
+
+	struct /* lxc_terminal_splice */ {
+		/* pipe used to move output from the master without copying */
+		int splice_pipe[2];
+
+		/* pipe holding the copy of the output for the log file */
+		int tee_pipe[2];
+
+		/* whether the terminal doesn't support splice */
+		bool splice_disabled;
+	};
 };
 
 /**
@@ -248,15 +276,15 @@ extern void lxc_terminal_winsz(int srcfd, int dstfd);
  * sigfd member of the returned lxc_terminal_state can be
  * select()/poll()ed/epoll()ed on (i.e. added to a mainloop) for signals.
  *
- * Must be called with process_lock held to protect the lxc_ttys list, or from
- * a non-threaded context.
+ * The lxc_ttys list is protected by its own mutex so this may be called from
+ * multiple threads.
  *
  * Note that the signal handler isn't installed as a classic asychronous
  * handler, rather signalfd(2) is used so that we can handle the signal when
  * we're ready for it. This avoids deadlocks since a signal handler (ie
- * lxc_terminal_sigwinch()) would need to take the thread mutex to prevent
- * lxc_ttys list corruption, but using the fd we can provide the tty_state
- * needed to the callback (lxc_terminal_signalfd_cb()).
+ * lxc_terminal_sigwinch()) would need to take the lxc_ttys mutex to prevent
+ * list corruption, but using the fd we can provide the tty_state needed to
+ * the callback (lxc_terminal_signalfd_cb()).
  *
  * This function allocates memory. It is up to the caller to free it.
  */
@@ -278,8 +306,8 @@ extern int lxc_terminal_signalfd_cb(int fd, uint32_t events, void *cbdata,
  * Restore the saved signal handler that was in effect at the time
  * lxc_terminal_signal_init() was called.
  *
- * Must be called with process_lock held to protect the lxc_ttys list, or
- * from a non-threaded context.
+ * The lxc_ttys list is protected by its own mutex so this may be called from
+ * multiple threads.
  */
 extern void lxc_terminal_signal_fini(struct lxc_terminal_state *ts);
 
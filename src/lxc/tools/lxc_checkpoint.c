@@ -38,8 +38,13 @@ static bool daemonize_set = false;
 static bool pre_dump = false;
 static char *predump_dir = NULL;
 static char *actionscript_path = NULL;
+static bool iterative = false;
+static unsigned int max_iterations = 0;
+static uint64_t converge_pages = 0;
 
 #define OPT_PREDUMP_DIR OPT_USAGE + 1
+#define OPT_MAX_ITERATIONS OPT_USAGE + 2
+#define OPT_CONVERGE_PAGES OPT_USAGE + 3
 
 static const struct option my_longopts[] = {
 	{"checkpoint-dir", required_argument, 0, 'D'},
@@ -51,6 +56,9 @@ static const struct option my_longopts[] = {
 	{"foreground", no_argument, 0, 'F'},
 	{"pre-dump", no_argument, 0, 'p'},
 	{"predump-dir", required_argument, 0, OPT_PREDUMP_DIR},
+	{"iterative", no_argument, 0, 'i'},
+	{"max-iterations", required_argument, 0, OPT_MAX_ITERATIONS},
+	{"converge-pages", required_argument, 0, OPT_CONVERGE_PAGES},
 	LXC_COMMON_OPTIONS
 };
 
@@ -77,6 +85,11 @@ static int my_checker(const struct lxc_arguments *args)
 		return -1;
 	}
 
+	if (iterative && (do_restore || pre_dump || predump_dir)) {
+		ERROR("-i not compatible with -r, -p or --predump-dir");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -118,6 +131,17 @@ static int my_parser(struct lxc_arguments *args, int c, char *arg)
 		if (!predump_dir)
 			return -1;
 		break;
+	case 'i':
+		iterative = true;
+		break;
+	case OPT_MAX_ITERATIONS:
+		if (lxc_safe_uint(arg, &max_iterations) < 0)
+			return -1;
+		break;
+	case OPT_CONVERGE_PAGES:
+		if (lxc_safe_uint64(arg, &converge_pages, 10) < 0)
+			return -1;
+		break;
 	}
 
 	return 0;
@@ -144,6 +168,11 @@ Options :\n\
                             Container keeps on running and following\n\
                             checkpoints will only dump the changes.\n\
   --predump-dir=DIR         path to images from previous dump (relative to -D)\n\
+  -i, --iterative           Pre-dump the memory in rounds until the dirty\n\
+                            pages converge, then checkpoint.\n\
+  --max-iterations=N        Maximum number of pre-dump rounds (default: 5)\n\
+  --converge-pages=N        Stop pre-dumping once a round copied at most N\n\
+                            pages (default: 1024)\n\
   Restore options:\n\
   -d, --daemon              Daemonize the container (default)\n\
   -F, --foreground          Start with the current tty attached to /dev/console\n\
@@ -174,8 +203,12 @@ static bool checkpoint(struct lxc_container *c)
 	opts.verbose = verbose;
 	opts.predump_dir = predump_dir;
 	opts.action_script = actionscript_path;
+	opts.max_iterations = max_iterations;
+	opts.converge_threshold = converge_pages;
 
-	if (pre_dump)
+	if (iterative)
+		mode = MIGRATE_ITERATIVE_DUMP;
+	else if (pre_dump)
 		mode = MIGRATE_PRE_DUMP;
 	else
 		mode = MIGRATE_DUMP;
@@ -36,6 +36,7 @@ static struct lxc_config_items items[] =
 	{ .name = "lxc.bdev.zfs.root", },
 	{ .name = "lxc.cgroup.use", },
 	{ .name = "lxc.cgroup.pattern", },
+	{ .name = "lxc.lock.timeout", },
 	{ .name = NULL, },
 };
 
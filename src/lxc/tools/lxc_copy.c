@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -94,7 +95,7 @@ static struct lxc_arguments my_args = {
 	.progname = "lxc-copy",
 	.help = "\n\
 --name=NAME [-P lxcpath] -N newname [-p newpath] [-B backingstorage] [-s] [-K] [-M] [-L size [unit]] -- hook options\n\
---name=NAME [-P lxcpath] [-N newname] [-p newpath] [-B backingstorage] -e [-d] [-D] [-K] [-M] [-m {bind,overlay}=/src:/dest] -- hook options\n\
+--name=NAME [-P lxcpath] [-N newname] [-p newpath] [-B backingstorage] -e [-d] [-D] [-K] [-M] [-t [-L size [unit]]] [-m {bind,overlay}=/src:/dest] -- hook options\n\
 --name=NAME [-P lxcpath] -N newname -R\n\
 \n\
 lxc-copy clone a container\n\
@@ -114,6 +115,7 @@ Options :\n\
   -t, --tmpfs               place ephemeral container on a tmpfs\n\
                             (WARNING: On reboot all changes made to the container will be lost.)\n\
   -L, --fssize              size of the new block device for block device containers\n\
+                            or of the tmpfs of an ephemeral container with -t\n\
   -D, --keedata             pass together with -e start a persistent snapshot \n\
   -K, --keepname            keep the hostname of the original container\n\
   --  hook options          arguments passed to the hook program\n\
@@ -149,8 +151,7 @@ static uint64_t get_fssize(char *s);
  * are that you cannot request the data to be kept while placing the container
  * on a tmpfs and that either overlay storage driver must be used.
  */
-static char *mount_tmpfs(const char *oldname, const char *newname,
-			 const char *path, struct lxc_arguments *arg);
+static int check_tmpfs(struct lxc_arguments *arg);
 static int parse_mntsubopts(char *subopts, char *const *keys,
 			    char *mntparameters);
 static int parse_bind_mnt(char *mntstring, enum mnttype type);
@@ -378,8 +379,8 @@ static int do_clone(struct lxc_container *c, char *newname, char *newpath,
 static int do_clone_ephemeral(struct lxc_container *c,
 		struct lxc_arguments *arg, char **args, int flags)
 {
-	char *premount;
 	char randname[MAXPATHLEN];
+	char tmpfs_size[LXC_NUMSTRLEN64];
 	unsigned int i;
 	int ret = 0;
 	bool bret = true, started = false;
@@ -388,6 +389,9 @@ static int do_clone_ephemeral(struct lxc_container *c,
 	lxc_attach_options_t attach_options = LXC_ATTACH_OPTIONS_DEFAULT;
 	attach_options.env_policy = LXC_ATTACH_CLEAR_ENV;
 
+	if (arg->tmpfs && check_tmpfs(arg) < 0)
+		return -1;
+
 	if (!arg->newname) {
 		ret = snprintf(randname, MAXPATHLEN, "%s/%s_XXXXXX", arg->newpath, arg->name);
 		if (ret < 0 || ret >= MAXPATHLEN)
@@ -404,18 +408,18 @@ static int do_clone_ephemeral(struct lxc_container *c,
 		arg->newname = randname + strlen(arg->newpath) + 1;
 	}
 
+	/* With -t the size is the size of the tmpfs not of the clone. */
 	clone = c->clone(c, arg->newname, arg->newpath, flags,
-			 arg->bdevtype, NULL, arg->fssize, args);
+			 arg->bdevtype, NULL, arg->tmpfs ? 0 : arg->fssize, args);
 	if (!clone)
 		return -1;
 
 	if (arg->tmpfs) {
-		premount = mount_tmpfs(arg->name, arg->newname, arg->newpath, arg);
-		if (!premount)
+		ret = snprintf(tmpfs_size, sizeof(tmpfs_size), "%" PRIu64, arg->fssize);
+		if (ret < 0 || (size_t)ret >= sizeof(tmpfs_size))
 			goto destroy_and_put;
 
-		bret = clone->set_config_item(clone, "lxc.hook.pre-mount", premount);
-		free(premount);
+		bret = clone->set_config_item(clone, "lxc.rootfs.overlay.tmpfs_size", tmpfs_size);
 		if (!bret)
 			goto destroy_and_put;
 	}
@@ -743,93 +747,44 @@ err:
 	return -1;
 }
 
-/* For ephemeral snapshots backed by the overlay filesystem, this function
- * mounts a fresh tmpfs over the containers directory if the user requests it.
- * Because we mount a fresh tmpfs over the directory of the container the
- * updated /etc/hostname file created during the clone residing in the upperdir
- * (currently named "delta0" by default) will be hidden. Hence, if the user
- * requests that the old name is not to be kept for the clone, we recreate this
- * file on the tmpfs. This should be all that is required to restore the exact
- * behaviour we would get with a normal clone.
+/* For ephemeral snapshots backed by the overlay filesystem the upper dir of
+ * the clone's rootfs is placed on a tmpfs of -L size when the container is
+ * started. The tmpfs is mounted in the container's mount namespace and takes
+ * all changes made to the container with it when the container stops. The
+ * upper dir on disk, holding e.g. the updated /etc/hostname of the clone, is
+ * kept as the topmost read-only layer. Without -L the tmpfs is limited to half
+ * of the host's memory, which is the kernel's default.
  */
-static char *mount_tmpfs(const char *oldname, const char *newname,
-			 const char *path, struct lxc_arguments *arg)
+static int check_tmpfs(struct lxc_arguments *arg)
 {
-	int ret, fd;
-	size_t len;
-	mode_t msk;
-	char *premount = NULL;
-	FILE *fp = NULL;
+	long pages, pagesize;
 
-	if (arg->tmpfs && arg->keepdata) {
+	if (arg->keepdata) {
 		ERROR("%s",
-		      "A container can only be placed on a tmpfs when the "
-		      "overlay storage driver is used");
-		goto err_free;
+		      "The data of a container placed on a tmpfs can't be "
+		      "kept");
+		return -1;
 	}
 
-	if (arg->tmpfs && !arg->bdevtype) {
+	if (!arg->bdevtype) {
 		arg->bdevtype = "overlayfs";
-	} else if (arg->tmpfs && arg->bdevtype &&
-		   strncmp(arg->bdevtype, "overlayfs", strlen(arg->bdevtype)) != 0) {
+	} else if (strncmp(arg->bdevtype, "overlayfs", strlen(arg->bdevtype)) != 0) {
 		ERROR("%s",
 		      "A container can only be placed on a tmpfs when the "
 		      "overlay storage driver is used");
-		goto err_free;
-	}
-
-	len = strlen(path) + strlen(newname) + strlen("pre-start-XXXXXX") + /* //\0 */ 3;
-	premount = malloc(len);
-	if (!premount)
-		goto err_free;
-
-	ret = snprintf(premount, len, "%s/%s/pre-start-XXXXXX", path, newname);
-	if (ret < 0 || (size_t)ret >= len)
-		goto err_free;
-
-	msk = umask(0022);
-	fd = mkstemp(premount);
-	umask(msk);
-	if (fd < 0)
-		goto err_free;
-
-	if (fcntl(fd, F_SETFD, FD_CLOEXEC)) {
-		ERROR("Failed to set close-on-exec on file descriptor");
-		goto err_close;
+		return -1;
 	}
 
-	if (chmod(premount, 0755) < 0)
-		goto err_close;
-
-	fp = fdopen(fd, "r+");
-	if (!fp)
-		goto err_close;
-	fd = -1;
-
-	ret = fprintf(fp, "#! /bin/sh\n"
-			  "mount -n -t tmpfs -o mode=0755 none %s/%s\n",
-		      path, newname);
-	if (ret < 0)
-		goto err_close;
+	if (arg->fssize)
+		return 0;
 
-	if (!arg->keepname) {
-		ret = fprintf(fp, "mkdir -p %s/%s/delta0/etc\n"
-				  "echo %s > %s/%s/delta0/etc/hostname\n",
-			      path, newname, newname, path, newname);
-		if (ret < 0)
-			goto err_close;
+	pages = sysconf(_SC_PHYS_PAGES);
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pages <= 0 || pagesize <= 0) {
+		ERROR("Failed to detect the size of the host's memory");
+		return -1;
 	}
 
-	fclose(fp);
-	return premount;
-
-err_close:
-	if (fd > 0)
-		close(fd);
-	else if (fp)
-		fclose(fp);
-
-err_free:
-	free(premount);
-	return NULL;
+	arg->fssize = (uint64_t)pages * (uint64_t)pagesize / 2;
+	return 0;
 }
@@ -2286,10 +2286,75 @@ on_error:
 	return fd_tmp;
 }
 
-int lxc_prepare_loop_dev(const char *source, char *loop_dev, int flags)
+/* Attach @fd_img with LOOP_SET_FD and LOOP_SET_STATUS64 for kernels that
+ * lack LOOP_CONFIGURE. Direct I/O and the block size are best effort here.
+ */
+static int lxc_configure_loop_dev_legacy(int fd_loop, int fd_img, int flags,
+					 unsigned int block_size)
 {
 	int ret;
 	struct loop_info64 lo64;
+
+	ret = ioctl(fd_loop, LOOP_SET_FD, fd_img);
+	if (ret < 0)
+		return -1;
+
+	memset(&lo64, 0, sizeof(lo64));
+	lo64.lo_flags = flags & ~LO_FLAGS_DIRECT_IO;
+
+	ret = ioctl(fd_loop, LOOP_SET_STATUS64, &lo64);
+	if (ret < 0)
+		return -1;
+
+	if (block_size > 0) {
+		ret = ioctl(fd_loop, LOOP_SET_BLOCK_SIZE, (unsigned long)block_size);
+		if (ret < 0)
+			SYSWARN("Failed to set block size %u of loop device",
+				block_size);
+	}
+
+	if (flags & LO_FLAGS_DIRECT_IO) {
+		ret = ioctl(fd_loop, LOOP_SET_DIRECT_IO, 1UL);
+		if (ret < 0)
+			SYSTRACE("Failed to enable direct I/O for loop device");
+	}
+
+	return 0;
+}
+
+/* Attach @fd_img to @fd_loop and set it up with a single LOOP_CONFIGURE call
+ * so that the device never becomes visible half configured.
+ */
+static int lxc_configure_loop_dev(int fd_loop, int fd_img, int flags,
+				  unsigned int block_size)
+{
+	int ret;
+	struct loop_config config;
+
+	memset(&config, 0, sizeof(config));
+	config.fd = fd_img;
+	config.block_size = block_size;
+	config.info.lo_flags = flags;
+
+	ret = ioctl(fd_loop, LOOP_CONFIGURE, &config);
+	if (ret == 0)
+		return 0;
+
+	/* Kernels before 5.8 reject unknown loop ioctls with EINVAL. The same
+	 * error is returned for an unsupported block size which the legacy
+	 * path treats as non-fatal.
+	 */
+	if (errno != EINVAL && errno != ENOTTY)
+		return -1;
+
+	TRACE("LOOP_CONFIGURE failed, falling back to LOOP_SET_FD");
+	return lxc_configure_loop_dev_legacy(fd_loop, fd_img, flags, block_size);
+}
+
+int lxc_prepare_loop_dev(const char *source, char *loop_dev, int flags,
+			 unsigned int block_size)
+{
+	int ret;
 	int fd_img = -1, fret = -1, fd_loop = -1;
 
 	fd_loop = lxc_get_unused_loop_dev(loop_dev);
@@ -2300,18 +2365,14 @@ int lxc_prepare_loop_dev(const char *source, char *loop_dev, int flags)
 			goto on_error;
 	}
 
-	fd_img = open(source, O_RDWR | O_CLOEXEC);
+	if (flags & LO_FLAGS_READ_ONLY)
+		fd_img = open(source, O_RDONLY | O_CLOEXEC);
+	else
+		fd_img = open(source, O_RDWR | O_CLOEXEC);
 	if (fd_img < 0)
 		goto on_error;
 
-	ret = ioctl(fd_loop, LOOP_SET_FD, fd_img);
-	if (ret < 0)
-		goto on_error;
-
-	memset(&lo64, 0, sizeof(lo64));
-	lo64.lo_flags = flags;
-
-	ret = ioctl(fd_loop, LOOP_SET_STATUS64, &lo64);
+	ret = lxc_configure_loop_dev(fd_loop, fd_img, flags, block_size);
 	if (ret < 0)
 		goto on_error;
 
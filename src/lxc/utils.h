@@ -270,6 +270,31 @@ static inline int signalfd(int fd, const sigset_t *mask, int flags)
 #define LO_FLAGS_AUTOCLEAR 4
 #endif
 
+#ifndef LO_FLAGS_DIRECT_IO
+#define LO_FLAGS_DIRECT_IO 16
+#endif
+
+#ifndef LOOP_SET_DIRECT_IO
+#define LOOP_SET_DIRECT_IO 0x4C08
+#endif
+
+#ifndef LOOP_SET_BLOCK_SIZE
+#define LOOP_SET_BLOCK_SIZE 0x4C09
+#endif
+
+#ifndef LOOP_CONFIGURE
+#define LOOP_CONFIGURE 0x4C0A
+#endif
+
+#ifndef HAVE_STRUCT_LOOP_CONFIG
+struct loop_config {
+	__u32 fd;
+	__u32 block_size;
+	struct loop_info64 info;
+	__u64 __reserved[8];
+};
+#endif
+
 #ifndef LOOP_CTL_GET_FREE
 #define LOOP_CTL_GET_FREE 0x4C82
 #endif
@@ -539,8 +564,11 @@ extern int parse_byte_size_string(const char *s, int64_t *converted);
 extern int lxc_switch_uid_gid(uid_t uid, gid_t gid);
 extern int lxc_setgroups(int size, gid_t list[]);
 
-/* Find an unused loop device and associate it with source. */
-extern int lxc_prepare_loop_dev(const char *source, char *loop_dev, int flags);
+/* Find an unused loop device and associate it with source. A @block_size of
+ * 0 keeps the kernel's default logical block size.
+ */
+extern int lxc_prepare_loop_dev(const char *source, char *loop_dev, int flags,
+				unsigned int block_size);
 
 /* Clear all mounts on a given node.
  * >= 0 successfully cleared. The number returned is the number of umounts
@@ -613,6 +641,20 @@ static inline pid_t lxc_raw_gettid(void)
 #endif
 }
 
+#ifndef __NR_pidfd_open
+	#if defined __alpha__
+		#define __NR_pidfd_open 544
+	#else
+		#define __NR_pidfd_open 434
+	#endif
+#endif
+
+/* Returns a file descriptor that becomes readable once @pid exits. */
+static inline int lxc_raw_pidfd_open(pid_t pid, unsigned int flags)
+{
+	return syscall(__NR_pidfd_open, pid, flags);
+}
+
 /* Set a signal the child process will receive after the parent has died. */
 extern int lxc_set_death_signal(int signal);
 extern int fd_cloexec(int fd, bool cloexec);
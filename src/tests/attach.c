@@ -281,6 +281,58 @@ static int test_attach_cmd(struct lxc_container *ct)
 	return 0;
 }
 
+static int test_attach_session(struct lxc_container *ct)
+{
+	int i, ret;
+	struct lxc_attach_session *session;
+	const char *argv[] = {"cmp", "-s", "/sbin/init", "/bin/busybox", NULL};
+	const char *envp[] = {"PATH=/bin:/usr/bin", NULL};
+	lxc_attach_options_t attach_options = LXC_ATTACH_OPTIONS_DEFAULT;
+
+	TSTOUT("Testing attach session...\n");
+	attach_options.attach_flags |= LXC_ATTACH_TERMINAL;
+	session = ct->attach_session_open(ct, &attach_options);
+	if (session) {
+		TSTERR("attach session open with a terminal succeeded");
+		ct->attach_session_close(ct, session);
+		return -1;
+	}
+	attach_options.attach_flags &= ~LXC_ATTACH_TERMINAL;
+
+	session = ct->attach_session_open(ct, &attach_options);
+	if (!session) {
+		TSTERR("attach session open failed");
+		return -1;
+	}
+
+	for (i = 0; i < 3; i++) {
+		ret = ct->attach_session_run(ct, session, "cmp", argv, NULL, NULL);
+		if (ret != 0) {
+			TSTERR("attach session success command got bad return %d", ret);
+			goto on_error;
+		}
+	}
+
+	argv[2] = "/etc/fstab";
+	ret = ct->attach_session_run(ct, session, "cmp", argv, envp, NULL);
+	if (ret <= 0) {
+		TSTERR("attach session failure command got bad return %d", ret);
+		goto on_error;
+	}
+
+	ret = ct->attach_session_close(ct, session);
+	if (ret != 0) {
+		TSTERR("attach session helper exited with %d", ret);
+		return -1;
+	}
+
+	return 0;
+
+on_error:
+	ct->attach_session_close(ct, session);
+	return -1;
+}
+
 /* test_ct_destroy: stop and destroy the test container
  *
  * @ct       : the container
@@ -368,6 +420,12 @@ static int test_attach(const char *lxcpath, const char *name, const char *templa
 		goto err2;
 	}
 
+	ret = test_attach_session(ct);
+	if (ret < 0) {
+		TSTERR("attach session test failed");
+		goto err2;
+	}
+
 	if (lsm_enabled()) {
 		ret = test_attach_lsm_cmd(ct);
 		if (ret < 0) {
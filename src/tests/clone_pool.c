@@ -0,0 +1,308 @@
+/* liblxcapi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "lxc/lxccontainer.h"
+#include "lxctest.h"
+
+#define TSTNAME "lxc-test-clone-pool"
+
+static char lxcpath[] = "/tmp/" TSTNAME "-XXXXXX";
+
+static struct lxc_container *clone_of(struct lxc_container *c, const char *name)
+{
+	return c->clone(c, name, NULL, LXC_CLONE_SNAPSHOT, NULL, NULL, 0, NULL);
+}
+
+/* Wait for the refill of the pool to settle with @nr entries and mark one of
+ * the entries with a file named "marker", which moves with it when it is taken
+ * from the pool.
+ */
+static bool wait_for_pool(unsigned int nr)
+{
+	int i;
+	char path[PATH_MAX];
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME "/pool", lxcpath);
+
+	for (i = 0; i < 300; i++) {
+		int fd;
+		DIR *dir;
+		struct dirent *direntp;
+		unsigned int count = 0;
+		char entry[NAME_MAX + 1] = {0};
+		char file[PATH_MAX + NAME_MAX + sizeof("/marker")];
+
+		dir = opendir(path);
+		if (dir) {
+			while ((direntp = readdir(dir))) {
+				if (direntp->d_name[0] == '.')
+					continue;
+
+				count++;
+				(void)snprintf(entry, sizeof(entry), "%s", direntp->d_name);
+			}
+			closedir(dir);
+		}
+
+		if (count != nr) {
+			usleep(100000);
+			continue;
+		}
+
+		/* The refill holds "pool/.fill" as long as it runs. */
+		(void)snprintf(file, sizeof(file), "%s/.fill", path);
+		fd = open(file, O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+				close(fd);
+				usleep(100000);
+				continue;
+			}
+			close(fd);
+		}
+
+		if (nr == 0)
+			return true;
+
+		(void)snprintf(file, sizeof(file), "%s/%s/marker", path, entry);
+		fd = open(file, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return false;
+		close(fd);
+
+		return true;
+	}
+
+	return false;
+}
+
+static bool has_marker(const char *name)
+{
+	char path[PATH_MAX];
+
+	(void)snprintf(path, sizeof(path), "%s/%s/marker", lxcpath, name);
+	return access(path, F_OK) == 0;
+}
+
+static bool create_base(struct lxc_container *c)
+{
+	int fd;
+	char path[PATH_MAX];
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME, lxcpath);
+	if (mkdir(path, 0755) < 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME "/rootfs", lxcpath);
+	if (mkdir(path, 0755) < 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME "/rootfs/etc", lxcpath);
+	if (mkdir(path, 0755) < 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME "/rootfs/etc/hostname", lxcpath);
+	fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	if (write(fd, TSTNAME "\n", strlen(TSTNAME) + 1) < 0) {
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	(void)snprintf(path, sizeof(path), "dir:%s/" TSTNAME "/rootfs", lxcpath);
+	if (!c->set_config_item(c, "lxc.rootfs.path", path) ||
+	    !c->set_config_item(c, "lxc.uts.name", TSTNAME) ||
+	    !c->set_config_item(c, "lxc.clone.pool", "1"))
+		return false;
+
+	return c->save_config(c, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	char buf[PATH_MAX];
+	struct lxc_container *c = NULL, *clones[3] = {NULL};
+	const char *names[3] = {TSTNAME "-1", TSTNAME "-2", TSTNAME "-3"};
+	int ret = EXIT_FAILURE;
+
+	if (!mkdtemp(lxcpath)) {
+		lxc_error("%s\n", "Failed to create temporary lxcpath");
+		exit(ret);
+	}
+
+	c = lxc_container_new(TSTNAME, lxcpath);
+	if (!c || !create_base(c)) {
+		lxc_error("%s\n", "Failed to create container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	/* The pool is empty so this is a regular snapshot which triggers the
+	 * first refill.
+	 */
+	clones[0] = clone_of(c, names[0]);
+	if (!clones[0]) {
+		lxc_error("%s\n", "Failed to clone container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	if (!wait_for_pool(1)) {
+		lxc_error("%s\n", "The clone pool wasn't refilled");
+		goto on_error;
+	}
+
+	/* The next clone is the pooled entry moved into place. */
+	clones[1] = clone_of(c, names[1]);
+	if (!clones[1]) {
+		lxc_error("%s\n", "Failed to clone container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	if (!has_marker(names[1])) {
+		lxc_error("%s\n", "The second clone wasn't taken from the pool");
+		goto on_error;
+	}
+
+	if (clones[1]->get_config_item(clones[1], "lxc.uts.name", buf, sizeof(buf)) < 0 ||
+	    strcmp(buf, names[1])) {
+		lxc_error("%s\n", "The pooled clone didn't get its own hostname");
+		goto on_error;
+	}
+
+	if (clones[1]->get_config_item(clones[1], "lxc.rootfs.path", buf, sizeof(buf)) < 0 ||
+	    !strstr(buf, names[1]) || strstr(buf, "/pool/")) {
+		lxc_error("Pooled clone has rootfs \"%s\"\n", buf);
+		goto on_error;
+	}
+
+	if (!wait_for_pool(1)) {
+		lxc_error("%s\n", "The clone pool wasn't refilled");
+		goto on_error;
+	}
+
+	/* Refusing to destroy a container with snapshots keeps its pool. */
+	if (c->destroy(c)) {
+		lxc_error("%s\n", "Destroyed container with snapshots");
+		goto on_error;
+	}
+
+	if (!wait_for_pool(1)) {
+		lxc_error("%s\n", "A refused destroy emptied the clone pool");
+		goto on_error;
+	}
+
+	/* Changing the config makes the pooled entry outdated. */
+	sleep(1);
+	if (!c->set_config_item(c, "lxc.uts.name", TSTNAME "-renamed") ||
+	    !c->save_config(c, NULL)) {
+		lxc_error("%s\n", "Failed to update config");
+		goto on_error;
+	}
+
+	clones[2] = clone_of(c, names[2]);
+	if (!clones[2]) {
+		lxc_error("%s\n", "Failed to clone container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	if (has_marker(names[2])) {
+		lxc_error("%s\n", "An outdated pooled entry was used");
+		goto on_error;
+	}
+
+	if (!wait_for_pool(1)) {
+		lxc_error("%s\n", "The clone pool wasn't refilled");
+		goto on_error;
+	}
+
+	/* An entry without a config, as left behind by an interrupted move,
+	 * is removed along with the others.
+	 */
+	(void)snprintf(buf, sizeof(buf), "%s/" TSTNAME "/pool/broken", lxcpath);
+	if (mkdir(buf, 0755) < 0) {
+		lxc_error("%s\n", "Failed to create broken pool entry");
+		goto on_error;
+	}
+
+	/* Starting the container empties the pool before the container is
+	 * set up, so it doesn't matter that the minimal rootfs can't boot.
+	 */
+	c->want_daemonize(c, true);
+	c->start(c, 0, NULL);
+	if (c->is_running(c))
+		c->stop(c);
+
+	if (!wait_for_pool(0)) {
+		lxc_error("%s\n", "Starting the container didn't empty the pool");
+		goto on_error;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (!clones[i]->destroy(clones[i])) {
+			lxc_error("Failed to destroy \"%s\"\n", names[i]);
+			goto on_error;
+		}
+		lxc_container_put(clones[i]);
+		clones[i] = NULL;
+	}
+
+	if (!c->destroy(c)) {
+		lxc_error("%s\n", "Failed to destroy container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	(void)snprintf(buf, sizeof(buf), "%s/" TSTNAME "/pool", lxcpath);
+	if (access(buf, F_OK) == 0) {
+		lxc_error("%s\n", "The clone pool survived its container");
+		goto on_error;
+	}
+
+	ret = EXIT_SUCCESS;
+	lxc_debug("%s\n", "All clone pool tests passed");
+
+on_error:
+	for (i = 0; i < 3; i++) {
+		if (!clones[i])
+			continue;
+
+		clones[i]->destroy(clones[i]);
+		lxc_container_put(clones[i]);
+	}
+
+	if (c) {
+		if (c->is_defined(c))
+			c->destroy(c);
+		lxc_container_put(c);
+	}
+
+	(void)rmdir(lxcpath);
+	exit(ret);
+}
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <time.h>
 
 #include <lxc/lxccontainer.h>
 
@@ -32,6 +33,7 @@ static int iterations = 1;
 static int debug = 0;
 static int quiet = 0;
 static int delay = 0;
+static int bench_ops = 1000;
 static const char *template = "busybox";
 
 static const struct option options[] = {
@@ -40,6 +42,7 @@ static const struct option options[] = {
 	{ "template",    required_argument, NULL, 't' },
 	{ "delay",       required_argument, NULL, 'd' },
 	{ "modes",       required_argument, NULL, 'm' },
+	{ "bench-ops",   required_argument, NULL, 'b' },
 	{ "quiet",       no_argument,       NULL, 'q' },
 	{ "debug",       no_argument,       NULL, 'D' },
 	{ "help",        no_argument,       NULL, '?' },
@@ -54,7 +57,9 @@ static void usage(void) {
 	        "  -i, --iterations=N           Number times to run the test (default: 1)\n"
 	        "  -t, --template=t             Template to use (default: busybox)\n"
 	        "  -d, --delay=N                Delay in seconds between start and stop\n"
-	        "  -m, --modes=<mode,mode,...>  Modes to run (create, start, stop, destroy)\n"
+	        "  -m, --modes=<mode,mode,...>  Modes to run (create, start, stop, destroy, bench)\n"
+	        "  -b, --bench-ops=N            Read-only API calls per thread in bench mode\n"
+	        "                               (default: 1000)\n"
 	        "  -q, --quiet                  Don't produce any output\n"
 	        "  -D, --debug                  Create a debug log\n"
 	        "  -?, --help                   Give this help list\n"
@@ -69,6 +74,41 @@ struct thread_args {
 	const char *mode;
 };
 
+/*
+ * Hammer the read-only API paths that management daemons poll. Each thread
+ * works on its own container so the calls should scale with the number of
+ * threads instead of serializing on a process-wide lock.
+ */
+static void do_bench(struct thread_args *args, const char *name)
+{
+	int i;
+	char buf[NAME_MAX + 1];
+	struct lxc_container *c;
+
+	args->return_code = 1;
+
+	for (i = 0; i < bench_ops; i++) {
+		c = lxc_container_new(name, NULL);
+		if (!c) {
+			fprintf(stderr, "Unable to instantiate container (%s)\n", name);
+			return;
+		}
+
+		if (c->is_defined(c)) {
+			if (c->get_config_item(c, "lxc.uts.name", buf, sizeof(buf)) < 0) {
+				fprintf(stderr, "Reading the config of container (%s) failed...\n", name);
+				lxc_container_put(c);
+				return;
+			}
+		}
+
+		(void)c->state(c);
+		lxc_container_put(c);
+	}
+
+	args->return_code = 0;
+}
+
 static void do_function(void *arguments)
 {
 	char name[NAME_MAX + 1];
@@ -77,6 +117,11 @@ static void do_function(void *arguments)
 
 	sprintf(name, "lxc-test-concurrent-%d", args->thread_id);
 
+	if (strcmp(args->mode, "bench") == 0) {
+		do_bench(args, name);
+		return;
+	}
+
 	args->return_code = 1;
 
 	c = lxc_container_new(name, NULL);
@@ -151,6 +196,7 @@ static void *concurrent(void *arguments)
 
 int main(int argc, char *argv[]) {
 	int i, j, iter, opt;
+	struct timespec t_start, t_end;
 	pthread_attr_t attr;
 	pthread_t *threads;
 	struct thread_args *args;
@@ -160,7 +206,7 @@ int main(int argc, char *argv[]) {
 
 	pthread_attr_init(&attr);
 
-	while ((opt = getopt_long(argc, argv, "j:i:t:d:m:qD", options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "j:i:t:d:m:b:qD", options, NULL)) != -1) {
 		switch(opt) {
 		case 'j':
 			nthreads = atoi(optarg);
@@ -174,6 +220,9 @@ int main(int argc, char *argv[]) {
 		case 'd':
 			delay = atoi(optarg);
 			break;
+		case 'b':
+			bench_ops = atoi(optarg);
+			break;
 		case 'q':
 			quiet = 1;
 			break;
@@ -233,6 +282,8 @@ int main(int argc, char *argv[]) {
 			if (!quiet)
 				printf("Executing (%s) for %d containers...\n", modes[i], nthreads);
 
+			clock_gettime(CLOCK_MONOTONIC, &t_start);
+
 			for (j = 0; j < nthreads; j++) {
 				args[j].thread_id = j;
 				args[j].mode = modes[i];
@@ -260,6 +311,18 @@ int main(int argc, char *argv[]) {
 					exit(EXIT_FAILURE);
 				}
 			}
+
+			clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+			if (!quiet && strcmp(modes[i], "bench") == 0) {
+				double secs;
+
+				secs = (t_end.tv_sec - t_start.tv_sec) +
+				       (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+				printf("bench: %d threads, %ld ops in %.3fs, %.0f ops/s\n",
+				       nthreads, (long)nthreads * bench_ops, secs,
+				       secs > 0 ? (double)nthreads * bench_ops / secs : 0);
+			}
 		}
 	}
 
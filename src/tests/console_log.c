@@ -31,12 +31,17 @@
 
 #include <lxc/lxccontainer.h>
 
+#include "commands.h"
 #include "lxctest.h"
+#include "ringbuf.h"
 #include "utils.h"
 
 int main(int argc, char *argv[])
 {
-	int ret;
+	int ret, ringfd;
+	ssize_t bytes;
+	char shared_buf[4096];
+	struct lxc_ringbuf_shared shared;
 	struct stat st_log_file;
 	struct lxc_container *c;
 	struct lxc_console_log log;
@@ -111,6 +116,34 @@ int main(int argc, char *argv[])
 			  *log.read_max, log.data);
 	}
 
+	/* Map the ringbuffer and read it without going through commands. */
+	ringfd = lxc_cmd_console_log_fd(c->name, c->config_path);
+	if (ringfd < 0) {
+		lxc_error("%s - Failed to retrieve console ringbuffer fd\n", strerror(-ringfd));
+		goto on_error_stop;
+	}
+
+	ret = lxc_ringbuf_shared_map(&shared, ringfd);
+	close(ringfd);
+	if (ret < 0) {
+		lxc_error("%s - Failed to map console ringbuffer\n", strerror(-ret));
+		goto on_error_stop;
+	}
+
+	if (shared.hdr->size != 4096) {
+		lxc_error("Unexpected console ringbuffer size %" PRIu64 "\n", shared.hdr->size);
+		lxc_ringbuf_shared_unmap(&shared);
+		goto on_error_stop;
+	}
+
+	bytes = lxc_ringbuf_shared_read(&shared, shared_buf, sizeof(shared_buf));
+	lxc_ringbuf_shared_unmap(&shared);
+	if (bytes < 0) {
+		lxc_error("%s - Failed to read shared console ringbuffer\n", strerror(-bytes));
+		goto on_error_stop;
+	}
+	lxc_debug("Retrieved %zd bytes from shared console ringbuffer\n", bytes);
+
 	/* Leave another two seconds to ensure boot is finished. */
 	sleep(2);
 
@@ -0,0 +1,142 @@
+/* liblxcapi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lxc/lxccontainer.h"
+#include "lxctest.h"
+
+#define TSTNAME "lxc-test-event-stream"
+
+/* Wait up to @timeout seconds for an event of @type for our container. */
+static bool wait_for_event(struct lxc_event_stream *stream, int type,
+			   const char *state, int timeout)
+{
+	int ret;
+	struct pollfd pfd;
+	struct lxc_event event;
+	const char *states[32];
+	int nr_states;
+
+	nr_states = lxc_get_wait_states(states);
+
+	pfd.fd = lxc_event_stream_fd(stream);
+	pfd.events = POLLIN;
+
+	for (;;) {
+		ret = lxc_event_stream_read(stream, &event);
+		if (ret < 0)
+			return false;
+
+		if (ret == 0) {
+			ret = poll(&pfd, 1, timeout * 1000);
+			if (ret <= 0)
+				return false;
+			continue;
+		}
+
+		if (strcmp(event.name, TSTNAME) || event.type != type)
+			continue;
+
+		if (type != LXC_EVENT_STATE)
+			return true;
+
+		if (event.value >= 0 && event.value < nr_states &&
+		    !strcmp(states[event.value], state))
+			return true;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct lxc_container *c;
+	struct lxc_event_stream *stream;
+	int ret = EXIT_FAILURE;
+
+	c = lxc_container_new(TSTNAME, NULL);
+	if (!c) {
+		lxc_error("%s\n", "Failed to create container \"" TSTNAME "\"");
+		exit(ret);
+	}
+
+	if (c->is_defined(c)) {
+		lxc_error("%s\n", "Container \"" TSTNAME "\" is defined");
+		goto on_error_put;
+	}
+
+	if (!c->createl(c, "busybox", NULL, NULL, 0, NULL)) {
+		lxc_error("%s\n", "Failed to create busybox container \"" TSTNAME "\"");
+		goto on_error_put;
+	}
+
+	stream = lxc_event_stream_open(c->config_path);
+	if (!stream) {
+		lxc_error("%s\n", "Failed to open event stream");
+		goto on_error_destroy;
+	}
+
+	if (!c->want_daemonize(c, true) || !c->startl(c, 0, NULL)) {
+		lxc_error("%s\n", "Failed to start container \"" TSTNAME "\" daemonized");
+		goto on_error_close;
+	}
+
+	if (!wait_for_event(stream, LXC_EVENT_STATE, "RUNNING", 30)) {
+		lxc_error("%s\n", "Did not receive RUNNING event");
+		goto on_error_stop;
+	}
+
+	if (!c->stop(c)) {
+		lxc_error("%s\n", "Failed to stop container \"" TSTNAME "\"");
+		goto on_error_stop;
+	}
+
+	if (!wait_for_event(stream, LXC_EVENT_EXIT_CODE, NULL, 30)) {
+		lxc_error("%s\n", "Did not receive exit code event");
+		goto on_error_stop;
+	}
+
+	if (!wait_for_event(stream, LXC_EVENT_STATE, "STOPPED", 30)) {
+		lxc_error("%s\n", "Did not receive STOPPED event");
+		goto on_error_stop;
+	}
+
+	ret = EXIT_SUCCESS;
+
+on_error_stop:
+	if (c->is_running(c) && !c->stop(c))
+		lxc_error("%s\n", "Failed to stop container \"" TSTNAME "\"");
+
+on_error_close:
+	lxc_event_stream_close(stream);
+
+on_error_destroy:
+	if (!c->destroy(c))
+		lxc_error("%s\n", "Failed to destroy container \"" TSTNAME "\"");
+
+on_error_put:
+	lxc_container_put(c);
+
+	if (ret == EXIT_SUCCESS)
+		lxc_debug("%s\n", "All event stream tests passed");
+
+	exit(ret);
+}
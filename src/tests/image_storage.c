@@ -0,0 +1,280 @@
+/* liblxcapi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "conf.h"
+#include "lxc/lxccontainer.h"
+#include "lxctest.h"
+#include "storage/storage.h"
+#include "utils.h"
+
+#define TSTNAME "lxc-test-image-storage"
+
+static char lxcpath[] = "/tmp/" TSTNAME "-XXXXXX";
+static char image[PATH_MAX];
+
+/* Build an image holding the file "hello" with whichever tool is around. */
+static int create_image(void)
+{
+	int fd, ret;
+	char dir[PATH_MAX], path[PATH_MAX + NAME_MAX + 1], cmd[4 * PATH_MAX + 128];
+
+	(void)snprintf(dir, sizeof(dir), "%s/contents", lxcpath);
+	if (mkdir(dir, 0755) < 0)
+		return -1;
+
+	(void)snprintf(path, sizeof(path), "%s/hello", dir);
+	fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+
+	ret = lxc_write_nointr(fd, "hello\n", 6);
+	close(fd);
+	if (ret < 0)
+		return -1;
+
+	(void)snprintf(image, sizeof(image), "%s/image", lxcpath);
+
+	(void)snprintf(cmd, sizeof(cmd),
+		       "mksquashfs %s %s -quiet -noappend >/dev/null 2>&1 || "
+		       "mkfs.erofs %s %s >/dev/null 2>&1", dir, image, image, dir);
+	ret = system(cmd);
+
+	(void)unlink(path);
+	(void)rmdir(dir);
+
+	return ret == 0 ? 0 : 1;
+}
+
+static bool create_base(struct lxc_container *c)
+{
+	char path[PATH_MAX + NAME_MAX + 1];
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME, lxcpath);
+	if (mkdir(path, 0755) < 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME "/rootfs", lxcpath);
+	if (mkdir(path, 0755) < 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME "/delta0", lxcpath);
+	if (mkdir(path, 0755) < 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "image:%s:%s/" TSTNAME "/delta0",
+		       image, lxcpath);
+	if (!c->set_config_item(c, "lxc.rootfs.path", path) ||
+	    !c->set_config_item(c, "lxc.uts.name", TSTNAME))
+		return false;
+
+	return c->save_config(c, NULL);
+}
+
+/* Count the loop devices backed by the image. */
+static int count_loop_devs(void)
+{
+	DIR *dir;
+	struct dirent *direntp;
+	int count = 0;
+
+	dir = opendir("/sys/block");
+	if (!dir)
+		return -1;
+
+	while ((direntp = readdir(dir))) {
+		FILE *f;
+		char path[PATH_MAX], backing[PATH_MAX];
+
+		if (strncmp(direntp->d_name, "loop", 4))
+			continue;
+
+		(void)snprintf(path, sizeof(path), "/sys/block/%s/loop/backing_file",
+			       direntp->d_name);
+		f = fopen(path, "re");
+		if (!f)
+			continue;
+
+		if (fgets(backing, sizeof(backing), f)) {
+			backing[strcspn(backing, "\n")] = '\0';
+			if (strcmp(backing, image) == 0)
+				count++;
+		}
+		fclose(f);
+	}
+	closedir(dir);
+
+	return count;
+}
+
+static bool mount_rootfs(struct lxc_container *c)
+{
+	int ret;
+	struct lxc_storage *bdev;
+	char path[PATH_MAX];
+
+	/* Mount each container on its own rootfs dir. */
+	(void)snprintf(path, sizeof(path), "%s/%s/rootfs", lxcpath, c->name);
+	if (!c->set_config_item(c, "lxc.rootfs.mount", path))
+		return false;
+
+	bdev = storage_init(c->lxc_conf);
+	if (!bdev)
+		return false;
+
+	ret = bdev->ops->mount(bdev);
+	storage_put(bdev);
+	if (ret < 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "%s/%s/rootfs/hello", lxcpath, c->name);
+	return access(path, F_OK) == 0;
+}
+
+/* Mount both containers in a private mount namespace and check that they
+ * share a single loop device.
+ */
+static bool mount_shared(struct lxc_container *c1, struct lxc_container *c2)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		return false;
+
+	if (pid == 0) {
+		if (unshare(CLONE_NEWNS) < 0 ||
+		    mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0)
+			_exit(EXIT_FAILURE);
+
+		if (!mount_rootfs(c1)) {
+			lxc_error("Failed to mount rootfs of \"%s\"\n", c1->name);
+			_exit(EXIT_FAILURE);
+		}
+
+		if (!mount_rootfs(c2)) {
+			lxc_error("Failed to mount rootfs of \"%s\"\n", c2->name);
+			_exit(EXIT_FAILURE);
+		}
+
+		if (count_loop_devs() != 1) {
+			lxc_error("%s\n", "The containers don't share a loop device");
+			_exit(EXIT_FAILURE);
+		}
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	return wait_for_pid(pid) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+	struct stat st;
+	struct lxc_container *c = NULL, *clone = NULL;
+	int status = EXIT_FAILURE;
+
+	if (geteuid() != 0) {
+		lxc_debug("%s\n", "Skipping image storage tests as non-root user");
+		exit(EXIT_SUCCESS);
+	}
+
+	if (!mkdtemp(lxcpath)) {
+		lxc_error("%s\n", "Failed to create temporary lxcpath");
+		exit(status);
+	}
+
+	ret = create_image();
+	if (ret < 0) {
+		lxc_error("%s\n", "Failed to create image contents");
+		goto on_error;
+	}
+
+	if (ret > 0) {
+		lxc_debug("%s\n", "Skipping image storage tests without mksquashfs or mkfs.erofs");
+		status = EXIT_SUCCESS;
+		goto on_error;
+	}
+
+	c = lxc_container_new(TSTNAME, lxcpath);
+	if (!c || !create_base(c)) {
+		lxc_error("%s\n", "Failed to create container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	/* The snapshot uses the same image with an upper dir of its own. */
+	clone = c->clone(c, TSTNAME "-snap", NULL, LXC_CLONE_SNAPSHOT, NULL,
+			 NULL, 0, NULL);
+	if (!clone) {
+		lxc_error("%s\n", "Failed to snapshot container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	if (!mount_shared(c, clone))
+		goto on_error;
+
+	if (!clone->destroy(clone)) {
+		lxc_error("%s\n", "Failed to destroy container \"" TSTNAME "-snap\"");
+		goto on_error;
+	}
+	lxc_container_put(clone);
+	clone = NULL;
+
+	if (!c->destroy(c)) {
+		lxc_error("%s\n", "Failed to destroy container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	if (stat(image, &st) < 0 || st.st_size == 0) {
+		lxc_error("%s\n", "Destroying the containers removed their image");
+		goto on_error;
+	}
+
+	status = EXIT_SUCCESS;
+	lxc_debug("%s\n", "All image storage tests passed");
+
+on_error:
+	if (clone) {
+		clone->destroy(clone);
+		lxc_container_put(clone);
+	}
+
+	if (c) {
+		if (c->is_defined(c))
+			c->destroy(c);
+		lxc_container_put(c);
+	}
+
+	(void)unlink(image);
+	(void)rmdir(lxcpath);
+	exit(status);
+}
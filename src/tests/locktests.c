@@ -16,8 +16,10 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include "lxc/lxccontainer.h"
 #include "lxc/lxclock.h"
 #include "config.h"
+#include <errno.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdio.h>
@@ -104,6 +106,64 @@ static void test_two_locks(void)
 	lxc_putlock(l);
 }
 
+static void test_shared_locks(void)
+{
+	struct lxc_lock *l;
+	struct lxc_lock_stats stats;
+	pid_t pid;
+	int status;
+
+	l = lxc_newlock("/tmp", "lxctest-rdlock");
+	if (!l) {
+		fprintf(stderr, "%d: failed to create lock\n", __LINE__);
+		exit(1);
+	}
+
+	if (lxcrdlock(l, 0) < 0) {
+		fprintf(stderr, "%d: failed to get shared lock\n", __LINE__);
+		exit(1);
+	}
+
+	if ((pid = fork()) < 0)
+		exit(1);
+
+	if (pid == 0) {
+		struct lxc_lock *cl;
+
+		cl = lxc_newlock("/tmp", "lxctest-rdlock");
+		if (!cl)
+			exit(1);
+
+		/* Another reader gets the lock right away. */
+		if (lxcrdlock(cl, 1) < 0) {
+			fprintf(stderr, "%d: child: failed to get shared lock\n", __LINE__);
+			exit(1);
+		}
+		lxcunlock(cl);
+
+		/* A writer times out. */
+		if (lxclock(cl, 1) == 0 || errno != ETIMEDOUT) {
+			fprintf(stderr, "%d: child: exclusive lock did not time out\n", __LINE__);
+			exit(1);
+		}
+
+		lxc_get_lock_stats(&stats);
+		if (stats.shared < 1 || stats.contended < 1 || stats.timeouts != 1) {
+			fprintf(stderr, "%d: child: unexpected lock stats\n", __LINE__);
+			exit(1);
+		}
+
+		exit(0);
+	}
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0)
+		exit(1);
+
+	lxcunlock(l);
+	lxc_putlock(l);
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
@@ -147,6 +207,8 @@ int main(int argc, char *argv[])
 
 	test_two_locks();
 
+	test_shared_locks();
+
 	fprintf(stderr, "all tests passed\n");
 
 	exit(ret);
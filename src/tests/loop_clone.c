@@ -0,0 +1,220 @@
+/* liblxcapi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "lxc/lxccontainer.h"
+#include "lxctest.h"
+
+#define TSTNAME "lxc-test-loop-clone"
+#define TSTSIZE (64 * 1024 * 1024)
+
+static char lxcpath[] = "/tmp/" TSTNAME "-XXXXXX";
+
+static bool stat_image(const char *name, struct stat *st)
+{
+	char path[PATH_MAX];
+
+	(void)snprintf(path, sizeof(path), "%s/%s/rootdev", lxcpath, name);
+	return stat(path, st) == 0;
+}
+
+/* Reflinking fails on most filesystems, which makes the clones below use
+ * the sparse copy.
+ */
+static bool can_reflink(void)
+{
+	int ret, srcfd, dstfd;
+	char src[PATH_MAX], dst[PATH_MAX];
+
+	(void)snprintf(src, sizeof(src), "%s/" TSTNAME "/rootdev", lxcpath);
+	(void)snprintf(dst, sizeof(dst), "%s/reflink", lxcpath);
+
+	srcfd = open(src, O_RDONLY | O_CLOEXEC);
+	if (srcfd < 0)
+		return false;
+
+	dstfd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (dstfd < 0) {
+		close(srcfd);
+		return false;
+	}
+
+	ret = ioctl(dstfd, FICLONE, srcfd);
+	close(srcfd);
+	close(dstfd);
+	(void)unlink(dst);
+
+	return ret == 0;
+}
+
+/* The clone of a sparse image must have the same size without allocating
+ * the holes of the original. Mounting the clone to update it may allocate a
+ * few blocks, so allow for some slack.
+ */
+static bool check_clone(const char *name, const struct stat *orig)
+{
+	struct stat st;
+
+	if (!stat_image(name, &st)) {
+		lxc_error("Failed to stat image of \"%s\"\n", name);
+		return false;
+	}
+
+	if (st.st_size != orig->st_size) {
+		lxc_error("Image of \"%s\" has size %jd instead of %jd\n", name,
+			  (intmax_t)st.st_size, (intmax_t)orig->st_size);
+		return false;
+	}
+
+	if ((uintmax_t)st.st_blocks * 512 >= (uintmax_t)st.st_size / 2 ||
+	    st.st_blocks > orig->st_blocks + 2048) {
+		lxc_error("Image of \"%s\" has %jd blocks, the original %jd\n",
+			  name, (intmax_t)st.st_blocks,
+			  (intmax_t)orig->st_blocks);
+		return false;
+	}
+
+	return true;
+}
+
+/* Create a container on a sparse image with a filesystem spread over it. */
+static bool create_base(struct lxc_container *c)
+{
+	int fd, ret;
+	char path[PATH_MAX], cmd[PATH_MAX + 64];
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME, lxcpath);
+	if (mkdir(path, 0755) < 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "%s/" TSTNAME "/rootdev", lxcpath);
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+
+	ret = ftruncate(fd, TSTSIZE);
+	close(fd);
+	if (ret < 0)
+		return false;
+
+	(void)snprintf(cmd, sizeof(cmd), "mkfs.ext4 -q -F %s", path);
+	if (system(cmd) != 0)
+		return false;
+
+	(void)snprintf(path, sizeof(path), "loop:%s/" TSTNAME "/rootdev", lxcpath);
+	if (!c->set_config_item(c, "lxc.rootfs.path", path) ||
+	    !c->set_config_item(c, "lxc.uts.name", TSTNAME))
+		return false;
+
+	return c->save_config(c, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	struct stat st;
+	struct lxc_container *c = NULL, *clones[2] = {NULL};
+	const char *names[2] = {TSTNAME "-copy", TSTNAME "-snap"};
+	int flags[2] = {LXC_CLONE_KEEPNAME, LXC_CLONE_KEEPNAME | LXC_CLONE_SNAPSHOT};
+	int ret = EXIT_FAILURE;
+
+	if (geteuid() != 0) {
+		lxc_debug("%s\n", "Skipping loop clone tests as non-root user");
+		exit(EXIT_SUCCESS);
+	}
+
+	if (!mkdtemp(lxcpath)) {
+		lxc_error("%s\n", "Failed to create temporary lxcpath");
+		exit(ret);
+	}
+
+	c = lxc_container_new(TSTNAME, lxcpath);
+	if (!c || !create_base(c)) {
+		lxc_error("%s\n", "Failed to create container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	if (!stat_image(TSTNAME, &st)) {
+		lxc_error("%s\n", "Failed to stat image of \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	if ((uintmax_t)st.st_blocks * 512 >= (uintmax_t)st.st_size / 2) {
+		lxc_debug("%s\n", "Skipping loop clone tests as the image isn't sparse");
+		ret = EXIT_SUCCESS;
+		goto on_error;
+	}
+
+	lxc_debug("Clones are %s\n", can_reflink() ? "reflinked" : "sparse copies");
+
+	for (i = 0; i < 2; i++) {
+		clones[i] = c->clone(c, names[i], NULL, flags[i], NULL, NULL, 0, NULL);
+		if (!clones[i]) {
+			lxc_error("Failed to clone container \"%s\"\n", names[i]);
+			goto on_error;
+		}
+
+		if (!check_clone(names[i], &st))
+			goto on_error;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (!clones[i]->destroy(clones[i])) {
+			lxc_error("Failed to destroy \"%s\"\n", names[i]);
+			goto on_error;
+		}
+		lxc_container_put(clones[i]);
+		clones[i] = NULL;
+	}
+
+	if (!c->destroy(c)) {
+		lxc_error("%s\n", "Failed to destroy container \"" TSTNAME "\"");
+		goto on_error;
+	}
+
+	ret = EXIT_SUCCESS;
+	lxc_debug("%s\n", "All loop clone tests passed");
+
+on_error:
+	for (i = 0; i < 2; i++) {
+		if (!clones[i])
+			continue;
+
+		clones[i]->destroy(clones[i]);
+		lxc_container_put(clones[i]);
+	}
+
+	if (c) {
+		if (c->is_defined(c))
+			c->destroy(c);
+		lxc_container_put(c);
+	}
+
+	(void)rmdir(lxcpath);
+	exit(ret);
+}
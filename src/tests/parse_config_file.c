@@ -450,6 +450,13 @@ int main(int argc, char *argv[])
 		goto non_test_error;
 	}
 
+	/* lxc.log.format */
+	if (set_get_compare_clear_save_load(c, "lxc.log.format", "binary",
+					    tmpf, true) < 0) {
+		lxc_error("%s\n", "lxc.log.format");
+		goto non_test_error;
+	}
+
 	/* lxc.mount.fstab */
 	if (set_get_compare_clear_save_load(c, "lxc.mount.fstab", "/some/path", NULL,
 					    true) < 0) {
@@ -494,6 +501,25 @@ int main(int argc, char *argv[])
 		goto non_test_error;
 	}
 
+	/* lxc.rootfs.fstype */
+	if (set_get_compare_clear_save_load(c, "lxc.rootfs.fstype", "ext4",
+					    tmpf, true) < 0) {
+		lxc_error("%s\n", "lxc.rootfs.fstype");
+		goto non_test_error;
+	}
+
+	/* lxc.rootfs.loop.block_size */
+	if (set_get_compare_clear_save_load(c, "lxc.rootfs.loop.block_size",
+					    "4096", tmpf, true) < 0) {
+		lxc_error("%s\n", "lxc.rootfs.loop.block_size");
+		goto non_test_error;
+	}
+
+	if (c->set_config_item(c, "lxc.rootfs.loop.block_size", "1000")) {
+		lxc_error("%s\n", "lxc.rootfs.loop.block_size accepted 1000");
+		goto non_test_error;
+	}
+
 	/* lxc.rootfs.options */
 	if (set_get_compare_clear_save_load(c, "lxc.rootfs.options",
 					    "ext4,discard", tmpf, true) < 0) {
@@ -501,6 +527,13 @@ int main(int argc, char *argv[])
 		goto non_test_error;
 	}
 
+	/* lxc.rootfs.overlay.tmpfs_size */
+	if (set_get_compare_clear_save_load(c, "lxc.rootfs.overlay.tmpfs_size",
+					    "1048576", tmpf, true) < 0) {
+		lxc_error("%s\n", "lxc.rootfs.overlay.tmpfs_size");
+		goto non_test_error;
+	}
+
 	/* lxc.uts.name */
 	if (set_get_compare_clear_save_load(c, "lxc.uts.name", "the-shire", tmpf,
 					    true) < 0) {
@@ -713,6 +746,13 @@ int main(int argc, char *argv[])
 		goto non_test_error;
 	}
 
+	/* lxc.clone.pool */
+	if (set_get_compare_clear_save_load(c, "lxc.clone.pool", "4", tmpf,
+					    true) < 0) {
+		lxc_error("%s\n", "lxc.clone.pool");
+		goto non_test_error;
+	}
+
 	/* lxc.no_new_privs */
 	if (set_get_compare_clear_save_load(c, "lxc.no_new_privs", "1", tmpf,
 					    true) < 0) {
@@ -0,0 +1,257 @@
+/* liblxcapi
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "conf.h"
+#include "lxcseccomp.h"
+#include "lxctest.h"
+#include "utils.h"
+
+static char policy[] = "/tmp/lxc-test-seccomp-cache-XXXXXX";
+static char cache_dir[PATH_MAX];
+static char **cached;
+
+/* The policy carries a comment naming the policy file so that entries
+ * other runs of this test left in the cache can't cause hits.
+ */
+static bool write_policy(int err)
+{
+	int fd;
+	char buf[256];
+
+	(void)snprintf(buf, sizeof(buf),
+		       "2\nblacklist\n# %s\ngetpriority errno %d\n", policy,
+		       err);
+
+	fd = open(policy, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (lxc_write_nointr(fd, buf, strlen(buf)) < 0) {
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	return true;
+}
+
+static char **list_cache(void)
+{
+	DIR *dir;
+	struct dirent *direntp;
+	char **names = NULL;
+
+	dir = opendir(cache_dir);
+	if (!dir)
+		return NULL;
+
+	while ((direntp = readdir(dir)))
+		if (direntp->d_name[0] != '.')
+			(void)lxc_append_string(&names, direntp->d_name);
+	closedir(dir);
+
+	return names;
+}
+
+/* Remove the cache entries this test created. */
+static void clean_cache(void)
+{
+	char **it, **names;
+	char path[PATH_MAX + NAME_MAX + 1];
+
+	names = list_cache();
+	if (!names)
+		return;
+
+	for (it = names; *it; it++) {
+		if (cached && lxc_string_in_array(*it, (const char **)cached))
+			continue;
+
+		(void)snprintf(path, sizeof(path), "%s/%s", cache_dir, *it);
+		(void)unlink(path);
+	}
+	lxc_free_array((void **)names, free);
+}
+
+/* Read the policy into a new config. Returns 1 on a cache hit, 0 if the
+ * policy was parsed and -1 on error.
+ */
+static int read_policy(struct lxc_conf **conf)
+{
+	*conf = lxc_conf_init();
+	if (!*conf)
+		return -1;
+
+	(*conf)->seccomp = strdup(policy);
+	if (!(*conf)->seccomp || lxc_read_seccomp_config(*conf) < 0)
+		return -1;
+
+	if ((*conf)->seccomp_bpf && (*conf)->seccomp_bpf_len > 0)
+		return 1;
+
+	return (*conf)->seccomp_ctx ? 0 : -1;
+}
+
+/* liblxc doesn't load policies when we are confined already. */
+static bool seccomp_confined(void)
+{
+	FILE *f;
+	size_t len = 0;
+	char *line = NULL;
+	bool confined = false;
+
+	f = fopen("/proc/self/status", "re");
+	if (!f)
+		return false;
+
+	while (getline(&line, &len, f) != -1) {
+		if (strncmp(line, "Seccomp:", 8) == 0) {
+			confined = atoi(line + 8) != 0;
+			break;
+		}
+	}
+	free(line);
+	fclose(f);
+
+	return confined;
+}
+
+/* Load the filter of @conf in a child and check that getpriority() fails
+ * with @err.
+ */
+static bool filter_works(struct lxc_conf *conf, int err)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		return false;
+
+	if (pid == 0) {
+		if (lxc_seccomp_load(conf) < 0)
+			_exit(EXIT_FAILURE);
+
+		errno = 0;
+		if (getpriority(PRIO_PROCESS, 0) != -1 || errno != err)
+			_exit(EXIT_FAILURE);
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	return wait_for_pid(pid) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, i;
+	char *rundir;
+	struct lxc_conf *conf[4] = {NULL};
+	int ret = EXIT_FAILURE;
+
+	if (seccomp_confined()) {
+		lxc_debug("%s\n", "Skipping seccomp cache tests in a confined process");
+		exit(EXIT_SUCCESS);
+	}
+
+	rundir = get_rundir();
+	if (!rundir) {
+		lxc_error("%s\n", "Failed to find the run directory");
+		exit(ret);
+	}
+	(void)snprintf(cache_dir, sizeof(cache_dir), "%s/lxc/seccomp", rundir);
+	free(rundir);
+
+	fd = mkstemp(policy);
+	if (fd < 0) {
+		lxc_error("%s\n", "Failed to create seccomp policy");
+		exit(ret);
+	}
+	close(fd);
+
+	cached = list_cache();
+
+	if (!write_policy(42)) {
+		lxc_error("%s\n", "Failed to write seccomp policy");
+		goto on_error;
+	}
+
+	if (read_policy(&conf[0]) != 0) {
+		lxc_error("%s\n", "The first read of a policy didn't parse it");
+		goto on_error;
+	}
+
+	if (read_policy(&conf[1]) != 1) {
+		lxc_error("%s\n", "The second read of a policy missed the cache");
+		goto on_error;
+	}
+
+	/* Loading a filter without no_new_privs needs CAP_SYS_ADMIN. */
+	if (geteuid() == 0 && !filter_works(conf[1], 42)) {
+		lxc_error("%s\n", "The cached filter doesn't match the policy");
+		goto on_error;
+	}
+
+	/* A changed policy must not be served from the cache. */
+	if (!write_policy(43)) {
+		lxc_error("%s\n", "Failed to write seccomp policy");
+		goto on_error;
+	}
+
+	if (read_policy(&conf[2]) != 0) {
+		lxc_error("%s\n", "A changed policy was served from the cache");
+		goto on_error;
+	}
+
+	if (read_policy(&conf[3]) != 1) {
+		lxc_error("%s\n", "The changed policy wasn't cached");
+		goto on_error;
+	}
+
+	if (geteuid() == 0 && !filter_works(conf[3], 43)) {
+		lxc_error("%s\n", "The cached filter doesn't match the changed policy");
+		goto on_error;
+	}
+
+	ret = EXIT_SUCCESS;
+	lxc_debug("%s\n", "All seccomp cache tests passed");
+
+on_error:
+	for (i = 0; i < 4; i++)
+		if (conf[i])
+			lxc_conf_free(conf[i]);
+
+	clean_cache();
+	lxc_free_array((void **)cached, free);
+	(void)unlink(policy);
+	exit(ret);
+}